@@ -0,0 +1,70 @@
+# Cold start benchmark for pyphp.
+#
+# Times fresh processes that render a set of generated templates once, first
+# without the compiled script cache (every process compiles every template),
+# then with it (every process loads the templates compiled by the first one).
+#
+# TO USE CALL:
+#   python bench/coldstart.py [templates] [processes]
+#
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+WORKER = r'''
+import sys, time
+import pyphp
+cache, scripts = sys.argv[1], sys.argv[2:]
+pyphp.setOutputHandler(lambda output: None)
+if cache:
+	pyphp.setCompileCache(cache)
+pyphp.init()
+start = time.time()
+for script in scripts:
+	pyphp.runScript(script)
+print time.time() - start
+'''
+
+def makeTemplates(directory, count):
+	scripts = []
+	for i in xrange(count):
+		lines = ['<html><body><h1><?php echo "Template %d"; ?></h1><ul>' % i]
+		for j in xrange(200):
+			lines.append('<?php for ($k = 0; $k < 3; $k++) { if ($k %% 2) { echo "<li>", %d * $k, "</li>"; } else { echo strtoupper("row %d"), "\\n"; } } ?>' % (j, j))
+		lines.append('</ul></body></html>')
+		script = os.path.join(directory, 'template%d.php' % i)
+		with open(script, 'w') as f:
+			f.write('\n'.join(lines))
+		scripts.append(script)
+	return scripts
+
+def run(cache, scripts, processes):
+	times = []
+	for i in xrange(processes):
+		output = subprocess.check_output([sys.executable, '-c', WORKER, cache] + scripts)
+		times.append(float(output.strip()))
+	return times
+
+def report(name, times):
+	times = sorted(times)
+	print "%-18s min %8.2f ms  median %8.2f ms  max %8.2f ms" % (name, times[0] * 1000, times[len(times) // 2] * 1000, times[-1] * 1000)
+
+def main():
+	count = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+	processes = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+	directory = tempfile.mkdtemp(prefix='pyphp-coldstart-')
+	try:
+		scripts = makeTemplates(directory, count)
+		cache = os.path.join(directory, 'cache')
+		print "%d templates, %d processes" % (count, processes)
+		report('no cache', run('', scripts, processes))
+		run(cache, scripts, 1)
+		report('compile cache', run(cache, scripts, processes))
+	finally:
+		shutil.rmtree(directory)
+
+if __name__ == '__main__':
+	main()
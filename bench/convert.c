@@ -0,0 +1,321 @@
+/**
+ * convert.c benchmarks converting Python values to PHP values
+ * (pyphp_core_convert_pyObjectToZval()) on synthetic payloads, outside of the
+ * python module.
+ *
+ * For each payload it reports the time per element (best and median of the
+ * repetitions) and what the conversion allocated from the Zend memory manager.
+ *
+ * By default PHP runs on its own allocator, and only the bytes (from the
+ * memory usage of the heap) are reported. With -c, PHP is started with
+ * USE_ZEND_ALLOC=0 so that every emalloc()/efree()/erealloc() goes straight to
+ * malloc()/free()/realloc(), which this program interposes to count the calls,
+ * the bytes and the peak while a payload is converted and freed (the rare
+ * allocation Python makes meanwhile is counted too). The times of a -c run
+ * are those of malloc(), not of the Zend memory manager.
+ *
+ * TO USE CALL:
+ *   make -C bench
+ *   bench/convert [-c] [repetitions]
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+
+// Normally defined by the python module (pyphp.c).
+PyObject * pyphp_exception = NULL;
+PyObject * pyphp_memoryBudgetException = NULL;
+
+// What the Zend memory manager allocated.
+typedef struct bench_alloc_t {
+	// Whether allocations are counted.
+	bool isCounting;
+	uint64_t mallocs;
+	uint64_t frees;
+	uint64_t reallocs;
+	// The bytes allocated (reallocs count their new size).
+	uint64_t bytes;
+	uint64_t current;
+	uint64_t peak;
+} bench_alloc_t;
+
+static bench_alloc_t bench_alloc;
+
+// The allocator of the C library.
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+extern void __libc_free(void * ptr);
+
+/*******************************************************************************
+ * Records an allocation.
+ *
+ * @param size_t size The size of the allocation.
+ ******************************************************************************/
+static inline void bench_alloc_add(size_t size) {
+	bench_alloc.bytes += size;
+	bench_alloc.current += size;
+	if (bench_alloc.current > bench_alloc.peak) {
+		bench_alloc.peak = bench_alloc.current;
+	}
+}
+
+/*******************************************************************************
+ * Records a deallocation.
+ *
+ * @param size_t size The size of the allocation.
+ ******************************************************************************/
+static inline void bench_alloc_remove(size_t size) {
+	bench_alloc.current = (bench_alloc.current > size ? bench_alloc.current - size : 0);
+}
+
+/*******************************************************************************
+ * The counting malloc() (what emalloc() calls with USE_ZEND_ALLOC=0).
+ ******************************************************************************/
+void * malloc(size_t size) {
+	void * ptr = __libc_malloc(size);
+	if (bench_alloc.isCounting && ptr != NULL) {
+		bench_alloc.mallocs++;
+		bench_alloc_add(malloc_usable_size(ptr));
+	}
+	return ptr;
+}
+
+/*******************************************************************************
+ * The counting calloc().
+ ******************************************************************************/
+void * calloc(size_t count, size_t size) {
+	void * ptr = __libc_calloc(count, size);
+	if (bench_alloc.isCounting && ptr != NULL) {
+		bench_alloc.mallocs++;
+		bench_alloc_add(malloc_usable_size(ptr));
+	}
+	return ptr;
+}
+
+/*******************************************************************************
+ * The counting free() (what efree() calls with USE_ZEND_ALLOC=0).
+ ******************************************************************************/
+void free(void * ptr) {
+	if (bench_alloc.isCounting && ptr != NULL) {
+		bench_alloc.frees++;
+		bench_alloc_remove(malloc_usable_size(ptr));
+	}
+	__libc_free(ptr);
+}
+
+/*******************************************************************************
+ * The counting realloc() (what erealloc() calls with USE_ZEND_ALLOC=0).
+ ******************************************************************************/
+void * realloc(void * ptr, size_t size) {
+	size_t oldSize = (bench_alloc.isCounting && ptr != NULL ? malloc_usable_size(ptr) : 0);
+	void * grown = __libc_realloc(ptr, size);
+	if (bench_alloc.isCounting && grown != NULL) {
+		bench_alloc.reallocs++;
+		bench_alloc_remove(oldSize);
+		bench_alloc_add(malloc_usable_size(grown));
+	}
+	return grown;
+}
+
+/*******************************************************************************
+ * Builds a dict of count integers.
+ ******************************************************************************/
+static PyObject * bench_wideDict(size_t count, size_t * elements) {
+	PyObject * pyDict = PyDict_New();
+	char key[32];
+	for (size_t i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		PyObject * pyValue = PyInt_FromSsize_t(i);
+		PyDict_SetItemString(pyDict, key, pyValue);
+		Py_DECREF(pyValue);
+	}
+	*elements = count;
+	return pyDict;
+}
+
+/*******************************************************************************
+ * Builds dicts nested depth deep, each with a string, a float and a list.
+ ******************************************************************************/
+static PyObject * bench_deepNesting(size_t depth, size_t * elements) {
+	PyObject * pyChild = Py_None;
+	Py_INCREF(pyChild);
+	for (size_t i = 0; i < depth; i++) {
+		PyObject * pyDict = Py_BuildValue("{s:s,s:d,s:[i,i,i],s:N}", "name", "level", "weight", i * 0.5, "list", 1, 2, 3, "child", pyChild);
+		pyChild = pyDict;
+	}
+	*elements = depth * 8;
+	return pyChild;
+}
+
+/*******************************************************************************
+ * Builds a list of count integers.
+ ******************************************************************************/
+static PyObject * bench_longList(size_t count, size_t * elements) {
+	PyObject * pyList = PyList_New(count);
+	for (size_t i = 0; i < count; i++) {
+		PyList_SET_ITEM(pyList, i, PyInt_FromSsize_t(i));
+	}
+	*elements = count;
+	return pyList;
+}
+
+/*******************************************************************************
+ * Builds count rows (dicts) of 8 unicode strings.
+ *
+ * NOTE: the converter encodes unicode strings as ASCII, so they are ASCII.
+ ******************************************************************************/
+static PyObject * bench_unicodeRows(size_t count, size_t * elements) {
+	PyObject * pyList = PyList_New(count);
+	char value[64];
+	for (size_t i = 0; i < count; i++) {
+		PyObject * pyRow = PyDict_New();
+		for (int column = 0; column < 8; column++) {
+			char key[8];
+			snprintf(key, sizeof(key), "col%d", column);
+			int length = snprintf(value, sizeof(value), "row %zu column %d: the quick brown fox", i, column);
+			PyObject * pyValue = PyUnicode_DecodeASCII(value, length, NULL);
+			PyDict_SetItemString(pyRow, key, pyValue);
+			Py_DECREF(pyValue);
+		}
+		PyList_SET_ITEM(pyList, i, pyRow);
+	}
+	*elements = count * 9;
+	return pyList;
+}
+
+// A payload.
+typedef struct bench_payload_t {
+	const char * name;
+	PyObject * (* build)(size_t size, size_t * elements);
+	size_t size;
+} bench_payload_t;
+
+static const bench_payload_t bench_payloads[] = {
+	{"wide dict (100k)", bench_wideDict, 100000},
+	{"deep nesting (1k)", bench_deepNesting, 1000},
+	{"list (1M)", bench_longList, 1000000},
+	{"unicode rows (20k)", bench_unicodeRows, 20000},
+	{NULL, NULL, 0}
+};
+
+static int bench_compareTimes(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*******************************************************************************
+ * Converts a payload once, measuring what it allocated.
+ *
+ * @param PyObject* pyPayload The payload.
+ * @param bool isCounting Whether the allocations are counted (with
+ * USE_ZEND_ALLOC=0).
+ * @return uint64_t How long the conversion took in nanoseconds, or 0 if it
+ * failed.
+ ******************************************************************************/
+static uint64_t bench_convert(PyObject * pyPayload, bool isCounting) {
+	TSRMLS_FETCH();
+	memset(&bench_alloc, 0, sizeof(bench_alloc));
+	zval * phpValue = NULL;
+	size_t usage = zend_memory_usage(0 TSRMLS_CC);
+	zend_memory_reset_peak_usage(TSRMLS_C);
+	bench_alloc.isCounting = isCounting;
+	
+	uint64_t start = pyphp_core_now();
+	bool isConverted = pyphp_core_convert_pyObjectToZval(pyPayload, &phpValue);
+	uint64_t elapsed = pyphp_core_now() - start;
+	
+	if (!isCounting) {
+		bench_alloc.bytes = zend_memory_usage(0 TSRMLS_CC) - usage;
+		bench_alloc.peak = zend_memory_peak_usage(0 TSRMLS_CC) - usage;
+	}
+	if (isConverted) {
+		zval_ptr_dtor(&phpValue);
+	}
+	bench_alloc.isCounting = false;
+	return isConverted ? elapsed : 0;
+}
+
+/*******************************************************************************
+ * Benchmarks a payload.
+ *
+ * @param bench_payload_t* payload The payload.
+ * @param int repetitions How many times it is converted (after one warm up).
+ * @param bool isCounting Whether the allocations are counted.
+ ******************************************************************************/
+static void bench_run(const bench_payload_t * payload, int repetitions, bool isCounting) {
+	size_t elements;
+	PyObject * pyPayload = payload->build(payload->size, &elements);
+	uint64_t * times = (uint64_t *)malloc(sizeof(uint64_t) * repetitions);
+	
+	bench_convert(pyPayload, isCounting);
+	for (int i = 0; i < repetitions; i++) {
+		times[i] = bench_convert(pyPayload, isCounting);
+		if (times[i] == 0) {
+			printf("%-20s conversion failed\n", payload->name);
+			free(times);
+			Py_DECREF(pyPayload);
+			return;
+		}
+	}
+	qsort(times, repetitions, sizeof(uint64_t), bench_compareTimes);
+	
+	printf("%-20s %9zu %8.1f %8.1f", payload->name, elements, (double)times[0] / elements, (double)times[repetitions / 2] / elements);
+	if (isCounting) {
+		printf(" %9llu %9llu %8llu", (unsigned long long)bench_alloc.mallocs, (unsigned long long)bench_alloc.frees, (unsigned long long)bench_alloc.reallocs);
+	} else {
+		printf(" %9s %9s %8s", "-", "-", "-");
+	}
+	printf(" %11llu %11llu\n", (unsigned long long)bench_alloc.bytes, (unsigned long long)bench_alloc.peak);
+	
+	free(times);
+	Py_DECREF(pyPayload);
+}
+
+int main(int argc, char ** argv) {
+	bool isCounting = (argc > 1 && strcmp(argv[1], "-c") == 0);
+	if (isCounting) {
+		argc--;
+		argv++;
+	}
+	int repetitions = (argc > 1 ? atoi(argv[1]) : 10);
+	if (repetitions < 1) {
+		repetitions = 1;
+	}
+	
+	// NOTE: the Zend memory manager reads USE_ZEND_ALLOC when PHP starts up.
+	if (isCounting) {
+		setenv("USE_ZEND_ALLOC", "0", 1);
+	}
+	Py_Initialize();
+	pyphp_exception = PyErr_NewException("pyphp.error", NULL, NULL);
+	pyphp_memoryBudgetException = PyErr_NewException("pyphp.MemoryBudgetExceeded", pyphp_exception, NULL);
+	if (!pyphp_core_php_init(0, NULL)) {
+		return 1;
+	}
+	
+	printf("%-20s %9s %8s %8s %9s %9s %8s %11s %11s\n", "payload", "elements", "best", "median", "emallocs", "efrees", "reallocs", "bytes", "peak");
+	printf("%-20s %9s %8s %8s\n", "", "", "ns/elem", "ns/elem");
+	for (const bench_payload_t * payload = bench_payloads; payload->name != NULL; payload++) {
+		bench_run(payload, repetitions, isCounting);
+	}
+	
+	pyphp_core_php_shutdown();
+	Py_Finalize();
+	return 0;
+}
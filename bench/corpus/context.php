@@ -0,0 +1,11 @@
+<?php
+// Large context: a page rendered from many variables passed in from Python
+// ($user, $settings and $items).
+?>
+<h1>Hello <?php echo $user['name']; ?> (<?php echo $user['email']; ?>)</h1>
+<p>Theme: <?php echo $settings['theme']; ?>, page size <?php echo $settings['pageSize']; ?></p>
+<ul>
+<?php foreach ($items as $item): ?>
+	<li id="item-<?php echo $item['id']; ?>"><?php echo $item['title']; ?> &ndash; <?php echo number_format($item['price'], 2); ?><?php if ($item['tags']): ?> [<?php echo implode(', ', $item['tags']); ?>]<?php endif; ?></li>
+<?php endforeach; ?>
+</ul>
@@ -0,0 +1,9 @@
+<?php
+// Include heavy: a page assembled from partials, one of them included per row.
+include dirname(__FILE__) . '/partials/header.php';
+for ($row = 0; $row < 60; $row++) {
+	include dirname(__FILE__) . '/partials/row.php';
+}
+require_once dirname(__FILE__) . '/partials/helpers.php';
+echo corpus_footer(60);
+include dirname(__FILE__) . '/partials/footer.php';
@@ -0,0 +1,32 @@
+<?php
+// Tight loops: arithmetic and array work with little output.
+$sum = 0;
+for ($i = 0; $i < 20000; $i++) {
+	$sum += ($i * 7) % 13;
+	if ($i % 3 == 0) {
+		$sum ^= $i;
+	}
+}
+$primes = array();
+for ($n = 2; count($primes) < 300; $n++) {
+	$isPrime = true;
+	foreach ($primes as $p) {
+		if ($p * $p > $n) {
+			break;
+		}
+		if ($n % $p == 0) {
+			$isPrime = false;
+			break;
+		}
+	}
+	if ($isPrime) {
+		$primes[] = $n;
+	}
+}
+$matrix = array();
+for ($y = 0; $y < 40; $y++) {
+	for ($x = 0; $x < 40; $x++) {
+		$matrix[$y][$x] = $x * $y;
+	}
+}
+echo $sum, ' ', end($primes), ' ', $matrix[39][39], "\n";
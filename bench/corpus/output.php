@@ -0,0 +1,10 @@
+<?php
+// Output heavy: many small writes followed by a few large ones.
+for ($i = 0; $i < 5000; $i++) {
+	echo '<span>', $i, '</span>';
+	if ($i % 100 == 99) {
+		echo "\n";
+	}
+}
+echo str_repeat('<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit.</p>', 2000);
+print str_repeat('x', 65536);
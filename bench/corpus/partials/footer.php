@@ -0,0 +1,3 @@
+</table>
+</body>
+</html>
@@ -0,0 +1,5 @@
+<!DOCTYPE html>
+<html>
+<head><title>Include corpus</title></head>
+<body>
+<table>
@@ -0,0 +1,4 @@
+<?php
+function corpus_footer($rows) {
+	return sprintf("<tfoot><tr><td colspan=\"2\">%d rows</td></tr></tfoot>\n", $rows);
+}
@@ -0,0 +1 @@
+<tr class="<?php echo $row % 2 ? 'odd' : 'even'; ?>"><td><?php echo $row; ?></td><td><?php echo str_pad(dechex($row * 4099), 6, '0', STR_PAD_LEFT); ?></td></tr>
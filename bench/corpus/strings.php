@@ -0,0 +1,17 @@
+<?php
+// String heavy: building, searching and rewriting strings.
+$words = explode(' ', 'the quick brown fox jumps over the lazy dog while the cat sleeps on the warm mat');
+$text = '';
+for ($i = 0; $i < 400; $i++) {
+	$text .= ucfirst($words[$i % count($words)]) . ' ' . $words[($i * 7) % count($words)] . '. ';
+}
+$text = str_replace(array('The', 'fox', 'dog'), array('A', 'wolf', 'hound'), $text);
+$upper = strtoupper(substr($text, 0, 200));
+$counts = array_count_values(str_word_count(strtolower($text), 1));
+arsort($counts);
+$slug = trim(preg_replace('/[^a-z0-9]+/', '-', strtolower(substr($text, 0, 120))), '-');
+$lines = array();
+foreach (array_slice($counts, 0, 10, true) as $word => $count) {
+	$lines[] = sprintf('%-8s %4d', $word, $count);
+}
+echo $upper, "\n", $slug, "\n", implode("\n", $lines), "\n", md5($text), "\n", htmlspecialchars(wordwrap(substr($text, 0, 300), 60, "\n", true)), "\n";
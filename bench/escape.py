@@ -0,0 +1,79 @@
+# HTML escaping benchmark for pyphp.
+#
+# Renders a template that echoes every variable several times, first escaping
+# in PHP (htmlspecialchars() on each echo), then escaping once while the
+# variables are converted (pyphp.render(..., escape=True)). The output of both
+# must be identical.
+#
+# TO USE CALL:
+#   python bench/escape.py [variables] [echoes] [renders]
+#
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+import pyphp
+
+def makeVars(count):
+	vars = {}
+	for i in xrange(count):
+		vars['$v%d' % i] = 'Row %d: <b>"Tom" & \'Jerry\'</b> %s' % (i, 'plain text ' * (i % 8))
+	# Safe strings are passed through untouched by both templates.
+	vars['$safe'] = pyphp.Safe('<em>already escaped &amp; safe</em>')
+	return vars
+
+def makeTemplate(directory, name, vars, echoes, escapeInPhp):
+	lines = ['<html><body><?php echo $safe; ?><ul>']
+	for i in xrange(echoes):
+		for key in sorted(vars):
+			if key == '$safe':
+				continue
+			if escapeInPhp:
+				lines.append('<li><?php echo htmlspecialchars(%s, ENT_QUOTES); ?></li>' % key)
+			else:
+				lines.append('<li><?php echo %s; ?></li>' % key)
+	lines.append('</ul></body></html>')
+	script = os.path.join(directory, name)
+	with open(script, 'w') as f:
+		f.write('\n'.join(lines))
+	return script
+
+def run(script, vars, renders, escape):
+	times = []
+	output = None
+	for i in xrange(renders):
+		start = time.time()
+		output = pyphp.render(script, vars, ttl=-1, escape=escape)
+		times.append(time.time() - start)
+	return times, output
+
+def report(name, times):
+	times = sorted(times)
+	print "%-18s min %8.3f ms  median %8.3f ms  max %8.3f ms" % (name, times[0] * 1000, times[len(times) // 2] * 1000, times[-1] * 1000)
+
+def main():
+	count = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+	echoes = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+	renders = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+	directory = tempfile.mkdtemp(prefix='pyphp-escape-')
+	try:
+		vars = makeVars(count)
+		phpScript = makeTemplate(directory, 'php.php', vars, echoes, True)
+		convertScript = makeTemplate(directory, 'convert.php', vars, echoes, False)
+		pyphp.init()
+		print "%d variables, %d echoes each, %d renders" % (count, echoes, renders)
+		phpTimes, phpOutput = run(phpScript, vars, renders, False)
+		convertTimes, convertOutput = run(convertScript, vars, renders, True)
+		if phpOutput != convertOutput:
+			print "OUTPUT DIFFERS"
+			sys.exit(1)
+		report('htmlspecialchars', phpTimes)
+		report('escape=True', convertTimes)
+	finally:
+		pyphp.shutdown()
+		shutil.rmtree(directory)
+
+if __name__ == '__main__':
+	main()
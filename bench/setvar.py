@@ -0,0 +1,68 @@
+# pyphp.setVar() benchmark.
+#
+# Sets synthetic payloads (the same as bench/convert.c: a wide dict, deep
+# nesting, a 1M element list and rows of unicode strings) as PHP globals, and
+# reports the time per element of the call (wall) and of the conversion alone
+# (the marshal phase of pyphp.runTimes()). PHP is reset between repetitions
+# with an empty script.
+#
+# TO USE CALL:
+#   python bench/setvar.py [repetitions]
+#
+import sys
+import time
+
+import pyphp
+
+def wideDict(count):
+	return dict(('key%d' % i, i) for i in xrange(count)), count
+
+def deepNesting(depth):
+	child = None
+	for i in xrange(depth):
+		child = {'name': 'level', 'weight': i * 0.5, 'list': [1, 2, 3], 'child': child}
+	return child, depth * 8
+
+def longList(count):
+	return range(count), count
+
+def unicodeRows(count):
+	# NOTE: unicode strings are converted as ASCII.
+	rows = [dict(('col%d' % column, u'row %d column %d: the quick brown fox' % (i, column)) for column in xrange(8)) for i in xrange(count)]
+	return rows, count * 9
+
+PAYLOADS = [
+	('wide dict (100k)', wideDict, 100000),
+	('deep nesting (1k)', deepNesting, 1000),
+	('list (1M)', longList, 1000000),
+	('unicode rows (20k)', unicodeRows, 20000)
+]
+
+def run(payload, repetitions):
+	walls = []
+	marshals = []
+	for i in xrange(repetitions + 1):
+		start = time.time()
+		pyphp.setVar('$payload', payload)
+		wall = time.time() - start
+		pyphp.runInline('')
+		if i > 0:
+			walls.append(wall)
+			marshals.append(pyphp.runTimes()['marshal'])
+	return sorted(walls), sorted(marshals)
+
+def main():
+	repetitions = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+	pyphp.init()
+	try:
+		print "%-20s %9s %10s %10s %10s" % ('payload', 'elements', 'best', 'median', 'marshal')
+		print "%-20s %9s %10s %10s %10s" % ('', '', 'ns/elem', 'ns/elem', 'ns/elem')
+		for name, build, size in PAYLOADS:
+			payload, elements = build(size)
+			walls, marshals = run(payload, repetitions)
+			print "%-20s %9d %10.1f %10.1f %10.1f" % (name, elements, walls[0] * 1e9 / elements, walls[len(walls) // 2] * 1e9 / elements, marshals[len(marshals) // 2] * 1e9 / elements)
+	finally:
+		pyphp.shutdown()
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,164 @@
+# End-to-end benchmark suite for pyphp.
+#
+# Runs every template of the corpus (bench/corpus) in every mode, warming up
+# first, and reports the wall time percentiles (p50, p99, p999), the
+# throughput and how long each phase took (from pyphp.runTimes()): marshal
+# (converting the variables), compile, execute, output and reset. The startup
+# phases of the interpreter come from pyphp.initTimes().
+#
+# Modes:
+#   runScript  pyphp.setVar() then pyphp.runScript(), output discarded by an
+#              output handler.
+#   render     pyphp.render() with the render cache bypassed.
+#   escape     pyphp.render(..., escape=True) with the render cache bypassed.
+#
+# Results can be written as JSON to compare runs across builds and modes.
+#
+# TO USE CALL:
+#   python bench/suite.py [-n iterations] [-w warmup] [-m mode,...]
+#                         [-t template,...] [-o results.json]
+#
+import json
+import optparse
+import os
+import platform
+import sys
+import time
+
+import pyphp
+
+CORPUS = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'corpus')
+
+MODES = ['runScript', 'render', 'escape']
+
+PHASES = ['marshal', 'compile', 'execute', 'output', 'reset']
+
+def makeContext(count):
+	items = []
+	for i in xrange(count):
+		items.append({
+			'id': i,
+			'title': 'Item <%d> "%s"' % (i, 'abcdefghij'[i % 10] * (i % 20 + 1)),
+			'price': i * 1.25,
+			'tags': ['tag%d' % j for j in xrange(i % 4)]
+		})
+	return {
+		'$user': {'name': 'Jane & John', 'email': 'jane@example.com', 'id': 42},
+		'$settings': {'theme': 'dark', 'pageSize': count, 'flags': range(32)},
+		'$items': items
+	}
+
+# The variables each template is run with.
+CONTEXTS = {
+	'context': makeContext(1000)
+}
+
+def templates(names):
+	found = sorted(name[:-4] for name in os.listdir(CORPUS) if name.endswith('.php'))
+	if names:
+		missing = set(names) - set(found)
+		if missing:
+			raise SystemExit("unknown templates: %s" % ', '.join(sorted(missing)))
+		found = [name for name in found if name in names]
+	return found
+
+def runOnce(mode, script, vars):
+	start = time.time()
+	if mode == 'runScript':
+		if vars:
+			pyphp.setVar(vars)
+		pyphp.runScript(script)
+	else:
+		pyphp.render(script, vars or None, ttl=-1, escape=(mode == 'escape'))
+	return time.time() - start, pyphp.runTimes()
+
+def percentile(values, fraction):
+	# Nearest rank of sorted values.
+	index = int(round(fraction * (len(values) - 1)))
+	return values[index]
+
+def summarize(values):
+	values = sorted(values)
+	return {
+		'min': values[0],
+		'mean': sum(values) / len(values),
+		'p50': percentile(values, 0.5),
+		'p99': percentile(values, 0.99),
+		'p999': percentile(values, 0.999),
+		'max': values[-1]
+	}
+
+def bench(mode, name, iterations, warmup):
+	script = os.path.join(CORPUS, name + '.php')
+	vars = CONTEXTS.get(name)
+	for i in xrange(warmup):
+		runOnce(mode, script, vars)
+	walls = []
+	phases = dict((phase, []) for phase in PHASES)
+	start = time.time()
+	for i in xrange(iterations):
+		wall, times = runOnce(mode, script, vars)
+		walls.append(wall)
+		for phase in PHASES:
+			phases[phase].append(times[phase])
+	elapsed = time.time() - start
+	return {
+		'template': name,
+		'mode': mode,
+		'iterations': iterations,
+		'warmup': warmup,
+		'wall': summarize(walls),
+		'phases': dict((phase, summarize(values)) for phase, values in phases.items()),
+		'throughput': iterations / elapsed if elapsed > 0 else 0.0
+	}
+
+def report(result):
+	wall = result['wall']
+	phases = result['phases']
+	print "%-10s %-9s p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms  %9.1f/s" % (
+		result['template'], result['mode'], wall['p50'] * 1000, wall['p99'] * 1000, wall['p999'] * 1000, result['throughput'])
+	print "%20s %s" % ('', '  '.join("%s %.3f" % (phase, phases[phase]['mean'] * 1000) for phase in PHASES))
+
+def main():
+	parser = optparse.OptionParser(usage="%prog [options]")
+	parser.add_option('-n', '--iterations', type='int', default=1000, help="measured runs per template and mode [%default]")
+	parser.add_option('-w', '--warmup', type='int', default=100, help="unmeasured runs first [%default]")
+	parser.add_option('-m', '--modes', default=','.join(MODES), help="comma separated modes [%default]")
+	parser.add_option('-t', '--templates', default='', help="comma separated templates (default all)")
+	parser.add_option('-o', '--output', help="write the results as JSON to this file")
+	options, args = parser.parse_args()
+	modes = [mode for mode in options.modes.split(',') if mode]
+	for mode in modes:
+		if mode not in MODES:
+			parser.error("unknown mode: %s" % mode)
+	names = templates([name for name in options.templates.split(',') if name])
+
+	pyphp.setOutputHandler(lambda output: None)
+	start = time.time()
+	pyphp.init()
+	init = dict(pyphp.initTimes(), wall=time.time() - start)
+	print "init %.3f ms (%s)" % (init['wall'] * 1000, ', '.join("%s %.3f" % (phase, init[phase] * 1000) for phase in ('sapi', 'module', 'request')))
+
+	results = []
+	try:
+		for name in names:
+			for mode in modes:
+				result = bench(mode, name, options.iterations, options.warmup)
+				report(result)
+				results.append(result)
+	finally:
+		pyphp.shutdown()
+
+	if options.output:
+		with open(options.output, 'w') as f:
+			json.dump({
+				'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+				'python': sys.version.split()[0],
+				'platform': platform.platform(),
+				'argv': sys.argv[1:],
+				'init': init,
+				'results': results
+			}, f, indent=1, sort_keys=True)
+
+if __name__ == '__main__':
+	main()
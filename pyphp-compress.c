@@ -0,0 +1,211 @@
+/**
+ * pyphp-compress.c provides streaming compression of PHP output.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-compress.h"
+
+extern PyObject * pyphp_exception;
+
+// The size of the blocks of compressed output.
+#define PYPHP_COMPRESS_CHUNK 16384
+
+// The compressor.
+struct pyphp_compress_t pyphp_compress;
+
+// The block the compressed output is written to.
+static char pyphp_compress_out[PYPHP_COMPRESS_CHUNK];
+
+/*******************************************************************************
+ * Enables or disables compression.
+ *
+ * @param bool isEnabled Whether output is compressed.
+ * @param int level The zlib compression level (-1 for the default, 0-9).
+ * @param int format The format (enum pyphp_compress_format_t).
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_compress_configure(bool isEnabled, int level, int format) {
+	if (pyphp_compress.isActive) {
+		PyErr_SetString(pyphp_exception, "The output compression can't change in the middle of a run");
+		return false;
+	}
+	if (pyphp_compress.isInit) {
+		deflateEnd(&pyphp_compress.stream);
+		pyphp_compress.isInit = false;
+	}
+	pyphp_compress.isEnabled = isEnabled;
+	pyphp_compress.level = level;
+	pyphp_compress.format = format;
+	return true;
+}
+
+/*******************************************************************************
+ * Gets the content coding of the compressed output.
+ *
+ * @return char* The content coding ("gzip" or "deflate"), or NULL if output
+ * isn't compressed (or is raw deflate, which has no content coding).
+ ******************************************************************************/
+const char * pyphp_compress_encoding(void) {
+	if (!pyphp_compress_isOn()) {
+		return NULL;
+	}
+	switch (pyphp_compress.format) {
+		case PYPHP_COMPRESS_GZIP:
+			return "gzip";
+		case PYPHP_COMPRESS_DEFLATE:
+			return "deflate";
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ * Negotiates the compression of the current run with the Accept-Encoding of
+ * its request: unless the client accepts the content coding, the run isn't
+ * compressed.
+ *
+ * @param char* acceptEncoding The Accept-Encoding of the request, or NULL if
+ * it has none (nothing but the identity is accepted then).
+ * @return bool Whether the run is compressed.
+ ******************************************************************************/
+bool pyphp_compress_php_negotiate(const char * acceptEncoding) {
+	pyphp_compress.isRefused = false;
+	const char * encoding = pyphp_compress_encoding();
+	if (encoding == NULL) {
+		// NOTE: raw deflate has no content coding to offer.
+		pyphp_compress.isRefused = pyphp_compress.isEnabled;
+		return false;
+	}
+	
+	// The quality of the coding ("gzip;q=0.5"), or of any coding ("*").
+	double quality = -1;
+	double anyQuality = -1;
+	const char * coding = acceptEncoding;
+	while (coding != NULL && *coding != '\0') {
+		while (*coding == ' ' || *coding == '\t' || *coding == ',') {
+			coding++;
+		}
+		size_t length = strcspn(coding, " \t;,");
+		if (length == 0) {
+			break;
+		}
+		const char * params = coding + length;
+		const char * next = strchr(params, ',');
+		double q = 1;
+		const char * semicolon = strchr(params, ';');
+		if (semicolon != NULL && (next == NULL || semicolon < next)) {
+			const char * value = semicolon + 1;
+			while (*value == ' ' || *value == '\t') {
+				value++;
+			}
+			if ((value[0] == 'q' || value[0] == 'Q') && value[1] == '=') {
+				q = strtod(value + 2, NULL);
+			}
+		}
+		if ((length == strlen(encoding) && strncasecmp(coding, encoding, length) == 0)
+			|| (length == 6 && strncasecmp(coding, "x-gzip", 6) == 0 && pyphp_compress.format == PYPHP_COMPRESS_GZIP)) {
+			quality = q;
+		} else if (length == 1 && coding[0] == '*') {
+			anyQuality = q;
+		}
+		coding = next;
+	}
+	
+	bool isAccepted = (quality >= 0 ? quality > 0 : anyQuality > 0);
+	pyphp_compress.isRefused = !isAccepted;
+	return isAccepted;
+}
+
+/*******************************************************************************
+ * Runs the compressor and sends what it produced on.
+ *
+ * @param int flush The zlib flush mode.
+ ******************************************************************************/
+static void pyphp_compress_deflate(int flush) {
+	z_stream * stream = &pyphp_compress.stream;
+	do {
+		stream->next_out = (Bytef *)pyphp_compress_out;
+		stream->avail_out = PYPHP_COMPRESS_CHUNK;
+		if (deflate(stream, flush) == Z_STREAM_ERROR) {
+			return;
+		}
+		size_t length = PYPHP_COMPRESS_CHUNK - stream->avail_out;
+		if (length > 0) {
+			pyphp_core.stats.bytesCompressed += length;
+			pyphp_core_output_send(pyphp_compress_out, length);
+		}
+		// NOTE: a full block means zlib may have more to produce.
+	} while (stream->avail_out == 0);
+}
+
+/*******************************************************************************
+ * Compresses output.
+ *
+ * @param char* data The output.
+ * @param size_t length The length of the output.
+ * @return bool If the output was compressed, true; otherwise (the compressor
+ * couldn't be initialized), false.
+ ******************************************************************************/
+bool pyphp_compress_write(const char * data, size_t length) {
+	z_stream * stream = &pyphp_compress.stream;
+	if (!pyphp_compress.isInit) {
+		memset(stream, 0, sizeof(z_stream));
+		int windowBits = 15;
+		if (pyphp_compress.format == PYPHP_COMPRESS_GZIP) {
+			windowBits += 16;
+		} else if (pyphp_compress.format == PYPHP_COMPRESS_RAW) {
+			windowBits = -windowBits;
+		}
+		if (deflateInit2(stream, pyphp_compress.level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return false;
+		}
+		pyphp_compress.isInit = true;
+	}
+	pyphp_compress.isActive = true;
+	stream->next_in = (Bytef *)data;
+	stream->avail_in = (uInt)length;
+	pyphp_compress_deflate(Z_NO_FLUSH);
+	return true;
+}
+
+/*******************************************************************************
+ * Flushes the compressor, if the current run wrote to it.
+ ******************************************************************************/
+void pyphp_compress_flush(void) {
+	if (!pyphp_compress.isActive) {
+		return;
+	}
+	uint64_t start = pyphp_core_now();
+	pyphp_compress_deflate(Z_SYNC_FLUSH);
+	pyphp_core.runTimes.output += pyphp_core_now() - start;
+}
+
+/*******************************************************************************
+ * Finishes the stream of the current run, if it wrote to it.
+ ******************************************************************************/
+void pyphp_compress_end(void) {
+	if (!pyphp_compress.isActive) {
+		return;
+	}
+	uint64_t start = pyphp_core_now();
+	pyphp_compress_deflate(Z_FINISH);
+	// NOTE: the stream (and its memory) is reused by the next run.
+	deflateReset(&pyphp_compress.stream);
+	pyphp_compress.isActive = false;
+	pyphp_core.runTimes.output += pyphp_core_now() - start;
+}
@@ -0,0 +1,112 @@
+/**
+ * pyphp-compress.h provides streaming compression of PHP output
+ * (pyphp.setCompression()).
+ *
+ * While compression is enabled, everything PHP writes through ub_write is fed
+ * to zlib as it is written, and only the compressed bytes go on to wherever
+ * the output goes (the capture of pyphp.render() and WSGI responses, the
+ * Python output handler, or the output stream). A PHP flush() flushes the
+ * compressor (Z_SYNC_FLUSH) so that the output so far can be decompressed, and
+ * the stream is finished when the run ends. A WSGI response is only compressed
+ * if the Accept-Encoding of its request accepts the content coding.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_COMPRESS_H
+#define PYPHP_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#include <Python.h>
+
+// The formats of the compressed output.
+enum pyphp_compress_format_t {
+	PYPHP_COMPRESS_GZIP = 0,
+	PYPHP_COMPRESS_DEFLATE,
+	PYPHP_COMPRESS_RAW
+};
+
+/**
+ * The compressor.
+ */
+extern struct pyphp_compress_t {
+	// Whether output is compressed, and how.
+	bool isEnabled;
+	int level;
+	int format;
+	// Whether the current run isn't compressed (its client doesn't accept the
+	// content coding).
+	bool isRefused;
+	// The zlib stream, whether it was initialized, and whether the current run
+	// has written to it.
+	z_stream stream;
+	bool isInit;
+	bool isActive;
+} pyphp_compress;
+
+/**
+ * Enables or disables compression.
+ *
+ * @param bool isEnabled Whether output is compressed.
+ * @param int level The zlib compression level (-1 for the default, 0-9).
+ * @param int format The format (enum pyphp_compress_format_t).
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_compress_configure(bool isEnabled, int level, int format);
+
+/**
+ * Checks whether the output of the current run is compressed.
+ *
+ * @return bool Whether it is compressed.
+ */
+static inline bool pyphp_compress_isOn(void) {
+	return pyphp_compress.isEnabled && !pyphp_compress.isRefused;
+}
+
+/**
+ * Gets the content coding of the compressed output.
+ *
+ * @return char* The content coding ("gzip" or "deflate"), or NULL if output
+ * isn't compressed (or is raw deflate, which has no content coding).
+ */
+const char * pyphp_compress_encoding(void);
+
+/**
+ * Negotiates the compression of the current run with the Accept-Encoding of
+ * its request: unless the client accepts the content coding, the run isn't
+ * compressed.
+ *
+ * @param char* acceptEncoding The Accept-Encoding of the request, or NULL if
+ * it has none (nothing but the identity is accepted then).
+ * @return bool Whether the run is compressed.
+ */
+bool pyphp_compress_php_negotiate(const char * acceptEncoding);
+
+/**
+ * Compresses output.
+ *
+ * @param char* data The output.
+ * @param size_t length The length of the output.
+ * @return bool If the output was compressed, true; otherwise (the compressor
+ * couldn't be initialized), false.
+ */
+bool pyphp_compress_write(const char * data, size_t length);
+
+/**
+ * Flushes the compressor, if the current run wrote to it.
+ */
+void pyphp_compress_flush(void);
+
+/**
+ * Finishes the stream of the current run, if it wrote to it.
+ */
+void pyphp_compress_end(void);
+
+#endif
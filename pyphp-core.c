@@ -9,13 +9,285 @@
  
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <Python.h>
 #include <sapi/embed/php_embed.h>
+#include <zend_exceptions.h>
 
 #include "pyphp-core.h"
 
 extern PyObject * pyphp_exception;
+extern PyObject * pyphp_memoryBudgetException;
+
+// Needed by PHP embed.
+#ifdef ZTS
+void **** ptsrm_ls;
+#endif
+
+// The core state.
+struct pyphp_core_t pyphp_core;
+
+// The PHP compile file handler that was installed before ours.
+static zend_op_array * (* pyphp_core_phpCompileFile)(zend_file_handle * handle, int type TSRMLS_DC);
+
+// The default conversion options: request zvals.
+static const pyphp_core_convert_t pyphp_core_convert_defaults = {
+	.persistent = false,
+	.inputHash = NULL,
+	.hashOnly = false,
+	.escape = false
+};
+
+/*******************************************************************************
+ * Reads 64 bits of unaligned memory.
+ ******************************************************************************/
+static inline uint64_t pyphp_core_read64(const unsigned char * data) {
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+/*******************************************************************************
+ * Reads 32 bits of unaligned memory.
+ ******************************************************************************/
+static inline uint32_t pyphp_core_read32(const unsigned char * data) {
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+/*******************************************************************************
+ * An XXH64 accumulator round.
+ ******************************************************************************/
+static inline uint64_t pyphp_core_hash_round(uint64_t acc, uint64_t input) {
+	acc += input * PYPHP_CORE_PRIME64_2;
+	acc = pyphp_core_rotl64(acc, 31);
+	return acc * PYPHP_CORE_PRIME64_1;
+}
+
+/*******************************************************************************
+ * Merges an XXH64 accumulator into the hash.
+ ******************************************************************************/
+static inline uint64_t pyphp_core_hash_merge(uint64_t hash, uint64_t acc) {
+	hash ^= pyphp_core_hash_round(0, acc);
+	return hash * PYPHP_CORE_PRIME64_1 + PYPHP_CORE_PRIME64_4;
+}
+
+/*******************************************************************************
+ * Hashes bytes (XXH64).
+ *
+ * @param void* data The bytes.
+ * @param size_t length The number of bytes.
+ * @param uint64_t seed The seed.
+ * @return uint64_t The hash.
+ ******************************************************************************/
+uint64_t pyphp_core_hash_bytes(const void * data, size_t length, uint64_t seed) {
+	const unsigned char * p = (const unsigned char *)data;
+	const unsigned char * end = p + length;
+	uint64_t hash;
+	
+	if (length >= 32) {
+		const unsigned char * limit = end - 32;
+		uint64_t v1 = seed + PYPHP_CORE_PRIME64_1 + PYPHP_CORE_PRIME64_2;
+		uint64_t v2 = seed + PYPHP_CORE_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PYPHP_CORE_PRIME64_1;
+		do {
+			v1 = pyphp_core_hash_round(v1, pyphp_core_read64(p));
+			v2 = pyphp_core_hash_round(v2, pyphp_core_read64(p + 8));
+			v3 = pyphp_core_hash_round(v3, pyphp_core_read64(p + 16));
+			v4 = pyphp_core_hash_round(v4, pyphp_core_read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		hash = pyphp_core_rotl64(v1, 1) + pyphp_core_rotl64(v2, 7) + pyphp_core_rotl64(v3, 12) + pyphp_core_rotl64(v4, 18);
+		hash = pyphp_core_hash_merge(hash, v1);
+		hash = pyphp_core_hash_merge(hash, v2);
+		hash = pyphp_core_hash_merge(hash, v3);
+		hash = pyphp_core_hash_merge(hash, v4);
+	} else {
+		hash = seed + PYPHP_CORE_PRIME64_5;
+	}
+	hash += (uint64_t)length;
+	
+	while (p + 8 <= end) {
+		hash ^= pyphp_core_hash_round(0, pyphp_core_read64(p));
+		hash = pyphp_core_rotl64(hash, 27) * PYPHP_CORE_PRIME64_1 + PYPHP_CORE_PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		hash ^= (uint64_t)pyphp_core_read32(p) * PYPHP_CORE_PRIME64_1;
+		hash = pyphp_core_rotl64(hash, 23) * PYPHP_CORE_PRIME64_2 + PYPHP_CORE_PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		hash ^= (*p) * PYPHP_CORE_PRIME64_5;
+		hash = pyphp_core_rotl64(hash, 11) * PYPHP_CORE_PRIME64_1;
+		p++;
+	}
+	
+	hash ^= hash >> 33;
+	hash *= PYPHP_CORE_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PYPHP_CORE_PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+/*******************************************************************************
+ * Mixes a tagged value into the structural hash of a conversion.
+ *
+ * @param pyphp_core_convert_t* options The conversion options.
+ * @param enum pyphp_core_hashTag_t tag The kind of value.
+ * @param uint64_t value The value (or its hash).
+ ******************************************************************************/
+static inline void pyphp_core_convert_hash(const pyphp_core_convert_t * options, enum pyphp_core_hashTag_t tag, uint64_t value) {
+	if (options->inputHash != NULL) {
+		pyphp_core_hash_mix(options->inputHash, tag);
+		pyphp_core_hash_mix(options->inputHash, value);
+	}
+}
+
+// The PHP key of a dict key: an index, or a string.
+typedef struct pyphp_core_key_t {
+	bool isIndex;
+	long index;
+	const char * string;
+	Py_ssize_t length;
+	// The ASCII encoding of a unicode key, or NULL.
+	PyObject * pyAscii;
+} pyphp_core_key_t;
+
+/*******************************************************************************
+ * Gets the PHP key of a dict key.
+ *
+ * Unicode keys are encoded as ASCII just like unicode values, and longs that
+ * fit in a PHP integer are indexes just like ints.
+ *
+ * @param PyObject* pyKey The dict key.
+ * @param pyphp_core_key_t* key Where the key is stored (release it with
+ * pyphp_core_key_release()).
+ * @return bool If the dict key can be a PHP key, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_core_key_get(PyObject * pyKey, pyphp_core_key_t * key) {
+	key->pyAscii = NULL;
+	if (PyInt_Check(pyKey) || PyLong_Check(pyKey)) {
+		key->isIndex = true;
+		key->index = PyInt_AsLong(pyKey);
+		if (key->index == -1 && PyErr_Occurred()) {
+			PyErr_Clear();
+			return false;
+		}
+		return true;
+	}
+	key->isIndex = false;
+	if (PyUnicode_Check(pyKey)) {
+		key->pyAscii = PyUnicode_AsASCIIString(pyKey);
+		if (key->pyAscii == NULL) {
+			PyErr_Clear();
+			return false;
+		}
+		pyKey = key->pyAscii;
+	}
+	if (!PyString_Check(pyKey)) {
+		return false;
+	}
+	key->string = PyString_AS_STRING(pyKey);
+	key->length = PyString_GET_SIZE(pyKey);
+	return true;
+}
+
+/*******************************************************************************
+ * Releases the PHP key of a dict key.
+ *
+ * @param pyphp_core_key_t* key The key.
+ ******************************************************************************/
+static inline void pyphp_core_key_release(pyphp_core_key_t * key) {
+	Py_XDECREF(key->pyAscii);
+	key->pyAscii = NULL;
+}
+
+/*******************************************************************************
+ * Allocates and initializes a zval.
+ *
+ * Persistent zvals are allocated with room for the GC info, just like
+ * ALLOC_ZVAL(), because the cycle collector walks them once they are bound
+ * into a request.
+ *
+ * @param pyphp_core_convert_t* options The conversion options.
+ * @return zval* The new zval.
+ ******************************************************************************/
+static inline zval * pyphp_core_convert_allocZval(const pyphp_core_convert_t * options) {
+	zval * phpObj;
+	if (options->persistent) {
+		phpObj = (zval *)pemalloc(sizeof(zval_gc_info), 1);
+		GC_ZVAL_INIT(phpObj);
+		INIT_PZVAL(phpObj);
+	} else {
+		MAKE_STD_ZVAL(phpObj);
+	}
+	return phpObj;
+}
+
+/*******************************************************************************
+ * Releases a zval created during conversion.
+ *
+ * @param zval* phpObj The zval to release.
+ * @param pyphp_core_convert_t* options The conversion options.
+ ******************************************************************************/
+static inline void pyphp_core_convert_freeZval(zval * phpObj, const pyphp_core_convert_t * options) {
+	if (options->persistent) {
+		pyphp_core_persistent_zval_ptr_dtor(&phpObj);
+	} else {
+		zval_ptr_dtor(&phpObj);
+	}
+}
+
+/*******************************************************************************
+ * Sets a zval to a copy of the character string, HTML escaped if asked.
+ *
+ * @param zval* phpObj The zval to set.
+ * @param char* string The character string.
+ * @param int length The length of the character string.
+ * @param bool isEscaped Whether the copy is HTML escaped.
+ * @param pyphp_core_convert_t* options The conversion options.
+ ******************************************************************************/
+static inline void pyphp_core_convert_setString(zval * phpObj, const char * string, int length, bool isEscaped, const pyphp_core_convert_t * options) {
+	Z_TYPE_P(phpObj) = IS_STRING;
+	size_t growth = isEscaped ? pyphp_escape_growth(string, length) : 0;
+	if (growth == 0) {
+		Z_STRLEN_P(phpObj) = length;
+		Z_STRVAL_P(phpObj) = pestrndup(string, length, options->persistent);
+		return;
+	}
+	char * escaped = (char *)pemalloc(length + growth + 1, options->persistent);
+	pyphp_escape_html(string, length, escaped);
+	escaped[length + growth] = '\0';
+	Z_STRLEN_P(phpObj) = length + growth;
+	Z_STRVAL_P(phpObj) = escaped;
+}
+
+/*******************************************************************************
+ * Sets a zval to an empty array.
+ *
+ * @param zval* phpObj The zval to set.
+ * @param uint size The expected number of elements.
+ * @param pyphp_core_convert_t* options The conversion options.
+ ******************************************************************************/
+static inline void pyphp_core_convert_setArray(zval * phpObj, uint size, const pyphp_core_convert_t * options) {
+	if (options->persistent) {
+		HashTable * ht = (HashTable *)pemalloc(sizeof(HashTable), 1);
+		zend_hash_init(ht, size, NULL, pyphp_core_persistent_zval_ptr_dtor, 1);
+		Z_TYPE_P(phpObj) = IS_ARRAY;
+		Z_ARRVAL_P(phpObj) = ht;
+	} else {
+		array_init_size(phpObj, size);
+	}
+}
 
 /*******************************************************************************
  * Converts a Python object (PyObject) to a PHP value (zval).
@@ -26,115 +298,222 @@ extern PyObject * pyphp_exception;
  * @return bool On success, true; otherwise, false.
  ******************************************************************************/
 bool pyphp_core_convert_pyObjectToZval(PyObject * pyObj, zval ** phpObj) {
+	return pyphp_core_convert_pyObjectToZvalEx(pyObj, phpObj, &pyphp_core_convert_defaults);
+}
+
+/*******************************************************************************
+ * Converts a Python value (PyObject) to a PHP value (zval) with options.
+ *
+ * @param PyObject* pyObj The python object to convert.
+ * @param zval** phpObj A reference to a zval where the converted zval will be
+ * stored.
+ * @param pyphp_core_convert_t* options The conversion options.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_convert_pyObjectToZvalEx(PyObject * pyObj, zval ** phpObj, const pyphp_core_convert_t * options) {
 	// Make sure pyObj isn't NULL.
 	if (pyObj == NULL) {
 		printf("%s:%u PyObject is NULL!\n", __FUNCTION__, __LINE__);
 		return false;
 	}
-	if (phpObj == NULL) {
+	if (phpObj == NULL && !options->hashOnly) {
 		printf("%s:%u zval reference is NULL!\n", __FUNCTION__, __LINE__);
 		return false;
 	}
 	
 	// Check for Python null value.
 	if (pyObj == Py_None) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_NONE, 0);
+		if (options->hashOnly) {
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
 		ZVAL_NULL(phpPtr);
 		return true;
 	}
 	// Check for Python boolean value.
 	else if (PyBool_Check(pyObj)) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_BOOL, pyObj == Py_True);
+		if (options->hashOnly) {
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
 		ZVAL_BOOL(phpPtr, PyInt_AsLong(pyObj));
 		return true;
 	}
 	// Check for Python integer value.
 	else if (PyInt_Check(pyObj) || PyLong_Check(pyObj)) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
-		ZVAL_LONG(phpPtr, PyInt_AsLong(pyObj));
+		long value = PyInt_AsLong(pyObj);
+		// A long that overflows a PHP integer becomes a float, just like it
+		// would in PHP, but can't be hashed (another long that overflows would
+		// hash the same), so its render isn't cached.
+		if (value == -1 && PyErr_Occurred()) {
+			PyErr_Clear();
+			if (options->hashOnly) {
+				return false;
+			}
+			double real = PyLong_AsDouble(pyObj);
+			if (real == -1.0 && PyErr_Occurred()) {
+				PyErr_Clear();
+				printf("%s:%u Python long is too large to convert to a PHP value!\n", __FUNCTION__, __LINE__);
+				return false;
+			}
+			zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+			ZVAL_DOUBLE(phpPtr, real);
+			return true;
+		}
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_INT, (uint64_t)value);
+		if (options->hashOnly) {
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+		ZVAL_LONG(phpPtr, value);
 		return true;
 	}
 	// Check for Python floating-point value.
 	else if (PyFloat_Check(pyObj)) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
+		double value = PyFloat_AsDouble(pyObj);
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_FLOAT, bits);
+		if (options->hashOnly) {
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
 		ZVAL_DOUBLE(phpPtr, PyFloat_AsDouble(pyObj));
 		return true;
 	}
 	// Check for Python string.
 	else if (PyString_Check(pyObj)) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
-		char * string = PyString_AsString(pyObj);
-		ZVAL_STRING(phpPtr, string, 1);
-		string = NULL;
+		// NOTE: strings marked as safe (pyphp.Safe) are never escaped.
+		bool isEscaped = options->escape && !pyphp_escape_isSafe(pyObj);
+		if (options->inputHash != NULL) {
+			pyphp_core_convert_hash(options, isEscaped ? PYPHP_CORE_HASH_ESCAPED : PYPHP_CORE_HASH_STRING, pyphp_core_hash_bytes(PyString_AS_STRING(pyObj), PyString_GET_SIZE(pyObj), 0));
+		}
+		if (options->hashOnly) {
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+		pyphp_core_convert_setString(phpPtr, PyString_AS_STRING(pyObj), PyString_GET_SIZE(pyObj), isEscaped, options);
 		return true;
 	}
 	// Check for a Python unicode string.
 	// TODO: allow multibyte strings for PHP.
 	else if (PyUnicode_Check(pyObj)) {
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
 		PyObject * pyAscii = PyUnicode_AsASCIIString(pyObj);
-		char * ascii = PyString_AsString(pyAscii);
-		ZVAL_STRING(phpPtr, ascii, 1);
+		if (pyAscii == NULL) {
+			printf("%s:%u Failed to encode unicode string as ASCII\n", __FUNCTION__, __LINE__);
+			PyErr_Clear();
+			return false;
+		}
+		if (options->inputHash != NULL) {
+			pyphp_core_convert_hash(options, options->escape ? PYPHP_CORE_HASH_ESCAPED : PYPHP_CORE_HASH_STRING, pyphp_core_hash_bytes(PyString_AS_STRING(pyAscii), PyString_GET_SIZE(pyAscii), 0));
+		}
+		if (options->hashOnly) {
+			Py_DECREF(pyAscii);
+			return true;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+		pyphp_core_convert_setString(phpPtr, PyString_AS_STRING(pyAscii), PyString_GET_SIZE(pyAscii), options->escape, options);
 		Py_DECREF(pyAscii);
-		ascii = NULL;
 		pyAscii = NULL;
 		return true;
 	}
 	// Check for Python dict.
 	else if (PyDict_Check(pyObj)) {
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_DICT, PyDict_Size(pyObj));
 		// Initialize the PHP object to an array.
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
-		array_init(phpPtr);
+		zval * phpPtr = NULL;
+		if (!options->hashOnly) {
+			phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+			pyphp_core_convert_setArray(phpPtr, PyDict_Size(pyObj), options);
+		}
 		// Iterate over the python dict, convert the python keys and values into PHP
 		// keys and values, and append the key-value pairs to the PHP object.
 		PyObject * pyKey;
 		PyObject * pyValue;
 		Py_ssize_t pos = 0;
 		zval * phpValue;
-		char * key;
 		while (PyDict_Next(pyObj, &pos, &pyKey, &pyValue)) {
+			// Convert the PyObject key into the PHP key.
+			pyphp_core_key_t key;
+			bool hasKey = pyphp_core_key_get(pyKey, &key);
+			if (options->inputHash != NULL) {
+				if (!hasKey) {
+					pyphp_core_convert_hash(options, PYPHP_CORE_HASH_OTHER, 0);
+				} else if (key.isIndex) {
+					pyphp_core_convert_hash(options, PYPHP_CORE_HASH_INT, (uint64_t)key.index);
+				} else {
+					pyphp_core_convert_hash(options, PYPHP_CORE_HASH_STRING, pyphp_core_hash_bytes(key.string, key.length, 0));
+				}
+			}
+			if (options->hashOnly) {
+				pyphp_core_key_release(&key);
+				if (!pyphp_core_convert_pyObjectToZvalEx(pyValue, NULL, options)) {
+					return false;
+				}
+				continue;
+			}
 			// Convert the PyObject value into the PHP value.
-			if (pyphp_core_convert_pyObjectToZval(pyValue, &phpValue)) {
-				// Convert the PyObject key into the PHP string.
+			phpValue = NULL;
+			if (pyphp_core_convert_pyObjectToZvalEx(pyValue, &phpValue, options)) {
 				// Append the PHP key-value pair to the PHP object.
-				key = PyString_AsString(pyKey);
-				if (zend_hash_update(Z_ARRVAL_P(phpPtr), key, strlen(key), (void *)&phpValue, sizeof(phpValue), NULL) == FAILURE) {
+				int result;
+				if (!hasKey) {
+					printf("%s:%u Dict keys must be strings or integers\n", __FUNCTION__, __LINE__);
+					result = FAILURE;
+				} else if (key.isIndex) {
+					result = zend_hash_index_update(Z_ARRVAL_P(phpPtr), key.index, (void *)&phpValue, sizeof(phpValue), NULL);
+				} else {
+					result = zend_symtable_update(Z_ARRVAL_P(phpPtr), (char *)key.string, key.length+1, (void *)&phpValue, sizeof(phpValue), NULL);
+				}
+				if (result == FAILURE) {
 					printf("%s:%u Failed to insert zval into hash\n", __FUNCTION__, __LINE__);
-					zval_dtor(phpValue);
+					pyphp_core_convert_freeZval(phpValue, options);
 					phpValue = NULL;
 				}
+				pyphp_core_key_release(&key);
 			} else {
 				printf("%s:%u Failed to convert python value to php value\n", __FUNCTION__, __LINE__);
-				if (phpValue != NULL) {
-					zval_dtor(phpValue);
-					phpValue = NULL;
-				}
+				pyphp_core_key_release(&key);
+				pyphp_core_convert_freeZval(phpPtr, options);
+				*phpObj = NULL;
 				return false;
 			}
 		}
-		key = NULL;
 		phpValue = NULL;
 		pyValue = NULL;
 		pyKey = NULL;
 		
 		return true;
 	}
+	// Check for a Python object (passed as a proxy).
+	else if (pyphp_object_isProxied(pyObj)) {
+		// NOTE: proxies only live as long as the request, and their attributes
+		// are only read when used so they can't be hashed.
+		if (options->persistent || options->hashOnly) {
+			return false;
+		}
+		zval * phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+		if (!pyphp_object_php_wrap(phpPtr, pyObj)) {
+			pyphp_core_convert_freeZval(phpPtr, options);
+			*phpObj = NULL;
+			return false;
+		}
+		return true;
+	}
 	// Check for Python list/tuple.
 	else if (PySequence_Check(pyObj)) {
 		// Initialize the PHP object to an array.
-		MAKE_STD_ZVAL(*phpObj);
-		zval * phpPtr = *phpObj;
-		array_init(phpPtr);
+		const Py_ssize_t seqSize = PySequence_Size(pyObj);
+		pyphp_core_convert_hash(options, PYPHP_CORE_HASH_SEQUENCE, seqSize);
+		zval * phpPtr = NULL;
+		if (!options->hashOnly) {
+			phpPtr = *phpObj = pyphp_core_convert_allocZval(options);
+			pyphp_core_convert_setArray(phpPtr, seqSize, options);
+		}
 		// Iterate over the python sequence items, convert the python items into
 		// PHP values, and append the items to the PHP object.
-		const Py_ssize_t seqSize = PySequence_Size(pyObj);
 		PyObject * pyItem;
 		zval * phpItem;
 		Py_ssize_t i;
@@ -142,26 +521,34 @@ bool pyphp_core_convert_pyObjectToZval(PyObject * pyObj, zval ** phpObj) {
 			// Get the python sequence item at index.
 			pyItem = PySequence_GetItem(pyObj, i);
 			if (pyItem != NULL) {
+				if (options->hashOnly) {
+					bool isHashed = pyphp_core_convert_pyObjectToZvalEx(pyItem, NULL, options);
+					Py_DECREF(pyItem);
+					if (!isHashed) {
+						return false;
+					}
+					continue;
+				}
 				// Convert the PyObject item into the PHP item.
 				phpItem = NULL;
-				if (pyphp_core_convert_pyObjectToZval(pyItem, &phpItem)) {
+				bool isConverted = pyphp_core_convert_pyObjectToZvalEx(pyItem, &phpItem, options);
+				// Delete the reference to the python item.
+				Py_DECREF(pyItem);
+				if (isConverted) {
 					// Append the PHP item to the PHP object.
-					//add_next_index_zval(phpPtr, phpItem);
 					if (zend_hash_next_index_insert(Z_ARRVAL_P(phpPtr), &phpItem, sizeof(phpItem), NULL) == FAILURE) {
 						printf("%s:%u Failed to insert zval into hash\n", __FUNCTION__, __LINE__);
-						zval_dtor(phpItem);
+						pyphp_core_convert_freeZval(phpItem, options);
+						pyphp_core_convert_freeZval(phpPtr, options);
+						*phpObj = NULL;
 						return false;
 					}
 				} else {
 					printf("%s:%u Failed to convert python value to php value\n", __FUNCTION__, __LINE__);
-					if (phpItem != NULL) {
-						zval_dtor(phpItem);
-						phpItem = NULL;
-					}
+					pyphp_core_convert_freeZval(phpPtr, options);
+					*phpObj = NULL;
 					return false;
 				}
-				// Delete the reference to the python item.
-				Py_DECREF(pyItem);
 			}
 		}
 		phpItem = NULL;
@@ -174,6 +561,428 @@ bool pyphp_core_convert_pyObjectToZval(PyObject * pyObj, zval ** phpObj) {
 	return false;
 }
 
+/*******************************************************************************
+ * Converts a PHP hash table (array or object properties) to a Python value.
+ *
+ * @param HashTable* phpHash The hash table.
+ * @param bool isList Whether arrays keyed 0..n-1 in order become lists.
+ * @return PyObject* On success, a new reference to a list or dict; otherwise,
+ * NULL with a python exception set.
+ ******************************************************************************/
+static PyObject * pyphp_core_convert_hashToPyObject(HashTable * phpHash, bool isList) {
+	if (phpHash->nApplyCount > 0) {
+		PyErr_SetString(PyExc_ValueError, "Recursive PHP arrays can't be converted to python values");
+		return NULL;
+	}
+	
+	// Arrays keyed 0..n-1 in order are lists.
+	HashPosition pos;
+	char * key;
+	uint keyLen;
+	ulong index;
+	ulong next = 0;
+	zval ** phpValue;
+	for (zend_hash_internal_pointer_reset_ex(phpHash, &pos); isList && zend_hash_get_current_data_ex(phpHash, (void **)&phpValue, &pos) == SUCCESS; zend_hash_move_forward_ex(phpHash, &pos)) {
+		isList = (zend_hash_get_current_key_ex(phpHash, &key, &keyLen, &index, 0, &pos) == HASH_KEY_IS_LONG && index == next++);
+	}
+	
+	PyObject * pyObj = isList ? PyList_New(zend_hash_num_elements(phpHash)) : PyDict_New();
+	if (pyObj == NULL) {
+		return NULL;
+	}
+	phpHash->nApplyCount++;
+	Py_ssize_t i = 0;
+	for (zend_hash_internal_pointer_reset_ex(phpHash, &pos); zend_hash_get_current_data_ex(phpHash, (void **)&phpValue, &pos) == SUCCESS; zend_hash_move_forward_ex(phpHash, &pos)) {
+		int keyType = zend_hash_get_current_key_ex(phpHash, &key, &keyLen, &index, 0, &pos);
+		// NOTE: private and protected properties are mangled with a leading NUL.
+		if (keyType == HASH_KEY_IS_STRING && key[0] == '\0') {
+			continue;
+		}
+		PyObject * pyValue = pyphp_core_convert_zvalToPyObject(*phpValue);
+		if (pyValue == NULL) {
+			phpHash->nApplyCount--;
+			Py_DECREF(pyObj);
+			return NULL;
+		}
+		if (isList) {
+			// NOTE: steals the reference to the value.
+			PyList_SET_ITEM(pyObj, i++, pyValue);
+			continue;
+		}
+		PyObject * pyKey = (keyType == HASH_KEY_IS_STRING) ? PyString_FromStringAndSize(key, keyLen-1) : PyInt_FromLong(index);
+		int result = (pyKey != NULL) ? PyDict_SetItem(pyObj, pyKey, pyValue) : -1;
+		Py_XDECREF(pyKey);
+		Py_DECREF(pyValue);
+		if (result == -1) {
+			phpHash->nApplyCount--;
+			Py_DECREF(pyObj);
+			return NULL;
+		}
+	}
+	phpHash->nApplyCount--;
+	return pyObj;
+}
+
+/*******************************************************************************
+ * Converts a PHP value (zval) to a Python value (PyObject).
+ *
+ * Arrays keyed 0..n-1 in order become lists, other arrays and objects (their
+ * public properties) become dicts.
+ *
+ * @param zval* phpObj The PHP value.
+ * @return PyObject* On success, a new reference to the python value;
+ * otherwise, NULL with a python exception set.
+ ******************************************************************************/
+PyObject * pyphp_core_convert_zvalToPyObject(zval * phpObj) {
+	switch (Z_TYPE_P(phpObj)) {
+		case IS_NULL:
+			Py_RETURN_NONE;
+		case IS_BOOL:
+			return PyBool_FromLong(Z_BVAL_P(phpObj));
+		case IS_LONG:
+			return PyInt_FromLong(Z_LVAL_P(phpObj));
+		case IS_DOUBLE:
+			return PyFloat_FromDouble(Z_DVAL_P(phpObj));
+		case IS_STRING:
+			return PyString_FromStringAndSize(Z_STRVAL_P(phpObj), Z_STRLEN_P(phpObj));
+		case IS_ARRAY:
+			return pyphp_core_convert_hashToPyObject(Z_ARRVAL_P(phpObj), true);
+		case IS_OBJECT: {
+			// Proxies convert back to their python object.
+			PyObject * pyObj = pyphp_object_php_unwrap(phpObj);
+			if (pyObj != NULL) {
+				Py_INCREF(pyObj);
+				return pyObj;
+			}
+			TSRMLS_FETCH();
+			HashTable * properties = Z_OBJ_HT_P(phpObj)->get_properties ? Z_OBJPROP_P(phpObj) : NULL;
+			if (properties == NULL) {
+				return PyDict_New();
+			}
+			return pyphp_core_convert_hashToPyObject(properties, false);
+		}
+	}
+	PyErr_Format(PyExc_TypeError, "PHP values of type %s can't be converted to python values", zend_zval_type_name(phpObj));
+	return NULL;
+}
+
+/*******************************************************************************
+ * Throws a PHP exception for the current python exception, and clears it.
+ *
+ * @param char* context What raised it (e.g., the name of a PHP function).
+ ******************************************************************************/
+void pyphp_core_php_throwPyErr(const char * context TSRMLS_DC) {
+	if (!PyErr_Occurred()) {
+		zend_throw_exception_ex(zend_exception_get_default(TSRMLS_C), 0 TSRMLS_CC, "%s: the python value can't be converted to a PHP value", context);
+		return;
+	}
+	PyObject * pyType;
+	PyObject * pyValue;
+	PyObject * pyTraceback;
+	PyErr_Fetch(&pyType, &pyValue, &pyTraceback);
+	PyErr_NormalizeException(&pyType, &pyValue, &pyTraceback);
+	PyObject * pyMessage = (pyValue != NULL) ? PyObject_Str(pyValue) : NULL;
+	const char * typeName = (pyType != NULL && PyType_Check(pyType)) ? ((PyTypeObject *)pyType)->tp_name : "Exception";
+	const char * message = (pyMessage != NULL && PyString_Check(pyMessage)) ? PyString_AS_STRING(pyMessage) : "";
+	zend_throw_exception_ex(zend_exception_get_default(TSRMLS_C), 0 TSRMLS_CC, "%s: %s: %s", context, typeName, message);
+	Py_XDECREF(pyMessage);
+	Py_XDECREF(pyType);
+	Py_XDECREF(pyValue);
+	Py_XDECREF(pyTraceback);
+	PyErr_Clear();
+}
+
+/*******************************************************************************
+ * Gets the PHP variable name from a Python variable name.
+ *
+ * @param PyObject* pyKey The Python variable name (a string beginning with a
+ * dollar sign).
+ * @param char* name The buffer (of at least 256 characters) where the PHP
+ * variable name (without the dollar sign) will be stored.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_getVarName(PyObject * pyKey, char * name) {
+	if (!PyString_Check(pyKey)) {
+		PyErr_SetString(PyExc_TypeError, "PHP variable names must be strings");
+		return false;
+	}
+	char * key = PyString_AS_STRING(pyKey);
+	// Ensure variable name (key) begins with a dollar sign ($).
+	if (key[0] != '$') {
+		PyErr_Format(PyExc_KeyError, "Invalid name: %s - PHP variables must begin with a dollar sign ($)", key);
+		return false;
+	}
+	// Strip the dollar sign.
+	size_t len = strlen(key)-1;
+	if (len > 255) {
+		PyErr_Format(PyExc_KeyError, "Invalid name length: (%lu) %s  - PHP variable name must not exceed 255 characters", len, key);
+		return false;
+	}
+	memcpy(name, &(key[1]), len);
+	name[len] = '\0';
+	return true;
+}
+
+/*******************************************************************************
+ * Releases a persistent zval created by pyphp_core_convert_pyObjectToZvalEx().
+ *
+ * The zval is only destroyed once its last reference is released. This is
+ * also the destructor of persistent PHP arrays.
+ *
+ * @param void* pData A reference to the persistent zval.
+ ******************************************************************************/
+void pyphp_core_persistent_zval_ptr_dtor(void * pData) {
+	zval * phpObj = *(zval **)pData;
+	if (Z_DELREF_P(phpObj) > 0) {
+		return;
+	}
+	switch (Z_TYPE_P(phpObj)) {
+		case IS_STRING:
+			pefree(Z_STRVAL_P(phpObj), 1);
+			break;
+		case IS_ARRAY:
+			zend_hash_destroy(Z_ARRVAL_P(phpObj));
+			pefree(Z_ARRVAL_P(phpObj), 1);
+			break;
+		default:
+			break;
+	}
+	pefree(phpObj, 1);
+}
+
+/*******************************************************************************
+ * Releases a persistent zval once the current request can no longer
+ * reference it.
+ *
+ * This is the destructor of tables of persistent zvals that get bound into
+ * requests (e.g., the persistent global variables).
+ *
+ * @param void* pData A reference to the persistent zval.
+ ******************************************************************************/
+void pyphp_core_persistent_zval_release(void * pData) {
+	if (!pyphp_core.isInit) {
+		pyphp_core_persistent_zval_ptr_dtor(pData);
+		return;
+	}
+	// The request may hold the last reference otherwise, and PHP would then try
+	// to efree() persistent memory.
+	if (pyphp_core.persistentGarbage.size == 0) {
+		zend_llist_init(&pyphp_core.persistentGarbage, sizeof(zval *), pyphp_core_persistent_zval_ptr_dtor, 1);
+	}
+	zend_llist_add_element(&pyphp_core.persistentGarbage, pData);
+}
+
+/*******************************************************************************
+ * Releases the persistent zvals that were waiting for the request to shutdown.
+ ******************************************************************************/
+void pyphp_core_persistent_collectGarbage(void) {
+	if (pyphp_core.persistentGarbage.size != 0) {
+		zend_llist_clean(&pyphp_core.persistentGarbage);
+	}
+}
+
+/*******************************************************************************
+ * Binds the variables of a table of persistent zvals into the current request.
+ *
+ * Each variable is bound by reference (copy-on-write), so binding costs the
+ * same no matter how large the value is.
+ *
+ * @param HashTable* vars The variables (name => persistent zval*).
+ ******************************************************************************/
+void pyphp_core_php_bindVars(HashTable * vars) {
+	TSRMLS_FETCH();
+	HashPosition pos;
+	zval ** value;
+	char * name;
+	uint nameLen;
+	ulong index;
+	for (zend_hash_internal_pointer_reset_ex(vars, &pos);
+	     zend_hash_get_current_data_ex(vars, (void **)&value, &pos) == SUCCESS;
+	     zend_hash_move_forward_ex(vars, &pos)) {
+		zend_hash_get_current_key_ex(vars, &name, &nameLen, &index, 0, &pos);
+		// The previous request's cycle collector buffer is gone, so forget any
+		// stale reference to it.
+		GC_ZVAL_INIT(*value);
+		// The extra reference makes PHP separate the value before writing to it.
+		Z_ADDREF_PP(value);
+		zend_hash_update(&EG(symbol_table), name, nameLen, value, sizeof(zval *), NULL);
+	}
+}
+
+/*******************************************************************************
+ * Sets a global PHP variable in the current request.
+ *
+ * @param char* name The name of the variable (without the dollar sign).
+ * @param zval* value The value (ownership is taken).
+ ******************************************************************************/
+void pyphp_core_php_setGlobalVar(char * name, zval * value) {
+	TSRMLS_FETCH();
+	ZEND_SET_GLOBAL_VAR(name, value);
+}
+
+/*******************************************************************************
+ * Sets a persistent global variable that is bound into every request.
+ *
+ * @param char* name The name of the variable (without the dollar sign).
+ * @param zval* value The persistent value (ownership is taken), or NULL to
+ * unset the variable.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_setPersistentVar(const char * name, zval * value) {
+	TSRMLS_FETCH();
+	const uint nameLen = strlen(name)+1;
+	pyphp_core.generation++;
+	
+	if (pyphp_core.persistentVars == NULL) {
+		if (value == NULL) {
+			return true;
+		}
+		pyphp_core.persistentVars = (HashTable *)pemalloc(sizeof(HashTable), 1);
+		zend_hash_init(pyphp_core.persistentVars, 8, NULL, pyphp_core_persistent_zval_release, 1);
+	}
+	
+	if (value == NULL) {
+		zend_hash_del(pyphp_core.persistentVars, name, nameLen);
+		return true;
+	}
+	if (zend_hash_update(pyphp_core.persistentVars, name, nameLen, &value, sizeof(value), NULL) == FAILURE) {
+		pyphp_core_persistent_zval_ptr_dtor(&value);
+		return false;
+	}
+	
+	// Bind the new value into the current request.
+	if (pyphp_core.isInit) {
+		GC_ZVAL_INIT(value);
+		Z_ADDREF_P(value);
+		zend_hash_update(&EG(symbol_table), name, nameLen, &value, sizeof(value), NULL);
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Binds the persistent global variables into the current request.
+ ******************************************************************************/
+void pyphp_core_php_bindPersistentVars(void) {
+	if (pyphp_core.persistentVars != NULL) {
+		pyphp_core_php_bindVars(pyphp_core.persistentVars);
+	}
+}
+
+/*******************************************************************************
+ * Applies the memory budget to the current request.
+ *
+ * NOTE: the budget overrides memory_limit as the Zend heap limit, so
+ * exceeding it is a fatal error like any other, which the error handler
+ * raises as pyphp.MemoryBudgetExceeded.
+ ******************************************************************************/
+void pyphp_core_php_applyMemoryBudget(void) {
+	TSRMLS_FETCH();
+	zend_set_memory_limit(pyphp_core.memoryBudget != 0 ? pyphp_core.memoryBudget : PG(memory_limit));
+}
+
+// The memory_limit modify handler that was installed before ours.
+static ZEND_INI_MH((* pyphp_core_phpOnChangeMemoryLimit));
+
+/*******************************************************************************
+ * The memory_limit modify handler.
+ *
+ * While a memory budget is set, memory_limit cannot be raised past it (or
+ * lifted with -1) at runtime, so a script cannot undo its budget with
+ * ini_set(). Lowering it still works.
+ ******************************************************************************/
+static ZEND_INI_MH(pyphp_core_php_onChangeMemoryLimit) {
+	if (stage == ZEND_INI_STAGE_RUNTIME && pyphp_core.memoryBudget != 0) {
+		long limit = zend_atol(new_value, new_value_length);
+		if (limit < 0 || (size_t)limit > pyphp_core.memoryBudget) {
+			return FAILURE;
+		}
+	}
+	return pyphp_core_phpOnChangeMemoryLimit(entry, new_value, new_value_length, mh_arg1, mh_arg2, mh_arg3, stage TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Overrides the memory_limit modify handler to enforce the memory budget.
+ *
+ * NOTE: the INI entries are registered again by every module startup, so
+ * this must be called after each one.
+ ******************************************************************************/
+static void pyphp_core_php_guardMemoryLimit(void) {
+	TSRMLS_FETCH();
+	zend_ini_entry * entry;
+	if (zend_hash_find(EG(ini_directives), "memory_limit", sizeof("memory_limit"), (void **)&entry) == SUCCESS && entry->on_modify != pyphp_core_php_onChangeMemoryLimit) {
+		pyphp_core_phpOnChangeMemoryLimit = entry->on_modify;
+		entry->on_modify = pyphp_core_php_onChangeMemoryLimit;
+	}
+}
+
+/*******************************************************************************
+ * Returns the resident set size of the process.
+ *
+ * @return size_t The size in bytes, or 0 if it can't be read.
+ ******************************************************************************/
+static size_t pyphp_core_getRss(void) {
+	// NOTE: /proc/self/statm stays open so that reading it after every run costs
+	// a single pread().
+	static int statm = -1;
+	if (statm < 0 && (statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC)) < 0) {
+		return 0;
+	}
+	char buffer[64];
+	ssize_t length = pread(statm, buffer, sizeof(buffer)-1, 0);
+	if (length <= 0) {
+		return 0;
+	}
+	buffer[length] = '\0';
+	// The fields are "size resident ..." in pages.
+	unsigned long pages;
+	if (sscanf(buffer, "%*lu %lu", &pages) != 1) {
+		return 0;
+	}
+	return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*******************************************************************************
+ * Shuts PHP down and starts it up again (with the same INI profile,
+ * extensions, persistent variables and memory budget).
+ *
+ * NOTE: this must only be called between runs.
+ *
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_recycle(void) {
+	pyphp_trace_emit(PYPHP_TRACE_RECYCLE, PYPHP_TRACE_BEGIN, pyphp_core.recycle.runs);
+	uint64_t start = pyphp_core_now();
+	pyphp_core_php_shutdown();
+	// NOTE: startup re-applies the INI profile and extensions, registers the
+	// Python functions and classes again, and binds the persistent variables.
+	bool isInit = pyphp_core_php_init(0, NULL);
+	pyphp_core.stats.recycles++;
+	pyphp_core.stats.recycleTime += pyphp_core_now() - start;
+	pyphp_trace_emit(PYPHP_TRACE_RECYCLE, PYPHP_TRACE_END, isInit);
+	return isInit;
+}
+
+/*******************************************************************************
+ * Recycles PHP if the recycling policy says it is due.
+ *
+ * @return bool On success (or if it wasn't due), true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_recycleIfDue(void) {
+	const struct pyphp_core_recycle_t * policy = &pyphp_core.recycle;
+	if (!pyphp_core.isInit || pyphp_core.executeDepth > 0) {
+		return true;
+	}
+	bool isDue = (policy->afterRuns != 0 && policy->runs >= policy->afterRuns);
+	if (!isDue && policy->maxHeap != 0) {
+		TSRMLS_FETCH();
+		isDue = (zend_memory_usage(1 TSRMLS_CC) > policy->maxHeap);
+	}
+	if (!isDue && policy->maxRss != 0) {
+		isDue = (pyphp_core_getRss() > policy->maxRss);
+	}
+	return isDue ? pyphp_core_php_recycle() : true;
+}
+
 /*******************************************************************************
  * The PHP error handler.
  *
@@ -186,6 +995,22 @@ bool pyphp_core_convert_pyObjectToZval(PyObject * pyObj, zval ** phpObj) {
 void pyphp_core_php_errorHandler(int type, const char * file, const unsigned int line, const char * format, va_list args) {
 	char * error;
 	bool isFatal = false;
+	pyphp_core.stats.errors++;
+	pyphp_trace_emit(PYPHP_TRACE_ERROR, PYPHP_TRACE_INSTANT, type);
+	
+	// Collected errors are recorded instead of displayed or logged, so they
+	// aren't formatted by the internal PHP error handler. Every other error
+	// takes PHP's normal path (error_get_last(), $php_errormsg, logging).
+	// - NOTE: the errors the internal PHP error handler bails out on still have
+	//   to reach it (and error_get_last() misses the others that are collected).
+	bool isCollected = pyphp_diagnostics_isCollected(type);
+	if (isCollected) {
+		pyphp_diagnostics_record(type, file, line, format, args);
+		if (!(type & PYPHP_CORE_BAILOUT_ERRORS)) {
+			return;
+		}
+	}
+	
 	switch (type) {
 		case E_ERROR:
 		case E_CORE_ERROR:
@@ -222,8 +1047,19 @@ void pyphp_core_php_errorHandler(int type, const char * file, const unsigned int
 			break;
 	}
 	
+	// If the error is the memory budget being exceeded, raise a distinct
+	// python exception.
+	//HACK: the Zend memory manager only reports an exhausted heap through this
+	// message: its heap (and the overflow state it keeps while reporting) is
+	// private to zend_alloc.c, and the heap usage cannot tell a single huge
+	// allocation past the limit from any other fatal error. PHP never
+	// translates the message and scripts cannot raise an E_ERROR, so only a
+	// change of the wording in Zend would break this.
+	if (type == E_ERROR && pyphp_core.memoryBudget != 0 && strncmp(format, "Allowed memory size of", sizeof("Allowed memory size of")-1) == 0) {
+		PyErr_Format(pyphp_memoryBudgetException, "PHP exceeded the memory budget of %zu bytes in %s on line %u", pyphp_core.memoryBudget, file, line);
+	}
 	// If the error is fatal, raise a python exception.
-	if (isFatal) {
+	else if (isFatal) {
 		// Copy args so that the args don't become corrupted when passed to the
 		// internal PHP error handler.
 		va_list vars;
@@ -250,8 +1086,12 @@ void pyphp_core_php_errorHandler(int type, const char * file, const unsigned int
 void pyphp_core_php_logHandler(char * message) {
 	// Call the PHP log handler python callback function if it's set.
 	if (pyphp_core.pyLogHandler) {
-		PyObject * pyArgs = Py_BuildValue("{s:s}:pyphp.pyphp_core_php_logHandler", "message", message);
-		PyObject * pyResult = PyEval_CallObject(pyphp_core.pyOutputHandler, pyArgs);
+		pyphp_core.stats.logCallbacks++;
+		PyObject * pyArgs = Py_BuildValue("(s)", message);
+		if (pyArgs == NULL) {
+			return;
+		}
+		PyObject * pyResult = PyEval_CallObject(pyphp_core.pyLogHandler, pyArgs);
 		Py_XDECREF(pyResult);
 		Py_DECREF(pyArgs);
 		pyResult = NULL;
@@ -266,46 +1106,392 @@ void pyphp_core_php_logHandler(char * message) {
 }
 
 /*******************************************************************************
- * The PHP output handler.
+ * Hands a chunk over to a capture: to its write() callable if it has one, or to
+ * its chunks.
  *
- * @param char* messsage The output message.
- * @return int The number of characters written.
+ * @param pyphp_core_capture_t* capture The capture.
+ * @param PyObject* pyChunk The chunk (ownership is taken).
+ * @return bool On success, true; otherwise, false with a python exception set.
  ******************************************************************************/
-int pyphp_core_php_outputHandler(const char * message, unsigned int length TSRMLS_DC) {
+static bool pyphp_core_capture_emit(pyphp_core_capture_t * capture, PyObject * pyChunk) {
+	if (pyChunk == NULL) {
+		return false;
+	}
+	int result;
+	if (capture->write != NULL) {
+		// NOTE: once write() raised (e.g., the client went away), the rest of
+		// the output is dropped.
+		PyObject * pyResult = (PyErr_Occurred() ? NULL : PyObject_CallFunctionObjArgs(capture->write, pyChunk, NULL));
+		result = (pyResult != NULL ? 0 : -1);
+		Py_XDECREF(pyResult);
+	} else {
+		result = PyList_Append(capture->chunks, pyChunk);
+	}
+	Py_DECREF(pyChunk);
+	return result == 0;
+}
+
+/*******************************************************************************
+ * Writes output to a capture.
+ *
+ * Small writes are gathered into chunks of PYPHP_CORE_CAPTURE_CHUNK bytes;
+ * large writes become chunks of their own.
+ *
+ * @param pyphp_core_capture_t* capture The capture.
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_capture_write(pyphp_core_capture_t * capture, const char * message, size_t length) {
+	if (capture->pending.length + length < PYPHP_CORE_CAPTURE_CHUNK) {
+		if (!pyphp_core_buffer_append(&capture->pending, message, length)) {
+			PyErr_NoMemory();
+			return false;
+		}
+		return true;
+	}
+	
+	// Keep the chunks in order, then hand the write over as a chunk as is.
+	if (!pyphp_core_capture_flush(capture)) {
+		return false;
+	}
+	return pyphp_core_capture_emit(capture, PyString_FromStringAndSize(message, length));
+}
+
+/*******************************************************************************
+ * Turns the pending output of a capture into a chunk.
+ *
+ * @param pyphp_core_capture_t* capture The capture.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_capture_flush(pyphp_core_capture_t * capture) {
+	if (capture->pending.length == 0) {
+		return true;
+	}
+	PyObject * pyChunk = PyString_FromStringAndSize(capture->pending.data, capture->pending.length);
+	capture->pending.length = 0;
+	return pyphp_core_capture_emit(capture, pyChunk);
+}
+
+/*******************************************************************************
+ * Writes output to wherever PHP output goes (the capture, the Python output
+ * handler, or the output stream), through the compressor if output is
+ * compressed.
+ *
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ ******************************************************************************/
+void pyphp_core_output_write(const char * message, size_t length) {
+	uint64_t start = pyphp_core_now();
+	pyphp_core.stats.writes++;
+	pyphp_core.stats.bytesWritten += length;
+	if (!pyphp_compress_isOn() || !pyphp_compress_write(message, length)) {
+		pyphp_core_output_send(message, length);
+	}
+	pyphp_core.runTimes.output += pyphp_core_now() - start;
+}
+
+/*******************************************************************************
+ * Sends output (compressed, if it is) on to the capture, the Python output
+ * handler, or the output stream.
+ *
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ ******************************************************************************/
+void pyphp_core_output_send(const char * message, size_t length) {
+	// Capture the output if a capture is set.
+	if (pyphp_core.capture) {
+		pyphp_core_capture_write(pyphp_core.capture, message, length);
+	}
 	// Call the PHP output handler python callback function if it's set.
-	if (pyphp_core.pyOutputHandler) {
-		PyObject * pyArgs = Py_BuildValue("{s:s}:pyphp.pyphp_core_php_outputHandler", "message", message);
-		PyObject * pyResult = PyEval_CallObject(pyphp_core.pyOutputHandler, pyArgs);
+	else if (pyphp_core.pyOutputHandler) {
+		pyphp_core.stats.outputCallbacks++;
+		PyObject * pyResult = PyObject_CallFunction(pyphp_core.pyOutputHandler, "s#", message, (int)length);
 		Py_XDECREF(pyResult);
-		Py_DECREF(pyArgs);
 		pyResult = NULL;
-		pyArgs = NULL;
-		return length;
 	}
-	
 	// Since no output handler was specified, send output message to the output
 	// stream (usually stdout).
-	fwrite(message, sizeof(char), length, pyphp_core.outputStream);
-	fflush(pyphp_core.outputStream);
+	else {
+		fwrite(message, sizeof(char), length, pyphp_core.outputStream);
+		fflush(pyphp_core.outputStream);
+	}
+}
+
+/*******************************************************************************
+ * The PHP output handler.
+ *
+ * @param char* messsage The output message.
+ * @return int The number of characters written.
+ ******************************************************************************/
+int pyphp_core_php_outputHandler(const char * message, unsigned int length TSRMLS_DC) {
+	pyphp_core_output_write(message, length);
 	return length;
 }
 
 /*******************************************************************************
  * The PHP output flush handler.
+ *
+ * A PHP flush() flushes the compressor and ends the current capture chunk.
  ******************************************************************************/
 void pyphp_core_php_outputFlushHandler(void * server_context) {
+	pyphp_trace_emit(PYPHP_TRACE_FLUSH, PYPHP_TRACE_INSTANT, 0);
+	pyphp_compress_flush();
+	if (pyphp_core.capture) {
+		pyphp_core_capture_flush(pyphp_core.capture);
+		return;
+	}
 	fflush(pyphp_core.outputStream);
 }
 
+/*******************************************************************************
+ * Initializes the PHP interpreter if it isn't already.
+ *
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_ensureInit(void) {
+	if (pyphp_core.isInit) {
+		return true;
+	}
+	if (!pyphp_core_php_init(0, NULL)) {
+		PyErr_SetString(pyphp_exception, "PHP failed to initialize!");
+		return false;
+	}
+	return true;
+}
+
+// A script mapped into memory.
+typedef struct pyphp_core_mapping_t {
+	void * map;
+	size_t size;
+} pyphp_core_mapping_t;
+
+/*******************************************************************************
+ * Unmaps a mapped script (the closer of mapped script file handles).
+ *
+ * @param void* handle The mapping (pyphp_core_mapping_t*).
+ ******************************************************************************/
+static void pyphp_core_php_unmapScript(void * handle TSRMLS_DC) {
+	pyphp_core_mapping_t * mapping = (pyphp_core_mapping_t *)handle;
+	munmap(mapping->map, mapping->size);
+	efree(mapping);
+}
+
+/*******************************************************************************
+ * Frees a copied script source (the closer of source file handles).
+ *
+ * @param void* handle The source.
+ ******************************************************************************/
+static void pyphp_core_php_freeSource(void * handle TSRMLS_DC) {
+	efree(handle);
+}
+
+/*******************************************************************************
+ * Initializes a mapped file handle that PHP scans in place.
+ *
+ * @param zend_file_handle* script The file handle to initialize.
+ * @param char* filename The filename of the script.
+ * @param char* source The source, followed by ZEND_MMAP_AHEAD NULs.
+ * @param size_t length The length of the source.
+ * @param void* handle What the closer is called with.
+ * @param zend_stream_closer_t closer Releases the source.
+ ******************************************************************************/
+static void pyphp_core_php_mapped(zend_file_handle * script, char * filename, char * source, size_t length, void * handle, zend_stream_closer_t closer) {
+	script->type = ZEND_HANDLE_MAPPED;
+	script->filename = filename;
+	script->opened_path = NULL;
+	script->free_filename = 0;
+	memset(&script->handle.stream, 0, sizeof(script->handle.stream));
+	script->handle.stream.handle = handle;
+	script->handle.stream.closer = closer;
+	script->handle.stream.mmap.buf = source;
+	script->handle.stream.mmap.len = length;
+}
+
+/*******************************************************************************
+ * Maps a script file into memory.
+ *
+ * The file is mapped over an anonymous reservation that's ZEND_MMAP_AHEAD
+ * bytes longer, so the scanner's NUL padding is always there, no matter how
+ * much room the file's last page has left.
+ *
+ * @param int fd The file descriptor of the script.
+ * @param size_t size The size of the script.
+ * @param pyphp_core_mapping_t* mapping Where the mapping will be stored.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_core_mapScript(int fd, size_t size, pyphp_core_mapping_t * mapping) {
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	mapping->size = (size + ZEND_MMAP_AHEAD + pageSize - 1) / pageSize * pageSize;
+	mapping->map = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping->map == MAP_FAILED) {
+		return false;
+	}
+	if (mmap(mapping->map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(mapping->map, mapping->size);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Opens a PHP script for execution.
+ *
+ * Scripts of at least PYPHP_CORE_MAP_MIN bytes are mapped into memory (and
+ * share the page cache between processes) instead of being read into a copy.
+ *
+ * @param zend_file_handle* script The file handle to initialize.
+ * @param char* filename The filename of the script.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_openScript(zend_file_handle * script, char * filename) {
+	TSRMLS_FETCH();
+	// Mounted scripts are compiled from memory.
+	pyphp_vfs_file_t * mounted = pyphp_vfs_find(filename, strlen(filename));
+	if (mounted != NULL) {
+		pyphp_vfs_php_open(script, filename, filename, mounted TSRMLS_CC);
+		return true;
+	}
+	
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size >= PYPHP_CORE_MAP_MIN) {
+		pyphp_core_mapping_t mapping;
+		if (pyphp_core_mapScript(fd, info.st_size, &mapping)) {
+			// NOTE: the mapping stays valid once the file is closed.
+			close(fd);
+			pyphp_core_mapping_t * handle = (pyphp_core_mapping_t *)emalloc(sizeof(mapping));
+			*handle = mapping;
+			pyphp_core_php_mapped(script, filename, (char *)mapping.map, info.st_size, handle, pyphp_core_php_unmapScript);
+			return true;
+		}
+	}
+	
+	FILE * file = fdopen(fd, "rb");
+	if (file == NULL) {
+		close(fd);
+		return false;
+	}
+	script->type = ZEND_HANDLE_FP;
+	script->filename = filename;
+	script->opened_path = NULL;
+	script->free_filename = 0;
+	script->handle.fp = file;
+	return true;
+}
+
+/*******************************************************************************
+ * Opens a PHP script source held in memory for execution.
+ *
+ * The source is copied once, since the scanner needs it to be followed by
+ * ZEND_MMAP_AHEAD NULs.
+ *
+ * @param zend_file_handle* script The file handle to initialize.
+ * @param char* filename The filename the script is reported as.
+ * @param char* source The source.
+ * @param size_t length The length of the source.
+ ******************************************************************************/
+void pyphp_core_php_openSource(zend_file_handle * script, char * filename, const char * source, size_t length) {
+	TSRMLS_FETCH();
+	char * copy = (char *)safe_emalloc(1, length, ZEND_MMAP_AHEAD);
+	memcpy(copy, source, length);
+	memset(copy + length, 0, ZEND_MMAP_AHEAD);
+	pyphp_core_php_mapped(script, filename, copy, length, copy, pyphp_core_php_freeSource);
+}
+
+/*******************************************************************************
+ * Executes a PHP script in the current request.
+ *
+ * @param zend_file_handle* script The script to execute. The handle is closed.
+ * @return int On success, SUCCESS (0); otherwise, FAILURE (1) if PHP bailed
+ * out.
+ ******************************************************************************/
+int pyphp_core_php_execute(zend_file_handle * script) {
+	TSRMLS_FETCH();
+	int result = SUCCESS;
+	uint64_t start = pyphp_core_now();
+	uint64_t compile = pyphp_core.runTimes.compile;
+	uint64_t output = pyphp_core.runTimes.output;
+	bool isSampled = pyphp_profile_php_begin();
+	pyphp_trace_emit(PYPHP_TRACE_EXECUTE, PYPHP_TRACE_BEGIN, 0);
+	pyphp_core.executeDepth++;
+	zend_try {
+		zend_execute_scripts(ZEND_REQUIRE TSRMLS_CC, NULL, 1, script);
+	} zend_catch {
+		result = FAILURE;
+	} zend_end_try();
+	pyphp_core.executeDepth--;
+	pyphp_trace_emit(PYPHP_TRACE_EXECUTE, PYPHP_TRACE_END, result);
+	pyphp_profile_php_end(isSampled);
+	pyphp_core.runTimes.execute += pyphp_core_now() - start - (pyphp_core.runTimes.compile - compile) - (pyphp_core.runTimes.output - output);
+	return result;
+}
+
+/*******************************************************************************
+ * The PHP compile file handler (times and counts compiling scripts,
+ * including loading them from the compiled script cache).
+ *
+ * @param zend_file_handle* handle The script.
+ * @param int type The include type.
+ * @return zend_op_array* On success, the compiled script; otherwise, NULL.
+ ******************************************************************************/
+static zend_op_array * pyphp_core_php_compileFile(zend_file_handle * handle, int type TSRMLS_DC) {
+	uint64_t start = pyphp_core_now();
+	uint64_t output = pyphp_core.runTimes.output;
+	pyphp_core.stats.compiles++;
+	pyphp_trace_emit(PYPHP_TRACE_COMPILE, PYPHP_TRACE_BEGIN, 0);
+	zend_op_array * opArray = pyphp_core_phpCompileFile(handle, type TSRMLS_CC);
+	pyphp_trace_emit(PYPHP_TRACE_COMPILE, PYPHP_TRACE_END, opArray != NULL);
+	pyphp_core.runTimes.compile += pyphp_core_now() - start - (pyphp_core.runTimes.output - output);
+	return opArray;
+}
+
 /*******************************************************************************
  * The PHP startup handler.
  *
  * @hack Stores and overrides the internal PHP error handler.
+ * @hack Appends the PyPHP INI defaults and profile to the embed INI entries.
  *
  * @param sapi_module_struct* sapi_module The SAPI module to startup.
  * @return int On success, SUCCESS (0); otherwise, FAILURE (1).
  ******************************************************************************/
 int pyphp_core_php_startup(sapi_module_struct * sapi_module) {
+	// Everything php_embed_init() did before calling us is SAPI startup
+	// (pyphp_core_php_init() stored when it started).
+	uint64_t start = pyphp_core_now();
+	pyphp_core.initTimes.sapi = start - pyphp_core.initTimes.sapi;
+	
+	//HACK: php_embed_init() has just set the embed INI entries. Append our
+	// defaults, the user profile and the extensions so that PHP parses them once
+	// at startup instead of us altering them after every request. Later entries
+	// win.
+	const char * embedIni = sapi_module->ini_entries ? sapi_module->ini_entries : "";
+	const char * profileIni = pyphp_core.iniProfile ? pyphp_core.iniProfile : "";
+	const char * extensionsIni = pyphp_core.extensions ? pyphp_core.extensions : "";
+	size_t embedLen = strlen(embedIni);
+	size_t defaultsLen = sizeof(PYPHP_CORE_INI_DEFAULTS)-1;
+	size_t profileLen = strlen(profileIni);
+	size_t extensionsLen = strlen(extensionsIni);
+	char * ini = (char *)malloc(embedLen + defaultsLen + profileLen + extensionsLen + 1);
+	if (ini == NULL) {
+		return FAILURE;
+	}
+	memcpy(ini, embedIni, embedLen);
+	memcpy(ini + embedLen, PYPHP_CORE_INI_DEFAULTS, defaultsLen);
+	memcpy(ini + embedLen + defaultsLen, profileIni, profileLen);
+	memcpy(ini + embedLen + defaultsLen + profileLen, extensionsIni, extensionsLen);
+	ini[embedLen + defaultsLen + profileLen + extensionsLen] = '\0';
+	// NOTE: php_embed_shutdown() free()s the INI entries.
+	free(sapi_module->ini_entries);
+	sapi_module->ini_entries = ini;
+	
+	// Only load the listed extensions by skipping php.ini and its scan
+	// directory.
+	sapi_module->php_ini_ignore = (pyphp_core.extensions != NULL);
+	
 	if (php_module_startup(sapi_module, NULL, 0) == FAILURE) {
 		return FAILURE;
 	}
@@ -314,5 +1500,33 @@ int pyphp_core_php_startup(sapi_module_struct * sapi_module) {
 	//HACK: Override the internal PHP error handler.
 	zend_error_cb = pyphp_core_php_errorHandler;
 	
+	// Keep scripts from raising memory_limit past the memory budget.
+	pyphp_core_php_guardMemoryLimit();
+	
+	// Build the super globals from the WSGI environ.
+	pyphp_request_php_startup();
+	
+	// Open mounted scripts from memory.
+	pyphp_vfs_php_startup();
+	
+	// Load compiled scripts from the cache directory.
+	pyphp_filecache_php_startup();
+	
+	// Register pyphp_cache_fragment().
+	pyphp_fragment_php_startup();
+	
+	// Register the python callables registered as PHP functions.
+	pyphp_function_php_startup();
+	
+	// Register the PythonObject class python objects are proxied by.
+	pyphp_object_php_startup();
+	
+	// Time compiling scripts.
+	// - NOTE: installed last so that the time spent in the other compile file
+	//   handlers is included.
+	pyphp_core_phpCompileFile = zend_compile_file;
+	zend_compile_file = pyphp_core_php_compileFile;
+	
+	pyphp_core.initTimes.module = pyphp_core_now() - start;
 	return SUCCESS;
 }
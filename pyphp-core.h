@@ -7,19 +7,186 @@
  * @version 0.4
  */
 
+#ifndef PYPHP_CORE_H
+#define PYPHP_CORE_H
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <Python.h>
 #include <sapi/embed/php_embed.h>
 
-// Needed by PHP embed.
+#include "pyphp-request.h"
+#include "pyphp-wsgi.h"
+#include "pyphp-vfs.h"
+#include "pyphp-filecache.h"
+#include "pyphp-fragment.h"
+#include "pyphp-function.h"
+#include "pyphp-object.h"
+#include "pyphp-escape.h"
+#include "pyphp-profile.h"
+#include "pyphp-trace.h"
+#include "pyphp-diagnostics.h"
+#include "pyphp-compress.h"
+
+// Needed by PHP embed (defined in pyphp-core.c).
 #ifdef ZTS
-void **** ptsrm_ls;
+extern void **** ptsrm_ls;
 #endif
 
-struct pyphp_core_t {
+// The INI settings PyPHP applies on top of the PHP embed defaults.
+// - NOTE: long arrays keep PHP from building $_SERVER just-in-time.
+#define PYPHP_CORE_INI_DEFAULTS \
+	"error_reporting=E_ALL\n" \
+	"register_long_arrays=0\n" \
+	"log_errors=1\n" \
+	"display_errors=1\n" \
+	"display_startup_errors=1\n"
+
+// The error types the internal PHP error handler bails out on.
+#define PYPHP_CORE_BAILOUT_ERRORS (E_ERROR | E_CORE_ERROR | E_COMPILE_ERROR | E_USER_ERROR | E_RECOVERABLE_ERROR | E_PARSE)
+
+// Options for converting Python values to PHP values.
+typedef struct pyphp_core_convert_t {
+	// Whether the zvals are allocated persistently (outside of the request heap)
+	// so that they survive pyphp_core_php_reset().
+	bool persistent;
+	// Where a structural hash of the converted value is accumulated, or NULL.
+	uint64_t * inputHash;
+	// Whether the value is only hashed (no zvals are created).
+	bool hashOnly;
+	// Whether strings are HTML escaped (except pyphp.Safe strings).
+	bool escape;
+} pyphp_core_convert_t;
+
+// The tags mixed into a structural hash ahead of each kind of value.
+enum pyphp_core_hashTag_t {
+	PYPHP_CORE_HASH_NONE = 1,
+	PYPHP_CORE_HASH_BOOL,
+	PYPHP_CORE_HASH_INT,
+	PYPHP_CORE_HASH_FLOAT,
+	PYPHP_CORE_HASH_STRING,
+	PYPHP_CORE_HASH_DICT,
+	PYPHP_CORE_HASH_SEQUENCE,
+	PYPHP_CORE_HASH_OTHER,
+	PYPHP_CORE_HASH_ESCAPED
+};
+
+// The XXH64 primes.
+#define PYPHP_CORE_PRIME64_1 11400714785074694791ULL
+#define PYPHP_CORE_PRIME64_2 14029467366897019727ULL
+#define PYPHP_CORE_PRIME64_3 1609587929392839161ULL
+#define PYPHP_CORE_PRIME64_4 9650029242287828579ULL
+#define PYPHP_CORE_PRIME64_5 2870177450012600261ULL
+
+// The size of the chunks captured output is split into.
+#define PYPHP_CORE_CAPTURE_CHUNK 8192
+
+// The size from which script files are mapped into memory instead of read.
+#define PYPHP_CORE_MAP_MIN 65536
+
+// A growable byte buffer.
+typedef struct pyphp_core_buffer_t {
+	char * data;
+	size_t length;
+	size_t size;
+} pyphp_core_buffer_t;
+
+// Captured output: a list of string chunks fed straight from the output
+// handler, so output never goes through a Python call per write.
+typedef struct pyphp_core_capture_t {
+	// The captured chunks (a PyList of PyStrings).
+	PyObject * chunks;
+	// The callable each chunk is passed to instead as soon as it's made (the
+	// write() of a WSGI response), or NULL.
+	PyObject * write;
+	// The output not yet turned into a chunk.
+	pyphp_core_buffer_t pending;
+} pyphp_core_capture_t;
+
+extern struct pyphp_core_t {
 	bool isInit;
+	// Counts PHP startups and request startups, so that lookups cached in
+	// persistent memory can tell when what they point at was destroyed (user
+	// functions and classes only live as long as their request).
+	ulong startups;
+	ulong requests;
+	// The user INI profile ("name=value\n" lines) applied at startup.
+	char * iniProfile;
+	// The only shared extensions ("extension=name\n" lines) loaded at startup,
+	// or NULL to load the extensions from php.ini.
+	char * extensions;
+	// How long (in nanoseconds) each phase of the last startup took.
+	struct pyphp_core_initTimes_t {
+		uint64_t sapi;
+		uint64_t module;
+		uint64_t request;
+	} initTimes;
+	// How long (in nanoseconds) each phase of the current run has taken so far
+	// (runTimes), and of the last run (lastRunTimes). A run ends when PHP is
+	// reset. Execute excludes the time spent compiling and writing output, and
+	// reset excludes the output flushed while shutting the request down.
+	struct pyphp_core_runTimes_t {
+		uint64_t marshal;
+		uint64_t compile;
+		uint64_t execute;
+		uint64_t output;
+		uint64_t reset;
+	} runTimes, lastRunTimes;
+	// The Zend heap usage (in bytes) of the current run (runMemory) and of the
+	// last run (lastRunMemory): the bytes the converted input variables took,
+	// and the peak and current usage when the run ended.
+	struct pyphp_core_runMemory_t {
+		size_t input;
+		size_t peak;
+		size_t usage;
+	} runMemory, lastRunMemory;
+	// The Zend heap limit (in bytes) of each run, or 0 to use memory_limit.
+	size_t memoryBudget;
+	// The recycling policy: PHP is shut down and started up again when a run
+	// ends once it has served afterRuns runs, or once the resident set size or
+	// the Zend heap has grown past maxRss or maxHeap bytes (0 disables each
+	// limit).
+	struct pyphp_core_recycle_t {
+		uint64_t afterRuns;
+		size_t maxRss;
+		size_t maxHeap;
+		// The runs since the last startup.
+		uint64_t runs;
+	} recycle;
+	// The depth of the scripts (and inline scripts and PHP functions called
+	// from Python) being executed (PHP is never recycled while one calls back
+	// into Python that runs another).
+	int executeDepth;
+	// Cumulative statistics since startup or pyphp.resetStats(). The phase
+	// times of a run are added when it ends.
+	struct pyphp_core_stats_t {
+		struct pyphp_core_runTimes_t times;
+		// The largest peak heap usage of a run.
+		size_t peakMemory;
+		uint64_t runs;
+		uint64_t compiles;
+		uint64_t errors;
+		// Writes through ub_write, the bytes written, and the bytes they were
+		// compressed into.
+		uint64_t writes;
+		uint64_t bytesWritten;
+		uint64_t bytesCompressed;
+		// Calls of the Python callbacks.
+		uint64_t outputCallbacks;
+		uint64_t logCallbacks;
+		uint64_t functionCallbacks;
+		// Recycles of PHP, and how long (in nanoseconds) they took.
+		uint64_t recycles;
+		uint64_t recycleTime;
+		// Diagnostics recorded, and dropped (sampled out or over the limit).
+		uint64_t diagnostics;
+		uint64_t diagnosticsDropped;
+	} stats;
 	// Output streams.
 	FILE * logStream;
 	FILE * errorStream;
@@ -28,10 +195,139 @@ struct pyphp_core_t {
 	PyObject * pyErrorHandler;
 	PyObject * pyLogHandler;
 	PyObject * pyOutputHandler;
+	// The capture the output is written to instead, or NULL.
+	pyphp_core_capture_t * capture;
+	// Persistent global variables (name => persistent zval*) bound into every
+	// request, or NULL if none were set.
+	HashTable * persistentVars;
+	// Bumped whenever state the output of a script depends on besides its
+	// variables changes (persistent variables, INI settings, the request,
+	// registered functions), so that the render cache never serves output
+	// made with the state before.
+	uint64_t generation;
+	// Persistent zvals (zval*) released while the current request may still
+	// reference them; they are released after the request shuts down.
+	zend_llist persistentGarbage;
 	// Internal PHP (zend) error function.
 	void (* phpInternalErrorHandler)(int type, const char * file, const uint line, const char * format, va_list args) ZEND_ATTRIBUTE_PTR_FORMAT(printf, 4, 0);
 } pyphp_core;
 
+/*******************************************************************************
+ * Returns the current time of the monotonic clock.
+ *
+ * @return uint64_t The time in nanoseconds.
+ ******************************************************************************/
+static inline uint64_t pyphp_core_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * Rotates a 64-bit value left.
+ ******************************************************************************/
+static inline uint64_t pyphp_core_rotl64(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+/*******************************************************************************
+ * Mixes a 64-bit value into a hash (an XXH64 round).
+ *
+ * @param uint64_t* hash The hash.
+ * @param uint64_t value The value.
+ ******************************************************************************/
+static inline void pyphp_core_hash_mix(uint64_t * hash, uint64_t value) {
+	uint64_t round = pyphp_core_rotl64(value * PYPHP_CORE_PRIME64_2, 31) * PYPHP_CORE_PRIME64_1;
+	*hash = pyphp_core_rotl64(*hash ^ round, 27) * PYPHP_CORE_PRIME64_1 + PYPHP_CORE_PRIME64_4;
+}
+
+/*******************************************************************************
+ * Hashes bytes (XXH64).
+ *
+ * @param void* data The bytes.
+ * @param size_t length The number of bytes.
+ * @param uint64_t seed The seed.
+ * @return uint64_t The hash.
+ ******************************************************************************/
+uint64_t pyphp_core_hash_bytes(const void * data, size_t length, uint64_t seed);
+
+/*******************************************************************************
+ * Appends bytes to a buffer.
+ *
+ * @param pyphp_core_buffer_t* buffer The buffer.
+ * @param char* data The bytes to append.
+ * @param size_t length The number of bytes to append.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static inline bool pyphp_core_buffer_append(pyphp_core_buffer_t * buffer, const char * data, size_t length) {
+	if (buffer->length + length > buffer->size) {
+		size_t size = buffer->size ? buffer->size : 256;
+		while (size < buffer->length + length) {
+			size *= 2;
+		}
+		char * grown = (char *)realloc(buffer->data, size);
+		if (grown == NULL) {
+			return false;
+		}
+		buffer->data = grown;
+		buffer->size = size;
+	}
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	return true;
+}
+
+/*******************************************************************************
+ * Frees a buffer's memory.
+ *
+ * @param pyphp_core_buffer_t* buffer The buffer.
+ ******************************************************************************/
+static inline void pyphp_core_buffer_free(pyphp_core_buffer_t * buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->length = 0;
+	buffer->size = 0;
+}
+
+/*******************************************************************************
+ * Writes output to a capture.
+ *
+ * Small writes are gathered into chunks of PYPHP_CORE_CAPTURE_CHUNK bytes;
+ * large writes become chunks of their own.
+ *
+ * @param pyphp_core_capture_t* capture The capture.
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_capture_write(pyphp_core_capture_t * capture, const char * message, size_t length);
+
+/*******************************************************************************
+ * Turns the pending output of a capture into a chunk.
+ *
+ * @param pyphp_core_capture_t* capture The capture.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_capture_flush(pyphp_core_capture_t * capture);
+
+/*******************************************************************************
+ * Writes output to wherever PHP output goes (the capture, the Python output
+ * handler, or the output stream).
+ *
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ ******************************************************************************/
+void pyphp_core_output_write(const char * message, size_t length);
+
+/*******************************************************************************
+ * Sends output (compressed, if it is) on to the capture, the Python output
+ * handler, or the output stream.
+ *
+ * @param char* message The output.
+ * @param size_t length The length of the output.
+ ******************************************************************************/
+void pyphp_core_output_send(const char * message, size_t length);
+
 /*******************************************************************************
  * Converts a Python value (PyObject) to a PHP value (zval).
  *
@@ -42,6 +338,162 @@ struct pyphp_core_t {
  ******************************************************************************/
 bool pyphp_core_convert_pyObjectToZval(PyObject * pyObj, zval ** phpObj);
 
+/*******************************************************************************
+ * Converts a Python value (PyObject) to a PHP value (zval) with options.
+ *
+ * @param PyObject* pyObj The python object to convert.
+ * @param zval** phpObj A reference to a zval where the converted zval will be
+ * stored.
+ * @param pyphp_core_convert_t* options The conversion options.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_convert_pyObjectToZvalEx(PyObject * pyObj, zval ** phpObj, const pyphp_core_convert_t * options);
+
+/*******************************************************************************
+ * Converts a PHP value (zval) to a Python value (PyObject).
+ *
+ * @param zval* phpObj The PHP value.
+ * @return PyObject* On success, a new reference to the python value;
+ * otherwise, NULL with a python exception set.
+ ******************************************************************************/
+PyObject * pyphp_core_convert_zvalToPyObject(zval * phpObj);
+
+/*******************************************************************************
+ * Throws a PHP exception for the current python exception, and clears it.
+ *
+ * @param char* context What raised it (e.g., the name of a PHP function).
+ ******************************************************************************/
+void pyphp_core_php_throwPyErr(const char * context TSRMLS_DC);
+
+/*******************************************************************************
+ * Gets the PHP variable name from a Python variable name.
+ *
+ * @param PyObject* pyKey The Python variable name (a string beginning with a
+ * dollar sign).
+ * @param char* name The buffer (of at least 256 characters) where the PHP
+ * variable name (without the dollar sign) will be stored.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_getVarName(PyObject * pyKey, char * name);
+
+/*******************************************************************************
+ * Releases a persistent zval created by pyphp_core_convert_pyObjectToZvalEx().
+ *
+ * The zval is only destroyed once its last reference is released. This is
+ * also the destructor of persistent PHP arrays.
+ *
+ * @param void* pData A reference to the persistent zval.
+ ******************************************************************************/
+void pyphp_core_persistent_zval_ptr_dtor(void * pData);
+
+/*******************************************************************************
+ * Releases a persistent zval once the current request can no longer
+ * reference it.
+ *
+ * This is the destructor of tables of persistent zvals that get bound into
+ * requests (e.g., the persistent global variables).
+ *
+ * @param void* pData A reference to the persistent zval.
+ ******************************************************************************/
+void pyphp_core_persistent_zval_release(void * pData);
+
+/*******************************************************************************
+ * Releases the persistent zvals that were waiting for the request to shutdown.
+ ******************************************************************************/
+void pyphp_core_persistent_collectGarbage(void);
+
+/*******************************************************************************
+ * Binds the variables of a table of persistent zvals into the current request.
+ *
+ * Each variable is bound by reference (copy-on-write), so binding costs the
+ * same no matter how large the value is.
+ *
+ * @param HashTable* vars The variables (name => persistent zval*).
+ ******************************************************************************/
+void pyphp_core_php_bindVars(HashTable * vars);
+
+/*******************************************************************************
+ * Sets a global PHP variable in the current request.
+ *
+ * @param char* name The name of the variable (without the dollar sign).
+ * @param zval* value The value (ownership is taken).
+ ******************************************************************************/
+void pyphp_core_php_setGlobalVar(char * name, zval * value);
+
+/*******************************************************************************
+ * Sets a persistent global variable that is bound into every request.
+ *
+ * @param char* name The name of the variable (without the dollar sign).
+ * @param zval* value The persistent value (ownership is taken), or NULL to
+ * unset the variable.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_setPersistentVar(const char * name, zval * value);
+
+/*******************************************************************************
+ * Binds the persistent global variables into the current request.
+ *
+ * Each variable is bound by reference (copy-on-write), so binding costs the
+ * same no matter how large the value is.
+ ******************************************************************************/
+void pyphp_core_php_bindPersistentVars(void);
+
+/*******************************************************************************
+ * Applies the memory budget to the current request.
+ ******************************************************************************/
+void pyphp_core_php_applyMemoryBudget(void);
+
+/*******************************************************************************
+ * Shuts PHP down and starts it up again (with the same INI profile,
+ * extensions, persistent variables and memory budget).
+ *
+ * NOTE: this must only be called between runs.
+ *
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_recycle(void);
+
+/*******************************************************************************
+ * Recycles PHP if the recycling policy says it is due.
+ *
+ * @return bool On success (or if it wasn't due), true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_recycleIfDue(void);
+
+// The start of a conversion of input variables.
+typedef struct pyphp_core_marshal_t {
+	uint64_t start;
+	size_t usage;
+} pyphp_core_marshal_t;
+
+/*******************************************************************************
+ * Starts timing and measuring a conversion of input variables.
+ *
+ * @param pyphp_core_marshal_t* marshal Where the start is stored.
+ ******************************************************************************/
+static inline void pyphp_core_marshal_start(pyphp_core_marshal_t * marshal) {
+	TSRMLS_FETCH();
+	pyphp_trace_emit(PYPHP_TRACE_MARSHAL, PYPHP_TRACE_BEGIN, 0);
+	marshal->start = pyphp_core_now();
+	marshal->usage = zend_memory_usage(0 TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Adds the time and heap usage of a conversion of input variables to the
+ * current run.
+ *
+ * @param pyphp_core_marshal_t* marshal The start.
+ ******************************************************************************/
+static inline void pyphp_core_marshal_end(const pyphp_core_marshal_t * marshal) {
+	TSRMLS_FETCH();
+	size_t usage = zend_memory_usage(0 TSRMLS_CC);
+	if (usage > marshal->usage) {
+		pyphp_core.runMemory.input += usage - marshal->usage;
+	}
+	pyphp_core.runTimes.marshal += pyphp_core_now() - marshal->start;
+	pyphp_trace_emit(PYPHP_TRACE_MARSHAL, PYPHP_TRACE_END, usage > marshal->usage ? usage - marshal->usage : 0);
+}
+
 /*******************************************************************************
  * The PHP error handler.
  *
@@ -73,10 +525,52 @@ int pyphp_core_php_outputHandler(const char * message, unsigned int length TSRML
  ******************************************************************************/
 void pyphp_core_php_outputFlushHandler(void * server_context);
 
+/*******************************************************************************
+ * Initializes the PHP interpreter if it isn't already.
+ *
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_core_ensureInit(void);
+
+/*******************************************************************************
+ * Opens a PHP script for execution.
+ *
+ * Scripts of at least PYPHP_CORE_MAP_MIN bytes are mapped into memory (and
+ * share the page cache between processes) instead of being read into a copy.
+ *
+ * @param zend_file_handle* script The file handle to initialize.
+ * @param char* filename The filename of the script.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_core_php_openScript(zend_file_handle * script, char * filename);
+
+/*******************************************************************************
+ * Opens a PHP script source held in memory for execution.
+ *
+ * The source is copied once, since the scanner needs it to be followed by
+ * ZEND_MMAP_AHEAD NULs.
+ *
+ * @param zend_file_handle* script The file handle to initialize.
+ * @param char* filename The filename the script is reported as.
+ * @param char* source The source.
+ * @param size_t length The length of the source.
+ ******************************************************************************/
+void pyphp_core_php_openSource(zend_file_handle * script, char * filename, const char * source, size_t length);
+
+/*******************************************************************************
+ * Executes a PHP script in the current request.
+ *
+ * @param zend_file_handle* script The script to execute. The handle is closed.
+ * @return int On success, SUCCESS (0); otherwise, FAILURE (1) if PHP bailed
+ * out.
+ ******************************************************************************/
+int pyphp_core_php_execute(zend_file_handle * script);
+
 /*******************************************************************************
  * The PHP startup handler.
  *
  * @hack Stores and overrides the internal PHP error handler.
+ * @hack Appends the PyPHP INI defaults and profile to the embed INI entries.
  *
  * @param sapi_module_struct* sapi_module The SAPI module to startup.
  * @return int On success, SUCCESS (0); otherwise, FAILURE (1).
@@ -101,19 +595,65 @@ static inline void pyphp_core_php_shutdown() {
 	}
 	pyphp_core.isInit = false;
 	php_embed_shutdown();
+	pyphp_compress_end();
+	pyphp_core_persistent_collectGarbage();
+	pyphp_request_reset();
 }
 
 /*******************************************************************************
- * Sets-up the PHP INI settings.
+ * Sets a PHP INI setting for the current request only.
+ *
+ * The setting is rolled back by PHP itself when the request is shutdown (see
+ * pyphp_core_php_reset()), so only the overridden entries cost anything.
+ *
+ * @param char* name The name of the INI setting.
+ * @param char* value The value of the INI setting.
+ * @return bool On success, true; otherwise, false.
  ******************************************************************************/
-static inline void pyphp_core_php_setup_ini(void) {
-	char allErrors[12];
-	snprintf(allErrors, sizeof(allErrors)-1, "%u", E_ALL);
-	
-	zend_alter_ini_entry("error_reporting", sizeof("error_reporting"), allErrors, strlen(allErrors), PHP_INI_SYSTEM, PHP_INI_STAGE_RUNTIME);
-	zend_alter_ini_entry("log_errors", sizeof("log_errors"), "1", 1, PHP_INI_SYSTEM, PHP_INI_STAGE_RUNTIME);
-	zend_alter_ini_entry("display_errors", sizeof("display_errors"), "1", 1, PHP_INI_SYSTEM, PHP_INI_STAGE_RUNTIME);
-	zend_alter_ini_entry("display_startup_errors", sizeof("display_startup_errors"), "1", 1, PHP_INI_SYSTEM, PHP_INI_STAGE_RUNTIME);
+static inline bool pyphp_core_php_setIni(char * name, char * value) {
+	pyphp_core.generation++;
+	return zend_alter_ini_entry(name, strlen(name)+1, value, strlen(value), PHP_INI_SYSTEM, PHP_INI_STAGE_RUNTIME) == SUCCESS;
+}
+
+/*******************************************************************************
+ * Sets the INI profile applied once when the PHP interpreter starts up.
+ *
+ * The profile only takes effect the next time the interpreter is initialized.
+ *
+ * @param char* iniProfile The INI profile ("name=value\n" lines), or NULL to
+ * clear it. The profile is copied.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static inline bool pyphp_core_setIniProfile(const char * iniProfile) {
+	char * copy = NULL;
+	if (iniProfile != NULL && (copy = strdup(iniProfile)) == NULL) {
+		return false;
+	}
+	pyphp_core.generation++;
+	free(pyphp_core.iniProfile);
+	pyphp_core.iniProfile = copy;
+	return true;
+}
+
+/*******************************************************************************
+ * Sets the only shared extensions loaded when the PHP interpreter starts up.
+ *
+ * When set, the system php.ini and its scan directory are ignored so that
+ * nothing else is loaded. The extensions only take effect the next time the
+ * interpreter is initialized.
+ *
+ * @param char* extensions The extensions ("extension=name\n" lines), or NULL
+ * to load the extensions from php.ini. The extensions are copied.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static inline bool pyphp_core_setExtensions(const char * extensions) {
+	char * copy = NULL;
+	if (extensions != NULL && (copy = strdup(extensions)) == NULL) {
+		return false;
+	}
+	free(pyphp_core.extensions);
+	pyphp_core.extensions = copy;
+	return true;
 }
 
 /*******************************************************************************
@@ -144,15 +684,30 @@ static inline bool pyphp_core_php_init(int argc, char ** argv) {
 	// Override PHP embed startup handler.
 	php_embed_module.startup = pyphp_core_php_startup;
 	
+	// Override PHP embed server variables handler (builds $_SERVER).
+	php_embed_module.register_server_variables = pyphp_request_php_registerServerVariables;
+	
+	// Override PHP embed send headers handler (passes headers to WSGI).
+	php_embed_module.send_headers = pyphp_wsgi_php_sendHeaders;
+	
 	// Initialize PHP.
+	// - NOTE: the startup handler times the SAPI and module startup phases;
+	//   whatever remains is the startup of the first request.
+	memset(&pyphp_core.initTimes, 0, sizeof(pyphp_core.initTimes));
+	uint64_t start = pyphp_core_now();
+	pyphp_core.initTimes.sapi = start;
 	if (php_embed_init(argc, argv PTSRMLS_CC) == FAILURE) {
 		printf("%s:%u Failed to initialize PHP!\n", __FUNCTION__, __LINE__);
 		return false;
 	}
+	pyphp_core.initTimes.request = pyphp_core_now() - start - pyphp_core.initTimes.sapi - pyphp_core.initTimes.module;
+	pyphp_core.startups++;
+	pyphp_core.requests++;
+	pyphp_core.recycle.runs = 0;
 	//EG(bailout_set) = 0;
 	
-	// Setup INI.
-	pyphp_core_php_setup_ini();
+	pyphp_core_php_bindPersistentVars();
+	pyphp_core_php_applyMemoryBudget();
 	
 	return true;
 }
@@ -163,16 +718,48 @@ static inline bool pyphp_core_php_init(int argc, char ** argv) {
  * @return bool On success, true; otherwise, false.
  ******************************************************************************/
 static inline bool pyphp_core_php_reset(void) {
+	pyphp_trace_emit(PYPHP_TRACE_RESET, PYPHP_TRACE_BEGIN, 0);
+	uint64_t start = pyphp_core_now();
+	uint64_t output = pyphp_core.runTimes.output;
+	pyphp_core.runMemory.peak = zend_memory_peak_usage(0 TSRMLS_CC);
+	pyphp_core.runMemory.usage = zend_memory_usage(0 TSRMLS_CC);
 	php_request_shutdown(NULL);
+	// NOTE: shutting the request down flushed the output buffers, so the
+	// compressed output is complete.
+	pyphp_compress_end();
+	pyphp_core_persistent_collectGarbage();
+	pyphp_request_reset();
 	if (php_request_startup(TSRMLS_C) == FAILURE) {
 		printf("%s:%u Failed to re-startup the PHP!\n", __FUNCTION__, __LINE__);
+		pyphp_trace_emit(PYPHP_TRACE_RESET, PYPHP_TRACE_END, 0);
 		return false;
 	}
+	pyphp_core.requests++;
 	
-	// Setup INI.
-	pyphp_core_php_setup_ini();
+	pyphp_core_php_bindPersistentVars();
+	pyphp_core_php_applyMemoryBudget();
 	
-	return true;
+	// The run ends here.
+	pyphp_core.runTimes.reset += pyphp_core_now() - start - (pyphp_core.runTimes.output - output);
+	pyphp_core.lastRunTimes = pyphp_core.runTimes;
+	pyphp_core.stats.times.marshal += pyphp_core.runTimes.marshal;
+	pyphp_core.stats.times.compile += pyphp_core.runTimes.compile;
+	pyphp_core.stats.times.execute += pyphp_core.runTimes.execute;
+	pyphp_core.stats.times.output += pyphp_core.runTimes.output;
+	pyphp_core.stats.times.reset += pyphp_core.runTimes.reset;
+	pyphp_core.stats.runs++;
+	if (pyphp_core.runMemory.peak > pyphp_core.stats.peakMemory) {
+		pyphp_core.stats.peakMemory = pyphp_core.runMemory.peak;
+	}
+	pyphp_core.lastRunMemory = pyphp_core.runMemory;
+	pyphp_diagnostics_endRun();
+	memset(&pyphp_core.runTimes, 0, sizeof(pyphp_core.runTimes));
+	memset(&pyphp_core.runMemory, 0, sizeof(pyphp_core.runMemory));
+	pyphp_trace_emit(PYPHP_TRACE_RESET, PYPHP_TRACE_END, pyphp_core.lastRunMemory.peak);
+	
+	// Between runs is the only safe point to recycle PHP.
+	pyphp_core.recycle.runs++;
+	return pyphp_core_php_recycleIfDue();
 }
  
 /*******************************************************************************
@@ -207,3 +794,5 @@ static inline void pyphp_core_setOutputHandler(PyObject * pyOutputHandler) {
 	Py_XINCREF(pyOutputHandler);
 	pyphp_core.pyOutputHandler = pyOutputHandler;
 }
+
+#endif
@@ -0,0 +1,293 @@
+/**
+ * pyphp-diagnostics.c provides structured diagnostics.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-diagnostics.h"
+
+// The longest message recorded (longer messages are truncated).
+#define PYPHP_DIAGNOSTICS_MAX_MESSAGE 1024
+
+// The diagnostics.
+struct pyphp_diagnostics_t pyphp_diagnostics;
+
+/*******************************************************************************
+ * Adds the error type constants (pyphp.E_ERROR, etc.) to the module.
+ *
+ * @param PyObject* module The pyphp module.
+ ******************************************************************************/
+void pyphp_diagnostics_init(PyObject * module) {
+	PyModule_AddIntConstant(module, "E_ERROR", E_ERROR);
+	PyModule_AddIntConstant(module, "E_WARNING", E_WARNING);
+	PyModule_AddIntConstant(module, "E_PARSE", E_PARSE);
+	PyModule_AddIntConstant(module, "E_NOTICE", E_NOTICE);
+	PyModule_AddIntConstant(module, "E_CORE_ERROR", E_CORE_ERROR);
+	PyModule_AddIntConstant(module, "E_CORE_WARNING", E_CORE_WARNING);
+	PyModule_AddIntConstant(module, "E_COMPILE_ERROR", E_COMPILE_ERROR);
+	PyModule_AddIntConstant(module, "E_COMPILE_WARNING", E_COMPILE_WARNING);
+	PyModule_AddIntConstant(module, "E_USER_ERROR", E_USER_ERROR);
+	PyModule_AddIntConstant(module, "E_USER_WARNING", E_USER_WARNING);
+	PyModule_AddIntConstant(module, "E_USER_NOTICE", E_USER_NOTICE);
+	PyModule_AddIntConstant(module, "E_STRICT", E_STRICT);
+	PyModule_AddIntConstant(module, "E_RECOVERABLE_ERROR", E_RECOVERABLE_ERROR);
+	PyModule_AddIntConstant(module, "E_DEPRECATED", E_DEPRECATED);
+	PyModule_AddIntConstant(module, "E_USER_DEPRECATED", E_USER_DEPRECATED);
+	PyModule_AddIntConstant(module, "E_ALL", E_ALL | E_STRICT);
+}
+
+/*******************************************************************************
+ * Gets the index of an error type.
+ *
+ * @param int type The error type.
+ * @return int The index, or -1 if the type isn't a single known type.
+ ******************************************************************************/
+static inline int pyphp_diagnostics_index(int type) {
+	if (type <= 0 || (type & (type - 1)) != 0) {
+		return -1;
+	}
+	int index = __builtin_ctz((unsigned int)type);
+	return index < PYPHP_DIAGNOSTICS_TYPES ? index : -1;
+}
+
+/*******************************************************************************
+ * Makes room for strings in a run.
+ *
+ * @param pyphp_diagnostics_run_t* run The run.
+ * @param size_t length The number of bytes needed.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_diagnostics_reserve(pyphp_diagnostics_run_t * run, size_t length) {
+	if (run->stringsLength + length <= run->stringsSize) {
+		return true;
+	}
+	size_t size = run->stringsSize ? run->stringsSize : 4096;
+	while (size < run->stringsLength + length) {
+		size *= 2;
+	}
+	char * grown = (char *)realloc(run->strings, size);
+	if (grown == NULL) {
+		return false;
+	}
+	run->strings = grown;
+	run->stringsSize = size;
+	return true;
+}
+
+/*******************************************************************************
+ * Records a collected error, unless it is sampled out or over the limit.
+ *
+ * @param int type The error type.
+ * @param char* file The PHP file the error occured in.
+ * @param uint line The line the error occured on.
+ * @param char* format The format of the message.
+ * @param va_list args The arguments of the format.
+ * @return bool Whether the error was recorded.
+ ******************************************************************************/
+bool pyphp_diagnostics_record(int type, const char * file, unsigned int line, const char * format, va_list args) {
+	pyphp_diagnostics_run_t * run = &pyphp_diagnostics.run;
+	pyphp_diagnostics.isDirty = true;
+	
+	// Sample and rate limit before anything is formatted.
+	int index = pyphp_diagnostics_index(type);
+	if (index >= 0) {
+		uint32_t seen = run->seen[index]++;
+		uint32_t sample = pyphp_diagnostics.sample[index];
+		uint32_t limit = pyphp_diagnostics.limit[index];
+		if ((sample > 1 && seen % sample != 0) || (limit != 0 && run->recorded[index] >= limit)) {
+			pyphp_core.stats.diagnosticsDropped++;
+			return false;
+		}
+	}
+	
+	if (file == NULL) {
+		file = "";
+	}
+	size_t fileLength = strlen(file) + 1;
+	if (run->count == run->size) {
+		size_t size = run->size ? run->size * 2 : 64;
+		pyphp_diagnostics_record_t * grown = (pyphp_diagnostics_record_t *)realloc(run->records, size * sizeof(pyphp_diagnostics_record_t));
+		if (grown == NULL) {
+			pyphp_core.stats.diagnosticsDropped++;
+			return false;
+		}
+		run->records = grown;
+		run->size = size;
+	}
+	if (!pyphp_diagnostics_reserve(run, fileLength + PYPHP_DIAGNOSTICS_MAX_MESSAGE + 1)) {
+		pyphp_core.stats.diagnosticsDropped++;
+		return false;
+	}
+	
+	pyphp_diagnostics_record_t * record = &run->records[run->count++];
+	record->type = type;
+	record->line = line;
+	record->file = run->stringsLength;
+	memcpy(run->strings + run->stringsLength, file, fileLength);
+	run->stringsLength += fileLength;
+	
+	// Copy args so that the args don't become corrupted when passed to the
+	// internal PHP error handler.
+	// - NOTE: PHP's own vsnprintf() understands PHP's format extensions, and
+	//   unlike vspprintf() doesn't allocate from a heap that may be exhausted.
+	va_list vars;
+	va_copy(vars, args);
+	int length = ap_php_vsnprintf(run->strings + run->stringsLength, PYPHP_DIAGNOSTICS_MAX_MESSAGE + 1, format, vars);
+	va_end(vars);
+	if (length < 0) {
+		length = 0;
+		run->strings[run->stringsLength] = '\0';
+	} else if (length > PYPHP_DIAGNOSTICS_MAX_MESSAGE) {
+		length = PYPHP_DIAGNOSTICS_MAX_MESSAGE;
+	}
+	record->message = run->stringsLength;
+	run->stringsLength += length + 1;
+	
+	if (index >= 0) {
+		run->recorded[index]++;
+	}
+	pyphp_core.stats.diagnostics++;
+	return true;
+}
+
+/*******************************************************************************
+ * Ends the run: its records become the records of the last run.
+ ******************************************************************************/
+void pyphp_diagnostics_endRun(void) {
+	if (!pyphp_diagnostics.isDirty && pyphp_diagnostics.lastRun.count == 0) {
+		return;
+	}
+	// NOTE: the memory of the last run is reused by the next run.
+	pyphp_diagnostics_run_t last = pyphp_diagnostics.lastRun;
+	pyphp_diagnostics.lastRun = pyphp_diagnostics.run;
+	pyphp_diagnostics.run = last;
+	pyphp_diagnostics.run.count = 0;
+	pyphp_diagnostics.run.stringsLength = 0;
+	memset(pyphp_diagnostics.run.seen, 0, sizeof(pyphp_diagnostics.run.seen));
+	memset(pyphp_diagnostics.run.recorded, 0, sizeof(pyphp_diagnostics.run.recorded));
+	pyphp_diagnostics.isDirty = false;
+}
+
+/*******************************************************************************
+ * Parses a sampling or rate limiting setting.
+ *
+ * @param PyObject* pySetting Of each type (a dict of type => N), or of all
+ * types (an int), or NULL (or None) for 0.
+ * @param uint32_t* values Where the N of each type are stored.
+ * @param char* name The name of the setting.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+static bool pyphp_diagnostics_parseSetting(PyObject * pySetting, uint32_t * values, const char * name) {
+	memset(values, 0, sizeof(uint32_t) * PYPHP_DIAGNOSTICS_TYPES);
+	if (pySetting == NULL || pySetting == Py_None) {
+		return true;
+	}
+	if (PyInt_Check(pySetting) || PyLong_Check(pySetting)) {
+		long value = PyInt_AsLong(pySetting);
+		if (value < 0 || value > UINT32_MAX) {
+			if (!PyErr_Occurred()) {
+				PyErr_Format(PyExc_ValueError, "%s must be between 0 and %u", name, UINT32_MAX);
+			}
+			return false;
+		}
+		for (int i = 0; i < PYPHP_DIAGNOSTICS_TYPES; i++) {
+			values[i] = (uint32_t)value;
+		}
+		return true;
+	}
+	if (!PyDict_Check(pySetting)) {
+		PyErr_Format(PyExc_TypeError, "%s must be an int or a dict of error type => int", name);
+		return false;
+	}
+	
+	Py_ssize_t pos = 0;
+	PyObject * pyType;
+	PyObject * pyValue;
+	while (PyDict_Next(pySetting, &pos, &pyType, &pyValue)) {
+		long type = PyInt_AsLong(pyType);
+		long value = PyInt_AsLong(pyValue);
+		if (PyErr_Occurred()) {
+			return false;
+		}
+		int index = pyphp_diagnostics_index((int)type);
+		if (index < 0 || type > INT_MAX) {
+			PyErr_Format(PyExc_ValueError, "%s has an unknown error type: %ld", name, type);
+			return false;
+		}
+		if (value < 0 || value > UINT32_MAX) {
+			PyErr_Format(PyExc_ValueError, "%s must be between 0 and %u", name, UINT32_MAX);
+			return false;
+		}
+		values[index] = (uint32_t)value;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Sets which error levels are collected, and how each type is sampled and
+ * rate limited.
+ *
+ * @param int levels The error levels (0 disables diagnostics).
+ * @param PyObject* pySample Of each type (a dict of type => N), or of all
+ * types (an int), record every Nth error, or NULL to record all.
+ * @param PyObject* pyLimit Of each type (a dict of type => N), or of all types
+ * (an int), record at most N errors per run, or NULL for no limit.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_diagnostics_setPolicy(int levels, PyObject * pySample, PyObject * pyLimit) {
+	uint32_t sample[PYPHP_DIAGNOSTICS_TYPES];
+	uint32_t limit[PYPHP_DIAGNOSTICS_TYPES];
+	if (!pyphp_diagnostics_parseSetting(pySample, sample, "sample") || !pyphp_diagnostics_parseSetting(pyLimit, limit, "limit")) {
+		return false;
+	}
+	pyphp_diagnostics.levels = levels;
+	memcpy(pyphp_diagnostics.sample, sample, sizeof(sample));
+	memcpy(pyphp_diagnostics.limit, limit, sizeof(limit));
+	return true;
+}
+
+/*******************************************************************************
+ * Returns the records of the last run.
+ *
+ * @return PyObject* On success, a list of (type, file, line, message) tuples;
+ * otherwise, NULL with a python exception set.
+ ******************************************************************************/
+PyObject * pyphp_diagnostics_get(void) {
+	const pyphp_diagnostics_run_t * run = &pyphp_diagnostics.lastRun;
+	PyObject * pyRecords = PyList_New((Py_ssize_t)run->count);
+	if (pyRecords == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < run->count; i++) {
+		const pyphp_diagnostics_record_t * record = &run->records[i];
+		PyObject * pyRecord = Py_BuildValue("(isIs)",
+			record->type,
+			run->strings + record->file,
+			record->line,
+			run->strings + record->message
+		);
+		if (pyRecord == NULL) {
+			Py_DECREF(pyRecords);
+			return NULL;
+		}
+		// NOTE: PyList_SET_ITEM() steals the reference.
+		PyList_SET_ITEM(pyRecords, (Py_ssize_t)i, pyRecord);
+	}
+	return pyRecords;
+}
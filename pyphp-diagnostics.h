@@ -0,0 +1,131 @@
+/**
+ * pyphp-diagnostics.h provides structured diagnostics: the PHP errors of a run
+ * collected as (type, file, line, message) records, which Python reads once
+ * the run ended (pyphp.diagnostics(), or pyphp.render(..., diagnostics=True)).
+ *
+ * Only the error levels enabled with pyphp.setDiagnostics() are collected, and
+ * collected errors are no longer displayed or logged by PHP. Each type can be
+ * sampled (only every Nth error is recorded) and rate limited (at most N
+ * records per run); the errors sampled out or over the limit are counted but
+ * never formatted.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_DIAGNOSTICS_H
+#define PYPHP_DIAGNOSTICS_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Python.h>
+
+// The number of error types (E_ERROR is bit 0, E_USER_DEPRECATED bit 14).
+#define PYPHP_DIAGNOSTICS_TYPES 15
+
+/**
+ * A record.
+ */
+typedef struct pyphp_diagnostics_record_t {
+	int type;
+	unsigned int line;
+	// The offsets of the file and message (NUL terminated) in the strings of
+	// the run.
+	size_t file;
+	size_t message;
+} pyphp_diagnostics_record_t;
+
+/**
+ * The records of a run.
+ */
+typedef struct pyphp_diagnostics_run_t {
+	pyphp_diagnostics_record_t * records;
+	size_t count;
+	size_t size;
+	// The files and messages of the records.
+	char * strings;
+	size_t stringsLength;
+	size_t stringsSize;
+	// The errors of each type the run raised, and recorded.
+	uint32_t seen[PYPHP_DIAGNOSTICS_TYPES];
+	uint32_t recorded[PYPHP_DIAGNOSTICS_TYPES];
+} pyphp_diagnostics_run_t;
+
+/**
+ * The diagnostics.
+ */
+extern struct pyphp_diagnostics_t {
+	// The error levels collected (0 while diagnostics are disabled).
+	int levels;
+	// Of each type, record every Nth error (0 and 1 record all), and at most N
+	// records per run (0 for no limit).
+	uint32_t sample[PYPHP_DIAGNOSTICS_TYPES];
+	uint32_t limit[PYPHP_DIAGNOSTICS_TYPES];
+	// The records of the current run and of the last run.
+	pyphp_diagnostics_run_t run, lastRun;
+	// Whether the current run raised any error that was collected.
+	bool isDirty;
+} pyphp_diagnostics;
+
+/**
+ * Adds the error type constants (pyphp.E_ERROR, etc.) to the module.
+ *
+ * @param PyObject* module The pyphp module.
+ */
+void pyphp_diagnostics_init(PyObject * module);
+
+/**
+ * Checks whether an error type is collected.
+ *
+ * @param int type The error type.
+ * @return bool Whether it is collected.
+ */
+static inline bool pyphp_diagnostics_isCollected(int type) {
+	return (pyphp_diagnostics.levels & type) != 0;
+}
+
+/**
+ * Records a collected error, unless it is sampled out or over the limit.
+ *
+ * @param int type The error type.
+ * @param char* file The PHP file the error occured in.
+ * @param uint line The line the error occured on.
+ * @param char* format The format of the message.
+ * @param va_list args The arguments of the format.
+ * @return bool Whether the error was recorded.
+ */
+bool pyphp_diagnostics_record(int type, const char * file, unsigned int line, const char * format, va_list args);
+
+/**
+ * Ends the run: its records become the records of the last run.
+ */
+void pyphp_diagnostics_endRun(void);
+
+/**
+ * Sets which error levels are collected, and how each type is sampled and
+ * rate limited.
+ *
+ * @param int levels The error levels (0 disables diagnostics).
+ * @param PyObject* pySample Of each type (a dict of type => N), or of all
+ * types (an int), record every Nth error, or NULL to record all.
+ * @param PyObject* pyLimit Of each type (a dict of type => N), or of all types
+ * (an int), record at most N errors per run, or NULL for no limit.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_diagnostics_setPolicy(int levels, PyObject * pySample, PyObject * pyLimit);
+
+/**
+ * Returns the records of the last run.
+ *
+ * @return PyObject* On success, a list of (type, file, line, message) tuples;
+ * otherwise, NULL with a python exception set.
+ */
+PyObject * pyphp_diagnostics_get(void);
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * pyphp-escape.c provides HTML escaping of strings.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <Python.h>
+
+#include "pyphp-escape.h"
+
+// The pyphp.Safe type.
+PyObject * pyphp_escape_safeType = NULL;
+
+/*******************************************************************************
+ * Gets the entity a character is escaped as.
+ *
+ * @param char c The character.
+ * @param size_t* length Where the length of the entity is stored.
+ * @return char* If the character is escaped, the entity; otherwise, NULL.
+ ******************************************************************************/
+static inline const char * pyphp_escape_entity(char c, size_t * length) {
+	switch (c) {
+		case '&': *length = 5; return "&amp;";
+		case '<': *length = 4; return "&lt;";
+		case '>': *length = 4; return "&gt;";
+		case '"': *length = 6; return "&quot;";
+		case '\'': *length = 6; return "&#039;";
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ * Finds the next character that is escaped.
+ *
+ * @param char* source The string.
+ * @param size_t start Where to start looking.
+ * @param size_t length The length of the string.
+ * @return size_t The index of the character, or the length if there is none.
+ ******************************************************************************/
+static inline size_t pyphp_escape_scan(const char * source, size_t start, size_t length) {
+	size_t i = start;
+#ifdef __SSE2__
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i quot = _mm_set1_epi8('"');
+	const __m128i apos = _mm_set1_epi8('\'');
+	for (; i + 16 <= length; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(source + i));
+		__m128i found = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, quot)), _mm_cmpeq_epi8(chunk, apos))
+		);
+		int mask = _mm_movemask_epi8(found);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	size_t entityLen;
+	for (; i < length; i++) {
+		if (pyphp_escape_entity(source[i], &entityLen) != NULL) {
+			return i;
+		}
+	}
+	return length;
+}
+
+/*******************************************************************************
+ * Counts how many bytes escaping a string adds.
+ *
+ * @param char* source The string.
+ * @param size_t length The length of the string.
+ * @return size_t The number of bytes added (0 if nothing needs escaping).
+ ******************************************************************************/
+size_t pyphp_escape_growth(const char * source, size_t length) {
+	size_t growth = 0;
+	size_t entityLen;
+	size_t i = pyphp_escape_scan(source, 0, length);
+	while (i < length) {
+		pyphp_escape_entity(source[i], &entityLen);
+		growth += entityLen - 1;
+		i = pyphp_escape_scan(source, i + 1, length);
+	}
+	return growth;
+}
+
+/*******************************************************************************
+ * Escapes a string.
+ *
+ * @param char* source The string.
+ * @param size_t length The length of the string.
+ * @param char* dest The buffer where the escaped string is written.
+ * @return size_t The length of the escaped string.
+ ******************************************************************************/
+size_t pyphp_escape_html(const char * source, size_t length, char * dest) {
+	char * out = dest;
+	size_t entityLen;
+	size_t start = 0;
+	while (start < length) {
+		size_t i = pyphp_escape_scan(source, start, length);
+		memcpy(out, source + start, i - start);
+		out += i - start;
+		if (i == length) {
+			break;
+		}
+		const char * entity = pyphp_escape_entity(source[i], &entityLen);
+		memcpy(out, entity, entityLen);
+		out += entityLen;
+		start = i + 1;
+	}
+	return out - dest;
+}
+
+/*******************************************************************************
+ * Creates the pyphp.Safe type and adds it to the module (also as pyphp.Raw).
+ *
+ * @param PyObject* module The pyphp module.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_escape_init(PyObject * module) {
+	PyObject * pyDict = Py_BuildValue("{s:s,s:s}",
+		"__module__", "pyphp",
+		"__doc__", "A string of safe HTML: it is never escaped when converted to a PHP value."
+	);
+	if (pyDict == NULL) {
+		return false;
+	}
+	pyphp_escape_safeType = PyObject_CallFunction((PyObject *)&PyType_Type, "s(O)O", "Safe", &PyString_Type, pyDict);
+	Py_DECREF(pyDict);
+	if (pyphp_escape_safeType == NULL) {
+		return false;
+	}
+	// NOTE: PyModule_AddObject() steals a reference.
+	Py_INCREF(pyphp_escape_safeType);
+	PyModule_AddObject(module, "Safe", pyphp_escape_safeType);
+	Py_INCREF(pyphp_escape_safeType);
+	PyModule_AddObject(module, "Raw", pyphp_escape_safeType);
+	return true;
+}
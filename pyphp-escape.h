@@ -0,0 +1,68 @@
+/**
+ * pyphp-escape.h provides HTML escaping of strings while they are converted to
+ * PHP values (pyphp.setVar(..., escape=True)), and the pyphp.Safe marker for
+ * strings that are already safe HTML.
+ *
+ * Escaping matches htmlspecialchars($value, ENT_QUOTES): & < > " and ' are
+ * replaced by entities. Strings are scanned 16 bytes at a time with SSE2 where
+ * available.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_ESCAPE_H
+#define PYPHP_ESCAPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <Python.h>
+
+/**
+ * The pyphp.Safe type (a str subclass), or NULL before pyphp_escape_init().
+ */
+extern PyObject * pyphp_escape_safeType;
+
+/**
+ * Creates the pyphp.Safe type and adds it to the module (also as pyphp.Raw).
+ *
+ * @param PyObject* module The pyphp module.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_escape_init(PyObject * module);
+
+/**
+ * Checks whether a string is marked as safe HTML (an instance of pyphp.Safe).
+ *
+ * @param PyObject* pyObj The string.
+ * @return bool Whether the string is safe.
+ */
+static inline bool pyphp_escape_isSafe(PyObject * pyObj) {
+	return pyphp_escape_safeType != NULL && PyObject_TypeCheck(pyObj, (PyTypeObject *)pyphp_escape_safeType);
+}
+
+/**
+ * Counts how many bytes escaping a string adds.
+ *
+ * @param char* source The string.
+ * @param size_t length The length of the string.
+ * @return size_t The number of bytes added (0 if nothing needs escaping).
+ */
+size_t pyphp_escape_growth(const char * source, size_t length);
+
+/**
+ * Escapes a string.
+ *
+ * @param char* source The string.
+ * @param size_t length The length of the string.
+ * @param char* dest The buffer (of at least length plus the growth bytes)
+ * where the escaped string is written (not NUL terminated).
+ * @return size_t The length of the escaped string.
+ */
+size_t pyphp_escape_html(const char * source, size_t length, char * dest);
+
+#endif
@@ -0,0 +1,646 @@
+/**
+ * pyphp-filecache.c implements the on-disk cache of compiled PHP scripts.
+ *
+ * A cache file holds a header (format, PHP build, source path, modification
+ * time and size) followed by the op_array, its opcodes, their string
+ * constants, the compiled variables, and the break/continue and try/catch
+ * tables. Pointers are stored as offsets (jump targets as opline numbers) and
+ * the opcode handlers are looked up again when the script is loaded.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h> // for PATH_MAX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+#include <zend_extensions.h>
+
+#include "pyphp-core.h"
+#include "pyphp-vfs.h"
+#include "pyphp-filecache.h"
+
+// Identifies the PHP build a cache file was written by (op_array layouts and
+// opcodes differ between builds).
+#define PYPHP_FILECACHE_BUILD_ID PHP_VERSION "," ZEND_EXTENSION_BUILD_ID
+
+// The magic bytes every cache file begins with.
+#define PYPHP_FILECACHE_MAGIC "PYPHPOPC"
+
+// The cache file header.
+typedef struct pyphp_filecache_header_t {
+	char magic[8];
+	uint32_t format;
+	uint32_t opSize;
+	char buildId[64];
+	int64_t mtime;
+	int64_t size;
+	uint32_t pathLen;
+	uint32_t filenameLen;
+} pyphp_filecache_header_t;
+
+// The cache counters.
+pyphp_filecache_stats_t pyphp_filecache_stats;
+
+// The versioned cache directory, or NULL if the cache is disabled.
+static char * pyphp_filecache_directory = NULL;
+
+// The PHP compile file handler being overridden.
+static zend_op_array * (* pyphp_filecache_phpCompileFile)(zend_file_handle * handle, int type TSRMLS_DC) = NULL;
+
+/*******************************************************************************
+ * Sets the cache directory.
+ *
+ * Cache files go in a subdirectory named after the PHP build, so that a new
+ * build never loads the files of another.
+ *
+ * @param char* directory The directory, or NULL to disable the cache.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_filecache_setDirectory(const char * directory) {
+	free(pyphp_filecache_directory);
+	pyphp_filecache_directory = NULL;
+	if (directory == NULL) {
+		return true;
+	}
+	
+	char versioned[PATH_MAX];
+	ulong build = zend_inline_hash_func(PYPHP_FILECACHE_BUILD_ID, sizeof(PYPHP_FILECACHE_BUILD_ID));
+	int length = snprintf(versioned, sizeof(versioned), "%s/%d-%lx", directory, PYPHP_FILECACHE_FORMAT, build);
+	if (length < 0 || length >= (int)sizeof(versioned)) {
+		PyErr_Format(PyExc_ValueError, "Invalid directory: %s - the path is too long", directory);
+		return false;
+	}
+	if ((mkdir(directory, 0755) != 0 && errno != EEXIST) || (mkdir(versioned, 0755) != 0 && errno != EEXIST)) {
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, versioned);
+		return false;
+	}
+	if ((pyphp_filecache_directory = strdup(versioned)) == NULL) {
+		PyErr_NoMemory();
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Gets the cache file of a script.
+ *
+ * @param char* path The absolute path of the script.
+ * @param char* cacheFile Where the cache filename (PATH_MAX bytes) will be
+ * stored.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_filecache_cacheFile(const char * path, char * cacheFile) {
+	ulong hash = zend_inline_hash_func(path, strlen(path)+1);
+	int length = snprintf(cacheFile, PATH_MAX, "%s/%lx.opc", pyphp_filecache_directory, hash);
+	return length > 0 && length < PATH_MAX;
+}
+
+/*******************************************************************************
+ * Checks whether an opcode jumps with op1 or op2.
+ *
+ * @param zend_op* op The opcode.
+ * @return znode* The operand holding the jump target, or NULL.
+ ******************************************************************************/
+static znode * pyphp_filecache_jumpOperand(zend_op * op) {
+	switch (op->opcode) {
+		case ZEND_JMP:
+		// NOTE: a goto out of a loop or switch stays a goto.
+		case ZEND_GOTO:
+			return &op->op1;
+		case ZEND_JMPZ:
+		case ZEND_JMPNZ:
+		case ZEND_JMPZ_EX:
+		case ZEND_JMPNZ_EX:
+#ifdef ZEND_JMP_SET
+		case ZEND_JMP_SET:
+#endif
+			return &op->op2;
+		default:
+			return NULL;
+	}
+}
+
+/*******************************************************************************
+ * Checks whether an operand that isn't translated still points into the
+ * opcodes (the jump of an opcode pyphp_filecache_jumpOperand() doesn't know).
+ *
+ * @param znode* operand The operand.
+ * @param zend_op_array* opArray The compiled script.
+ * @return bool Whether the operand holds a jump address.
+ ******************************************************************************/
+static bool pyphp_filecache_isJumpAddress(znode * operand, zend_op_array * opArray) {
+	if (operand->op_type != IS_UNUSED) {
+		return false;
+	}
+	return operand->u.jmp_addr >= opArray->opcodes && operand->u.jmp_addr < opArray->opcodes + opArray->last;
+}
+
+/*******************************************************************************
+ * Checks whether an opcode fetches a super global by name (e.g., $_SERVER),
+ * which only the compiler makes sure is built (zend_is_auto_global()).
+ *
+ * @param zend_op* op The opcode.
+ * @return bool Whether op1 names an auto global.
+ ******************************************************************************/
+static bool pyphp_filecache_fetchesGlobal(zend_op * op) {
+	switch (op->opcode) {
+		case ZEND_FETCH_R:
+		case ZEND_FETCH_W:
+		case ZEND_FETCH_RW:
+		case ZEND_FETCH_IS:
+		case ZEND_FETCH_FUNC_ARG:
+		case ZEND_FETCH_UNSET:
+		case ZEND_UNSET_VAR:
+		case ZEND_ISSET_ISEMPTY_VAR:
+			return op->op1.op_type == IS_CONST
+			    && Z_TYPE(op->op1.u.constant) == IS_STRING
+			    && op->op2.u.EA.type == ZEND_FETCH_GLOBAL;
+		default:
+			return false;
+	}
+}
+
+/*******************************************************************************
+ * Checks whether a constant operand can be cached.
+ *
+ * @param znode* operand The operand.
+ * @return bool Whether the operand is not a constant, or a scalar or string
+ * one.
+ ******************************************************************************/
+static bool pyphp_filecache_isCacheable(znode * operand) {
+	if (operand->op_type != IS_CONST) {
+		return true;
+	}
+	switch (Z_TYPE(operand->u.constant) & IS_CONSTANT_TYPE_MASK) {
+		case IS_NULL:
+		case IS_BOOL:
+		case IS_LONG:
+		case IS_DOUBLE:
+		case IS_STRING:
+		case IS_CONSTANT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*******************************************************************************
+ * Checks whether a constant operand has a string value.
+ *
+ * @param znode* operand The operand.
+ * @return bool Whether the operand is a string (or named) constant.
+ ******************************************************************************/
+static inline bool pyphp_filecache_hasString(znode * operand) {
+	if (operand->op_type != IS_CONST) {
+		return false;
+	}
+	int type = Z_TYPE(operand->u.constant) & IS_CONSTANT_TYPE_MASK;
+	return type == IS_STRING || type == IS_CONSTANT;
+}
+
+/*******************************************************************************
+ * Appends a length-prefixed string to a buffer.
+ *
+ * @param pyphp_core_buffer_t* buffer The buffer.
+ * @param char* string The string.
+ * @param uint32_t length The length of the string.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_filecache_appendString(pyphp_core_buffer_t * buffer, const char * string, uint32_t length) {
+	return pyphp_core_buffer_append(buffer, (const char *)&length, sizeof(length))
+	    && pyphp_core_buffer_append(buffer, string, length);
+}
+
+/*******************************************************************************
+ * Serializes a compiled script.
+ *
+ * @param zend_op_array* opArray The compiled script.
+ * @param pyphp_filecache_header_t* header The header.
+ * @param char* path The absolute path of the script.
+ * @param pyphp_core_buffer_t* buffer The buffer to serialize into.
+ * @return bool If the script could be serialized, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_filecache_serialize(zend_op_array * opArray, pyphp_filecache_header_t * header, const char * path, pyphp_core_buffer_t * buffer) {
+	// Only the main op_array of a script is cached.
+	if (opArray->function_name || opArray->static_variables || opArray->arg_info) {
+		return false;
+	}
+	for (zend_uint i = 0; i < opArray->last; i++) {
+		if (!pyphp_filecache_isCacheable(&opArray->opcodes[i].op1) || !pyphp_filecache_isCacheable(&opArray->opcodes[i].op2)) {
+			return false;
+		}
+	}
+	
+	if (!pyphp_core_buffer_append(buffer, (const char *)header, sizeof(*header))
+	    || !pyphp_core_buffer_append(buffer, path, header->pathLen)
+	    || !pyphp_core_buffer_append(buffer, opArray->filename, header->filenameLen)
+	    || !pyphp_core_buffer_append(buffer, (const char *)opArray, sizeof(*opArray))) {
+		return false;
+	}
+	
+	// The opcodes, with jump targets as opline numbers.
+	// - NOTE: an address that isn't translated would be dereferenced by
+	//   another process, so such a script isn't cached.
+	for (zend_uint i = 0; i < opArray->last; i++) {
+		zend_op op = opArray->opcodes[i];
+		znode * jump = pyphp_filecache_jumpOperand(&op);
+		if ((jump != &op.op1 && pyphp_filecache_isJumpAddress(&op.op1, opArray))
+		    || (jump != &op.op2 && pyphp_filecache_isJumpAddress(&op.op2, opArray))) {
+			return false;
+		}
+		if (jump != NULL) {
+			jump->u.opline_num = jump->u.jmp_addr - opArray->opcodes;
+		}
+		if (!pyphp_core_buffer_append(buffer, (const char *)&op, sizeof(op))) {
+			return false;
+		}
+	}
+	
+	// The string constants, in the order of the opcodes.
+	for (zend_uint i = 0; i < opArray->last; i++) {
+		zend_op * op = &opArray->opcodes[i];
+		if (pyphp_filecache_hasString(&op->op1) && !pyphp_filecache_appendString(buffer, Z_STRVAL(op->op1.u.constant), Z_STRLEN(op->op1.u.constant))) {
+			return false;
+		}
+		if (pyphp_filecache_hasString(&op->op2) && !pyphp_filecache_appendString(buffer, Z_STRVAL(op->op2.u.constant), Z_STRLEN(op->op2.u.constant))) {
+			return false;
+		}
+	}
+	
+	for (int i = 0; i < opArray->last_var; i++) {
+		if (!pyphp_filecache_appendString(buffer, opArray->vars[i].name, opArray->vars[i].name_len)) {
+			return false;
+		}
+	}
+	
+	return pyphp_core_buffer_append(buffer, (const char *)opArray->brk_cont_array, sizeof(zend_brk_cont_element) * opArray->last_brk_cont)
+	    && pyphp_core_buffer_append(buffer, (const char *)opArray->try_catch_array, sizeof(zend_try_catch_element) * opArray->last_try_catch);
+}
+
+/*******************************************************************************
+ * Writes a compiled script to the cache.
+ *
+ * The file is written under a temporary name and renamed into place, so that
+ * other processes never load a partial file.
+ *
+ * @param zend_op_array* opArray The compiled script.
+ * @param char* path The absolute path of the script.
+ * @param struct stat* info The script file's status.
+ ******************************************************************************/
+static void pyphp_filecache_store(zend_op_array * opArray, const char * path, struct stat * info) {
+	pyphp_filecache_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PYPHP_FILECACHE_MAGIC, sizeof(header.magic));
+	header.format = PYPHP_FILECACHE_FORMAT;
+	header.opSize = sizeof(zend_op);
+	strncpy(header.buildId, PYPHP_FILECACHE_BUILD_ID, sizeof(header.buildId)-1);
+	header.mtime = info->st_mtime;
+	header.size = info->st_size;
+	header.pathLen = strlen(path);
+	header.filenameLen = strlen(opArray->filename);
+	
+	pyphp_core_buffer_t buffer = {NULL, 0, 0};
+	if (!pyphp_filecache_serialize(opArray, &header, path, &buffer)) {
+		pyphp_filecache_stats.rejects++;
+		pyphp_core_buffer_free(&buffer);
+		return;
+	}
+	
+	char cacheFile[PATH_MAX];
+	char tempFile[PATH_MAX];
+	if (pyphp_filecache_cacheFile(path, cacheFile) && snprintf(tempFile, sizeof(tempFile), "%s.%d", cacheFile, (int)getpid()) < (int)sizeof(tempFile)) {
+		FILE * file = fopen(tempFile, "wb");
+		if (file != NULL) {
+			bool isWritten = fwrite(buffer.data, 1, buffer.length, file) == buffer.length;
+			isWritten = (fclose(file) == 0) && isWritten;
+			if (isWritten && rename(tempFile, cacheFile) == 0) {
+				pyphp_filecache_stats.stores++;
+			} else {
+				unlink(tempFile);
+			}
+		}
+	}
+	pyphp_core_buffer_free(&buffer);
+}
+
+/*******************************************************************************
+ * Reads the next part of a mapped cache file.
+ *
+ * @param char** cursor The read position (advanced past the part).
+ * @param char* end The end of the file.
+ * @param size_t length The length of the part.
+ * @return char* On success, the part; otherwise, NULL if the file is
+ * truncated.
+ ******************************************************************************/
+static inline const char * pyphp_filecache_read(const char ** cursor, const char * end, size_t length) {
+	if ((size_t)(end - *cursor) < length) {
+		return NULL;
+	}
+	const char * part = *cursor;
+	*cursor += length;
+	return part;
+}
+
+/*******************************************************************************
+ * Reads the next length-prefixed string of a mapped cache file.
+ *
+ * @param char** cursor The read position (advanced past the string).
+ * @param char* end The end of the file.
+ * @param uint32_t* length Where the length of the string will be stored.
+ * @return char* On success, the string (not NUL terminated); otherwise, NULL
+ * if the file is truncated.
+ ******************************************************************************/
+static const char * pyphp_filecache_readString(const char ** cursor, const char * end, uint32_t * length) {
+	const char * prefix = pyphp_filecache_read(cursor, end, sizeof(*length));
+	if (prefix == NULL) {
+		return NULL;
+	}
+	memcpy(length, prefix, sizeof(*length));
+	return pyphp_filecache_read(cursor, end, *length);
+}
+
+/*******************************************************************************
+ * Deserializes a compiled script from a mapped cache file.
+ *
+ * Everything is copied into request memory laid out just like the compiler
+ * would have, so PHP destroys the op_array as usual.
+ *
+ * @param char* data The cache file.
+ * @param size_t length The length of the cache file.
+ * @param char* path The absolute path of the script.
+ * @param struct stat* info The script file's status.
+ * @return zend_op_array* On success, the compiled script; otherwise, NULL if
+ * the cache file is stale or corrupt.
+ ******************************************************************************/
+static zend_op_array * pyphp_filecache_unserialize(const char * data, size_t length, const char * path, struct stat * info TSRMLS_DC) {
+	const char * cursor = data;
+	const char * end = data + length;
+	
+	pyphp_filecache_header_t header;
+	const char * part = pyphp_filecache_read(&cursor, end, sizeof(header));
+	if (part == NULL) {
+		return NULL;
+	}
+	memcpy(&header, part, sizeof(header));
+	size_t pathLen = strlen(path);
+	if (memcmp(header.magic, PYPHP_FILECACHE_MAGIC, sizeof(header.magic)) != 0
+	    || header.format != PYPHP_FILECACHE_FORMAT
+	    || header.opSize != sizeof(zend_op)
+	    || strncmp(header.buildId, PYPHP_FILECACHE_BUILD_ID, sizeof(header.buildId)-1) != 0
+	    || header.mtime != info->st_mtime
+	    || header.size != info->st_size
+	    || header.pathLen != pathLen
+	    || (part = pyphp_filecache_read(&cursor, end, pathLen)) == NULL
+	    || memcmp(part, path, pathLen) != 0) {
+		return NULL;
+	}
+	const char * filename = pyphp_filecache_read(&cursor, end, header.filenameLen);
+	const char * stored = pyphp_filecache_read(&cursor, end, sizeof(zend_op_array));
+	if (filename == NULL || stored == NULL) {
+		return NULL;
+	}
+	zend_op_array cached;
+	memcpy(&cached, stored, sizeof(cached));
+	const char * opcodes = pyphp_filecache_read(&cursor, end, sizeof(zend_op) * cached.last);
+	if (opcodes == NULL) {
+		return NULL;
+	}
+	
+	zend_op_array * opArray = (zend_op_array *)emalloc(sizeof(zend_op_array));
+	*opArray = cached;
+	opArray->function_name = NULL;
+	opArray->scope = NULL;
+	opArray->prototype = NULL;
+	opArray->arg_info = NULL;
+	opArray->static_variables = NULL;
+	opArray->start_op = NULL;
+	opArray->doc_comment = NULL;
+	opArray->doc_comment_len = 0;
+	opArray->vars = NULL;
+	opArray->last_var = 0;
+	opArray->size_var = 0;
+	opArray->brk_cont_array = NULL;
+	opArray->try_catch_array = NULL;
+	memset(opArray->reserved, 0, sizeof(opArray->reserved));
+	opArray->refcount = (zend_uint *)emalloc(sizeof(zend_uint));
+	*opArray->refcount = 1;
+	opArray->opcodes = (zend_op *)safe_emalloc(sizeof(zend_op), cached.last, 0);
+	memcpy(opArray->opcodes, opcodes, sizeof(zend_op) * cached.last);
+	opArray->size = cached.last;
+	
+	// NOTE: until every constant is restored, the op_array can't be destroyed,
+	// so the constants are first marked as plain values.
+	bool isValid = true;
+	for (zend_uint i = 0; i < opArray->last; i++) {
+		zend_op * op = &opArray->opcodes[i];
+		znode * operands[2] = {&op->op1, &op->op2};
+		for (int j = 0; j < 2; j++) {
+			if (pyphp_filecache_hasString(operands[j])) {
+				uint32_t stringLen;
+				const char * string = isValid ? pyphp_filecache_readString(&cursor, end, &stringLen) : NULL;
+				if (string == NULL) {
+					isValid = false;
+					ZVAL_NULL(&operands[j]->u.constant);
+					continue;
+				}
+				Z_STRVAL(operands[j]->u.constant) = estrndup(string, stringLen);
+				Z_STRLEN(operands[j]->u.constant) = stringLen;
+			}
+		}
+		znode * jump = pyphp_filecache_jumpOperand(op);
+		if (jump != NULL) {
+			if (jump->u.opline_num >= opArray->last) {
+				isValid = false;
+				jump->u.opline_num = 0;
+			}
+			jump->u.jmp_addr = opArray->opcodes + jump->u.opline_num;
+		}
+		// The compiler builds the just-in-time super globals a script fetches
+		// (and runs the callbacks of the request ones); a cached script has to
+		// as well.
+		if (isValid && pyphp_filecache_fetchesGlobal(op)) {
+			zend_is_auto_global(Z_STRVAL(op->op1.u.constant), Z_STRLEN(op->op1.u.constant) TSRMLS_CC);
+		}
+		zend_vm_set_opcode_handler(op);
+	}
+	
+	if (isValid && cached.last_var > 0) {
+		opArray->vars = (zend_compiled_variable *)safe_emalloc(sizeof(zend_compiled_variable), cached.last_var, 0);
+		for (int i = 0; i < cached.last_var; i++) {
+			uint32_t nameLen;
+			const char * name = pyphp_filecache_readString(&cursor, end, &nameLen);
+			if (name == NULL) {
+				isValid = false;
+				break;
+			}
+			opArray->vars[i].name = estrndup(name, nameLen);
+			opArray->vars[i].name_len = nameLen;
+			opArray->vars[i].hash_value = zend_inline_hash_func(name, nameLen+1);
+			opArray->last_var = opArray->size_var = i + 1;
+		}
+	}
+	
+	const char * brkCont = isValid ? pyphp_filecache_read(&cursor, end, sizeof(zend_brk_cont_element) * cached.last_brk_cont) : NULL;
+	const char * tryCatch = brkCont ? pyphp_filecache_read(&cursor, end, sizeof(zend_try_catch_element) * cached.last_try_catch) : NULL;
+	if (brkCont == NULL || tryCatch == NULL) {
+		opArray->last_brk_cont = 0;
+		opArray->last_try_catch = 0;
+		destroy_op_array(opArray TSRMLS_CC);
+		efree(opArray);
+		return NULL;
+	}
+	if (cached.last_brk_cont > 0) {
+		opArray->brk_cont_array = (zend_brk_cont_element *)safe_emalloc(sizeof(zend_brk_cont_element), cached.last_brk_cont, 0);
+		memcpy(opArray->brk_cont_array, brkCont, sizeof(zend_brk_cont_element) * cached.last_brk_cont);
+	}
+	if (cached.last_try_catch > 0) {
+		opArray->try_catch_array = (zend_try_catch_element *)safe_emalloc(sizeof(zend_try_catch_element), cached.last_try_catch, 0);
+		memcpy(opArray->try_catch_array, tryCatch, sizeof(zend_try_catch_element) * cached.last_try_catch);
+	}
+	
+	// The filename is interned by the compiler for the rest of the request.
+	char * compiledFilename = estrndup(filename, header.filenameLen);
+	char * originalFilename = zend_get_compiled_filename(TSRMLS_C);
+	opArray->filename = zend_set_compiled_filename(compiledFilename TSRMLS_CC);
+	zend_restore_compiled_filename(originalFilename TSRMLS_CC);
+	efree(compiledFilename);
+	
+	return opArray;
+}
+
+/*******************************************************************************
+ * Loads a compiled script from the cache.
+ *
+ * @param char* path The absolute path of the script.
+ * @param struct stat* info The script file's status.
+ * @return zend_op_array* On success, the compiled script; otherwise, NULL.
+ ******************************************************************************/
+static zend_op_array * pyphp_filecache_load(const char * path, struct stat * info TSRMLS_DC) {
+	char cacheFile[PATH_MAX];
+	if (!pyphp_filecache_cacheFile(path, cacheFile)) {
+		return NULL;
+	}
+	int fd = open(cacheFile, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	zend_op_array * opArray = NULL;
+	struct stat cacheInfo;
+	if (fstat(fd, &cacheInfo) == 0 && cacheInfo.st_size > 0) {
+		void * data = mmap(NULL, cacheInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			opArray = pyphp_filecache_unserialize((const char *)data, cacheInfo.st_size, path, info TSRMLS_CC);
+			munmap(data, cacheInfo.st_size);
+		}
+	}
+	close(fd);
+	return opArray;
+}
+
+/*******************************************************************************
+ * Gets the absolute path of the script a file handle opens.
+ *
+ * @param zend_file_handle* handle The file handle.
+ * @return char* On success, the path (emalloc'd); otherwise, NULL.
+ ******************************************************************************/
+static char * pyphp_filecache_path(zend_file_handle * handle TSRMLS_DC) {
+	const char * name = handle->opened_path ? handle->opened_path : handle->filename;
+	if (name == NULL) {
+		return NULL;
+	}
+	if (name[0] == '/') {
+		return estrdup(name);
+	}
+	// Includes are resolved against the include path; anything else (e.g., a
+	// script run by filename) against the working directory.
+	if (handle->type == ZEND_HANDLE_FILENAME) {
+		return zend_resolve_path(name, strlen(name) TSRMLS_CC);
+	}
+	return expand_filepath(name, NULL TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * The PHP compile file handler.
+ *
+ * @param zend_file_handle* handle The script to compile.
+ * @param int type The kind of include (e.g., ZEND_REQUIRE).
+ * @return zend_op_array* On success, the compiled script; otherwise, NULL.
+ ******************************************************************************/
+static zend_op_array * pyphp_filecache_php_compileFile(zend_file_handle * handle, int type TSRMLS_DC) {
+	if (pyphp_filecache_directory == NULL) {
+		return pyphp_filecache_phpCompileFile(handle, type TSRMLS_CC);
+	}
+	
+	// NOTE: mounted scripts are already in memory, and their versions don't
+	// carry over to other processes.
+	char * path = pyphp_filecache_path(handle TSRMLS_CC);
+	struct stat info;
+	if (path == NULL || pyphp_vfs_find(path, strlen(path)) != NULL || stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+		if (path != NULL) {
+			efree(path);
+		}
+		return pyphp_filecache_phpCompileFile(handle, type TSRMLS_CC);
+	}
+	
+	zend_op_array * opArray = pyphp_filecache_load(path, &info TSRMLS_CC);
+	if (opArray != NULL) {
+		pyphp_filecache_stats.hits++;
+		// The caller destroys the handle through the open files list, just as
+		// if it had been scanned. A handle that was never opened stands in as
+		// a mapped one so that it is found there (and the script is recorded
+		// as included).
+		if (handle->type == ZEND_HANDLE_FILENAME) {
+			handle->type = ZEND_HANDLE_MAPPED;
+			memset(&handle->handle.stream, 0, sizeof(handle->handle.stream));
+			handle->handle.stream.handle = opArray;
+			if (handle->opened_path == NULL) {
+				handle->opened_path = estrdup(path);
+			}
+		}
+		zend_llist_add_element(&CG(open_files), handle);
+		efree(path);
+		return opArray;
+	}
+	pyphp_filecache_stats.misses++;
+	
+	// Only scripts whose compilation doesn't declare anything are cached.
+	uint functions = zend_hash_num_elements(CG(function_table));
+	uint classes = zend_hash_num_elements(CG(class_table));
+	uint constants = zend_hash_num_elements(EG(zend_constants));
+	opArray = pyphp_filecache_phpCompileFile(handle, type TSRMLS_CC);
+	if (opArray != NULL) {
+		if (functions == zend_hash_num_elements(CG(function_table))
+		    && classes == zend_hash_num_elements(CG(class_table))
+		    && constants == zend_hash_num_elements(EG(zend_constants))) {
+			pyphp_filecache_store(opArray, path, &info);
+		} else {
+			pyphp_filecache_stats.rejects++;
+		}
+	}
+	efree(path);
+	return opArray;
+}
+
+/*******************************************************************************
+ * Installs the PHP compile file handler.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_filecache_php_startup(void) {
+	// NOTE: the engine startup sets the handler every time PHP is initialized.
+	pyphp_filecache_phpCompileFile = zend_compile_file;
+	zend_compile_file = pyphp_filecache_php_compileFile;
+}
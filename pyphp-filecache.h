@@ -0,0 +1,66 @@
+/**
+ * pyphp-filecache.h provides the on-disk cache of compiled PHP scripts
+ * (pyphp.setCompileCache()).
+ *
+ * Compiled scripts are written to a directory versioned by the PHP build, and
+ * loaded back with mmap() the next time a process compiles them, so new
+ * processes don't have to recompile every script.
+ *
+ * Only self-contained scripts are cached: scripts whose compilation declares
+ * functions, classes or constants are always compiled.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_FILECACHE_H
+#define PYPHP_FILECACHE_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * The version of the cache file format.
+ */
+#define PYPHP_FILECACHE_FORMAT 2
+
+/**
+ * The cache counters.
+ */
+typedef struct pyphp_filecache_stats_t {
+	// Scripts loaded from the cache.
+	unsigned long hits;
+	// Scripts compiled because they weren't cached (or were stale).
+	unsigned long misses;
+	// Scripts written to the cache.
+	unsigned long stores;
+	// Scripts that couldn't be cached (not self-contained).
+	unsigned long rejects;
+} pyphp_filecache_stats_t;
+
+/**
+ * The cache counters.
+ */
+extern pyphp_filecache_stats_t pyphp_filecache_stats;
+
+/**
+ * Sets the cache directory.
+ *
+ * @param char* directory The directory, or NULL to disable the cache.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_filecache_setDirectory(const char * directory);
+
+/**
+ * Installs the PHP compile file handler.
+ *
+ * Called once PHP's modules have started up.
+ */
+void pyphp_filecache_php_startup(void);
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * pyphp-fragment.c provides the fragment cache.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-fragment.h"
+#include "pyphp-lru.h"
+
+/**
+ * A cached fragment.
+ */
+typedef struct pyphp_fragment_t {
+	// The length of the output.
+	size_t length;
+	// The output.
+	char output[];
+} pyphp_fragment_t;
+
+// The cached fragments (key => pyphp_fragment_t*).
+static pyphp_lru_t pyphp_fragment_cache;
+
+// Whether the fragment cache has been initialized.
+static bool pyphp_fragment_isCacheInit = false;
+
+/*******************************************************************************
+ * Releases a cached fragment.
+ *
+ * @param void* value The fragment.
+ ******************************************************************************/
+static void pyphp_fragment_release(void * value) {
+	free(value);
+}
+
+/*******************************************************************************
+ * Sets the byte budget of the fragment cache.
+ *
+ * @param size_t maxBytes The byte budget (0 empties and disables the cache).
+ ******************************************************************************/
+void pyphp_fragment_setCache(size_t maxBytes) {
+	if (!pyphp_fragment_isCacheInit) {
+		pyphp_lru_init(&pyphp_fragment_cache, maxBytes, pyphp_fragment_release);
+		pyphp_fragment_isCacheInit = true;
+	} else {
+		pyphp_lru_setMaxBytes(&pyphp_fragment_cache, maxBytes);
+	}
+}
+
+/*******************************************************************************
+ * Removes cached fragments.
+ *
+ * @param char* prefix The prefix of the keys of the fragments removed, or NULL
+ * for all fragments.
+ * @param size_t prefixLength The length of the prefix.
+ * @return int The number of fragments removed.
+ ******************************************************************************/
+int pyphp_fragment_clearCache(const char * prefix, size_t prefixLength) {
+	if (!pyphp_fragment_isCacheInit) {
+		return 0;
+	}
+	if (prefix == NULL) {
+		int count = zend_hash_num_elements(&pyphp_fragment_cache.entries);
+		pyphp_lru_clear(&pyphp_fragment_cache);
+		return count;
+	}
+	return pyphp_lru_removePrefix(&pyphp_fragment_cache, prefix, prefixLength);
+}
+
+/*******************************************************************************
+ * Removes a cached fragment.
+ *
+ * @param char* key The key of the fragment.
+ * @param size_t keyLength The length of the key.
+ * @return bool If the fragment was cached, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_fragment_invalidate(const char * key, size_t keyLength) {
+	if (!pyphp_fragment_isCacheInit) {
+		return false;
+	}
+	return pyphp_lru_remove(&pyphp_fragment_cache, key, keyLength);
+}
+
+/*******************************************************************************
+ * Builds a Python dict of the fragment cache counters.
+ *
+ * @return PyObject* The dict.
+ ******************************************************************************/
+PyObject * pyphp_fragment_cacheStats(void) {
+	if (!pyphp_fragment_isCacheInit) {
+		pyphp_fragment_setCache(0);
+	}
+	return pyphp_lru_stats(&pyphp_fragment_cache);
+}
+
+/*******************************************************************************
+ * Calls the callback of a fragment.
+ *
+ * @param zend_fcall_info* fci The callback.
+ * @param zend_fcall_info_cache* fcc The callback cache.
+ * @return int On success, SUCCESS; otherwise, FAILURE.
+ ******************************************************************************/
+static int pyphp_fragment_php_call(zend_fcall_info * fci, zend_fcall_info_cache * fcc TSRMLS_DC) {
+	zval * retval = NULL;
+	fci->retval_ptr_ptr = &retval;
+	int result = zend_call_function(fci, fcc TSRMLS_CC);
+	if (retval != NULL) {
+		zval_ptr_dtor(&retval);
+	}
+	return (result == SUCCESS && !EG(exception)) ? SUCCESS : FAILURE;
+}
+
+/*******************************************************************************
+ * The PHP function pyphp_cache_fragment($key, $ttl, $callback).
+ *
+ * Writes the cached output of the fragment, or calls the callback and caches
+ * the output it writes for $ttl seconds (0 for ever). Returns false if the
+ * callback failed (its output isn't cached).
+ ******************************************************************************/
+static ZEND_FUNCTION(pyphp_fragment_php_cacheFragment) {
+	char * key;
+	int keyLen;
+	long ttl;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "slf", &key, &keyLen, &ttl, &fci, &fcc) == FAILURE) {
+		return;
+	}
+	
+	if (!pyphp_fragment_isCacheInit || pyphp_fragment_cache.maxBytes == 0) {
+		RETURN_BOOL(pyphp_fragment_php_call(&fci, &fcc TSRMLS_CC) == SUCCESS);
+	}
+	
+	pyphp_lru_entry_t * entry = pyphp_lru_find(&pyphp_fragment_cache, key, keyLen);
+	if (entry != NULL) {
+		pyphp_fragment_t * fragment = (pyphp_fragment_t *)entry->value;
+		PHPWRITE(fragment->output, fragment->length);
+		RETURN_TRUE;
+	}
+	
+	// Capture what the callback writes in an output buffer of our own.
+	if (php_start_ob_buffer(NULL, 0, 1 TSRMLS_CC) == FAILURE) {
+		RETURN_BOOL(pyphp_fragment_php_call(&fci, &fcc TSRMLS_CC) == SUCCESS);
+	}
+	int nesting = OG(ob_nesting_level);
+	int result = pyphp_fragment_php_call(&fci, &fcc TSRMLS_CC);
+	if (OG(ob_nesting_level) != nesting) {
+		// The callback left its own buffers open (or closed ours): leave them to
+		// PHP and don't cache anything.
+		RETURN_FALSE;
+	}
+	
+	zval output;
+	if (result == FAILURE || php_ob_get_buffer(&output TSRMLS_CC) == FAILURE) {
+		php_end_ob_buffer(1, 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+	php_end_ob_buffer(0, 0 TSRMLS_CC);
+	
+	pyphp_fragment_t * fragment = malloc(sizeof(pyphp_fragment_t) + Z_STRLEN(output));
+	if (fragment != NULL) {
+		fragment->length = Z_STRLEN(output);
+		memcpy(fragment->output, Z_STRVAL(output), Z_STRLEN(output));
+		pyphp_lru_put(&pyphp_fragment_cache, key, keyLen, fragment, fragment->length, ttl > 0 ? (uint64_t)ttl * 1000000000ULL : 0);
+	}
+	PHPWRITE(Z_STRVAL(output), Z_STRLEN(output));
+	zval_dtor(&output);
+	RETURN_TRUE;
+}
+
+// The PHP functions.
+static const zend_function_entry pyphp_fragment_php_functions[] = {
+	ZEND_NAMED_FE(pyphp_cache_fragment, ZEND_FN(pyphp_fragment_php_cacheFragment), NULL)
+	{NULL, NULL, NULL}
+};
+
+/*******************************************************************************
+ * Registers the PHP functions.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_fragment_php_startup(void) {
+	TSRMLS_FETCH();
+	if (zend_register_functions(NULL, pyphp_fragment_php_functions, NULL, MODULE_PERSISTENT TSRMLS_CC) == FAILURE) {
+		printf("%s:%u Failed to register the fragment cache functions!\n", __FUNCTION__, __LINE__);
+	}
+}
@@ -0,0 +1,67 @@
+/**
+ * pyphp-fragment.h provides the fragment cache: the PHP function
+ * pyphp_cache_fragment($key, $ttl, $callback).
+ *
+ * The output of the callback is cached under the key in process-wide memory
+ * that survives PHP resets, and written straight to the output on later calls
+ * until it expires or is invalidated from Python (pyphp.clearFragmentCache()).
+ *
+ * While the fragment cache is disabled (the default), the callback is simply
+ * called.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_FRAGMENT_H
+#define PYPHP_FRAGMENT_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * Sets the byte budget of the fragment cache.
+ *
+ * @param size_t maxBytes The byte budget (0 empties and disables the cache).
+ */
+void pyphp_fragment_setCache(size_t maxBytes);
+
+/**
+ * Removes cached fragments.
+ *
+ * @param char* prefix The prefix of the keys of the fragments removed, or NULL
+ * for all fragments.
+ * @param size_t prefixLength The length of the prefix.
+ * @return int The number of fragments removed.
+ */
+int pyphp_fragment_clearCache(const char * prefix, size_t prefixLength);
+
+/**
+ * Removes a cached fragment.
+ *
+ * @param char* key The key of the fragment.
+ * @param size_t keyLength The length of the key.
+ * @return bool If the fragment was cached, true; otherwise, false.
+ */
+bool pyphp_fragment_invalidate(const char * key, size_t keyLength);
+
+/**
+ * Builds a Python dict of the fragment cache counters.
+ *
+ * @return PyObject* The dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ */
+PyObject * pyphp_fragment_cacheStats(void);
+
+/**
+ * Registers the PHP functions.
+ *
+ * Called once PHP's modules have started up.
+ */
+void pyphp_fragment_php_startup(void);
+
+#endif
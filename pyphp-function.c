@@ -0,0 +1,340 @@
+/**
+ * pyphp-function.c provides Python callables registered as PHP functions.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-function.h"
+
+extern PyObject * pyphp_exception;
+
+/**
+ * A cached PHP function lookup.
+ */
+typedef struct pyphp_function_lookup_t {
+	// The function.
+	zend_function * function;
+	// When the function was looked up (see pyphp_core.startups and
+	// pyphp_core.requests).
+	ulong startup;
+	ulong request;
+} pyphp_function_lookup_t;
+
+// The PHP functions looked up by pyphp.call() (lowercase name =>
+// pyphp_function_lookup_t), or NULL.
+static HashTable * pyphp_function_lookups = NULL;
+
+// The registered callables (lowercase PHP function name => callable).
+// NOTE: PHP keeps pointing at the name strings (the keys), so registrations
+// are never removed.
+static PyObject * pyphp_function_callables = NULL;
+
+/*******************************************************************************
+ * The handler of every registered PHP function: calls the callable registered
+ * under the name the function was called by.
+ ******************************************************************************/
+static ZEND_FUNCTION(pyphp_function_php_call) {
+	const char * name = get_active_function_name(TSRMLS_C);
+	PyObject * pyCallable = (pyphp_function_callables != NULL) ? PyDict_GetItemString(pyphp_function_callables, name) : NULL;
+	if (pyCallable == NULL) {
+		zend_error(E_WARNING, "%s(): no python callable is registered", name);
+		RETURN_NULL();
+	}
+	
+	// Convert the arguments.
+	const int argc = ZEND_NUM_ARGS();
+	zval *** phpArgs = (argc > 0) ? (zval ***)safe_emalloc(argc, sizeof(zval **), 0) : NULL;
+	if (argc > 0 && zend_get_parameters_array_ex(argc, phpArgs) == FAILURE) {
+		efree(phpArgs);
+		WRONG_PARAM_COUNT;
+	}
+	PyObject * pyArgs = PyTuple_New(argc);
+	int i;
+	for (i = 0; pyArgs != NULL && i < argc; i++) {
+		PyObject * pyArg = pyphp_core_convert_zvalToPyObject(*phpArgs[i]);
+		if (pyArg == NULL) {
+			Py_CLEAR(pyArgs);
+			break;
+		}
+		// NOTE: steals the reference to the argument.
+		PyTuple_SET_ITEM(pyArgs, i, pyArg);
+	}
+	if (phpArgs != NULL) {
+		efree(phpArgs);
+	}
+	if (pyArgs == NULL) {
+		pyphp_core_php_throwPyErr(name TSRMLS_CC);
+		return;
+	}
+	
+	// Call the callable.
+	pyphp_core.stats.functionCallbacks++;
+	Py_INCREF(pyCallable);
+	PyObject * pyResult = PyObject_Call(pyCallable, pyArgs, NULL);
+	Py_DECREF(pyCallable);
+	Py_DECREF(pyArgs);
+	if (pyResult == NULL) {
+		pyphp_core_php_throwPyErr(name TSRMLS_CC);
+		return;
+	}
+	
+	// Convert the result.
+	zval * phpResult = NULL;
+	bool isConverted = pyphp_core_convert_pyObjectToZval(pyResult, &phpResult);
+	Py_DECREF(pyResult);
+	if (!isConverted) {
+		pyphp_core_php_throwPyErr(name TSRMLS_CC);
+		return;
+	}
+	COPY_PZVAL_TO_ZVAL(*return_value, phpResult);
+}
+
+/*******************************************************************************
+ * Installs a PHP function that calls a registered callable.
+ *
+ * @param char* name The lowercase name of the PHP function (must outlive the
+ * function).
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_function_php_install(const char * name TSRMLS_DC) {
+	zend_function_entry functions[2];
+	memset(functions, 0, sizeof(functions));
+	functions[0].fname = name;
+	functions[0].handler = ZEND_FN(pyphp_function_php_call);
+	return zend_register_functions(NULL, functions, NULL, MODULE_PERSISTENT TSRMLS_CC) == SUCCESS;
+}
+
+/*******************************************************************************
+ * Registers a Python callable as a PHP function.
+ *
+ * @param char* name The name of the PHP function.
+ * @param PyObject* pyCallable The callable.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_function_register(const char * name, PyObject * pyCallable) {
+	if (!PyCallable_Check(pyCallable)) {
+		PyErr_SetString(PyExc_TypeError, "The function must be callable");
+		return false;
+	}
+	size_t nameLen = strlen(name);
+	if (nameLen == 0) {
+		PyErr_SetString(PyExc_ValueError, "The function name must not be empty");
+		return false;
+	}
+	if (pyphp_function_callables == NULL) {
+		pyphp_function_callables = PyDict_New();
+		if (pyphp_function_callables == NULL) {
+			return false;
+		}
+	}
+	
+	// PHP function names are case-insensitive.
+	PyObject * pyName = PyString_FromStringAndSize(NULL, nameLen);
+	if (pyName == NULL) {
+		return false;
+	}
+	pyphp_core.generation++;
+	zend_str_tolower_copy(PyString_AS_STRING(pyName), name, nameLen);
+	
+	// A function registered before only gets its callable replaced.
+	// NOTE: the dict keeps the original key (which PHP points at).
+	if (PyDict_GetItem(pyphp_function_callables, pyName) != NULL) {
+		int result = PyDict_SetItem(pyphp_function_callables, pyName, pyCallable);
+		Py_DECREF(pyName);
+		return result == 0;
+	}
+	
+	if (pyphp_core.isInit) {
+		TSRMLS_FETCH();
+		if (!pyphp_function_php_install(PyString_AS_STRING(pyName) TSRMLS_CC)) {
+			PyErr_Format(pyphp_exception, "Failed to register the PHP function %s (is it already defined?)", name);
+			Py_DECREF(pyName);
+			return false;
+		}
+	}
+	int result = PyDict_SetItem(pyphp_function_callables, pyName, pyCallable);
+	Py_DECREF(pyName);
+	return result == 0;
+}
+
+/*******************************************************************************
+ * Registers the PHP functions of the registered callables.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_function_php_startup(void) {
+	if (pyphp_function_callables == NULL) {
+		return;
+	}
+	TSRMLS_FETCH();
+	PyObject * pyName;
+	PyObject * pyCallable;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(pyphp_function_callables, &pos, &pyName, &pyCallable)) {
+		if (!pyphp_function_php_install(PyString_AS_STRING(pyName) TSRMLS_CC)) {
+			printf("%s:%u Failed to register the PHP function %s!\n", __FUNCTION__, __LINE__, PyString_AS_STRING(pyName));
+		}
+	}
+}
+
+/*******************************************************************************
+ * Looks up a PHP function, using the cached lookup while what it points at is
+ * still alive.
+ *
+ * @param char* name The lowercase name of the function.
+ * @param size_t nameLen The length of the name.
+ * @return zend_function* If the function is defined, the function; otherwise,
+ * NULL.
+ ******************************************************************************/
+static zend_function * pyphp_function_php_lookup(const char * name, size_t nameLen TSRMLS_DC) {
+	pyphp_function_lookup_t * lookup;
+	if (pyphp_function_lookups == NULL) {
+		pyphp_function_lookups = malloc(sizeof(HashTable));
+		if (pyphp_function_lookups == NULL) {
+			return NULL;
+		}
+		zend_hash_init(pyphp_function_lookups, 32, NULL, NULL, 1);
+	} else if (zend_hash_find(pyphp_function_lookups, name, nameLen+1, (void **)&lookup) == SUCCESS) {
+		// NOTE: internal functions live until PHP shuts down, user functions
+		// until their request does.
+		if (lookup->startup == pyphp_core.startups && (lookup->function->type == ZEND_INTERNAL_FUNCTION || lookup->request == pyphp_core.requests)) {
+			return lookup->function;
+		}
+	}
+	
+	zend_function * function;
+	if (zend_hash_find(EG(function_table), name, nameLen+1, (void **)&function) == FAILURE) {
+		return NULL;
+	}
+	pyphp_function_lookup_t newLookup = {
+		.function = function,
+		.startup = pyphp_core.startups,
+		.request = pyphp_core.requests
+	};
+	zend_hash_update(pyphp_function_lookups, name, nameLen+1, &newLookup, sizeof(newLookup), NULL);
+	return function;
+}
+
+/*******************************************************************************
+ * Sets a python exception for the pending PHP exception, and clears it.
+ *
+ * @param char* name The name of the PHP function.
+ ******************************************************************************/
+static void pyphp_function_php_raise(const char * name TSRMLS_DC) {
+	zval * message = zend_read_property(zend_get_class_entry(EG(exception) TSRMLS_CC), EG(exception), "message", sizeof("message")-1, 1 TSRMLS_CC);
+	PyErr_Format(pyphp_exception, "PHP function %s threw %s: %s", name, Z_OBJCE_P(EG(exception))->name, (message != NULL && Z_TYPE_P(message) == IS_STRING) ? Z_STRVAL_P(message) : "");
+	zend_clear_exception(TSRMLS_C);
+}
+
+/*******************************************************************************
+ * Calls a PHP function.
+ *
+ * @param char* name The name of the function.
+ * @param PyObject* pyArgs The arguments (a tuple).
+ * @return PyObject* On success, the result; otherwise, NULL with a python
+ * exception set.
+ ******************************************************************************/
+PyObject * pyphp_function_call(const char * name, PyObject * pyArgs) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	TSRMLS_FETCH();
+	
+	size_t nameLen = strlen(name);
+	char * lcName = zend_str_tolower_dup(name, nameLen);
+	zend_function * function = pyphp_function_php_lookup(lcName, nameLen TSRMLS_CC);
+	efree(lcName);
+	if (function == NULL) {
+		PyErr_Format(pyphp_exception, "PHP function %s is not defined", name);
+		return NULL;
+	}
+	
+	// Convert the arguments.
+	const Py_ssize_t argc = PyTuple_GET_SIZE(pyArgs);
+	zval ** phpArgs = (argc > 0) ? (zval **)safe_emalloc(argc, sizeof(zval *), 0) : NULL;
+	zval *** phpParams = (argc > 0) ? (zval ***)safe_emalloc(argc, sizeof(zval **), 0) : NULL;
+	Py_ssize_t i;
+	for (i = 0; i < argc; i++) {
+		if (!pyphp_core_convert_pyObjectToZval(PyTuple_GET_ITEM(pyArgs, i), &phpArgs[i])) {
+			PyErr_Format(PyExc_TypeError, "Argument %d of PHP function %s can't be converted to a PHP value", (int)i + 1, name);
+			break;
+		}
+		phpParams[i] = &phpArgs[i];
+	}
+	
+	PyObject * pyResult = NULL;
+	if (i == argc) {
+		zval * phpResult = NULL;
+		zend_fcall_info_cache fcc = {
+			.initialized = 1,
+			.function_handler = function,
+			.calling_scope = NULL,
+			.called_scope = NULL,
+			.object_ptr = NULL
+		};
+		zend_fcall_info fci = {
+			.size = sizeof(zend_fcall_info),
+			.function_table = EG(function_table),
+			.function_name = NULL,
+			.symbol_table = NULL,
+			.retval_ptr_ptr = &phpResult,
+			.param_count = argc,
+			.params = phpParams,
+			.object_ptr = NULL,
+			.no_separation = 1
+		};
+		int result = FAILURE;
+		bool isBailout = false;
+		// NOTE: PHP must not be recycled while the function runs.
+		pyphp_core.executeDepth++;
+		zend_try {
+			result = zend_call_function(&fci, &fcc TSRMLS_CC);
+		} zend_catch {
+			isBailout = true;
+		} zend_end_try();
+		pyphp_core.executeDepth--;
+		
+		if (isBailout) {
+			// NOTE: after a fatal error the request is unusable, so start a new
+			// one; the arguments are freed with the old request's memory.
+			pyphp_core_php_reset();
+			if (!PyErr_Occurred()) {
+				PyErr_Format(pyphp_exception, "PHP function %s failed with a fatal error", name);
+			}
+			return NULL;
+		}
+		if (EG(exception) != NULL) {
+			pyphp_function_php_raise(name TSRMLS_CC);
+		} else if (!PyErr_Occurred()) {
+			if (result == FAILURE || phpResult == NULL) {
+				PyErr_Format(pyphp_exception, "Failed to call PHP function %s", name);
+			} else {
+				pyResult = pyphp_core_convert_zvalToPyObject(phpResult);
+			}
+		}
+		if (phpResult != NULL) {
+			zval_ptr_dtor(&phpResult);
+		}
+	}
+	
+	while (i-- > 0) {
+		zval_ptr_dtor(&phpArgs[i]);
+	}
+	if (phpArgs != NULL) {
+		efree(phpArgs);
+		efree(phpParams);
+	}
+	return pyResult;
+}
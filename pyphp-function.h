@@ -0,0 +1,59 @@
+/**
+ * pyphp-function.h provides Python callables registered as PHP functions
+ * (pyphp.registerFunction()).
+ *
+ * Each callable is installed as an internal PHP function that converts its
+ * arguments to Python values, calls the callable and converts its result back
+ * to a PHP value. Registrations survive PHP resets and restarts.
+ *
+ * PHP functions can also be called straight from Python (pyphp.call()); their
+ * lookups are cached for as long as the functions live.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_FUNCTION_H
+#define PYPHP_FUNCTION_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * Registers a Python callable as a PHP function.
+ *
+ * Registering a callable under the name of a function registered before
+ * replaces its callable.
+ *
+ * @param char* name The name of the PHP function.
+ * @param PyObject* pyCallable The callable.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_function_register(const char * name, PyObject * pyCallable);
+
+/**
+ * Calls a PHP function.
+ *
+ * The function is called in the current request, so functions declared by a
+ * script loaded with pyphp.load() can be called until the next reset.
+ *
+ * @param char* name The name of the function.
+ * @param PyObject* pyArgs The arguments (a tuple).
+ * @return PyObject* On success, the result; otherwise, NULL with a python
+ * exception set.
+ */
+PyObject * pyphp_function_call(const char * name, PyObject * pyArgs);
+
+/**
+ * Registers the PHP functions of the registered callables.
+ *
+ * Called once PHP's modules have started up.
+ */
+void pyphp_function_php_startup(void);
+
+#endif
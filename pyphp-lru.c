@@ -0,0 +1,274 @@
+/**
+ * pyphp-lru.c provides a least-recently-used cache with a byte budget and
+ * time-to-live.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-lru.h"
+#include "pyphp-core.h"
+
+/*******************************************************************************
+ * Initializes a cache.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param size_t maxBytes The byte budget.
+ * @param pyphp_lru_dtor_t dtor Releases entry values.
+ ******************************************************************************/
+void pyphp_lru_init(pyphp_lru_t * lru, size_t maxBytes, pyphp_lru_dtor_t dtor) {
+	// NOTE: the table holds entry pointers only; entries are released when they
+	// are unlinked.
+	zend_hash_init(&lru->entries, 64, NULL, NULL, 1);
+	lru->head = NULL;
+	lru->tail = NULL;
+	lru->maxBytes = maxBytes;
+	lru->bytes = 0;
+	lru->dtor = dtor;
+	memset(&lru->stats, 0, sizeof(lru->stats));
+}
+
+/*******************************************************************************
+ * Destroys a cache and all its entries.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ ******************************************************************************/
+void pyphp_lru_destroy(pyphp_lru_t * lru) {
+	pyphp_lru_clear(lru);
+	zend_hash_destroy(&lru->entries);
+}
+
+/*******************************************************************************
+ * Unlinks an entry from the recency list.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param pyphp_lru_entry_t* entry The entry.
+ ******************************************************************************/
+static void pyphp_lru_unlink(pyphp_lru_t * lru, pyphp_lru_entry_t * entry) {
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		lru->head = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	} else {
+		lru->tail = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+/*******************************************************************************
+ * Links an entry at the head (most recently used) of the recency list.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param pyphp_lru_entry_t* entry The entry.
+ ******************************************************************************/
+static void pyphp_lru_link(pyphp_lru_t * lru, pyphp_lru_entry_t * entry) {
+	entry->prev = NULL;
+	entry->next = lru->head;
+	if (lru->head != NULL) {
+		lru->head->prev = entry;
+	} else {
+		lru->tail = entry;
+	}
+	lru->head = entry;
+}
+
+/*******************************************************************************
+ * Removes an entry from the cache and releases it.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param pyphp_lru_entry_t* entry The entry.
+ ******************************************************************************/
+static void pyphp_lru_drop(pyphp_lru_t * lru, pyphp_lru_entry_t * entry) {
+	zend_hash_del(&lru->entries, entry->key, entry->keyLength + 1);
+	pyphp_lru_unlink(lru, entry);
+	lru->bytes -= entry->size;
+	if (lru->dtor != NULL) {
+		lru->dtor(entry->value);
+	}
+	free(entry->key);
+	free(entry);
+}
+
+/*******************************************************************************
+ * Evicts the least recently used entries until a number of bytes fit within
+ * the budget.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param size_t size The number of bytes to make room for.
+ ******************************************************************************/
+static void pyphp_lru_evict(pyphp_lru_t * lru, size_t size) {
+	while (lru->tail != NULL && lru->bytes + size > lru->maxBytes) {
+		pyphp_lru_drop(lru, lru->tail);
+		lru->stats.evictions++;
+	}
+}
+
+/*******************************************************************************
+ * Finds a live entry, marking it most recently used.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key.
+ * @param size_t keyLength The length of the key.
+ * @return pyphp_lru_entry_t* If found, the entry; otherwise, NULL.
+ ******************************************************************************/
+pyphp_lru_entry_t * pyphp_lru_find(pyphp_lru_t * lru, const char * key, size_t keyLength) {
+	pyphp_lru_entry_t ** found = NULL;
+	if (zend_hash_find(&lru->entries, key, keyLength + 1, (void **)&found) == FAILURE) {
+		lru->stats.misses++;
+		return NULL;
+	}
+	pyphp_lru_entry_t * entry = *found;
+	if (entry->expires != 0 && entry->expires <= pyphp_core_now()) {
+		pyphp_lru_drop(lru, entry);
+		lru->stats.expirations++;
+		lru->stats.misses++;
+		return NULL;
+	}
+	if (lru->head != entry) {
+		pyphp_lru_unlink(lru, entry);
+		pyphp_lru_link(lru, entry);
+	}
+	lru->stats.hits++;
+	return entry;
+}
+
+/*******************************************************************************
+ * Stores an entry, replacing any entry with the same key and evicting the
+ * least recently used entries to stay within the budget.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key (copied).
+ * @param size_t keyLength The length of the key.
+ * @param void* value The value (owned by the cache, even on failure).
+ * @param size_t size The number of bytes the value is charged.
+ * @param uint64_t ttl How long the entry lives in nanoseconds, or 0 for ever.
+ * @return bool If stored, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_lru_put(pyphp_lru_t * lru, const char * key, size_t keyLength, void * value, size_t size, uint64_t ttl) {
+	pyphp_lru_remove(lru, key, keyLength);
+	
+	// Charge the key and bookkeeping too so that many tiny entries still count.
+	size += keyLength + sizeof(pyphp_lru_entry_t);
+	if (size > lru->maxBytes) {
+		if (lru->dtor != NULL) {
+			lru->dtor(value);
+		}
+		return false;
+	}
+	pyphp_lru_evict(lru, size);
+	
+	pyphp_lru_entry_t * entry = malloc(sizeof(pyphp_lru_entry_t));
+	char * keyCopy = malloc(keyLength + 1);
+	if (entry == NULL || keyCopy == NULL) {
+		free(entry);
+		free(keyCopy);
+		if (lru->dtor != NULL) {
+			lru->dtor(value);
+		}
+		return false;
+	}
+	memcpy(keyCopy, key, keyLength);
+	keyCopy[keyLength] = '\0';
+	entry->key = keyCopy;
+	entry->keyLength = keyLength;
+	entry->value = value;
+	entry->size = size;
+	entry->expires = (ttl != 0 ? pyphp_core_now() + ttl : 0);
+	
+	zend_hash_update(&lru->entries, entry->key, keyLength + 1, (void *)&entry, sizeof(entry), NULL);
+	pyphp_lru_link(lru, entry);
+	lru->bytes += size;
+	return true;
+}
+
+/*******************************************************************************
+ * Removes an entry.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key.
+ * @param size_t keyLength The length of the key.
+ * @return bool If removed, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_lru_remove(pyphp_lru_t * lru, const char * key, size_t keyLength) {
+	pyphp_lru_entry_t ** found = NULL;
+	if (zend_hash_find(&lru->entries, key, keyLength + 1, (void **)&found) == FAILURE) {
+		return false;
+	}
+	pyphp_lru_drop(lru, *found);
+	return true;
+}
+
+/*******************************************************************************
+ * Removes the entries whose keys begin with a prefix.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* prefix The prefix.
+ * @param size_t prefixLength The length of the prefix.
+ * @return int The number of entries removed.
+ ******************************************************************************/
+int pyphp_lru_removePrefix(pyphp_lru_t * lru, const char * prefix, size_t prefixLength) {
+	int count = 0;
+	pyphp_lru_entry_t * entry = lru->head;
+	while (entry != NULL) {
+		pyphp_lru_entry_t * next = entry->next;
+		if (entry->keyLength >= prefixLength && memcmp(entry->key, prefix, prefixLength) == 0) {
+			pyphp_lru_drop(lru, entry);
+			count++;
+		}
+		entry = next;
+	}
+	return count;
+}
+
+/*******************************************************************************
+ * Removes all entries.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ ******************************************************************************/
+void pyphp_lru_clear(pyphp_lru_t * lru) {
+	while (lru->head != NULL) {
+		pyphp_lru_drop(lru, lru->head);
+	}
+}
+
+/*******************************************************************************
+ * Sets the byte budget, evicting entries to stay within it.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param size_t maxBytes The byte budget.
+ ******************************************************************************/
+void pyphp_lru_setMaxBytes(pyphp_lru_t * lru, size_t maxBytes) {
+	lru->maxBytes = maxBytes;
+	pyphp_lru_evict(lru, 0);
+}
+
+/*******************************************************************************
+ * Builds a Python dict of the cache counters.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @return PyObject* The dict.
+ ******************************************************************************/
+PyObject * pyphp_lru_stats(pyphp_lru_t * lru) {
+	return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:n,s:n}",
+		"hits", lru->stats.hits,
+		"misses", lru->stats.misses,
+		"evictions", lru->stats.evictions,
+		"expirations", lru->stats.expirations,
+		"entries", (unsigned long)zend_hash_num_elements(&lru->entries),
+		"bytes", (Py_ssize_t)lru->bytes,
+		"maxBytes", (Py_ssize_t)lru->maxBytes
+	);
+}
@@ -0,0 +1,167 @@
+/**
+ * pyphp-lru.h provides a least-recently-used cache with a byte budget and
+ * time-to-live, held in persistent (process-wide) memory so that entries
+ * survive PHP resets.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_LRU_H
+#define PYPHP_LRU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * Releases the value of an entry.
+ *
+ * @param void* value The value.
+ */
+typedef void (*pyphp_lru_dtor_t)(void * value);
+
+/**
+ * A cache entry.
+ */
+typedef struct pyphp_lru_entry_t {
+	// The key (persistent, NUL terminated).
+	char * key;
+	// The length of the key (excluding the NUL).
+	size_t keyLength;
+	// The value.
+	void * value;
+	// The number of bytes the entry is charged against the budget.
+	size_t size;
+	// When the entry expires (see pyphp_core_now()), or 0 if it never does.
+	uint64_t expires;
+	// The next most recently used entry.
+	struct pyphp_lru_entry_t * prev;
+	// The next least recently used entry.
+	struct pyphp_lru_entry_t * next;
+} pyphp_lru_entry_t;
+
+/**
+ * The cache counters.
+ */
+typedef struct pyphp_lru_stats_t {
+	// Lookups that found a live entry.
+	unsigned long hits;
+	// Lookups that didn't (including expired entries).
+	unsigned long misses;
+	// Entries removed to stay within the budget.
+	unsigned long evictions;
+	// Entries removed because they expired.
+	unsigned long expirations;
+} pyphp_lru_stats_t;
+
+/**
+ * A cache.
+ */
+typedef struct pyphp_lru_t {
+	// The entries by key (key => pyphp_lru_entry_t*).
+	HashTable entries;
+	// The most recently used entry.
+	pyphp_lru_entry_t * head;
+	// The least recently used entry.
+	pyphp_lru_entry_t * tail;
+	// The byte budget (0 disables the cache).
+	size_t maxBytes;
+	// The number of bytes held.
+	size_t bytes;
+	// Releases entry values.
+	pyphp_lru_dtor_t dtor;
+	// The counters.
+	pyphp_lru_stats_t stats;
+} pyphp_lru_t;
+
+/**
+ * Initializes a cache.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param size_t maxBytes The byte budget.
+ * @param pyphp_lru_dtor_t dtor Releases entry values.
+ */
+void pyphp_lru_init(pyphp_lru_t * lru, size_t maxBytes, pyphp_lru_dtor_t dtor);
+
+/**
+ * Destroys a cache and all its entries.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ */
+void pyphp_lru_destroy(pyphp_lru_t * lru);
+
+/**
+ * Finds a live entry, marking it most recently used.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key.
+ * @param size_t keyLength The length of the key.
+ * @return pyphp_lru_entry_t* If found, the entry; otherwise, NULL.
+ */
+pyphp_lru_entry_t * pyphp_lru_find(pyphp_lru_t * lru, const char * key, size_t keyLength);
+
+/**
+ * Stores an entry, replacing any entry with the same key and evicting the
+ * least recently used entries to stay within the budget.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key (copied).
+ * @param size_t keyLength The length of the key.
+ * @param void* value The value (owned by the cache, even on failure).
+ * @param size_t size The number of bytes the value is charged.
+ * @param uint64_t ttl How long the entry lives in nanoseconds, or 0 for ever.
+ * @return bool If stored, true; otherwise, false (the value is larger than the
+ * budget).
+ */
+bool pyphp_lru_put(pyphp_lru_t * lru, const char * key, size_t keyLength, void * value, size_t size, uint64_t ttl);
+
+/**
+ * Removes an entry.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* key The key.
+ * @param size_t keyLength The length of the key.
+ * @return bool If removed, true; otherwise, false.
+ */
+bool pyphp_lru_remove(pyphp_lru_t * lru, const char * key, size_t keyLength);
+
+/**
+ * Removes the entries whose keys begin with a prefix.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param char* prefix The prefix.
+ * @param size_t prefixLength The length of the prefix.
+ * @return int The number of entries removed.
+ */
+int pyphp_lru_removePrefix(pyphp_lru_t * lru, const char * prefix, size_t prefixLength);
+
+/**
+ * Removes all entries.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ */
+void pyphp_lru_clear(pyphp_lru_t * lru);
+
+/**
+ * Sets the byte budget, evicting entries to stay within it.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @param size_t maxBytes The byte budget (0 empties and disables the cache).
+ */
+void pyphp_lru_setMaxBytes(pyphp_lru_t * lru, size_t maxBytes);
+
+/**
+ * Builds a Python dict of the cache counters.
+ *
+ * @param pyphp_lru_t* lru The cache.
+ * @return PyObject* The dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ */
+PyObject * pyphp_lru_stats(pyphp_lru_t * lru);
+
+#endif
@@ -0,0 +1,459 @@
+/**
+ * pyphp-object.c provides Python objects as PHP objects.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-object.h"
+
+// The PythonObject class.
+static zend_class_entry * pyphp_object_ce = NULL;
+
+// The PythonObject handlers.
+static zend_object_handlers pyphp_object_handlers;
+
+/*******************************************************************************
+ * Checks whether a Python value is a named tuple.
+ *
+ * @param PyObject* pyObj The Python value.
+ * @return bool Whether the value is a named tuple.
+ ******************************************************************************/
+static inline bool pyphp_object_isNamedTuple(PyObject * pyObj) {
+	return PyTuple_Check(pyObj) && !PyTuple_CheckExact(pyObj) && PyObject_HasAttrString(pyObj, "_fields");
+}
+
+/*******************************************************************************
+ * Checks whether a Python value is passed to PHP as a proxy.
+ *
+ * @param PyObject* pyObj The Python value.
+ * @return bool Whether the value is proxied.
+ ******************************************************************************/
+bool pyphp_object_isProxied(PyObject * pyObj) {
+	if (pyObj == Py_None || PyBool_Check(pyObj) || PyInt_Check(pyObj) || PyLong_Check(pyObj) || PyFloat_Check(pyObj) || PyString_Check(pyObj) || PyUnicode_Check(pyObj) || PyDict_Check(pyObj)) {
+		return false;
+	}
+	return pyphp_object_isNamedTuple(pyObj) || !PySequence_Check(pyObj);
+}
+
+/*******************************************************************************
+ * Gets the proxy of a PHP object.
+ *
+ * @param zval* phpObj The PHP object.
+ * @return pyphp_object_t* The proxy.
+ ******************************************************************************/
+static inline pyphp_object_t * pyphp_object_php_get(zval * phpObj TSRMLS_DC) {
+	return (pyphp_object_t *)zend_object_store_get_object(phpObj TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Frees a proxy.
+ *
+ * @param void* object The proxy.
+ ******************************************************************************/
+static void pyphp_object_php_free(void * object TSRMLS_DC) {
+	pyphp_object_t * proxy = (pyphp_object_t *)object;
+	if (proxy->cache != NULL) {
+		zend_hash_destroy(proxy->cache);
+		FREE_HASHTABLE(proxy->cache);
+	}
+	Py_XDECREF(proxy->pyObj);
+	zend_object_std_dtor(&proxy->std TSRMLS_CC);
+	efree(proxy);
+}
+
+/*******************************************************************************
+ * Creates a proxy (PythonObject) with no Python object yet.
+ *
+ * @param zend_class_entry* ce The class.
+ * @return zend_object_value The object.
+ ******************************************************************************/
+static zend_object_value pyphp_object_php_create(zend_class_entry * ce TSRMLS_DC) {
+	pyphp_object_t * proxy = ecalloc(1, sizeof(pyphp_object_t));
+	zend_object_std_init(&proxy->std, ce TSRMLS_CC);
+	
+	zend_object_value value;
+	value.handle = zend_objects_store_put(proxy, (zend_objects_store_dtor_t)zend_objects_destroy_object, (zend_objects_free_object_storage_t)pyphp_object_php_free, NULL TSRMLS_CC);
+	value.handlers = &pyphp_object_handlers;
+	return value;
+}
+
+/*******************************************************************************
+ * Initializes a PHP value to a proxy of a Python object.
+ *
+ * @param zval* phpObj The PHP value.
+ * @param PyObject* pyObj The Python object (a reference is taken).
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+bool pyphp_object_php_wrap(zval * phpObj, PyObject * pyObj) {
+	TSRMLS_FETCH();
+	if (pyphp_object_ce == NULL || object_init_ex(phpObj, pyphp_object_ce) == FAILURE) {
+		return false;
+	}
+	pyphp_object_t * proxy = pyphp_object_php_get(phpObj TSRMLS_CC);
+	Py_INCREF(pyObj);
+	proxy->pyObj = pyObj;
+	return true;
+}
+
+/*******************************************************************************
+ * Gets the Python object a PHP value proxies.
+ *
+ * @param zval* phpObj The PHP value.
+ * @return PyObject* If the value is a proxy, its Python object (borrowed);
+ * otherwise, NULL.
+ ******************************************************************************/
+PyObject * pyphp_object_php_unwrap(zval * phpObj) {
+	if (Z_TYPE_P(phpObj) != IS_OBJECT || Z_OBJ_HT_P(phpObj) != &pyphp_object_handlers) {
+		return NULL;
+	}
+	TSRMLS_FETCH();
+	return pyphp_object_php_get(phpObj TSRMLS_CC)->pyObj;
+}
+
+/*******************************************************************************
+ * Converts a Python value and caches it in a proxy.
+ *
+ * @param pyphp_object_t* proxy The proxy.
+ * @param char* name The attribute name, or NULL for an item.
+ * @param int nameLen The length of the attribute name.
+ * @param long index The item index.
+ * @param PyObject* pyValue The Python value (a reference is stolen).
+ * @return zval* On success, the PHP value (owned by the cache); otherwise,
+ * NULL with a PHP exception thrown.
+ ******************************************************************************/
+static zval * pyphp_object_php_cache(pyphp_object_t * proxy, const char * name, int nameLen, long index, PyObject * pyValue TSRMLS_DC) {
+	zval * phpValue = NULL;
+	bool isConverted = pyphp_core_convert_pyObjectToZval(pyValue, &phpValue);
+	Py_DECREF(pyValue);
+	if (!isConverted) {
+		pyphp_core_php_throwPyErr(name != NULL ? name : "PythonObject" TSRMLS_CC);
+		return NULL;
+	}
+	if (proxy->cache == NULL) {
+		ALLOC_HASHTABLE(proxy->cache);
+		zend_hash_init(proxy->cache, 8, NULL, ZVAL_PTR_DTOR, 0);
+	}
+	if (name != NULL) {
+		zend_hash_update(proxy->cache, name, nameLen+1, &phpValue, sizeof(zval *), NULL);
+	} else {
+		zend_hash_index_update(proxy->cache, index, &phpValue, sizeof(zval *), NULL);
+	}
+	return phpValue;
+}
+
+/*******************************************************************************
+ * Reads an attribute of a proxy.
+ *
+ * @param pyphp_object_t* proxy The proxy.
+ * @param char* name The attribute name.
+ * @param int nameLen The length of the attribute name.
+ * @param bool isQuiet Whether a missing attribute is reported.
+ * @return zval* If the attribute exists, its value (owned by the cache);
+ * otherwise, NULL.
+ ******************************************************************************/
+static zval * pyphp_object_php_getAttr(pyphp_object_t * proxy, const char * name, int nameLen, bool isQuiet TSRMLS_DC) {
+	zval ** cached;
+	if (proxy->cache != NULL && zend_hash_find(proxy->cache, name, nameLen+1, (void **)&cached) == SUCCESS) {
+		return *cached;
+	}
+	PyObject * pyValue = PyObject_GetAttrString(proxy->pyObj, name);
+	if (pyValue == NULL) {
+		if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+			pyphp_core_php_throwPyErr(name TSRMLS_CC);
+			return NULL;
+		}
+		PyErr_Clear();
+		if (!isQuiet) {
+			zend_error(E_NOTICE, "Undefined property: %s::$%s", Py_TYPE(proxy->pyObj)->tp_name, name);
+		}
+		return NULL;
+	}
+	return pyphp_object_php_cache(proxy, name, nameLen, 0, pyValue TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Reads an item of a proxy.
+ *
+ * @param pyphp_object_t* proxy The proxy.
+ * @param zval* offset The index or key.
+ * @param bool isQuiet Whether a missing item is reported.
+ * @return zval* If the item exists, its value; otherwise, NULL.
+ ******************************************************************************/
+static zval * pyphp_object_php_getItem(pyphp_object_t * proxy, zval * offset, bool isQuiet TSRMLS_DC) {
+	// String keys of named tuples are their fields.
+	if (Z_TYPE_P(offset) == IS_STRING && pyphp_object_isNamedTuple(proxy->pyObj)) {
+		return pyphp_object_php_getAttr(proxy, Z_STRVAL_P(offset), Z_STRLEN_P(offset), isQuiet TSRMLS_CC);
+	}
+	
+	PyObject * pyValue;
+	if (Z_TYPE_P(offset) == IS_LONG) {
+		zval ** cached;
+		if (proxy->cache != NULL && zend_hash_index_find(proxy->cache, Z_LVAL_P(offset), (void **)&cached) == SUCCESS) {
+			return *cached;
+		}
+		if (PySequence_Check(proxy->pyObj)) {
+			pyValue = PySequence_GetItem(proxy->pyObj, Z_LVAL_P(offset));
+		} else {
+			PyObject * pyKey = PyInt_FromLong(Z_LVAL_P(offset));
+			pyValue = (pyKey != NULL) ? PyObject_GetItem(proxy->pyObj, pyKey) : NULL;
+			Py_XDECREF(pyKey);
+		}
+	} else if (Z_TYPE_P(offset) == IS_STRING) {
+		PyObject * pyKey = PyString_FromStringAndSize(Z_STRVAL_P(offset), Z_STRLEN_P(offset));
+		pyValue = (pyKey != NULL) ? PyObject_GetItem(proxy->pyObj, pyKey) : NULL;
+		Py_XDECREF(pyKey);
+	} else {
+		zend_error(E_WARNING, "Illegal offset type");
+		return NULL;
+	}
+	if (pyValue == NULL) {
+		if (!PyErr_ExceptionMatches(PyExc_IndexError) && !PyErr_ExceptionMatches(PyExc_KeyError)) {
+			pyphp_core_php_throwPyErr("PythonObject" TSRMLS_CC);
+			return NULL;
+		}
+		PyErr_Clear();
+		if (!isQuiet) {
+			zend_error(E_NOTICE, "Undefined offset in %s", Py_TYPE(proxy->pyObj)->tp_name);
+		}
+		return NULL;
+	}
+	if (Z_TYPE_P(offset) == IS_LONG) {
+		return pyphp_object_php_cache(proxy, NULL, 0, Z_LVAL_P(offset), pyValue TSRMLS_CC);
+	}
+	// NOTE: string keys share the cache with attributes, so they aren't cached.
+	zval * phpValue = NULL;
+	bool isConverted = pyphp_core_convert_pyObjectToZval(pyValue, &phpValue);
+	Py_DECREF(pyValue);
+	if (!isConverted) {
+		pyphp_core_php_throwPyErr("PythonObject" TSRMLS_CC);
+		return NULL;
+	}
+	Z_DELREF_P(phpValue);
+	return phpValue;
+}
+
+/*******************************************************************************
+ * Gets the name of a property as a string.
+ *
+ * @param zval* member The property name.
+ * @param zval* copy Where a string copy is made if the name isn't a string.
+ * @return zval* The string name.
+ ******************************************************************************/
+static inline zval * pyphp_object_php_memberName(zval * member, zval * copy) {
+	if (Z_TYPE_P(member) == IS_STRING) {
+		return member;
+	}
+	*copy = *member;
+	zval_copy_ctor(copy);
+	convert_to_string(copy);
+	return copy;
+}
+
+/*******************************************************************************
+ * The read property handler ($proxy->name).
+ ******************************************************************************/
+static zval * pyphp_object_php_readProperty(zval * object, zval * member, int type TSRMLS_DC) {
+	zval copy;
+	zval * name = pyphp_object_php_memberName(member, &copy);
+	zval * phpValue = pyphp_object_php_getAttr(pyphp_object_php_get(object TSRMLS_CC), Z_STRVAL_P(name), Z_STRLEN_P(name), type == BP_VAR_IS TSRMLS_CC);
+	if (name == &copy) {
+		zval_dtor(&copy);
+	}
+	return (phpValue != NULL) ? phpValue : EG(uninitialized_zval_ptr);
+}
+
+/*******************************************************************************
+ * The has property handler (isset($proxy->name), empty($proxy->name)).
+ ******************************************************************************/
+static int pyphp_object_php_hasProperty(zval * object, zval * member, int hasSetExists TSRMLS_DC) {
+	zval copy;
+	zval * name = pyphp_object_php_memberName(member, &copy);
+	pyphp_object_t * proxy = pyphp_object_php_get(object TSRMLS_CC);
+	int result;
+	if (hasSetExists == 2) {
+		result = PyObject_HasAttrString(proxy->pyObj, Z_STRVAL_P(name));
+	} else {
+		zval * phpValue = pyphp_object_php_getAttr(proxy, Z_STRVAL_P(name), Z_STRLEN_P(name), true TSRMLS_CC);
+		result = (phpValue != NULL && (hasSetExists == 0 ? Z_TYPE_P(phpValue) != IS_NULL : zend_is_true(phpValue)));
+	}
+	if (name == &copy) {
+		zval_dtor(&copy);
+	}
+	return result;
+}
+
+/*******************************************************************************
+ * The read dimension handler ($proxy[0], $proxy['key']).
+ ******************************************************************************/
+static zval * pyphp_object_php_readDimension(zval * object, zval * offset, int type TSRMLS_DC) {
+	zval * phpValue = pyphp_object_php_getItem(pyphp_object_php_get(object TSRMLS_CC), offset, type == BP_VAR_IS TSRMLS_CC);
+	return (phpValue != NULL) ? phpValue : EG(uninitialized_zval_ptr);
+}
+
+/*******************************************************************************
+ * The has dimension handler (isset($proxy[0]), empty($proxy[0])).
+ ******************************************************************************/
+static int pyphp_object_php_hasDimension(zval * object, zval * offset, int checkEmpty TSRMLS_DC) {
+	zval * phpValue = pyphp_object_php_getItem(pyphp_object_php_get(object TSRMLS_CC), offset, true TSRMLS_CC);
+	if (phpValue == NULL) {
+		return 0;
+	}
+	int result = checkEmpty ? zend_is_true(phpValue) : Z_TYPE_P(phpValue) != IS_NULL;
+	// NOTE: uncached values were handed over with no references.
+	if (Z_REFCOUNT_P(phpValue) == 0) {
+		Z_ADDREF_P(phpValue);
+		zval_ptr_dtor(&phpValue);
+	}
+	return result;
+}
+
+/*******************************************************************************
+ * The write handlers: proxies are read-only.
+ ******************************************************************************/
+static void pyphp_object_php_writeProperty(zval * object, zval * member, zval * value TSRMLS_DC) {
+	zend_error(E_WARNING, "Cannot modify a property of a PythonObject");
+}
+
+static void pyphp_object_php_writeDimension(zval * object, zval * offset, zval * value TSRMLS_DC) {
+	zend_error(E_WARNING, "Cannot modify an item of a PythonObject");
+}
+
+static void pyphp_object_php_unsetProperty(zval * object, zval * member TSRMLS_DC) {
+	zend_error(E_WARNING, "Cannot unset a property of a PythonObject");
+}
+
+static void pyphp_object_php_unsetDimension(zval * object, zval * offset TSRMLS_DC) {
+	zend_error(E_WARNING, "Cannot unset an item of a PythonObject");
+}
+
+/*******************************************************************************
+ * The count handler (count($proxy)).
+ ******************************************************************************/
+static int pyphp_object_php_countElements(zval * object, long * count TSRMLS_DC) {
+	Py_ssize_t size = PyObject_Size(pyphp_object_php_get(object TSRMLS_CC)->pyObj);
+	if (size < 0) {
+		PyErr_Clear();
+		return FAILURE;
+	}
+	*count = size;
+	return SUCCESS;
+}
+
+/*******************************************************************************
+ * The cast handler: (string) uses str(), (bool) uses truth testing.
+ ******************************************************************************/
+static int pyphp_object_php_castObject(zval * object, zval * result, int type TSRMLS_DC) {
+	pyphp_object_t * proxy = pyphp_object_php_get(object TSRMLS_CC);
+	if (type == IS_STRING) {
+		PyObject * pyString = PyObject_Str(proxy->pyObj);
+		if (pyString == NULL) {
+			PyErr_Clear();
+			return FAILURE;
+		}
+		ZVAL_STRINGL(result, PyString_AS_STRING(pyString), PyString_GET_SIZE(pyString), 1);
+		Py_DECREF(pyString);
+		return SUCCESS;
+	} else if (type == IS_BOOL) {
+		int isTrue = PyObject_IsTrue(proxy->pyObj);
+		if (isTrue < 0) {
+			PyErr_Clear();
+			return FAILURE;
+		}
+		ZVAL_BOOL(result, isTrue);
+		return SUCCESS;
+	}
+	return zend_std_cast_object_tostring(object, result, type TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Adds the attributes named by a Python sequence of names to the properties
+ * of a proxy.
+ *
+ * @param pyphp_object_t* proxy The proxy.
+ * @param PyObject* pyNames The names (any iterable).
+ ******************************************************************************/
+static void pyphp_object_php_addProperties(pyphp_object_t * proxy, PyObject * pyNames TSRMLS_DC) {
+	PyObject * pyIter = PyObject_GetIter(pyNames);
+	if (pyIter == NULL) {
+		PyErr_Clear();
+		return;
+	}
+	PyObject * pyName;
+	while ((pyName = PyIter_Next(pyIter)) != NULL) {
+		if (PyString_Check(pyName) && PyString_AS_STRING(pyName)[0] != '_') {
+			zval * phpValue = pyphp_object_php_getAttr(proxy, PyString_AS_STRING(pyName), PyString_GET_SIZE(pyName), true TSRMLS_CC);
+			if (phpValue != NULL) {
+				Z_ADDREF_P(phpValue);
+				zend_hash_update(proxy->std.properties, PyString_AS_STRING(pyName), PyString_GET_SIZE(pyName)+1, &phpValue, sizeof(zval *), NULL);
+			}
+		}
+		Py_DECREF(pyName);
+	}
+	Py_DECREF(pyIter);
+	PyErr_Clear();
+}
+
+/*******************************************************************************
+ * The get properties handler (foreach, print_r(), (array) casts): fills the
+ * properties in from __dict__, __slots__ or _fields the first time.
+ ******************************************************************************/
+static HashTable * pyphp_object_php_getProperties(zval * object TSRMLS_DC) {
+	pyphp_object_t * proxy = pyphp_object_php_get(object TSRMLS_CC);
+	if (!proxy->hasProperties) {
+		proxy->hasProperties = true;
+		const char * sources[] = {"_fields", "__slots__", "__dict__"};
+		int i;
+		for (i = 0; i < 3; i++) {
+			PyObject * pyNames = PyObject_GetAttrString(proxy->pyObj, sources[i]);
+			if (pyNames == NULL) {
+				PyErr_Clear();
+				continue;
+			}
+			pyphp_object_php_addProperties(proxy, pyNames TSRMLS_CC);
+			Py_DECREF(pyNames);
+		}
+	}
+	return proxy->std.properties;
+}
+
+/*******************************************************************************
+ * Registers the PythonObject class.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_object_php_startup(void) {
+	TSRMLS_FETCH();
+	memcpy(&pyphp_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	pyphp_object_handlers.clone_obj = NULL;
+	pyphp_object_handlers.read_property = pyphp_object_php_readProperty;
+	pyphp_object_handlers.write_property = pyphp_object_php_writeProperty;
+	pyphp_object_handlers.has_property = pyphp_object_php_hasProperty;
+	pyphp_object_handlers.unset_property = pyphp_object_php_unsetProperty;
+	pyphp_object_handlers.read_dimension = pyphp_object_php_readDimension;
+	pyphp_object_handlers.write_dimension = pyphp_object_php_writeDimension;
+	pyphp_object_handlers.has_dimension = pyphp_object_php_hasDimension;
+	pyphp_object_handlers.unset_dimension = pyphp_object_php_unsetDimension;
+	pyphp_object_handlers.count_elements = pyphp_object_php_countElements;
+	pyphp_object_handlers.get_properties = pyphp_object_php_getProperties;
+	pyphp_object_handlers.cast_object = pyphp_object_php_castObject;
+	// NOTE: without a property pointer handler PHP reads and writes through
+	// the handlers above.
+	pyphp_object_handlers.get_property_ptr_ptr = NULL;
+	
+	zend_class_entry ce;
+	INIT_CLASS_ENTRY(ce, "PythonObject", NULL);
+	ce.create_object = pyphp_object_php_create;
+	pyphp_object_ce = zend_register_internal_class(&ce TSRMLS_CC);
+	pyphp_object_ce->ce_flags |= ZEND_ACC_FINAL_CLASS;
+}
@@ -0,0 +1,78 @@
+/**
+ * pyphp-object.h provides Python objects as PHP objects (of the class
+ * PythonObject).
+ *
+ * Python values that aren't scalars, dicts or sequences are passed to PHP as
+ * proxies instead of being converted. Reading a property ($user->name) gets
+ * the attribute of the Python object the first time and caches the converted
+ * value for the life of the proxy (at most the request). Named tuples also
+ * support index access ($point[0]), objects supporting item access also
+ * support string offsets ($row['name']), and foreach/print_r() see the
+ * attributes listed by __dict__, __slots__ or _fields.
+ *
+ * Proxies are read-only, and convert back to their Python object.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_OBJECT_H
+#define PYPHP_OBJECT_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * A PythonObject.
+ */
+typedef struct pyphp_object_t {
+	// The PHP object.
+	zend_object std;
+	// The Python object.
+	PyObject * pyObj;
+	// The converted attributes (name => zval*) and items (index => zval*), or
+	// NULL.
+	HashTable * cache;
+	// Whether the properties (std.properties) have been filled in.
+	bool hasProperties;
+} pyphp_object_t;
+
+/**
+ * Checks whether a Python value is passed to PHP as a proxy.
+ *
+ * @param PyObject* pyObj The Python value.
+ * @return bool Whether the value is proxied (it isn't a scalar, dict or
+ * plain sequence).
+ */
+bool pyphp_object_isProxied(PyObject * pyObj);
+
+/**
+ * Initializes a PHP value to a proxy of a Python object.
+ *
+ * @param zval* phpObj The PHP value.
+ * @param PyObject* pyObj The Python object (a reference is taken).
+ * @return bool On success, true; otherwise, false.
+ */
+bool pyphp_object_php_wrap(zval * phpObj, PyObject * pyObj);
+
+/**
+ * Gets the Python object a PHP value proxies.
+ *
+ * @param zval* phpObj The PHP value.
+ * @return PyObject* If the value is a proxy, its Python object (borrowed);
+ * otherwise, NULL.
+ */
+PyObject * pyphp_object_php_unwrap(zval * phpObj);
+
+/**
+ * Registers the PythonObject class.
+ *
+ * Called once PHP's modules have started up.
+ */
+void pyphp_object_php_startup(void);
+
+#endif
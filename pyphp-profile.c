@@ -0,0 +1,374 @@
+/**
+ * pyphp-profile.c provides the sampling profiler of PHP scripts.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-profile.h"
+
+// NOTE: older C libraries only name the thread of SIGEV_THREAD_ID through the
+// union.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// A frame of a sample. The names point into PHP memory that lives until the
+// request shuts down.
+typedef struct pyphp_profile_frame_t {
+	const char * function;
+	const char * scope;
+	const char * file;
+	uint line;
+} pyphp_profile_frame_t;
+
+// A sample: the call stack, innermost frame first.
+typedef struct pyphp_profile_sample_t {
+	int depth;
+	pyphp_profile_frame_t frames[PYPHP_PROFILE_MAX_DEPTH];
+} pyphp_profile_sample_t;
+
+// The samples of the script execution in progress.
+// - NOTE: written by the signal handler, so preallocated.
+static pyphp_profile_sample_t pyphp_profile_samples[PYPHP_PROFILE_MAX_SAMPLES];
+static volatile sig_atomic_t pyphp_profile_sampleCount = 0;
+static volatile sig_atomic_t pyphp_profile_droppedCount = 0;
+
+// Whether a script is being sampled.
+static volatile sig_atomic_t pyphp_profile_isSampling = 0;
+
+// The sampling interval in microseconds, or 0 while disabled.
+static long pyphp_profile_interval = 0;
+
+// The SIGPROF action that was installed before ours.
+static struct sigaction pyphp_profile_oldAction;
+
+// The timer on the CPU clock of the thread running PHP, once created, and that
+// thread.
+static timer_t pyphp_profile_timer;
+static bool pyphp_profile_hasTimer = false;
+static pid_t pyphp_profile_thread = 0;
+
+// The aggregated profile: collapsed stack => samples, and function (file:line)
+// => samples.
+static PyObject * pyphp_profile_stacks = NULL;
+static PyObject * pyphp_profile_functions = NULL;
+static unsigned PY_LONG_LONG pyphp_profile_samplesTotal = 0;
+static unsigned PY_LONG_LONG pyphp_profile_droppedTotal = 0;
+
+/*******************************************************************************
+ * The SIGPROF handler: records the PHP call stack of the thread running PHP.
+ *
+ * @param int signo The signal number.
+ ******************************************************************************/
+static void pyphp_profile_php_sample(int signo) {
+	if (!pyphp_profile_isSampling) {
+		return;
+	}
+	if (pyphp_profile_sampleCount >= PYPHP_PROFILE_MAX_SAMPLES) {
+		pyphp_profile_droppedCount++;
+		return;
+	}
+	TSRMLS_FETCH();
+	pyphp_profile_sample_t * sample = &pyphp_profile_samples[pyphp_profile_sampleCount];
+	zend_execute_data * execute = EG(current_execute_data);
+	int depth = 0;
+	
+	// An internal function being called by the innermost frame is the leaf.
+	if (execute != NULL && execute->function_state.function != NULL && execute->function_state.function->type == ZEND_INTERNAL_FUNCTION) {
+		zend_function * function = execute->function_state.function;
+		pyphp_profile_frame_t * frame = &sample->frames[depth++];
+		frame->function = function->common.function_name;
+		frame->scope = (function->common.scope != NULL ? function->common.scope->name : NULL);
+		frame->file = NULL;
+		frame->line = 0;
+	}
+	for (; execute != NULL && depth < PYPHP_PROFILE_MAX_DEPTH; execute = execute->prev_execute_data) {
+		zend_op_array * opArray = execute->op_array;
+		if (opArray == NULL) {
+			continue;
+		}
+		pyphp_profile_frame_t * frame = &sample->frames[depth++];
+		frame->function = opArray->function_name;
+		frame->scope = (opArray->scope != NULL ? opArray->scope->name : NULL);
+		frame->file = opArray->filename;
+		frame->line = (execute->opline != NULL ? execute->opline->lineno : opArray->line_start);
+	}
+	if (depth > 0) {
+		sample->depth = depth;
+		pyphp_profile_sampleCount++;
+	}
+}
+
+/*******************************************************************************
+ * Enables, changes or disables the profiler.
+ *
+ * @param double interval The sampling interval in seconds of CPU time, or 0
+ * to disable the profiler.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_profile_setInterval(double interval) {
+	long micros = (long)(interval * 1e6);
+	if (interval < 0 || (interval > 0 && micros == 0)) {
+		PyErr_SetString(PyExc_ValueError, "The sampling interval must be 0 or at least a microsecond");
+		return false;
+	}
+	
+	if (micros == 0) {
+		if (pyphp_profile_interval != 0) {
+			if (pyphp_profile_hasTimer) {
+				timer_delete(pyphp_profile_timer);
+				pyphp_profile_hasTimer = false;
+			}
+			sigaction(SIGPROF, &pyphp_profile_oldAction, NULL);
+			pyphp_profile_interval = 0;
+		}
+		return true;
+	}
+	
+	if (pyphp_profile_interval == 0) {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = pyphp_profile_php_sample;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, &pyphp_profile_oldAction) != 0) {
+			PyErr_SetFromErrno(PyExc_OSError);
+			return false;
+		}
+	}
+	// NOTE: the timer is armed by each script execution.
+	pyphp_profile_interval = micros;
+	return true;
+}
+
+/*******************************************************************************
+ * Creates the timer on the CPU clock of the calling thread, signaling that
+ * thread.
+ *
+ * @param pid_t thread The thread (ID) running PHP.
+ * @return bool On success, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_profile_php_createTimer(pid_t thread) {
+	if (pyphp_profile_hasTimer) {
+		timer_delete(pyphp_profile_timer);
+		pyphp_profile_hasTimer = false;
+	}
+	// NOTE: CLOCK_THREAD_CPUTIME_ID is the CPU clock of the thread creating the
+	// timer, and SIGEV_THREAD_ID keeps the signal from landing on another
+	// thread (whose stack isn't PHP's).
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = thread;
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &pyphp_profile_timer) != 0) {
+		return false;
+	}
+	pyphp_profile_thread = thread;
+	pyphp_profile_hasTimer = true;
+	return true;
+}
+
+/*******************************************************************************
+ * Adds samples to a count in a dict.
+ *
+ * @param PyObject* pyDict The dict.
+ * @param char* key The key.
+ * @param size_t keyLength The length of the key.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+static bool pyphp_profile_count(PyObject * pyDict, const char * key, size_t keyLength) {
+	PyObject * pyKey = PyString_FromStringAndSize(key, keyLength);
+	if (pyKey == NULL) {
+		return false;
+	}
+	PyObject * pyCount = PyDict_GetItem(pyDict, pyKey);
+	pyCount = PyInt_FromLong(pyCount != NULL ? PyInt_AS_LONG(pyCount) + 1 : 1);
+	int result = (pyCount != NULL ? PyDict_SetItem(pyDict, pyKey, pyCount) : -1);
+	Py_XDECREF(pyCount);
+	Py_DECREF(pyKey);
+	return result == 0;
+}
+
+/*******************************************************************************
+ * Writes the label of a frame ("Class::function (file:line)").
+ *
+ * @param pyphp_profile_frame_t* frame The frame.
+ * @param char* buffer Where the label is written.
+ * @param size_t size The size of the buffer.
+ * @return size_t The length of the label (cut to the size of the buffer).
+ ******************************************************************************/
+static size_t pyphp_profile_label(const pyphp_profile_frame_t * frame, char * buffer, size_t size) {
+	int length = snprintf(buffer, size, "%s%s%s",
+		frame->scope != NULL ? frame->scope : "",
+		frame->scope != NULL ? "::" : "",
+		frame->function != NULL ? frame->function : "{main}"
+	);
+	if (length >= 0 && (size_t)length < size && frame->file != NULL) {
+		length += snprintf(buffer + length, size - length, " (%s:%u)", frame->file, frame->line);
+	}
+	if (length < 0) {
+		return 0;
+	}
+	return ((size_t)length < size ? (size_t)length : size - 1);
+}
+
+/*******************************************************************************
+ * Starts sampling a script execution.
+ *
+ * @return bool Whether samples are taken.
+ ******************************************************************************/
+bool pyphp_profile_php_begin(void) {
+	if (pyphp_profile_interval == 0 || pyphp_profile_isSampling) {
+		return false;
+	}
+	pid_t thread = (pid_t)syscall(SYS_gettid);
+	if ((!pyphp_profile_hasTimer || pyphp_profile_thread != thread) && !pyphp_profile_php_createTimer(thread)) {
+		return false;
+	}
+	pyphp_profile_sampleCount = 0;
+	pyphp_profile_droppedCount = 0;
+	pyphp_profile_isSampling = 1;
+	
+	struct itimerspec timer;
+	timer.it_interval.tv_sec = pyphp_profile_interval / 1000000;
+	timer.it_interval.tv_nsec = (pyphp_profile_interval % 1000000) * 1000;
+	timer.it_value = timer.it_interval;
+	if (timer_settime(pyphp_profile_timer, 0, &timer, NULL) != 0) {
+		pyphp_profile_isSampling = 0;
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Stops sampling a script execution and aggregates its samples.
+ *
+ * @param bool isSampled What pyphp_profile_php_begin() returned.
+ ******************************************************************************/
+void pyphp_profile_php_end(bool isSampled) {
+	if (!isSampled) {
+		return;
+	}
+	if (pyphp_profile_hasTimer) {
+		struct itimerspec never;
+		memset(&never, 0, sizeof(never));
+		timer_settime(pyphp_profile_timer, 0, &never, NULL);
+	}
+	pyphp_profile_isSampling = 0;
+	
+	if (pyphp_profile_stacks == NULL) {
+		pyphp_profile_stacks = PyDict_New();
+		pyphp_profile_functions = PyDict_New();
+	}
+	
+	// NOTE: keep a python exception being raised from PHP.
+	PyObject * pyType, * pyValue, * pyTraceback;
+	PyErr_Fetch(&pyType, &pyValue, &pyTraceback);
+	
+	char stack[4096];
+	char label[1024];
+	int count = pyphp_profile_sampleCount;
+	for (int i = 0; i < count; i++) {
+		const pyphp_profile_sample_t * sample = &pyphp_profile_samples[i];
+		// Collapsed stacks go from the outermost frame to the innermost.
+		size_t stackLen = 0;
+		for (int depth = sample->depth - 1; depth >= 0 && stackLen < sizeof(stack) - 1; depth--) {
+			if (stackLen > 0) {
+				stack[stackLen++] = ';';
+			}
+			stackLen += pyphp_profile_label(&sample->frames[depth], stack + stackLen, sizeof(stack) - stackLen);
+		}
+		size_t labelLen = pyphp_profile_label(&sample->frames[0], label, sizeof(label));
+		if (pyphp_profile_stacks == NULL || pyphp_profile_functions == NULL
+			|| !pyphp_profile_count(pyphp_profile_stacks, stack, stackLen)
+			|| !pyphp_profile_count(pyphp_profile_functions, label, labelLen)) {
+			PyErr_Clear();
+			break;
+		}
+	}
+	pyphp_profile_samplesTotal += count;
+	pyphp_profile_droppedTotal += pyphp_profile_droppedCount;
+	pyphp_profile_sampleCount = 0;
+	pyphp_profile_droppedCount = 0;
+	
+	PyErr_Restore(pyType, pyValue, pyTraceback);
+}
+
+/*******************************************************************************
+ * Builds the aggregated profile.
+ *
+ * @param bool collapsed Whether the profile is built as collapsed stacks.
+ * @return PyObject* If collapsed, a string of collapsed stacks; otherwise, a
+ * dict. NULL with a python exception set on failure.
+ ******************************************************************************/
+PyObject * pyphp_profile_get(bool collapsed) {
+	if (collapsed) {
+		PyObject * pyLines = PyList_New(0);
+		if (pyLines == NULL) {
+			return NULL;
+		}
+		Py_ssize_t pos = 0;
+		PyObject * pyStack, * pyCount;
+		while (pyphp_profile_stacks != NULL && PyDict_Next(pyphp_profile_stacks, &pos, &pyStack, &pyCount)) {
+			PyObject * pyLine = PyString_FromFormat("%s %ld\n", PyString_AS_STRING(pyStack), PyInt_AS_LONG(pyCount));
+			if (pyLine == NULL || PyList_Append(pyLines, pyLine) != 0) {
+				Py_XDECREF(pyLine);
+				Py_DECREF(pyLines);
+				return NULL;
+			}
+			Py_DECREF(pyLine);
+		}
+		PyObject * pyEmpty = PyString_FromString("");
+		PyObject * pyCollapsed = (pyEmpty != NULL ? _PyString_Join(pyEmpty, pyLines) : NULL);
+		Py_XDECREF(pyEmpty);
+		Py_DECREF(pyLines);
+		return pyCollapsed;
+	}
+	
+	if (pyphp_profile_stacks == NULL) {
+		pyphp_profile_stacks = PyDict_New();
+		pyphp_profile_functions = PyDict_New();
+		if (pyphp_profile_stacks == NULL || pyphp_profile_functions == NULL) {
+			return NULL;
+		}
+	}
+	PyObject * pyStacks = PyDict_Copy(pyphp_profile_stacks);
+	PyObject * pyFunctions = PyDict_Copy(pyphp_profile_functions);
+	return Py_BuildValue("{s:N,s:N,s:K,s:K,s:d}",
+		"stacks", pyStacks,
+		"functions", pyFunctions,
+		"samples", pyphp_profile_samplesTotal,
+		"dropped", pyphp_profile_droppedTotal,
+		"interval", pyphp_profile_interval / 1e6
+	);
+}
+
+/*******************************************************************************
+ * Clears the aggregated profile.
+ ******************************************************************************/
+void pyphp_profile_clear(void) {
+	if (pyphp_profile_stacks != NULL) {
+		PyDict_Clear(pyphp_profile_stacks);
+		PyDict_Clear(pyphp_profile_functions);
+	}
+	pyphp_profile_samplesTotal = 0;
+	pyphp_profile_droppedTotal = 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * pyphp-profile.h provides the sampling profiler of PHP scripts.
+ *
+ * While the profiler is enabled (pyphp.setProfiler(interval)), a POSIX timer
+ * on the CPU clock of the thread running PHP (CLOCK_THREAD_CPUTIME_ID) signals
+ * that thread (SIGPROF) every interval of its CPU time while it executes a
+ * script, and the handler records the PHP call stack
+ * (EG(current_execute_data)) into a preallocated buffer. The samples are
+ * aggregated into Python dicts right after the script ran, while the function
+ * and file names they point at are still alive: by collapsed stack, and by the
+ * function and file:line the samples were taken in (self time).
+ *
+ * The cost is one signal and a stack walk per sample, so at an interval of 10
+ * ms it is well under 1% of the CPU time.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_PROFILE_H
+#define PYPHP_PROFILE_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+// The most samples recorded per script execution (more are dropped).
+#define PYPHP_PROFILE_MAX_SAMPLES 1024
+
+// The most frames recorded per sample (outer frames are cut).
+#define PYPHP_PROFILE_MAX_DEPTH 32
+
+/**
+ * Enables, changes or disables the profiler.
+ *
+ * @param double interval The sampling interval in seconds of CPU time, or 0
+ * to disable the profiler.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_profile_setInterval(double interval);
+
+/**
+ * Builds the aggregated profile.
+ *
+ * @param bool collapsed Whether the profile is built as collapsed stacks.
+ * @return PyObject* If collapsed, a string of collapsed stacks ("frame;frame
+ * samples" lines, as taken by flamegraph.pl); otherwise, a dict (stacks,
+ * functions, samples, dropped and interval). NULL with a python exception set
+ * on failure.
+ */
+PyObject * pyphp_profile_get(bool collapsed);
+
+/**
+ * Clears the aggregated profile.
+ */
+void pyphp_profile_clear(void);
+
+/**
+ * Starts sampling a script execution.
+ *
+ * @return bool Whether samples are taken (pass it to pyphp_profile_php_end()).
+ */
+bool pyphp_profile_php_begin(void);
+
+/**
+ * Stops sampling a script execution and aggregates its samples.
+ *
+ * Called before the request shuts down.
+ *
+ * @param bool isSampled What pyphp_profile_php_begin() returned.
+ */
+void pyphp_profile_php_end(bool isSampled);
+
+#endif
@@ -0,0 +1,346 @@
+/**
+ * pyphp-render.c provides rendering PHP scripts to strings and the rendered
+ * output cache.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-lru.h"
+#include "pyphp-render.h"
+#include "pyphp-vfs.h"
+
+extern PyObject * pyphp_exception;
+
+// The rendered output (key => PyString*).
+static pyphp_lru_t pyphp_render_cache;
+
+// Whether the render cache has been initialized.
+static bool pyphp_render_isCacheInit = false;
+
+// The default time-to-live of rendered output in nanoseconds (0 for ever).
+static uint64_t pyphp_render_ttl = 0;
+
+/*******************************************************************************
+ * Releases cached output.
+ *
+ * @param void* value The output (a PyString).
+ ******************************************************************************/
+static void pyphp_render_releaseOutput(void * value) {
+	Py_DECREF((PyObject *)value);
+}
+
+/*******************************************************************************
+ * Hashes the identity of a script and its variables.
+ *
+ * @param char* filename The filename of the script.
+ * @param PyObject* pyVars The global variables, or NULL.
+ * @param bool escape Whether strings are HTML escaped.
+ * @param uint64_t* hash Where the hash is stored.
+ * @return int If hashed, 1; if the script or its variables can't be cached,
+ * 0; on error, -1 with a python exception set.
+ ******************************************************************************/
+static int pyphp_render_hash(const char * filename, PyObject * pyVars, bool escape, uint64_t * hash) {
+	size_t filenameLen = strlen(filename);
+	*hash = pyphp_core_hash_bytes(filename, filenameLen, 0);
+	
+	// NOTE: a changed script must not be served its stale output.
+	pyphp_vfs_file_t * file = pyphp_vfs_find(filename, filenameLen);
+	if (file != NULL) {
+		pyphp_core_hash_mix(hash, file->version);
+	} else {
+		struct stat info;
+		if (stat(filename, &info) != 0) {
+			return 0;
+		}
+		pyphp_core_hash_mix(hash, (uint64_t)info.st_mtime);
+		pyphp_core_hash_mix(hash, (uint64_t)info.st_size);
+		pyphp_core_hash_mix(hash, (uint64_t)info.st_ino);
+	}
+	
+	// NOTE: the output also depends on state set outside of the render.
+	pyphp_core_hash_mix(hash, pyphp_core.generation);
+	
+	// NOTE: the output is cached as it was compressed.
+	if (pyphp_compress.isEnabled) {
+		pyphp_core_hash_mix(hash, 1 + (uint64_t)pyphp_compress.format * 16 + (uint64_t)(pyphp_compress.level + 1));
+	}
+	
+	if (pyVars == NULL) {
+		return 1;
+	}
+	pyphp_core_convert_t options = {
+		.persistent = false,
+		.inputHash = hash,
+		.hashOnly = true,
+		.escape = escape
+	};
+	Py_ssize_t pos = 0;
+	PyObject * pyKey;
+	PyObject * pyValue;
+	char name[256];
+	while (PyDict_Next(pyVars, &pos, &pyKey, &pyValue)) {
+		if (!pyphp_core_getVarName(pyKey, name)) {
+			return -1;
+		}
+		pyphp_core_hash_mix(hash, pyphp_core_hash_bytes(name, strlen(name), 0));
+		if (!pyphp_core_convert_pyObjectToZvalEx(pyValue, NULL, &options)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*******************************************************************************
+ * Builds the cache key of a render.
+ *
+ * NOTE: keys begin with the filename and a newline so that the output of a
+ * script can be removed by prefix.
+ *
+ * @param char* filename The filename of the script.
+ * @param uint64_t hash The hash of the script and its variables.
+ * @param char* key The buffer (of at least PATH_MAX + 18 characters) where the
+ * key will be stored.
+ * @return size_t The length of the key, or 0 if the filename is too long.
+ ******************************************************************************/
+static size_t pyphp_render_key(const char * filename, uint64_t hash, char * key) {
+	int keyLen = snprintf(key, PATH_MAX + 18, "%s\n%016llx", filename, (unsigned long long)hash);
+	if (keyLen < 0 || keyLen >= PATH_MAX + 18) {
+		return 0;
+	}
+	return keyLen;
+}
+
+/*******************************************************************************
+ * Sets the global variables of a render.
+ *
+ * @param PyObject* pyVars The global variables.
+ * @param bool escape Whether strings are HTML escaped.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+static bool pyphp_render_setVars(PyObject * pyVars, bool escape) {
+	Py_ssize_t pos = 0;
+	PyObject * pyKey;
+	PyObject * pyValue;
+	zval * phpValue;
+	char name[256];
+	const pyphp_core_convert_t options = {
+		.escape = escape
+	};
+	while (PyDict_Next(pyVars, &pos, &pyKey, &pyValue)) {
+		if (!pyphp_core_getVarName(pyKey, name)) {
+			return false;
+		}
+		if (pyphp_core_convert_pyObjectToZvalEx(pyValue, &phpValue, &options)) {
+			// NOTE: the symbol table takes ownership of the value.
+			pyphp_core_php_setGlobalVar(name, phpValue);
+		} else {
+			printf("%s:%u Failed to convert python value to php value!\n", __FUNCTION__, __LINE__);
+		}
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Joins the captured output chunks into one string.
+ *
+ * @param PyObject* pyChunks The chunks (a list of strings).
+ * @return PyObject* On success, the output; otherwise, NULL with a python
+ * exception set.
+ ******************************************************************************/
+static PyObject * pyphp_render_join(PyObject * pyChunks) {
+	const Py_ssize_t count = PyList_GET_SIZE(pyChunks);
+	if (count == 1) {
+		PyObject * pyOutput = PyList_GET_ITEM(pyChunks, 0);
+		Py_INCREF(pyOutput);
+		return pyOutput;
+	}
+	Py_ssize_t length = 0;
+	Py_ssize_t i;
+	for (i = 0; i < count; i++) {
+		length += PyString_GET_SIZE(PyList_GET_ITEM(pyChunks, i));
+	}
+	PyObject * pyOutput = PyString_FromStringAndSize(NULL, length);
+	if (pyOutput == NULL) {
+		return NULL;
+	}
+	char * output = PyString_AS_STRING(pyOutput);
+	for (i = 0; i < count; i++) {
+		PyObject * pyChunk = PyList_GET_ITEM(pyChunks, i);
+		memcpy(output, PyString_AS_STRING(pyChunk), PyString_GET_SIZE(pyChunk));
+		output += PyString_GET_SIZE(pyChunk);
+	}
+	return pyOutput;
+}
+
+/*******************************************************************************
+ * Runs a script, capturing its output.
+ *
+ * @param char* filename The filename of the script.
+ * @param PyObject* pyVars The global variables, or NULL.
+ * @param bool escape Whether strings are HTML escaped.
+ * @return PyObject* On success, the output; otherwise, NULL with a python
+ * exception set.
+ ******************************************************************************/
+static PyObject * pyphp_render_run(const char * filename, PyObject * pyVars, bool escape) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	TSRMLS_FETCH();
+	if (pyphp_core.capture != NULL) {
+		PyErr_SetString(pyphp_exception, "PHP is already capturing output");
+		return NULL;
+	}
+	
+	zend_file_handle script;
+	if (!pyphp_core_php_openScript(&script, (char *)filename)) {
+		PyErr_Format(pyphp_exception, "Failed to open %s", filename);
+		return NULL;
+	}
+	
+	pyphp_core_marshal_t marshal;
+	pyphp_core_marshal_start(&marshal);
+	bool isSet = (pyVars == NULL || pyphp_render_setVars(pyVars, escape));
+	pyphp_core_marshal_end(&marshal);
+	if (!isSet) {
+		zend_file_handle_dtor(&script TSRMLS_CC);
+		pyphp_core_php_reset();
+		return NULL;
+	}
+	
+	PyObject * pyChunks = PyList_New(0);
+	if (pyChunks == NULL) {
+		zend_file_handle_dtor(&script TSRMLS_CC);
+		pyphp_core_php_reset();
+		return NULL;
+	}
+	pyphp_core_capture_t capture = {
+		.chunks = pyChunks,
+		.pending = {.data = NULL, .length = 0, .size = 0}
+	};
+	pyphp_core.capture = &capture;
+	
+	int result = pyphp_core_php_execute(&script);
+	
+	// NOTE: shutting the request down flushes the output buffers, so keep
+	// capturing until PHP has been reset.
+	pyphp_core_php_reset();
+	pyphp_core_capture_flush(&capture);
+	pyphp_core.capture = NULL;
+	pyphp_core_buffer_free(&capture.pending);
+	
+	PyObject * pyOutput = NULL;
+	if (result == FAILURE && !PyErr_Occurred()) {
+		PyErr_SetString(pyphp_exception, "An unknown PHP interpreter error occured");
+	} else if (!PyErr_Occurred()) {
+		pyOutput = pyphp_render_join(pyChunks);
+	}
+	Py_DECREF(pyChunks);
+	return pyOutput;
+}
+
+/*******************************************************************************
+ * Renders a script.
+ *
+ * @param char* filename The filename of the script.
+ * @param PyObject* pyVars The global variables ($name => value), or NULL.
+ * @param double ttl How long the output is cached in seconds, 0 to use the
+ * default, or a negative number not to cache it.
+ * @param bool escape Whether strings are HTML escaped as they are converted.
+ * @return PyObject* On success, the output (a string); otherwise, NULL with a
+ * python exception set.
+ ******************************************************************************/
+PyObject * pyphp_render_render(const char * filename, PyObject * pyVars, double ttl, bool escape) {
+	if (!pyphp_render_isCacheInit || pyphp_render_cache.maxBytes == 0 || ttl < 0) {
+		return pyphp_render_run(filename, pyVars, escape);
+	}
+	
+	uint64_t hash;
+	int isHashed = pyphp_render_hash(filename, pyVars, escape, &hash);
+	if (isHashed < 0) {
+		return NULL;
+	}
+	char key[PATH_MAX + 18];
+	size_t keyLen = (isHashed ? pyphp_render_key(filename, hash, key) : 0);
+	if (keyLen == 0) {
+		return pyphp_render_run(filename, pyVars, escape);
+	}
+	
+	pyphp_lru_entry_t * entry = pyphp_lru_find(&pyphp_render_cache, key, keyLen);
+	if (entry != NULL) {
+		PyObject * pyOutput = (PyObject *)entry->value;
+		Py_INCREF(pyOutput);
+		return pyOutput;
+	}
+	
+	PyObject * pyOutput = pyphp_render_run(filename, pyVars, escape);
+	if (pyOutput != NULL) {
+		Py_INCREF(pyOutput);
+		pyphp_lru_put(&pyphp_render_cache, key, keyLen, pyOutput, PyString_GET_SIZE(pyOutput), ttl > 0 ? (uint64_t)(ttl * 1e9) : pyphp_render_ttl);
+	}
+	return pyOutput;
+}
+
+/*******************************************************************************
+ * Configures the render cache.
+ *
+ * @param size_t maxBytes The byte budget (0 empties and disables the cache).
+ * @param double ttl The default time-to-live in seconds (0 for ever).
+ ******************************************************************************/
+void pyphp_render_setCache(size_t maxBytes, double ttl) {
+	if (!pyphp_render_isCacheInit) {
+		pyphp_lru_init(&pyphp_render_cache, maxBytes, pyphp_render_releaseOutput);
+		pyphp_render_isCacheInit = true;
+	} else {
+		pyphp_lru_setMaxBytes(&pyphp_render_cache, maxBytes);
+	}
+	pyphp_render_ttl = (ttl > 0 ? (uint64_t)(ttl * 1e9) : 0);
+}
+
+/*******************************************************************************
+ * Removes cached output.
+ *
+ * @param char* filename The filename of the script whose output is removed, or
+ * NULL for all output.
+ * @return int The number of entries removed.
+ ******************************************************************************/
+int pyphp_render_clearCache(const char * filename) {
+	if (!pyphp_render_isCacheInit) {
+		return 0;
+	}
+	if (filename == NULL) {
+		int count = zend_hash_num_elements(&pyphp_render_cache.entries);
+		pyphp_lru_clear(&pyphp_render_cache);
+		return count;
+	}
+	char prefix[PATH_MAX + 1];
+	int prefixLen = snprintf(prefix, sizeof(prefix), "%s\n", filename);
+	if (prefixLen < 0 || prefixLen >= (int)sizeof(prefix)) {
+		return 0;
+	}
+	return pyphp_lru_removePrefix(&pyphp_render_cache, prefix, prefixLen);
+}
+
+/*******************************************************************************
+ * Builds a Python dict of the render cache counters.
+ *
+ * @return PyObject* The dict.
+ ******************************************************************************/
+PyObject * pyphp_render_cacheStats(void) {
+	if (!pyphp_render_isCacheInit) {
+		pyphp_render_setCache(0, 0);
+	}
+	return pyphp_lru_stats(&pyphp_render_cache);
+}
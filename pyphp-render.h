@@ -0,0 +1,67 @@
+/**
+ * pyphp-render.h provides rendering PHP scripts to strings (pyphp.render())
+ * and the rendered output cache.
+ *
+ * When the render cache is enabled, the output of a render is stored under
+ * the identity of the script (its filename plus its modification time, or its
+ * version when mounted) and a structural hash of its variables. Rendering the
+ * same script with equal variables again returns the stored output without
+ * entering PHP at all.
+ *
+ * Only use the cache for scripts whose output depends on their variables
+ * alone.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_RENDER_H
+#define PYPHP_RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * Renders a script.
+ *
+ * @param char* filename The filename of the script.
+ * @param PyObject* pyVars The global variables ($name => value), or NULL.
+ * @param double ttl How long the output is cached in seconds, 0 to use the
+ * default, or a negative number not to cache it.
+ * @param bool escape Whether strings are HTML escaped as they are converted.
+ * @return PyObject* On success, the output (a string); otherwise, NULL with a
+ * python exception set.
+ */
+PyObject * pyphp_render_render(const char * filename, PyObject * pyVars, double ttl, bool escape);
+
+/**
+ * Configures the render cache.
+ *
+ * @param size_t maxBytes The byte budget (0 empties and disables the cache).
+ * @param double ttl The default time-to-live in seconds (0 for ever).
+ */
+void pyphp_render_setCache(size_t maxBytes, double ttl);
+
+/**
+ * Removes cached output.
+ *
+ * @param char* filename The filename of the script whose output is removed, or
+ * NULL for all output.
+ * @return int The number of entries removed.
+ */
+int pyphp_render_clearCache(const char * filename);
+
+/**
+ * Builds a Python dict of the render cache counters.
+ *
+ * @return PyObject* The dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ */
+PyObject * pyphp_render_cacheStats(void);
+
+#endif
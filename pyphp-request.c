@@ -0,0 +1,282 @@
+/**
+ * pyphp-request.c implements the population of the PHP super globals from a
+ * WSGI environ.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+#include <main/php_variables.h>
+
+#include "pyphp-core.h"
+#include "pyphp-request.h"
+
+// The WSGI environ of the current request, or NULL.
+static PyObject * pyphp_request_pyEnviron = NULL;
+
+// The internal PHP $_REQUEST callback.
+static zend_auto_global_callback pyphp_request_phpCreateRequest = NULL;
+
+/*******************************************************************************
+ * Returns a string from the WSGI environ.
+ *
+ * @param char* key The environ key.
+ * @param Py_ssize_t* length Where the length of the string will be stored
+ * (optional).
+ * @return char* The string, or NULL if the key is missing or not a string.
+ ******************************************************************************/
+static const char * pyphp_request_getString(const char * key, Py_ssize_t * length) {
+	PyObject * pyValue = PyDict_GetItemString(pyphp_request_pyEnviron, key);
+	if (pyValue == NULL || !PyString_Check(pyValue)) {
+		return NULL;
+	}
+	if (length != NULL) {
+		*length = PyString_GET_SIZE(pyValue);
+	}
+	return PyString_AS_STRING(pyValue);
+}
+
+/*******************************************************************************
+ * Publishes a tracked variables array as its super global.
+ *
+ * @param char* name The name of the super global.
+ * @param uint nameLen The length of the name (excluding the terminating NUL).
+ * @param int track The tracked variables index (TRACK_VARS_*).
+ ******************************************************************************/
+static void pyphp_request_php_publish(char * name, uint nameLen, int track TSRMLS_DC) {
+	zval * trackVars = PG(http_globals)[track];
+	if (trackVars == NULL) {
+		return;
+	}
+	Z_ADDREF_P(trackVars);
+	zend_hash_update(&EG(symbol_table), name, nameLen+1, &trackVars, sizeof(zval *), NULL);
+}
+
+/*******************************************************************************
+ * The $_GET callback: parses QUERY_STRING.
+ ******************************************************************************/
+static zend_bool pyphp_request_php_createGet(char * name, uint nameLen TSRMLS_DC) {
+	if (pyphp_request_pyEnviron == NULL) {
+		return 0;
+	}
+	const char * query = pyphp_request_getString("QUERY_STRING", NULL);
+	if (query != NULL && *query) {
+		// NOTE: treat_data() copies the query string.
+		SG(request_info).query_string = (char *)query;
+		sapi_module.treat_data(PARSE_GET, NULL, NULL TSRMLS_CC);
+		SG(request_info).query_string = NULL;
+		pyphp_request_php_publish(name, nameLen, TRACK_VARS_GET TSRMLS_CC);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * The $_COOKIE callback: parses HTTP_COOKIE.
+ ******************************************************************************/
+static zend_bool pyphp_request_php_createCookie(char * name, uint nameLen TSRMLS_DC) {
+	if (pyphp_request_pyEnviron == NULL) {
+		return 0;
+	}
+	const char * cookie = pyphp_request_getString("HTTP_COOKIE", NULL);
+	if (cookie != NULL && *cookie) {
+		// NOTE: treat_data() copies the cookie data.
+		SG(request_info).cookie_data = (char *)cookie;
+		sapi_module.treat_data(PARSE_COOKIE, NULL, NULL TSRMLS_CC);
+		SG(request_info).cookie_data = NULL;
+		pyphp_request_php_publish(name, nameLen, TRACK_VARS_COOKIE TSRMLS_CC);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * The $_POST callback: reads and parses an url-encoded form body from
+ * wsgi.input.
+ *
+ * @todo Parse multipart/form-data bodies.
+ ******************************************************************************/
+static zend_bool pyphp_request_php_createPost(char * name, uint nameLen TSRMLS_DC) {
+	if (pyphp_request_pyEnviron == NULL) {
+		return 0;
+	}
+	const char * method = pyphp_request_getString("REQUEST_METHOD", NULL);
+	const char * contentType = pyphp_request_getString("CONTENT_TYPE", NULL);
+	const char * contentLength = pyphp_request_getString("CONTENT_LENGTH", NULL);
+	PyObject * pyInput = PyDict_GetItemString(pyphp_request_pyEnviron, "wsgi.input");
+	if (method == NULL || strcasecmp(method, "POST") != 0
+	    || contentType == NULL || strncasecmp(contentType, "application/x-www-form-urlencoded", sizeof("application/x-www-form-urlencoded")-1) != 0
+	    || contentLength == NULL || pyInput == NULL) {
+		return 0;
+	}
+	char * end;
+	errno = 0;
+	long length = strtol(contentLength, &end, 10);
+	if (errno != 0 || end == contentLength || *end != '\0' || length <= 0) {
+		return 0;
+	}
+	// Like PHP, refuse a body larger than post_max_size (without reading it).
+	if (SG(post_max_size) > 0 && length > SG(post_max_size)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "POST Content-Length of %ld bytes exceeds the limit of %ld bytes", length, SG(post_max_size));
+		return 0;
+	}
+	
+	// Read the body.
+	// - NOTE: a python exception raised by read() is left for the run to
+	//   report.
+	PyObject * pyBody = PyObject_CallMethod(pyInput, "read", "l", length);
+	if (pyBody == NULL) {
+		return 0;
+	}
+	if (PyString_Check(pyBody)) {
+		zval * trackVars;
+		ALLOC_ZVAL(trackVars);
+		array_init(trackVars);
+		INIT_PZVAL(trackVars);
+		// NOTE: treat_data() frees the string.
+		sapi_module.treat_data(PARSE_STRING, estrndup(PyString_AS_STRING(pyBody), PyString_GET_SIZE(pyBody)), trackVars TSRMLS_CC);
+		if (PG(http_globals)[TRACK_VARS_POST]) {
+			zval_ptr_dtor(&PG(http_globals)[TRACK_VARS_POST]);
+		}
+		PG(http_globals)[TRACK_VARS_POST] = trackVars;
+		pyphp_request_php_publish(name, nameLen, TRACK_VARS_POST TSRMLS_CC);
+	}
+	Py_DECREF(pyBody);
+	return 0;
+}
+
+/*******************************************************************************
+ * The $_REQUEST callback: builds $_GET, $_POST and $_COOKIE first so that
+ * $_REQUEST is merged from them.
+ ******************************************************************************/
+static zend_bool pyphp_request_php_createRequest(char * name, uint nameLen TSRMLS_DC) {
+	zend_is_auto_global("_GET", sizeof("_GET")-1 TSRMLS_CC);
+	zend_is_auto_global("_POST", sizeof("_POST")-1 TSRMLS_CC);
+	zend_is_auto_global("_COOKIE", sizeof("_COOKIE")-1 TSRMLS_CC);
+	return pyphp_request_phpCreateRequest ? pyphp_request_phpCreateRequest(name, nameLen TSRMLS_CC) : 0;
+}
+
+/*******************************************************************************
+ * Replaces the callback of an auto global.
+ *
+ * @param char* name The name of the auto global.
+ * @param uint nameLen The length of the name (excluding the terminating NUL).
+ * @param zend_auto_global_callback callback The new callback.
+ * @return zend_auto_global_callback The old callback.
+ ******************************************************************************/
+static zend_auto_global_callback pyphp_request_php_setCallback(char * name, uint nameLen, zend_auto_global_callback callback TSRMLS_DC) {
+	zend_auto_global * autoGlobal;
+	if (zend_hash_find(CG(auto_globals), name, nameLen+1, (void **)&autoGlobal) == FAILURE) {
+		printf("%s:%u Auto global %s is not registered!\n", __FUNCTION__, __LINE__, name);
+		return NULL;
+	}
+	zend_auto_global_callback old = autoGlobal->auto_global_callback;
+	autoGlobal->auto_global_callback = callback;
+	return old;
+}
+
+/*******************************************************************************
+ * Installs the super global callbacks.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_request_php_startup(void) {
+	TSRMLS_FETCH();
+	// $_GET, $_POST and $_COOKIE are created (empty) at request startup, but
+	// with a callback they get rebuilt from the environ the first time a script
+	// that uses them is compiled.
+	pyphp_request_php_setCallback("_GET", sizeof("_GET")-1, pyphp_request_php_createGet TSRMLS_CC);
+	pyphp_request_php_setCallback("_POST", sizeof("_POST")-1, pyphp_request_php_createPost TSRMLS_CC);
+	pyphp_request_php_setCallback("_COOKIE", sizeof("_COOKIE")-1, pyphp_request_php_createCookie TSRMLS_CC);
+	pyphp_request_phpCreateRequest = pyphp_request_php_setCallback("_REQUEST", sizeof("_REQUEST")-1, pyphp_request_php_createRequest TSRMLS_CC);
+}
+
+/*******************************************************************************
+ * Sets the WSGI environ the super globals of the current request are built
+ * from.
+ *
+ * @param PyObject* pyEnviron The WSGI environ dict.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_request_set(PyObject * pyEnviron) {
+	TSRMLS_FETCH();
+	if (!PyDict_Check(pyEnviron)) {
+		PyErr_SetString(PyExc_TypeError, "environ must be a dict");
+		return false;
+	}
+	Py_INCREF(pyEnviron);
+	Py_XDECREF(pyphp_request_pyEnviron);
+	pyphp_request_pyEnviron = pyEnviron;
+	pyphp_core.generation++;
+	
+	// $_SERVER is only built by the server variables handler if it's still
+	// pending, so fill it now if it was already built.
+	zval ** phpServer;
+	if (zend_hash_find(&EG(symbol_table), "_SERVER", sizeof("_SERVER"), (void **)&phpServer) == SUCCESS && Z_TYPE_PP(phpServer) == IS_ARRAY) {
+		pyphp_request_php_registerServerVariables(*phpServer TSRMLS_CC);
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Forgets the WSGI environ of the request that was shutdown.
+ ******************************************************************************/
+void pyphp_request_reset(void) {
+	Py_CLEAR(pyphp_request_pyEnviron);
+}
+
+/*******************************************************************************
+ * Finds a super global, building it first if it's a just-in-time one.
+ *
+ * @param char* name The name of the super global (e.g., "_SERVER").
+ * @param uint nameLen The length of the name (excluding the terminating NUL).
+ * @return zval* On success, the super global array; otherwise, NULL.
+ ******************************************************************************/
+zval * pyphp_request_php_findSuperGlobal(char * name, uint nameLen) {
+	TSRMLS_FETCH();
+	zval ** phpSuperGlobal;
+	if (zend_hash_find(&EG(symbol_table), name, nameLen+1, (void **)&phpSuperGlobal) == FAILURE) {
+		// Build it if it hasn't been used yet.
+		if (!zend_is_auto_global(name, nameLen TSRMLS_CC)
+		    || zend_hash_find(&EG(symbol_table), name, nameLen+1, (void **)&phpSuperGlobal) == FAILURE) {
+			return NULL;
+		}
+	}
+	if (Z_TYPE_PP(phpSuperGlobal) != IS_ARRAY) {
+		return NULL;
+	}
+	return *phpSuperGlobal;
+}
+
+/*******************************************************************************
+ * The PHP register server variables handler (builds $_SERVER).
+ *
+ * Without an environ this imports the process environment, just like PHP
+ * embed does.
+ *
+ * @param zval* trackVars The $_SERVER array.
+ ******************************************************************************/
+void pyphp_request_php_registerServerVariables(zval * trackVars TSRMLS_DC) {
+	if (pyphp_request_pyEnviron == NULL) {
+		php_import_environment_variables(trackVars TSRMLS_CC);
+		return;
+	}
+	// Only the CGI (string) variables are registered; wsgi.* values aren't.
+	PyObject * pyKey;
+	PyObject * pyValue;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(pyphp_request_pyEnviron, &pos, &pyKey, &pyValue)) {
+		if (PyString_Check(pyKey) && PyString_Check(pyValue)) {
+			php_register_variable_safe(PyString_AS_STRING(pyKey), PyString_AS_STRING(pyValue), PyString_GET_SIZE(pyValue), trackVars TSRMLS_CC);
+		}
+	}
+}
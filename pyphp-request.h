@@ -0,0 +1,60 @@
+/**
+ * pyphp-request.h provides the population of the PHP super globals from a
+ * WSGI environ.
+ *
+ * The super globals are only built when a script uses them: $_SERVER through
+ * the SAPI server variables hook, and $_GET, $_POST and $_COOKIE through their
+ * auto global callbacks, which parse the request data in C.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_REQUEST_H
+#define PYPHP_REQUEST_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/*******************************************************************************
+ * Installs the super global callbacks.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_request_php_startup(void);
+
+/*******************************************************************************
+ * Sets the WSGI environ the super globals of the current request are built
+ * from.
+ *
+ * @param PyObject* pyEnviron The WSGI environ dict.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+bool pyphp_request_set(PyObject * pyEnviron);
+
+/*******************************************************************************
+ * Forgets the WSGI environ of the request that was shutdown.
+ ******************************************************************************/
+void pyphp_request_reset(void);
+
+/*******************************************************************************
+ * Finds a super global, building it first if it's a just-in-time one.
+ *
+ * @param char* name The name of the super global (e.g., "_SERVER").
+ * @param uint nameLen The length of the name (excluding the terminating NUL).
+ * @return zval* On success, the super global array; otherwise, NULL.
+ ******************************************************************************/
+zval * pyphp_request_php_findSuperGlobal(char * name, uint nameLen);
+
+/*******************************************************************************
+ * The PHP register server variables handler (builds $_SERVER).
+ *
+ * @param zval* trackVars The $_SERVER array.
+ ******************************************************************************/
+void pyphp_request_php_registerServerVariables(zval * trackVars TSRMLS_DC);
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * pyphp-scope.c implements prebuilt PHP global scopes (pyphp.Scope).
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-scope.h"
+
+/*******************************************************************************
+ * Gets the PHP variable name from a scope key.
+ *
+ * @param PyObject* pyKey The key (a string beginning with a dollar sign).
+ * @param uint* nameLen Where the length of the name (including the
+ * terminating NUL) will be stored.
+ * @return char* On success, the name (without the dollar sign); otherwise,
+ * NULL with a python exception set.
+ ******************************************************************************/
+static char * pyphp_scope_varName(PyObject * pyKey, uint * nameLen) {
+	if (!PyString_Check(pyKey)) {
+		PyErr_SetString(PyExc_TypeError, "PHP variable names must be strings");
+		return NULL;
+	}
+	char * key = PyString_AS_STRING(pyKey);
+	if (key[0] != '$' || key[1] == '\0') {
+		PyErr_Format(PyExc_KeyError, "Invalid name: %s - PHP variables must begin with a dollar sign ($)", key);
+		return NULL;
+	}
+	*nameLen = PyString_GET_SIZE(pyKey);
+	return &(key[1]);
+}
+
+/*******************************************************************************
+ * Sets or unsets a scope variable.
+ *
+ * @param pyphp_scope_t* self Myself.
+ * @param PyObject* pyKey The variable name.
+ * @param PyObject* pyValue The value, or NULL to unset the variable.
+ * @return int On success, 0; otherwise, -1 with a python exception set.
+ ******************************************************************************/
+static int pyphp_scope_assign(pyphp_scope_t * self, PyObject * pyKey, PyObject * pyValue) {
+	uint nameLen;
+	char * name = pyphp_scope_varName(pyKey, &nameLen);
+	if (name == NULL) {
+		return -1;
+	}
+	
+	if (pyValue == NULL) {
+		if (zend_hash_del(self->vars, name, nameLen) == FAILURE) {
+			PyErr_SetObject(PyExc_KeyError, pyKey);
+			return -1;
+		}
+		return 0;
+	}
+	
+	const pyphp_core_convert_t options = {
+		.persistent = true
+	};
+	zval * phpValue = NULL;
+	if (!pyphp_core_convert_pyObjectToZvalEx(pyValue, &phpValue, &options)) {
+		PyErr_Format(PyExc_TypeError, "Failed to convert the value of %s to a PHP value", PyString_AS_STRING(pyKey));
+		return -1;
+	}
+	if (zend_hash_update(self->vars, name, nameLen, &phpValue, sizeof(phpValue), NULL) == FAILURE) {
+		pyphp_core_persistent_zval_ptr_dtor(&phpValue);
+		PyErr_NoMemory();
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * Sets scope variables from a dict.
+ *
+ * @param pyphp_scope_t* self Myself.
+ * @param PyObject* pyDict The dict of variables ($name => value).
+ * @return int On success, 0; otherwise, -1 with a python exception set.
+ ******************************************************************************/
+static int pyphp_scope_assignDict(pyphp_scope_t * self, PyObject * pyDict) {
+	if (!PyDict_Check(pyDict)) {
+		PyErr_SetString(PyExc_TypeError, "Scope variables must be a dict");
+		return -1;
+	}
+	PyObject * pyKey;
+	PyObject * pyValue;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(pyDict, &pos, &pyKey, &pyValue)) {
+		if (pyphp_scope_assign(self, pyKey, pyValue) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * Creates a scope.
+ ******************************************************************************/
+static PyObject * pyphp_scope_new(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
+	pyphp_scope_t * self = (pyphp_scope_t *)type->tp_alloc(type, 0);
+	if (self == NULL) {
+		return NULL;
+	}
+	self->vars = (HashTable *)pemalloc(sizeof(HashTable), 1);
+	zend_hash_init(self->vars, 8, NULL, pyphp_core_persistent_zval_release, 1);
+	return (PyObject *)self;
+}
+
+/*******************************************************************************
+ * Initializes a scope.
+ *
+ * Arguments:
+ * - PyDict* vars (optional) The variables ($name => value) to set.
+ ******************************************************************************/
+static int pyphp_scope_init(pyphp_scope_t * self, PyObject * args, PyObject * kwargs) {
+	PyObject * pyVars = NULL;
+	if (!PyArg_ParseTuple(args, "|O:pyphp.Scope", &pyVars)) {
+		return -1;
+	}
+	if (pyVars != NULL) {
+		return pyphp_scope_assignDict(self, pyVars);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * Destroys a scope.
+ *
+ * NOTE: variables still bound into the current request are released once the
+ * request shuts down.
+ ******************************************************************************/
+static void pyphp_scope_dealloc(pyphp_scope_t * self) {
+	if (self->vars != NULL) {
+		zend_hash_destroy(self->vars);
+		pefree(self->vars, 1);
+		self->vars = NULL;
+	}
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+/*******************************************************************************
+ * Returns the number of scope variables.
+ ******************************************************************************/
+static Py_ssize_t pyphp_scope_length(pyphp_scope_t * self) {
+	return zend_hash_num_elements(self->vars);
+}
+
+/*******************************************************************************
+ * Checks whether a variable is set (`$name in scope`).
+ ******************************************************************************/
+static int pyphp_scope_contains(pyphp_scope_t * self, PyObject * pyKey) {
+	uint nameLen;
+	char * name = pyphp_scope_varName(pyKey, &nameLen);
+	if (name == NULL) {
+		return -1;
+	}
+	return zend_hash_exists(self->vars, name, nameLen);
+}
+
+/*******************************************************************************
+ * Sets scope variables from a dict (`scope.update(dict)`).
+ ******************************************************************************/
+static PyObject * pyphp_scope_update(pyphp_scope_t * self, PyObject * args) {
+	PyObject * pyVars;
+	if (!PyArg_ParseTuple(args, "O:pyphp.Scope.update", &pyVars)) {
+		return NULL;
+	}
+	if (pyphp_scope_assignDict(self, pyVars) != 0) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Unsets all scope variables (`scope.clear()`).
+ ******************************************************************************/
+static PyObject * pyphp_scope_clear(pyphp_scope_t * self, PyObject * args) {
+	zend_hash_clean(self->vars);
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Returns the scope variable names (`scope.keys()`).
+ ******************************************************************************/
+static PyObject * pyphp_scope_keys(pyphp_scope_t * self, PyObject * args) {
+	PyObject * pyKeys = PyList_New(0);
+	if (pyKeys == NULL) {
+		return NULL;
+	}
+	HashPosition pos;
+	char * name;
+	uint nameLen;
+	ulong index;
+	for (zend_hash_internal_pointer_reset_ex(self->vars, &pos);
+	     zend_hash_get_current_key_ex(self->vars, &name, &nameLen, &index, 0, &pos) == HASH_KEY_IS_STRING;
+	     zend_hash_move_forward_ex(self->vars, &pos)) {
+		PyObject * pyKey = PyString_FromFormat("$%s", name);
+		if (pyKey == NULL || PyList_Append(pyKeys, pyKey) != 0) {
+			Py_XDECREF(pyKey);
+			Py_DECREF(pyKeys);
+			return NULL;
+		}
+		Py_DECREF(pyKey);
+	}
+	return pyKeys;
+}
+
+/*******************************************************************************
+ * Binds the scope's variables into the current PHP request.
+ *
+ * @param pyphp_scope_t* scope The scope to bind.
+ ******************************************************************************/
+void pyphp_scope_bind(pyphp_scope_t * scope) {
+	pyphp_core_php_bindVars(scope->vars);
+}
+
+static PyMappingMethods pyphp_scope_mapping = {
+	(lenfunc)pyphp_scope_length,            // mp_length
+	NULL,                                   // mp_subscript
+	(objobjargproc)pyphp_scope_assign       // mp_ass_subscript
+};
+
+static PySequenceMethods pyphp_scope_sequence = {
+	.sq_contains = (objobjproc)pyphp_scope_contains
+};
+
+static PyMethodDef pyphp_scope_methods[] = {
+	{"update", (PyCFunction)pyphp_scope_update, METH_VARARGS, "Sets variables from a dict."},
+	{"clear", (PyCFunction)pyphp_scope_clear, METH_NOARGS, "Unsets all variables."},
+	{"keys", (PyCFunction)pyphp_scope_keys, METH_NOARGS, "Returns the variable names."},
+	{NULL, NULL, 0, NULL}
+};
+
+PyTypeObject pyphp_scope_type = {
+	PyObject_HEAD_INIT(NULL)
+	.tp_name = "pyphp.Scope",
+	.tp_basicsize = sizeof(pyphp_scope_t),
+	.tp_dealloc = (destructor)pyphp_scope_dealloc,
+	.tp_as_sequence = &pyphp_scope_sequence,
+	.tp_as_mapping = &pyphp_scope_mapping,
+	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.tp_doc = "A prebuilt PHP global scope. Variables ($name => value) are converted when they are set, so binding the scope into a run with pyphp.setVar(scope) only costs a pointer per variable.",
+	.tp_methods = pyphp_scope_methods,
+	.tp_init = (initproc)pyphp_scope_init,
+	.tp_new = pyphp_scope_new
+};
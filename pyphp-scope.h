@@ -0,0 +1,47 @@
+/**
+ * pyphp-scope.h provides prebuilt PHP global scopes (pyphp.Scope).
+ *
+ * A scope converts its variables ahead of time into persistent PHP values, so
+ * binding it into a run only costs a pointer per variable.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_SCOPE_H
+#define PYPHP_SCOPE_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * The pyphp.Scope object.
+ */
+typedef struct pyphp_scope_t {
+	PyObject_HEAD
+	// The variables (name => persistent zval*).
+	HashTable * vars;
+} pyphp_scope_t;
+
+/**
+ * The pyphp.Scope type.
+ */
+extern PyTypeObject pyphp_scope_type;
+
+/**
+ * Checks whether the Python object is a pyphp.Scope.
+ */
+#define pyphp_scope_check(pyObj) PyObject_TypeCheck(pyObj, &pyphp_scope_type)
+
+/**
+ * Binds the scope's variables into the current PHP request.
+ *
+ * @param pyphp_scope_t* scope The scope to bind.
+ */
+void pyphp_scope_bind(pyphp_scope_t * scope);
+
+#endif
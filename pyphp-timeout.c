@@ -0,0 +1,189 @@
+/**
+ * pyphp-timeout.c provides wall clock deadlines for running PHP scripts.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+#include <zend_vm.h>
+
+#include "pyphp-core.h"
+#include "pyphp-timeout.h"
+
+extern PyObject * pyphp_exception;
+
+#if defined(ZEND_VM_KIND) && ZEND_VM_KIND == ZEND_VM_KIND_CALL
+#define PYPHP_TIMEOUT_IS_SUPPORTED 1
+#endif
+
+// NOTE: older C libraries only name the thread of SIGEV_THREAD_ID through the
+// union.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// How often the timer fires again after the deadline (in nanoseconds).
+#define PYPHP_TIMEOUT_RETRY 1000000
+
+// How many interrupt ops the redirected oplines point into.
+// - NOTE: an opcode handler that was running when the opline was redirected
+//   still advances it (by up to 2 opcodes), so it must land on another
+//   interrupt op.
+#define PYPHP_TIMEOUT_OPS 4
+
+// Whether the signal handler and the interrupt ops were set up.
+static bool pyphp_timeout_isInit = false;
+
+// The timer, once created, and the thread it signals.
+static timer_t pyphp_timeout_timer;
+static bool pyphp_timeout_hasTimer = false;
+static pid_t pyphp_timeout_thread = 0;
+
+// Whether a deadline is armed, and whether the script was interrupted.
+static volatile sig_atomic_t pyphp_timeout_isArmed = 0;
+static volatile sig_atomic_t pyphp_timeout_isInterrupted = 0;
+
+// The interrupt ops.
+static zend_op pyphp_timeout_ops[PYPHP_TIMEOUT_OPS];
+
+#ifdef PYPHP_TIMEOUT_IS_SUPPORTED
+/*******************************************************************************
+ * The handler of the interrupt op: bails out of the script.
+ ******************************************************************************/
+static int ZEND_FASTCALL pyphp_timeout_php_interrupt(ZEND_OPCODE_HANDLER_ARGS) {
+	// NOTE: once PHP bailed out, the executing frame is about to be freed, so
+	// the signal handler must not redirect it anymore.
+	pyphp_timeout_isArmed = 0;
+	pyphp_timeout_isInterrupted = 1;
+	// NOTE: like exit(), leaves the clean up to the request shutdown.
+	zend_bailout();
+	return 0;
+}
+#endif
+
+/*******************************************************************************
+ * The timer signal handler: redirects the executing frame to the interrupt
+ * op.
+ *
+ * @param int signo The signal number.
+ ******************************************************************************/
+static void pyphp_timeout_php_expire(int signo) {
+	if (!pyphp_timeout_isArmed) {
+		return;
+	}
+	TSRMLS_FETCH();
+	zend_execute_data * execute = EG(current_execute_data);
+	if (execute != NULL && execute->op_array != NULL && execute->opline != NULL) {
+		execute->opline = pyphp_timeout_ops;
+	}
+}
+
+/*******************************************************************************
+ * Creates the timer (signaling the thread running PHP) and the interrupt ops.
+ *
+ * @param pid_t thread The thread (ID) running PHP.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+static bool pyphp_timeout_init(pid_t thread) {
+#ifdef PYPHP_TIMEOUT_IS_SUPPORTED
+	if (!pyphp_timeout_isInit) {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = pyphp_timeout_php_expire;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGRTMIN, &action, NULL) != 0) {
+			PyErr_SetFromErrno(PyExc_OSError);
+			return false;
+		}
+		
+		memset(pyphp_timeout_ops, 0, sizeof(pyphp_timeout_ops));
+		for (int i = 0; i < PYPHP_TIMEOUT_OPS; i++) {
+			pyphp_timeout_ops[i].handler = pyphp_timeout_php_interrupt;
+			pyphp_timeout_ops[i].opcode = ZEND_NOP;
+		}
+		pyphp_timeout_isInit = true;
+	}
+	
+	// The signal must interrupt the thread running PHP, not whichever thread
+	// of the process the kernel would pick.
+	if (pyphp_timeout_hasTimer) {
+		timer_delete(pyphp_timeout_timer);
+		pyphp_timeout_hasTimer = false;
+	}
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGRTMIN;
+	event.sigev_notify_thread_id = thread;
+	if (timer_create(CLOCK_MONOTONIC, &event, &pyphp_timeout_timer) != 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return false;
+	}
+	pyphp_timeout_thread = thread;
+	pyphp_timeout_hasTimer = true;
+	return true;
+#else
+	PyErr_SetString(pyphp_exception, "Timeouts need PHP built with the CALL kind of VM");
+	return false;
+#endif
+}
+
+/*******************************************************************************
+ * Arms the deadline of the script about to run.
+ *
+ * @param long timeoutMs The timeout in milliseconds (0 for no deadline).
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_timeout_php_arm(long timeoutMs) {
+	pyphp_timeout_isInterrupted = 0;
+	if (timeoutMs <= 0) {
+		return true;
+	}
+	pid_t thread = (pid_t)syscall(SYS_gettid);
+	if ((!pyphp_timeout_hasTimer || pyphp_timeout_thread != thread) && !pyphp_timeout_init(thread)) {
+		return false;
+	}
+	
+	struct itimerspec deadline;
+	deadline.it_value.tv_sec = timeoutMs / 1000;
+	deadline.it_value.tv_nsec = (timeoutMs % 1000) * 1000000;
+	deadline.it_interval.tv_sec = 0;
+	deadline.it_interval.tv_nsec = PYPHP_TIMEOUT_RETRY;
+	pyphp_timeout_isArmed = 1;
+	if (timer_settime(pyphp_timeout_timer, 0, &deadline, NULL) != 0) {
+		pyphp_timeout_isArmed = 0;
+		PyErr_SetFromErrno(PyExc_OSError);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Disarms the deadline once the script ran (or bailed out).
+ *
+ * @return bool Whether the script was interrupted at its deadline.
+ ******************************************************************************/
+bool pyphp_timeout_php_disarm(void) {
+	pyphp_timeout_isArmed = 0;
+	if (pyphp_timeout_hasTimer) {
+		struct itimerspec never;
+		memset(&never, 0, sizeof(never));
+		timer_settime(pyphp_timeout_timer, 0, &never, NULL);
+	}
+	return pyphp_timeout_isInterrupted != 0;
+}
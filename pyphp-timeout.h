@@ -0,0 +1,47 @@
+/**
+ * pyphp-timeout.h provides wall clock deadlines for running PHP scripts
+ * (pyphp.runScript(..., timeout_ms=50)).
+ *
+ * A POSIX timer signals the deadline to the thread that armed it. The signal
+ * handler doesn't unwind PHP from the middle of whatever it is doing: it points
+ * the next opline of the executing frame at an interrupt op, which the VM runs
+ * as soon as the current opcode (or internal function call) returns, and which
+ * bails out of the script. The timer keeps firing every millisecond after the
+ * deadline in case a jump overrode the redirection or PHP wasn't executing,
+ * until the script returns or bails out. The destructors and shutdown
+ * functions run by the request shutdown aren't bounded: by then the frames of
+ * the script are being freed.
+ *
+ * Only the CALL kind of VM (PHP's default) can be interrupted.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_TIMEOUT_H
+#define PYPHP_TIMEOUT_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * Arms the deadline of the script about to run.
+ *
+ * @param long timeoutMs The timeout in milliseconds (0 for no deadline).
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_timeout_php_arm(long timeoutMs);
+
+/**
+ * Disarms the deadline once the script ran (or bailed out).
+ *
+ * @return bool Whether the script was interrupted at its deadline.
+ */
+bool pyphp_timeout_php_disarm(void);
+
+#endif
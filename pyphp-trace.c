@@ -0,0 +1,131 @@
+/**
+ * pyphp-trace.c provides tracing through a lock-free ring buffer.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-trace.h"
+
+// The ring buffer.
+struct pyphp_trace_t pyphp_trace;
+
+// The names of the kinds of events.
+static const char * pyphp_trace_kindNames[PYPHP_TRACE_KINDS] = {
+	"compile",
+	"marshal",
+	"execute",
+	"flush",
+	"reset",
+	"error",
+	"recycle"
+};
+
+/*******************************************************************************
+ * Records an event into the ring buffer.
+ *
+ * @param int kind The kind of the event.
+ * @param int phase The phase of the event.
+ * @param uint64_t value The value of the event.
+ ******************************************************************************/
+void pyphp_trace_record(int kind, int phase, uint64_t value) {
+	uint64_t head = pyphp_trace.head;
+	if (head - pyphp_trace.tail > pyphp_trace.mask) {
+		pyphp_trace.dropped++;
+		return;
+	}
+	pyphp_trace_event_t * event = &pyphp_trace.events[head & pyphp_trace.mask];
+	event->time = pyphp_core_now();
+	event->id = pyphp_trace.id;
+	event->value = value;
+	event->kind = (uint16_t)kind;
+	event->phase = (uint16_t)phase;
+	// NOTE: the event must be written before the drain can see it.
+	__sync_synchronize();
+	pyphp_trace.head = head + 1;
+}
+
+/*******************************************************************************
+ * Enables, resizes or disables tracing. Pending events are discarded.
+ *
+ * @param size_t capacity The number of events the ring buffer holds (rounded
+ * up to a power of two), or 0 to disable tracing.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_trace_setCapacity(size_t capacity) {
+	pyphp_trace_event_t * events = NULL;
+	size_t size = 0;
+	if (capacity > 0) {
+		size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		events = (pyphp_trace_event_t *)calloc(size, sizeof(pyphp_trace_event_t));
+		if (events == NULL) {
+			PyErr_NoMemory();
+			return false;
+		}
+	}
+	free(pyphp_trace.events);
+	pyphp_trace.events = events;
+	pyphp_trace.mask = (size > 0 ? size - 1 : 0);
+	pyphp_trace.head = 0;
+	pyphp_trace.tail = 0;
+	pyphp_trace.dropped = 0;
+	return true;
+}
+
+/*******************************************************************************
+ * Drains events from the ring buffer.
+ *
+ * @param size_t max The most events drained, or 0 for all.
+ * @return PyObject* On success, a list of (time, id, kind, phase, value)
+ * tuples; otherwise, NULL with a python exception set.
+ ******************************************************************************/
+PyObject * pyphp_trace_drain(size_t max) {
+	PyObject * pyEvents = PyList_New(0);
+	if (pyEvents == NULL || pyphp_trace.events == NULL) {
+		return pyEvents;
+	}
+	
+	uint64_t tail = pyphp_trace.tail;
+	uint64_t head = pyphp_trace.head;
+	// NOTE: the events up to the head must be read after the head.
+	__sync_synchronize();
+	if (max > 0 && head - tail > max) {
+		head = tail + max;
+	}
+	for (; tail < head; tail++) {
+		const pyphp_trace_event_t * event = &pyphp_trace.events[tail & pyphp_trace.mask];
+		char phase[2] = {(char)event->phase, '\0'};
+		PyObject * pyEvent = Py_BuildValue("(KKssK)",
+			(unsigned PY_LONG_LONG)event->time,
+			(unsigned PY_LONG_LONG)event->id,
+			event->kind < PYPHP_TRACE_KINDS ? pyphp_trace_kindNames[event->kind] : "unknown",
+			phase,
+			(unsigned PY_LONG_LONG)event->value
+		);
+		if (pyEvent == NULL || PyList_Append(pyEvents, pyEvent) != 0) {
+			Py_XDECREF(pyEvent);
+			Py_DECREF(pyEvents);
+			return NULL;
+		}
+		Py_DECREF(pyEvent);
+	}
+	// NOTE: the events must be read before the engine can overwrite them.
+	__sync_synchronize();
+	pyphp_trace.tail = tail;
+	return pyEvents;
+}
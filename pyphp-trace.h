@@ -0,0 +1,122 @@
+/**
+ * pyphp-trace.h provides tracing: timestamped span events recorded by the
+ * engine into a fixed-size ring buffer, which Python drains in batches
+ * (pyphp.drainTrace()).
+ *
+ * Events begin and end the spans of the phases of a run (compile, marshal,
+ * execute and reset) and of recycling PHP, or mark instants (output flushes
+ * and PHP errors), and carry the trace id set from Python
+ * (pyphp.setTraceId()) to correlate them with requests.
+ *
+ * The ring buffer has a single producer (the engine) and a single consumer
+ * (pyphp.drainTrace()), so it needs no lock. When it is full, new events are
+ * dropped and counted. While tracing is disabled (the default), recording an
+ * event costs one predicted branch.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_TRACE_H
+#define PYPHP_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Python.h>
+
+// The kinds of events.
+enum pyphp_trace_kind_t {
+	PYPHP_TRACE_COMPILE = 0,
+	PYPHP_TRACE_MARSHAL,
+	PYPHP_TRACE_EXECUTE,
+	PYPHP_TRACE_FLUSH,
+	PYPHP_TRACE_RESET,
+	PYPHP_TRACE_ERROR,
+	PYPHP_TRACE_RECYCLE,
+	PYPHP_TRACE_KINDS
+};
+
+// The phases of events: the beginning or end of a span, or an instant.
+enum pyphp_trace_phase_t {
+	PYPHP_TRACE_BEGIN = 'B',
+	PYPHP_TRACE_END = 'E',
+	PYPHP_TRACE_INSTANT = 'I'
+};
+
+/**
+ * An event.
+ */
+typedef struct pyphp_trace_event_t {
+	// The time of the monotonic clock in nanoseconds.
+	uint64_t time;
+	// The trace id.
+	uint64_t id;
+	// A value depending on the kind (the PHP error type for errors).
+	uint64_t value;
+	uint16_t kind;
+	uint16_t phase;
+} pyphp_trace_event_t;
+
+/**
+ * The ring buffer.
+ */
+extern struct pyphp_trace_t {
+	// The events, or NULL while tracing is disabled.
+	pyphp_trace_event_t * events;
+	// The capacity minus one (the capacity is a power of two).
+	size_t mask;
+	// The counts of events written (by the engine) and read (by the drain).
+	volatile uint64_t head;
+	volatile uint64_t tail;
+	// The count of events dropped because the buffer was full.
+	uint64_t dropped;
+	// The current trace id.
+	uint64_t id;
+} pyphp_trace;
+
+/**
+ * Records an event into the ring buffer.
+ *
+ * @param int kind The kind of the event.
+ * @param int phase The phase of the event.
+ * @param uint64_t value The value of the event.
+ */
+void pyphp_trace_record(int kind, int phase, uint64_t value);
+
+/**
+ * Records an event if tracing is enabled.
+ *
+ * @param int kind The kind of the event.
+ * @param int phase The phase of the event.
+ * @param uint64_t value The value of the event.
+ */
+static inline void pyphp_trace_emit(int kind, int phase, uint64_t value) {
+	if (__builtin_expect(pyphp_trace.events != NULL, 0)) {
+		pyphp_trace_record(kind, phase, value);
+	}
+}
+
+/**
+ * Enables, resizes or disables tracing. Pending events are discarded.
+ *
+ * @param size_t capacity The number of events the ring buffer holds (rounded
+ * up to a power of two), or 0 to disable tracing.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_trace_setCapacity(size_t capacity);
+
+/**
+ * Drains events from the ring buffer.
+ *
+ * @param size_t max The most events drained, or 0 for all.
+ * @return PyObject* On success, a list of (time, id, kind, phase, value)
+ * tuples; otherwise, NULL with a python exception set.
+ */
+PyObject * pyphp_trace_drain(size_t max);
+
+#endif
@@ -0,0 +1,376 @@
+/**
+ * pyphp-vfs.c implements the in-memory filesystem for PHP scripts.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h> // for PATH_MAX
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-vfs.h"
+
+// The mounted scripts (absolute path => pyphp_vfs_file_t).
+static HashTable * pyphp_vfs_files = NULL;
+
+// The version of the last mounted script.
+static ulong pyphp_vfs_version = 0;
+
+// The PHP stream open and resolve path handlers being overridden.
+static int (* pyphp_vfs_phpStreamOpen)(const char * filename, zend_file_handle * handle TSRMLS_DC) = NULL;
+static char * (* pyphp_vfs_phpResolvePath)(const char * filename, int filenameLen TSRMLS_DC) = NULL;
+
+/*******************************************************************************
+ * Frees a mounted script.
+ *
+ * @param void* pData The script.
+ ******************************************************************************/
+static void pyphp_vfs_file_dtor(void * pData) {
+	pyphp_vfs_file_t * file = (pyphp_vfs_file_t *)pData;
+	pefree(file->source, 1);
+	file->source = NULL;
+}
+
+/*******************************************************************************
+ * Normalizes an absolute path (removes empty, "." and ".." segments).
+ *
+ * @param char* path The absolute path.
+ * @param size_t length The length of the path.
+ * @param char* normal Where the normalized path (PATH_MAX bytes) will be
+ * stored.
+ * @return size_t On success, the length of the normalized path; otherwise, 0
+ * if the path is relative, too long or climbs above the root.
+ ******************************************************************************/
+static size_t pyphp_vfs_normalize(const char * path, size_t length, char * normal) {
+	if (length == 0 || path[0] != '/' || length >= PATH_MAX) {
+		return 0;
+	}
+	size_t normalLen = 0;
+	const char * end = path + length;
+	const char * segment = path;
+	while (segment < end) {
+		while (segment < end && *segment == '/') {
+			segment++;
+		}
+		const char * segmentEnd = segment;
+		while (segmentEnd < end && *segmentEnd != '/') {
+			segmentEnd++;
+		}
+		size_t segmentLen = segmentEnd - segment;
+		if (segmentLen == 0 || (segmentLen == 1 && segment[0] == '.')) {
+			// Skip.
+		} else if (segmentLen == 2 && segment[0] == '.' && segment[1] == '.') {
+			if (normalLen == 0) {
+				return 0;
+			}
+			while (normal[--normalLen] != '/');
+		} else {
+			normal[normalLen++] = '/';
+			memcpy(normal + normalLen, segment, segmentLen);
+			normalLen += segmentLen;
+		}
+		segment = segmentEnd;
+	}
+	if (normalLen == 0) {
+		normal[normalLen++] = '/';
+	}
+	normal[normalLen] = '\0';
+	return normalLen;
+}
+
+/*******************************************************************************
+ * Finds a mounted script.
+ *
+ * @param char* path The absolute path of the script.
+ * @param size_t length The length of the path.
+ * @return pyphp_vfs_file_t* If the script is mounted, the script; otherwise,
+ * NULL.
+ ******************************************************************************/
+pyphp_vfs_file_t * pyphp_vfs_find(const char * path, size_t length) {
+	if (pyphp_vfs_files == NULL || zend_hash_num_elements(pyphp_vfs_files) == 0) {
+		return NULL;
+	}
+	char normal[PATH_MAX];
+	size_t normalLen = pyphp_vfs_normalize(path, length, normal);
+	pyphp_vfs_file_t * file;
+	if (normalLen == 0 || zend_hash_find(pyphp_vfs_files, normal, normalLen+1, (void **)&file) == FAILURE) {
+		return NULL;
+	}
+	return file;
+}
+
+/*******************************************************************************
+ * Resolves a script name to a mounted script.
+ *
+ * Relative names are resolved against the directory of the executing script,
+ * so the relative includes of a mounted script stay inside its mount.
+ *
+ * @param char* filename The script name.
+ * @param int filenameLen The length of the script name.
+ * @param char* path Where the absolute path (PATH_MAX bytes) will be stored.
+ * @return pyphp_vfs_file_t* If the script is mounted, the script; otherwise,
+ * NULL.
+ ******************************************************************************/
+static pyphp_vfs_file_t * pyphp_vfs_resolve(const char * filename, int filenameLen, char * path TSRMLS_DC) {
+	if (pyphp_vfs_files == NULL || zend_hash_num_elements(pyphp_vfs_files) == 0) {
+		return NULL;
+	}
+	
+	char joined[PATH_MAX];
+	const char * name = filename;
+	size_t nameLen = filenameLen;
+	if (filename[0] != '/') {
+		if (!zend_is_executing(TSRMLS_C)) {
+			return NULL;
+		}
+		const char * executing = zend_get_executed_filename(TSRMLS_C);
+		const char * slash = strrchr(executing, '/');
+		if (executing[0] != '/' || slash == NULL) {
+			return NULL;
+		}
+		size_t dirLen = slash - executing + 1;
+		if (dirLen + filenameLen >= PATH_MAX) {
+			return NULL;
+		}
+		memcpy(joined, executing, dirLen);
+		memcpy(joined + dirLen, filename, filenameLen);
+		name = joined;
+		nameLen = dirLen + filenameLen;
+	}
+	
+	size_t pathLen = pyphp_vfs_normalize(name, nameLen, path);
+	pyphp_vfs_file_t * file;
+	if (pathLen == 0 || zend_hash_find(pyphp_vfs_files, path, pathLen+1, (void **)&file) == FAILURE) {
+		return NULL;
+	}
+	return file;
+}
+
+/*******************************************************************************
+ * Initializes a file handle that compiles a mounted script from memory.
+ *
+ * The handle is a mapped one without a mapping or closer, so PHP scans the
+ * mounted source in place and never frees it.
+ *
+ * @param zend_file_handle* handle The file handle to initialize.
+ * @param char* filename The filename the script was opened as.
+ * @param char* path The absolute path of the script.
+ * @param pyphp_vfs_file_t* file The script.
+ ******************************************************************************/
+void pyphp_vfs_php_open(zend_file_handle * handle, const char * filename, const char * path, pyphp_vfs_file_t * file TSRMLS_DC) {
+	handle->type = ZEND_HANDLE_MAPPED;
+	handle->filename = (char *)filename;
+	handle->free_filename = 0;
+	handle->opened_path = estrdup(path);
+	memset(&handle->handle.stream, 0, sizeof(handle->handle.stream));
+	// NOTE: the handle only identifies the script (PHP tells open files apart
+	// by it); without a closer it's never used.
+	handle->handle.stream.handle = file;
+	handle->handle.stream.mmap.buf = file->source;
+	handle->handle.stream.mmap.len = file->length;
+}
+
+/*******************************************************************************
+ * The PHP stream open handler (opens scripts to compile).
+ *
+ * @param char* filename The script name.
+ * @param zend_file_handle* handle The file handle to initialize.
+ * @return int On success, SUCCESS (0); otherwise, FAILURE (1).
+ ******************************************************************************/
+static int pyphp_vfs_php_streamOpen(const char * filename, zend_file_handle * handle TSRMLS_DC) {
+	char path[PATH_MAX];
+	pyphp_vfs_file_t * file = pyphp_vfs_resolve(filename, strlen(filename), path TSRMLS_CC);
+	if (file == NULL) {
+		return pyphp_vfs_phpStreamOpen(filename, handle TSRMLS_CC);
+	}
+	pyphp_vfs_php_open(handle, filename, path, file TSRMLS_CC);
+	return SUCCESS;
+}
+
+/*******************************************************************************
+ * The PHP resolve path handler (resolves include_once and require_once
+ * scripts).
+ *
+ * @param char* filename The script name.
+ * @param int filenameLen The length of the script name.
+ * @return char* If the script was found, its absolute path (emalloc'd);
+ * otherwise, NULL.
+ ******************************************************************************/
+static char * pyphp_vfs_php_resolvePath(const char * filename, int filenameLen TSRMLS_DC) {
+	char path[PATH_MAX];
+	if (pyphp_vfs_resolve(filename, filenameLen, path TSRMLS_CC) == NULL) {
+		return pyphp_vfs_phpResolvePath(filename, filenameLen TSRMLS_CC);
+	}
+	return estrdup(path);
+}
+
+/*******************************************************************************
+ * Installs the PHP stream open and resolve path handlers.
+ *
+ * Called once PHP's modules have started up.
+ ******************************************************************************/
+void pyphp_vfs_php_startup(void) {
+	// NOTE: the module startup sets the handlers every time PHP is initialized.
+	pyphp_vfs_phpStreamOpen = zend_stream_open_function;
+	zend_stream_open_function = pyphp_vfs_php_streamOpen;
+	pyphp_vfs_phpResolvePath = zend_resolve_path;
+	zend_resolve_path = pyphp_vfs_php_resolvePath;
+}
+
+/*******************************************************************************
+ * Removes a mounted script if it's under a prefix.
+ *
+ * @param void* pData The script.
+ * @param int argc The number of arguments (2).
+ * @param va_list args The prefix (char*) and its length (size_t).
+ * @param zend_hash_key* hashKey The path of the script.
+ * @return int ZEND_HASH_APPLY_REMOVE if under the prefix; otherwise,
+ * ZEND_HASH_APPLY_KEEP.
+ ******************************************************************************/
+static int pyphp_vfs_removePrefixed(void * pData TSRMLS_DC, int argc, va_list args, zend_hash_key * hashKey) {
+	const char * prefix = va_arg(args, const char *);
+	size_t prefixLen = va_arg(args, size_t);
+	if (hashKey->nKeyLength-1 > prefixLen && hashKey->arKey[prefixLen] == '/' && memcmp(hashKey->arKey, prefix, prefixLen) == 0) {
+		return ZEND_HASH_APPLY_REMOVE;
+	}
+	return ZEND_HASH_APPLY_KEEP;
+}
+
+/*******************************************************************************
+ * Unmounts the scripts under a path prefix.
+ *
+ * @param char* prefix The absolute path prefix.
+ * @return int The number of scripts unmounted.
+ ******************************************************************************/
+int pyphp_vfs_unmount(const char * prefix) {
+	if (pyphp_vfs_files == NULL) {
+		return 0;
+	}
+	TSRMLS_FETCH();
+	char normal[PATH_MAX];
+	size_t normalLen = pyphp_vfs_normalize(prefix, strlen(prefix), normal);
+	if (normalLen == 0) {
+		return 0;
+	}
+	// The root prefix is "" so that every path is under it.
+	if (normalLen == 1) {
+		normalLen = 0;
+	}
+	int count = zend_hash_num_elements(pyphp_vfs_files);
+	zend_hash_apply_with_arguments(pyphp_vfs_files TSRMLS_CC, pyphp_vfs_removePrefixed, 2, normal, normalLen);
+	return count - zend_hash_num_elements(pyphp_vfs_files);
+}
+
+/*******************************************************************************
+ * Mounts scripts under a path prefix.
+ *
+ * Scripts previously mounted under the prefix are unmounted first.
+ *
+ * @param char* prefix The absolute path prefix (e.g., "/templates").
+ * @param PyObject* pyMapping The scripts (relative path => source string or
+ * buffer). The sources are copied.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+bool pyphp_vfs_mount(const char * prefix, PyObject * pyMapping) {
+	char normal[PATH_MAX];
+	size_t normalLen = pyphp_vfs_normalize(prefix, strlen(prefix), normal);
+	if (normalLen == 0) {
+		PyErr_Format(PyExc_ValueError, "Invalid prefix: %s - the prefix must be an absolute path", prefix);
+		return false;
+	}
+	if (normalLen == 1) {
+		normalLen = 0;
+	}
+	
+	// NOTE: items() of a mapping other than a dict may return any iterable.
+	PyObject * pyMappingItems = PyMapping_Items(pyMapping);
+	if (pyMappingItems == NULL) {
+		return false;
+	}
+	PyObject * pyItems = PySequence_Fast(pyMappingItems, "The scripts must be a mapping");
+	Py_DECREF(pyMappingItems);
+	if (pyItems == NULL) {
+		return false;
+	}
+	
+	// Copy every script before touching the mounted ones so that a bad entry
+	// leaves the mount as it was.
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(pyItems);
+	Py_ssize_t i;
+	HashTable mounted;
+	zend_hash_init(&mounted, count, NULL, pyphp_vfs_file_dtor, 1);
+	for (i = 0; i < count; i++) {
+		PyObject * pyItem = PySequence_Fast_GET_ITEM(pyItems, i);
+		if (!PyTuple_Check(pyItem) || PyTuple_GET_SIZE(pyItem) != 2) {
+			PyErr_SetString(PyExc_TypeError, "The scripts must be a mapping of paths to sources");
+			goto failure;
+		}
+		PyObject * pyName = PyTuple_GET_ITEM(pyItem, 0);
+		PyObject * pySource = PyTuple_GET_ITEM(pyItem, 1);
+		if (!PyString_Check(pyName)) {
+			PyErr_SetString(PyExc_TypeError, "Script paths must be strings");
+			goto failure;
+		}
+		// NOTE: unicode exposes its internal representation as a buffer.
+		if (PyUnicode_Check(pySource) || !PyObject_CheckReadBuffer(pySource)) {
+			PyErr_Format(PyExc_TypeError, "The source of %s must be a string or a buffer", PyString_AS_STRING(pyName));
+			goto failure;
+		}
+		const void * source;
+		Py_ssize_t sourceLen;
+		if (PyObject_AsReadBuffer(pySource, &source, &sourceLen) == -1) {
+			goto failure;
+		}
+	
+		char joined[PATH_MAX];
+		char path[PATH_MAX];
+		size_t joinedLen = normalLen + 1 + PyString_GET_SIZE(pyName);
+		size_t pathLen = 0;
+		if (joinedLen < PATH_MAX) {
+			memcpy(joined, normal, normalLen);
+			joined[normalLen] = '/';
+			memcpy(joined + normalLen + 1, PyString_AS_STRING(pyName), PyString_GET_SIZE(pyName));
+			pathLen = pyphp_vfs_normalize(joined, joinedLen, path);
+		}
+		// The script has to end up under the prefix.
+		if (pathLen <= normalLen + 1 || path[normalLen] != '/' || memcmp(path, normal, normalLen) != 0) {
+			PyErr_Format(PyExc_ValueError, "Invalid script path: %s", PyString_AS_STRING(pyName));
+			goto failure;
+		}
+	
+		pyphp_vfs_file_t file;
+		file.length = sourceLen;
+		file.source = (char *)pemalloc(sourceLen + ZEND_MMAP_AHEAD, 1);
+		memcpy(file.source, source, sourceLen);
+		memset(file.source + sourceLen, 0, ZEND_MMAP_AHEAD);
+		file.version = ++pyphp_vfs_version;
+		zend_hash_update(&mounted, path, pathLen+1, &file, sizeof(file), NULL);
+	}
+	Py_DECREF(pyItems);
+	
+	if (pyphp_vfs_files == NULL) {
+		pyphp_vfs_files = (HashTable *)pemalloc(sizeof(HashTable), 1);
+		zend_hash_init(pyphp_vfs_files, count, NULL, pyphp_vfs_file_dtor, 1);
+	}
+	pyphp_vfs_unmount(normal);
+	// NOTE: the sources are handed over, so don't free them with the
+	// temporary table.
+	mounted.pDestructor = NULL;
+	zend_hash_merge(pyphp_vfs_files, &mounted, NULL, NULL, sizeof(pyphp_vfs_file_t), 1);
+	zend_hash_destroy(&mounted);
+	return true;
+
+failure:
+	Py_DECREF(pyItems);
+	zend_hash_destroy(&mounted);
+	return false;
+}
@@ -0,0 +1,84 @@
+/**
+ * pyphp-vfs.h provides an in-memory filesystem for PHP scripts
+ * (pyphp.mount()).
+ *
+ * Script sources loaded from Python are mounted under a path prefix. Scripts
+ * run, included or required under a mounted prefix are compiled straight from
+ * memory, without any stat(), realpath() or read() calls.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_VFS_H
+#define PYPHP_VFS_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * A mounted script.
+ */
+typedef struct pyphp_vfs_file_t {
+	// The source, followed by ZEND_MMAP_AHEAD NULs for the scanner.
+	char * source;
+	// The length of the source.
+	size_t length;
+	// Changes every time a script is mounted at this path (a stand-in for the
+	// modification time when caching compiled scripts).
+	ulong version;
+} pyphp_vfs_file_t;
+
+/**
+ * Mounts scripts under a path prefix.
+ *
+ * Scripts previously mounted under the prefix are unmounted first.
+ *
+ * @param char* prefix The absolute path prefix (e.g., "/templates").
+ * @param PyObject* pyMapping The scripts (relative path => source string or
+ * buffer). The sources are copied.
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ */
+bool pyphp_vfs_mount(const char * prefix, PyObject * pyMapping);
+
+/**
+ * Unmounts the scripts under a path prefix.
+ *
+ * @param char* prefix The absolute path prefix.
+ * @return int The number of scripts unmounted.
+ */
+int pyphp_vfs_unmount(const char * prefix);
+
+/**
+ * Finds a mounted script.
+ *
+ * @param char* path The absolute path of the script.
+ * @param size_t length The length of the path.
+ * @return pyphp_vfs_file_t* If the script is mounted, the script; otherwise,
+ * NULL.
+ */
+pyphp_vfs_file_t * pyphp_vfs_find(const char * path, size_t length);
+
+/**
+ * Initializes a file handle that compiles a mounted script from memory.
+ *
+ * @param zend_file_handle* handle The file handle to initialize.
+ * @param char* filename The filename the script was opened as.
+ * @param char* path The absolute path of the script.
+ * @param pyphp_vfs_file_t* file The script.
+ */
+void pyphp_vfs_php_open(zend_file_handle * handle, const char * filename, const char * path, pyphp_vfs_file_t * file TSRMLS_DC);
+
+/**
+ * Installs the PHP stream open and resolve path handlers.
+ *
+ * Called once PHP's modules have started up.
+ */
+void pyphp_vfs_php_startup(void);
+
+#endif
@@ -0,0 +1,468 @@
+/**
+ * pyphp-wsgi.c implements the native WSGI application (pyphp.WSGIApp).
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h> // for PATH_MAX
+#include <sys/stat.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+#include "pyphp-core.h"
+#include "pyphp-request.h"
+#include "pyphp-vfs.h"
+#include "pyphp-wsgi.h"
+
+extern PyObject * pyphp_exception;
+
+// The start_response() of the running WSGI response, or NULL.
+static PyObject * pyphp_wsgi_pyStartResponse = NULL;
+
+/*******************************************************************************
+ * Gets the reason phrase of an HTTP status code.
+ *
+ * @param int code The HTTP status code.
+ * @return char* The reason phrase.
+ ******************************************************************************/
+static const char * pyphp_wsgi_reason(int code) {
+	switch (code) {
+		case 100: return "Continue";
+		case 101: return "Switching Protocols";
+		case 200: return "OK";
+		case 201: return "Created";
+		case 202: return "Accepted";
+		case 203: return "Non-Authoritative Information";
+		case 204: return "No Content";
+		case 205: return "Reset Content";
+		case 206: return "Partial Content";
+		case 300: return "Multiple Choices";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 303: return "See Other";
+		case 304: return "Not Modified";
+		case 305: return "Use Proxy";
+		case 307: return "Temporary Redirect";
+		case 400: return "Bad Request";
+		case 401: return "Unauthorized";
+		case 402: return "Payment Required";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 406: return "Not Acceptable";
+		case 407: return "Proxy Authentication Required";
+		case 408: return "Request Timeout";
+		case 409: return "Conflict";
+		case 410: return "Gone";
+		case 411: return "Length Required";
+		case 412: return "Precondition Failed";
+		case 413: return "Request Entity Too Large";
+		case 414: return "Request-URI Too Long";
+		case 415: return "Unsupported Media Type";
+		case 416: return "Requested Range Not Satisfiable";
+		case 417: return "Expectation Failed";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 502: return "Bad Gateway";
+		case 503: return "Service Unavailable";
+		case 504: return "Gateway Timeout";
+		case 505: return "HTTP Version Not Supported";
+		default: return "Unknown";
+	}
+}
+
+/*******************************************************************************
+ * Calls start_response() with a status and headers.
+ *
+ * @param PyObject* pyStartResponse The start_response() callable.
+ * @param PyObject* pyStatus The status string (ownership is taken).
+ * @param PyObject* pyHeaders The list of header tuples (ownership is taken).
+ * @return PyObject* On success, the write() callable start_response()
+ * returned; otherwise, NULL with a python exception set.
+ ******************************************************************************/
+static PyObject * pyphp_wsgi_startResponse(PyObject * pyStartResponse, PyObject * pyStatus, PyObject * pyHeaders) {
+	if (pyStatus == NULL || pyHeaders == NULL) {
+		Py_XDECREF(pyStatus);
+		Py_XDECREF(pyHeaders);
+		return NULL;
+	}
+	PyObject * pyWrite = PyObject_CallFunctionObjArgs(pyStartResponse, pyStatus, pyHeaders, NULL);
+	Py_DECREF(pyStatus);
+	Py_DECREF(pyHeaders);
+	return pyWrite;
+}
+
+/*******************************************************************************
+ * Adds a PHP header ("Name: value") to a list of WSGI header tuples.
+ *
+ * @param sapi_header_struct* sapiHeader The header.
+ * @param PyObject* pyHeaders The list of header tuples.
+ ******************************************************************************/
+static void pyphp_wsgi_addHeader(sapi_header_struct * sapiHeader, PyObject * pyHeaders TSRMLS_DC) {
+	char * colon = memchr(sapiHeader->header, ':', sapiHeader->header_len);
+	if (colon == NULL) {
+		return;
+	}
+	char * value = colon + 1;
+	char * end = sapiHeader->header + sapiHeader->header_len;
+	while (value < end && (*value == ' ' || *value == '\t')) {
+		value++;
+	}
+	PyObject * pyHeader = Py_BuildValue("(s#s#)", sapiHeader->header, (int)(colon - sapiHeader->header), value, (int)(end - value));
+	if (pyHeader != NULL) {
+		PyList_Append(pyHeaders, pyHeader);
+		Py_DECREF(pyHeader);
+	}
+}
+
+/*******************************************************************************
+ * Appends a header to a list of WSGI header tuples.
+ *
+ * @param PyObject* pyHeaders The list of header tuples.
+ * @param char* name The name of the header.
+ * @param char* value The value of the header.
+ ******************************************************************************/
+static void pyphp_wsgi_appendHeader(PyObject * pyHeaders, const char * name, const char * value) {
+	PyObject * pyHeader = Py_BuildValue("(ss)", name, value);
+	if (pyHeader != NULL) {
+		PyList_Append(pyHeaders, pyHeader);
+		Py_DECREF(pyHeader);
+	}
+}
+
+/*******************************************************************************
+ * Removes a header from a list of WSGI header tuples.
+ *
+ * @param PyObject* pyHeaders The list of header tuples.
+ * @param char* name The name of the header (case insensitive).
+ ******************************************************************************/
+static void pyphp_wsgi_removeHeader(PyObject * pyHeaders, const char * name) {
+	for (Py_ssize_t i = PyList_GET_SIZE(pyHeaders) - 1; i >= 0; i--) {
+		PyObject * pyName = PyTuple_GET_ITEM(PyList_GET_ITEM(pyHeaders, i), 0);
+		if (strcasecmp(PyString_AS_STRING(pyName), name) == 0) {
+			PySequence_DelItem(pyHeaders, i);
+		}
+	}
+}
+
+/*******************************************************************************
+ * The PHP send headers handler.
+ *
+ * Passes the status and headers of the running WSGI response to its
+ * start_response(). Outside of a WSGI response the headers are discarded, just
+ * like PHP embed does.
+ *
+ * @param sapi_headers_struct* sapiHeaders The status and headers.
+ * @return int SAPI_HEADER_SENT_SUCCESSFULLY.
+ ******************************************************************************/
+int pyphp_wsgi_php_sendHeaders(sapi_headers_struct * sapiHeaders TSRMLS_DC) {
+	if (pyphp_wsgi_pyStartResponse == NULL) {
+		return SAPI_HEADER_SENT_SUCCESSFULLY;
+	}
+	PyObject * pyStartResponse = pyphp_wsgi_pyStartResponse;
+	pyphp_wsgi_pyStartResponse = NULL;
+	
+	// A status line set with header("HTTP/1.1 404 Not Found") wins over the
+	// response code.
+	PyObject * pyStatus;
+	char * statusLine = sapiHeaders->http_status_line;
+	char * space = statusLine ? strchr(statusLine, ' ') : NULL;
+	if (space != NULL && space[1] != '\0') {
+		pyStatus = PyString_FromString(space + 1);
+	} else {
+		int code = sapiHeaders->http_response_code ? sapiHeaders->http_response_code : 200;
+		pyStatus = PyString_FromFormat("%d %s", code, pyphp_wsgi_reason(code));
+	}
+	
+	PyObject * pyHeaders = PyList_New(0);
+	if (pyHeaders != NULL) {
+		zend_llist_apply_with_argument(&sapiHeaders->headers, (llist_apply_with_arg_func_t)pyphp_wsgi_addHeader, pyHeaders TSRMLS_CC);
+		// The body is compressed as PHP writes it (see pyphp.setCompression()),
+		// if the client accepts it.
+		if (pyphp_compress.isEnabled && pyphp_compress.format != PYPHP_COMPRESS_RAW) {
+			pyphp_wsgi_appendHeader(pyHeaders, "Vary", "Accept-Encoding");
+		}
+		const char * encoding = pyphp_compress_encoding();
+		if (encoding != NULL) {
+			// NOTE: the Content-Length PHP sent is of the uncompressed body.
+			pyphp_wsgi_removeHeader(pyHeaders, "Content-Length");
+			pyphp_wsgi_appendHeader(pyHeaders, "Content-Encoding", encoding);
+		}
+	}
+	
+	// The body is streamed through the write() callable from then on.
+	PyObject * pyWrite = pyphp_wsgi_startResponse(pyStartResponse, pyStatus, pyHeaders);
+	Py_DECREF(pyStartResponse);
+	if (pyWrite != NULL && pyphp_core.capture != NULL && pyphp_core.capture->write == NULL) {
+		pyphp_core.capture->write = pyWrite;
+	} else {
+		Py_XDECREF(pyWrite);
+	}
+	return SAPI_HEADER_SENT_SUCCESSFULLY;
+}
+
+/*******************************************************************************
+ * Checks whether a request path climbs out of the document root.
+ *
+ * @param char* path The request path.
+ * @return bool Whether the path has a ".." segment.
+ ******************************************************************************/
+static bool pyphp_wsgi_isOutside(const char * path) {
+	const char * segment = path;
+	while (segment != NULL) {
+		if (segment[0] == '.' && segment[1] == '.' && (segment[2] == '/' || segment[2] == '\0')) {
+			return true;
+		}
+		segment = strchr(segment, '/');
+		if (segment != NULL) {
+			segment++;
+		}
+	}
+	return false;
+}
+
+/*******************************************************************************
+ * Resolves the script a request path maps to.
+ *
+ * @param pyphp_wsgi_app_t* self Myself.
+ * @param char* pathInfo The request path (PATH_INFO).
+ * @param char* filename Where the filename (PATH_MAX bytes) will be stored.
+ * @return bool If the script exists, true; otherwise, false.
+ ******************************************************************************/
+static bool pyphp_wsgi_resolve(pyphp_wsgi_app_t * self, const char * pathInfo, char * filename) {
+	if (pathInfo[0] != '/' && pathInfo[0] != '\0') {
+		return false;
+	}
+	if (pyphp_wsgi_isOutside(pathInfo)) {
+		return false;
+	}
+	int length = snprintf(filename, PATH_MAX, "%s%s", self->docroot, pathInfo[0] ? pathInfo : "/");
+	if (length < 0 || length >= PATH_MAX) {
+		return false;
+	}
+	
+	// NOTE: mounted scripts are found without touching the filesystem.
+	struct stat info;
+	if (filename[length-1] != '/') {
+		if (pyphp_vfs_find(filename, length) != NULL) {
+			return true;
+		}
+		if (stat(filename, &info) == 0 && !S_ISDIR(info.st_mode)) {
+			return S_ISREG(info.st_mode);
+		}
+		// A directory (mounted or not).
+		filename[length++] = '/';
+	}
+	size_t indexLen = strlen(self->index);
+	if (length + indexLen >= PATH_MAX) {
+		return false;
+	}
+	memcpy(filename + length, self->index, indexLen+1);
+	length += indexLen;
+	if (pyphp_vfs_find(filename, length) != NULL) {
+		return true;
+	}
+	return stat(filename, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+/*******************************************************************************
+ * Creates a WSGI application.
+ ******************************************************************************/
+static PyObject * pyphp_wsgi_app_new(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
+	pyphp_wsgi_app_t * self = (pyphp_wsgi_app_t *)type->tp_alloc(type, 0);
+	if (self == NULL) {
+		return NULL;
+	}
+	self->docroot = NULL;
+	self->index = NULL;
+	self->pending = NULL;
+	self->pendingSize = 0;
+	return (PyObject *)self;
+}
+
+/*******************************************************************************
+ * Initializes a WSGI application.
+ *
+ * Arguments:
+ * - PyString* docroot The directory the scripts are served from.
+ * - PyString* index (optional) The script served for directories (default
+ *   "index.php").
+ ******************************************************************************/
+static int pyphp_wsgi_app_init(pyphp_wsgi_app_t * self, PyObject * args, PyObject * kwargs) {
+	static char * keywords[] = {"docroot", "index", NULL};
+	const char * docroot;
+	const char * index = PYPHP_WSGI_INDEX;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|s:pyphp.WSGIApp", keywords, &docroot, &index)) {
+		return -1;
+	}
+	if (index[0] == '\0' || strchr(index, '/') != NULL) {
+		PyErr_SetString(PyExc_ValueError, "index must be a filename");
+		return -1;
+	}
+	
+	char * docrootCopy = strdup(docroot);
+	char * indexCopy = strdup(index);
+	if (docrootCopy == NULL || indexCopy == NULL) {
+		free(docrootCopy);
+		free(indexCopy);
+		PyErr_NoMemory();
+		return -1;
+	}
+	// Request paths begin with a slash.
+	size_t length = strlen(docrootCopy);
+	while (length > 1 && docrootCopy[length-1] == '/') {
+		docrootCopy[--length] = '\0';
+	}
+	
+	free(self->docroot);
+	free(self->index);
+	self->docroot = docrootCopy;
+	self->index = indexCopy;
+	return 0;
+}
+
+/*******************************************************************************
+ * Destroys a WSGI application.
+ ******************************************************************************/
+static void pyphp_wsgi_app_dealloc(pyphp_wsgi_app_t * self) {
+	free(self->docroot);
+	free(self->index);
+	free(self->pending);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+/*******************************************************************************
+ * Serves a request (the WSGI application callable).
+ *
+ * The script PATH_INFO maps to is run to completion; its headers are passed
+ * to start_response() as soon as PHP sends them, and from then on its output
+ * is streamed through the write() callable start_response() returned, a chunk
+ * of PYPHP_CORE_CAPTURE_CHUNK bytes (or a PHP flush()) at a time.
+ *
+ * Arguments:
+ * - PyDict* environ The WSGI environ.
+ * - PyCallable* start_response The WSGI start_response() callable.
+ *
+ * @param pyphp_wsgi_app_t* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The keyword arguments.
+ * @return PyObject* On success, the list of the body chunks that weren't
+ * written (usually empty); otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_wsgi_app_call(pyphp_wsgi_app_t * self, PyObject * args, PyObject * kwargs) {
+	PyObject * pyEnviron;
+	PyObject * pyStartResponse;
+	if (!PyArg_ParseTuple(args, "O!O:pyphp.WSGIApp", &PyDict_Type, &pyEnviron, &pyStartResponse)) {
+		return NULL;
+	}
+	if (self->docroot == NULL) {
+		PyErr_SetString(pyphp_exception, "pyphp.WSGIApp was not initialized");
+		return NULL;
+	}
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	TSRMLS_FETCH();
+	if (pyphp_core.capture != NULL) {
+		PyErr_SetString(pyphp_exception, "PHP is already serving a request");
+		return NULL;
+	}
+	
+	PyObject * pyPathInfo = PyDict_GetItemString(pyEnviron, "PATH_INFO");
+	const char * pathInfo = (pyPathInfo != NULL && PyString_Check(pyPathInfo)) ? PyString_AS_STRING(pyPathInfo) : "/";
+	char filename[PATH_MAX];
+	if (!pyphp_wsgi_resolve(self, pathInfo, filename)) {
+		PyObject * pyWrite = pyphp_wsgi_startResponse(pyStartResponse, PyString_FromString("404 Not Found"), Py_BuildValue("[(ss)]", "Content-Type", "text/plain"));
+		if (pyWrite == NULL) {
+			return NULL;
+		}
+		Py_DECREF(pyWrite);
+		return Py_BuildValue("[s]", "Not Found");
+	}
+	
+	zend_file_handle script;
+	if (!pyphp_core_php_openScript(&script, filename)) {
+		PyErr_Format(pyphp_exception, "Failed to open %s", filename);
+		return NULL;
+	}
+	if (!pyphp_request_set(pyEnviron)) {
+		zend_file_handle_dtor(&script TSRMLS_CC);
+		return NULL;
+	}
+	
+	PyObject * pyChunks = PyList_New(0);
+	if (pyChunks == NULL) {
+		zend_file_handle_dtor(&script TSRMLS_CC);
+		return NULL;
+	}
+	pyphp_core_capture_t capture = {
+		.chunks = pyChunks,
+		.write = NULL,
+		.pending = {.data = self->pending, .length = 0, .size = self->pendingSize}
+	};
+	pyphp_core.capture = &capture;
+	Py_INCREF(pyStartResponse);
+	pyphp_wsgi_pyStartResponse = pyStartResponse;
+	
+	// PHP embed marks the headers as sent since it has nowhere to send them.
+	SG(headers_sent) = 0;
+	SG(request_info).no_headers = 0;
+	
+	// The body is only compressed if the client accepts it.
+	PyObject * pyAcceptEncoding = PyDict_GetItemString(pyEnviron, "HTTP_ACCEPT_ENCODING");
+	pyphp_compress_php_negotiate((pyAcceptEncoding != NULL && PyString_Check(pyAcceptEncoding)) ? PyString_AS_STRING(pyAcceptEncoding) : NULL);
+	
+	int result = pyphp_core_php_execute(&script);
+	
+	// NOTE: shutting the request down flushes the output buffers and sends the
+	// headers of a script that didn't output anything, so keep capturing until
+	// PHP has been reset.
+	pyphp_core_php_reset();
+	pyphp_compress.isRefused = false;
+	pyphp_core_capture_flush(&capture);
+	pyphp_core.capture = NULL;
+	Py_XDECREF(capture.write);
+	self->pending = capture.pending.data;
+	self->pendingSize = capture.pending.size;
+	
+	// Headers PHP never sent (e.g., after a bailout) still have to be.
+	if (pyphp_wsgi_pyStartResponse != NULL) {
+		pyStartResponse = pyphp_wsgi_pyStartResponse;
+		pyphp_wsgi_pyStartResponse = NULL;
+		if (!PyErr_Occurred()) {
+			PyObject * pyWrite = pyphp_wsgi_startResponse(pyStartResponse, PyString_FromString(result == SUCCESS ? "200 OK" : "500 Internal Server Error"), PyList_New(0));
+			Py_XDECREF(pyWrite);
+		}
+		Py_DECREF(pyStartResponse);
+	}
+	
+	if (PyErr_Occurred()) {
+		Py_DECREF(pyChunks);
+		return NULL;
+	} else if (result == FAILURE) {
+		Py_DECREF(pyChunks);
+		PyErr_SetString(pyphp_exception, "An unknown PHP interpreter error occured");
+		return NULL;
+	}
+	return pyChunks;
+}
+
+PyTypeObject pyphp_wsgi_app_type = {
+	PyObject_HEAD_INIT(NULL)
+	.tp_name = "pyphp.WSGIApp",
+	.tp_basicsize = sizeof(pyphp_wsgi_app_t),
+	.tp_dealloc = (destructor)pyphp_wsgi_app_dealloc,
+	.tp_call = (ternaryfunc)pyphp_wsgi_app_call,
+	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.tp_doc = "A WSGI application serving the PHP scripts of a document root. PHP's status and headers are passed to start_response(), and the body is streamed through its write() callable as PHP writes it.",
+	.tp_init = (initproc)pyphp_wsgi_app_init,
+	.tp_new = pyphp_wsgi_app_new
+};
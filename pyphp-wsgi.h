@@ -0,0 +1,61 @@
+/**
+ * pyphp-wsgi.h provides a native WSGI application (pyphp.WSGIApp) that serves
+ * the PHP scripts of a document root.
+ *
+ * The status and headers set by a script (e.g., with header()) are collected
+ * through the SAPI send headers hook, and the body the SAPI output handler
+ * captured is streamed through the write() callable start_response() returned,
+ * so that a long or flushing script doesn't hold its whole response in memory.
+ *
+ * @author Caleb P Burns <cpburns2009@gmail.com>
+ * @author Ben DeMott <ben_demott@hotmail.com>
+ * @date 2010-09-30
+ * @version 0.4
+ */
+
+#ifndef PYPHP_WSGI_H
+#define PYPHP_WSGI_H
+
+#include <stdbool.h>
+
+#include <Python.h>
+#include <sapi/embed/php_embed.h>
+
+/**
+ * The default script served for directories.
+ */
+#define PYPHP_WSGI_INDEX "index.php"
+
+/**
+ * The pyphp.WSGIApp object.
+ */
+typedef struct pyphp_wsgi_app_t {
+	PyObject_HEAD
+	// The document root (without a trailing slash).
+	char * docroot;
+	// The script served for directories.
+	char * index;
+	// The pending output buffer, kept between calls so that it's only grown
+	// once.
+	char * pending;
+	size_t pendingSize;
+} pyphp_wsgi_app_t;
+
+/**
+ * The pyphp.WSGIApp type.
+ */
+extern PyTypeObject pyphp_wsgi_app_type;
+
+/**
+ * The PHP send headers handler.
+ *
+ * Passes the status and headers of the running WSGI response to its
+ * start_response(). Outside of a WSGI response the headers are discarded, just
+ * like PHP embed does.
+ *
+ * @param sapi_headers_struct* sapiHeaders The status and headers.
+ * @return int SAPI_HEADER_SENT_SUCCESSFULLY.
+ */
+int pyphp_wsgi_php_sendHeaders(sapi_headers_struct * sapiHeaders TSRMLS_DC);
+
+#endif
@@ -19,19 +19,69 @@
 
 #include "pyphp.h"
 #include "pyphp-core.h"
+#include "pyphp-scope.h"
+#include "pyphp-request.h"
+#include "pyphp-wsgi.h"
+#include "pyphp-vfs.h"
+#include "pyphp-filecache.h"
+#include "pyphp-render.h"
+#include "pyphp-escape.h"
+#include "pyphp-timeout.h"
+#include "pyphp-diagnostics.h"
 
 // Python exception object.
 PyObject * pyphp_exception = NULL;
+PyObject * pyphp_memoryBudgetException = NULL;
+PyObject * pyphp_timeoutException = NULL;
 
 // This is needed by php.
 static PyMethodDef pyphpMethods[] = {
 	{"shutdown", pyphp_shutdown, METH_VARARGS, "Shutdowns the PHP interpreter."},
-	{"init", pyphp_init, METH_VARARGS, "Initializes the PHP interpreter."},
+	{"init", (PyCFunction)pyphp_init, METH_VARARGS | METH_KEYWORDS, "Initializes the PHP interpreter."},
+	{"initTimes", pyphp_initTimes, METH_VARARGS, "Returns how long each startup phase of the PHP interpreter took."},
+	{"runTimes", pyphp_runTimes, METH_VARARGS, "Returns how long each phase of the last run took."},
+	{"stats", pyphp_stats, METH_VARARGS, "Returns the cumulative runtime statistics (phase times and counters)."},
+	{"resetStats", pyphp_resetStats, METH_VARARGS, "Clears the cumulative runtime statistics."},
+	{"runMemory", pyphp_runMemory, METH_VARARGS, "Returns the heap usage of the last run (peak, usage at the end and input variables)."},
+	{"setMemoryBudget", pyphp_setMemoryBudget, METH_VARARGS, "Sets the heap limit of each run in bytes (0 uses memory_limit)."},
+	{"recycle", (PyCFunction)pyphp_recycle, METH_VARARGS | METH_KEYWORDS, "Sets when PHP is shut down and started up again between runs (now=True recycles it immediately)."},
+	{"setProfiler", pyphp_setProfiler, METH_VARARGS, "Sets the sampling interval of the PHP profiler in seconds of CPU time (0 disables it)."},
+	{"profile", (PyCFunction)pyphp_profile, METH_VARARGS | METH_KEYWORDS, "Returns the aggregated PHP profile (collapsed=True for collapsed stacks)."},
+	{"clearProfile", pyphp_clearProfile, METH_VARARGS, "Clears the aggregated PHP profile."},
+	{"setTrace", pyphp_setTrace, METH_VARARGS, "Sets the number of events the trace ring buffer holds (0 disables tracing)."},
+	{"setTraceId", pyphp_setTraceId, METH_VARARGS, "Sets the id the following trace events carry."},
+	{"drainTrace", pyphp_drainTrace, METH_VARARGS, "Returns and removes the recorded trace events."},
+	{"setCompression", (PyCFunction)pyphp_setCompression, METH_VARARGS | METH_KEYWORDS, "Sets the zlib level and format PHP output is compressed with as it is written (None disables compression)."},
+	{"setDiagnostics", (PyCFunction)pyphp_setDiagnostics, METH_VARARGS | METH_KEYWORDS, "Sets which PHP error levels are collected as diagnostics, and how each type is sampled and rate limited."},
+	{"diagnostics", pyphp_getDiagnostics, METH_VARARGS, "Returns the diagnostics of the last run as (type, file, line, message) tuples."},
 	{"displayErrors", pyphp_displayErrors, METH_VARARGS, "Sets whether PHP errors are displayed or not."},
-	{"runInline", pyphp_runInline, METH_VARARGS, "Runs/evaluates an inline PHP script."},
-	{"runScript", pyphp_runScript, METH_VARARGS, "Runs/executes a PHP script."},
-	{"setVar", pyphp_setVar, METH_VARARGS, "Sets a global variable in PHP."},
-	{"setSuperGlobalKey", pyphp_setSuperGlobalKey, METH_VARARGS, "Sets a super global variable in PHP."}
+	{"runInline", (PyCFunction)pyphp_runInline, METH_VARARGS | METH_KEYWORDS, "Runs/evaluates an inline PHP script (timeout_ms interrupts it at a deadline)."},
+	{"runScript", (PyCFunction)pyphp_runScript, METH_VARARGS | METH_KEYWORDS, "Runs/executes a PHP script file, or a PHP source held in a buffer (timeout_ms interrupts it at a deadline)."},
+	{"setVar", (PyCFunction)pyphp_setVar, METH_VARARGS | METH_KEYWORDS, "Sets a global variable in PHP, or binds a pyphp.Scope (escape=True HTML escapes the strings)."},
+	{"setSuperGlobalKey", pyphp_setSuperGlobalKey, METH_VARARGS, "Sets a super global variable in PHP."},
+	{"setRequest", pyphp_setRequest, METH_VARARGS, "Sets the WSGI environ the PHP super globals are built from."},
+	{"configure", (PyCFunction)pyphp_configure, METH_VARARGS | METH_KEYWORDS, "Sets the INI profile applied when the PHP interpreter starts up."},
+	{"setIni", pyphp_setIni, METH_VARARGS, "Sets PHP INI settings for the next run only."},
+	{"setPersistentVar", pyphp_setPersistentVar, METH_VARARGS, "Sets a read-only global variable in PHP that survives resets."},
+	{"unsetPersistentVar", pyphp_unsetPersistentVar, METH_VARARGS, "Unsets a persistent global variable in PHP."},
+	{"mount", pyphp_mount, METH_VARARGS, "Mounts PHP scripts held in memory under a path prefix."},
+	{"unmount", pyphp_unmount, METH_VARARGS, "Unmounts the PHP scripts under a path prefix."},
+	{"setCompileCache", pyphp_setCompileCache, METH_VARARGS, "Sets the directory compiled PHP scripts are cached in (None disables the cache)."},
+	{"render", (PyCFunction)pyphp_render, METH_VARARGS | METH_KEYWORDS, "Runs a PHP script with global variables and returns its output (cached when the render cache is enabled)."},
+	{"setRenderCache", pyphp_setRenderCache, METH_VARARGS, "Sets the byte budget and default time-to-live of the render cache (0 bytes disables it)."},
+	{"clearRenderCache", pyphp_clearRenderCache, METH_VARARGS, "Removes the cached output of a PHP script, or all cached output."},
+	{"renderCacheStats", pyphp_renderCacheStats, METH_VARARGS, "Returns the render cache counters."},
+	{"setFragmentCache", pyphp_setFragmentCache, METH_VARARGS, "Sets the byte budget of the cache behind the PHP function pyphp_cache_fragment() (0 bytes disables it)."},
+	{"invalidateFragment", pyphp_invalidateFragment, METH_VARARGS, "Removes a cached fragment."},
+	{"clearFragmentCache", pyphp_clearFragmentCache, METH_VARARGS, "Removes the cached fragments whose keys begin with a prefix, or all cached fragments."},
+	{"fragmentCacheStats", pyphp_fragmentCacheStats, METH_VARARGS, "Returns the fragment cache counters."},
+	{"call", pyphp_call, METH_VARARGS, "Calls a PHP function and returns its result."},
+	{"load", pyphp_load, METH_VARARGS, "Runs a PHP script without resetting PHP, so its functions can be called with pyphp.call() until the next reset."},
+	{"registerFunction", pyphp_registerFunction, METH_VARARGS, "Registers a python callable as a PHP function."},
+	{"setErrorHandler", pyphp_setErrorHandler, METH_VARARGS, "Sets the PHP error handler callback function."},
+	{"setLogHandler", pyphp_setLogHandler, METH_VARARGS, "Sets the PHP log handler callback function."},
+	{"setOutputHandler", pyphp_setOutputHandler, METH_VARARGS, "Sets the PHP output handler callback function (called with each write)."},
+	{NULL, NULL, 0, NULL}
 };
 
 PyMODINIT_FUNC initpyphp(void) {
@@ -40,10 +90,26 @@ PyMODINIT_FUNC initpyphp(void) {
 	
 	pyphp_exception = PyErr_NewException("pyphp.error", NULL, NULL);
 	PyDict_SetItemString(moduleDict, "error", pyphp_exception);
+	pyphp_memoryBudgetException = PyErr_NewException("pyphp.MemoryBudgetExceeded", pyphp_exception, NULL);
+	PyDict_SetItemString(moduleDict, "MemoryBudgetExceeded", pyphp_memoryBudgetException);
+	pyphp_timeoutException = PyErr_NewException("pyphp.TimeoutError", pyphp_exception, NULL);
+	PyDict_SetItemString(moduleDict, "TimeoutError", pyphp_timeoutException);
 	
-	if (!pyphp_core_php_init(0, NULL)) {
-		PyErr_SetString(pyphp_exception, "PHP failed to initialize!");
+	if (PyType_Ready(&pyphp_scope_type) == 0) {
+		Py_INCREF(&pyphp_scope_type);
+		PyModule_AddObject(module, "Scope", (PyObject *)&pyphp_scope_type);
 	}
+	
+	pyphp_escape_init(module);
+	pyphp_diagnostics_init(module);
+	
+	if (PyType_Ready(&pyphp_wsgi_app_type) == 0) {
+		Py_INCREF(&pyphp_wsgi_app_type);
+		PyModule_AddObject(module, "WSGIApp", (PyObject *)&pyphp_wsgi_app_type);
+	}
+	
+	// NOTE: PHP is initialized on first use (see pyphp_core_ensureInit()) so that
+	// importing this module is cheap.
 }
 
 /*******************************************************************************
@@ -82,6 +148,9 @@ static PyObject * pyphp_displayErrors(PyObject * self, PyObject * args) {
 	}
 	bool displayErrors = (PyObject_IsTrue(pyDisplayErrors) ? true : false);
 	
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
 	pyphp_core_php_displayErrors(displayErrors);
 	
 	Py_RETURN_NONE;
@@ -90,29 +159,760 @@ static PyObject * pyphp_displayErrors(PyObject * self, PyObject * args) {
 /*******************************************************************************
  * Initializes the PHP interpreter.
  *
+ * PHP is otherwise initialized on first use. The keyword arguments are the
+ * same as pyphp.configure(); passing any restarts an already running
+ * interpreter so that they take effect.
+ *
+ * Keyword Arguments:
+ * - PyDict* ini The INI settings (name-value pairs) to apply.
+ * - PyList* extensions The only shared extensions to load.
+ *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
- * @return PyObject* Always returns Py_None.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
  ******************************************************************************/
-static PyObject * pyphp_init(PyObject * self, PyObject * args) {
+static PyObject * pyphp_init(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"ini", "extensions", NULL};
+	PyObject * pyIni = NULL;
+	PyObject * pyExtensions = NULL;
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:pyphp.init", kwlist, &pyIni, &pyExtensions)) {
+		return NULL;
+	}
+	if ((pyIni != NULL || pyExtensions != NULL) && !pyphp_setProfile(pyIni, pyExtensions)) {
+		return NULL;
+	}
+	if (pyphp_core.isInit && (pyIni != NULL || pyExtensions != NULL)) {
+		pyphp_core_php_shutdown();
+	}
+	
 	int init = pyphp_core_php_init(0, NULL);
 	PyObject * pyReturn = init ? Py_True : Py_False;
 	Py_INCREF(pyReturn);
 	return pyReturn;
 }
 
+/*******************************************************************************
+ * Returns how long the last initialization of the PHP interpreter took.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each startup phase:
+ * sapi (SAPI startup), module (module and extension startup), request (first
+ * request startup) and total.
+ ******************************************************************************/
+static PyObject * pyphp_initTimes(PyObject * self, PyObject * args) {
+	const struct pyphp_core_initTimes_t * times = &pyphp_core.initTimes;
+	return Py_BuildValue("{s:d,s:d,s:d,s:d}",
+		"sapi", times->sapi / 1e9,
+		"module", times->module / 1e9,
+		"request", times->request / 1e9,
+		"total", (times->sapi + times->module + times->request) / 1e9
+	);
+}
+
+/*******************************************************************************
+ * Returns how long each phase of the last run took.
+ *
+ * A run ends when PHP is reset (after pyphp.runScript(), pyphp.runInline(),
+ * pyphp.render() and WSGI requests), and includes the variables set before
+ * it.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each phase
+ * (marshal, compile, execute, output, reset and total).
+ ******************************************************************************/
+static PyObject * pyphp_runTimes(PyObject * self, PyObject * args) {
+	const struct pyphp_core_runTimes_t * times = &pyphp_core.lastRunTimes;
+	return Py_BuildValue("{s:d,s:d,s:d,s:d,s:d,s:d}",
+		"marshal", times->marshal / 1e9,
+		"compile", times->compile / 1e9,
+		"execute", times->execute / 1e9,
+		"output", times->output / 1e9,
+		"reset", times->reset / 1e9,
+		"total", (times->marshal + times->compile + times->execute + times->output + times->reset) / 1e9
+	);
+}
+
+/*******************************************************************************
+ * Returns the cumulative runtime statistics since startup or the last
+ * pyphp.resetStats().
+ *
+ * The times include the run in progress.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each phase
+ * (marshal, compile, execute, output and reset) and the counters: runs,
+ * compiles, errors, writes (through ub_write), bytesWritten, bytesCompressed
+ * (what the output was compressed into), outputCallbacks, logCallbacks,
+ * functionCallbacks (python callables called from PHP),
+ * peakMemory (the largest peak heap usage of a run in bytes), traceDropped
+ * (the trace events dropped because the ring buffer was full), recycles and
+ * recycleTime (how long recycling PHP took in seconds), diagnostics and
+ * diagnosticsDropped (the diagnostics recorded, and sampled out or over the
+ * limit), compileCacheHits, compileCacheMisses, compileCacheStores and
+ * compileCacheRejects (the scripts loaded from, compiled without, written to
+ * and not cacheable in the compile cache).
+ ******************************************************************************/
+static PyObject * pyphp_stats(PyObject * self, PyObject * args) {
+	const struct pyphp_core_stats_t * stats = &pyphp_core.stats;
+	const struct pyphp_core_runTimes_t * current = &pyphp_core.runTimes;
+	const pyphp_filecache_stats_t * cache = &pyphp_filecache_stats;
+	return Py_BuildValue("{s:d,s:d,s:d,s:d,s:d,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:n,s:K,s:K,s:d,s:K,s:K,s:k,s:k,s:k,s:k}",
+		"marshal", (stats->times.marshal + current->marshal) / 1e9,
+		"compile", (stats->times.compile + current->compile) / 1e9,
+		"execute", (stats->times.execute + current->execute) / 1e9,
+		"output", (stats->times.output + current->output) / 1e9,
+		"reset", (stats->times.reset + current->reset) / 1e9,
+		"runs", (unsigned PY_LONG_LONG)stats->runs,
+		"compiles", (unsigned PY_LONG_LONG)stats->compiles,
+		"errors", (unsigned PY_LONG_LONG)stats->errors,
+		"writes", (unsigned PY_LONG_LONG)stats->writes,
+		"bytesWritten", (unsigned PY_LONG_LONG)stats->bytesWritten,
+		"bytesCompressed", (unsigned PY_LONG_LONG)stats->bytesCompressed,
+		"outputCallbacks", (unsigned PY_LONG_LONG)stats->outputCallbacks,
+		"logCallbacks", (unsigned PY_LONG_LONG)stats->logCallbacks,
+		"functionCallbacks", (unsigned PY_LONG_LONG)stats->functionCallbacks,
+		"peakMemory", (Py_ssize_t)stats->peakMemory,
+		"traceDropped", (unsigned PY_LONG_LONG)pyphp_trace.dropped,
+		"recycles", (unsigned PY_LONG_LONG)stats->recycles,
+		"recycleTime", stats->recycleTime / 1e9,
+		"diagnostics", (unsigned PY_LONG_LONG)stats->diagnostics,
+		"diagnosticsDropped", (unsigned PY_LONG_LONG)stats->diagnosticsDropped,
+		"compileCacheHits", cache->hits,
+		"compileCacheMisses", cache->misses,
+		"compileCacheStores", cache->stores,
+		"compileCacheRejects", cache->rejects
+	);
+}
+
+/*******************************************************************************
+ * Clears the cumulative runtime statistics.
+ *
+ * NOTE: a run in progress is still counted whole when it ends.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ ******************************************************************************/
+static PyObject * pyphp_resetStats(PyObject * self, PyObject * args) {
+	memset(&pyphp_core.stats, 0, sizeof(pyphp_core.stats));
+	memset(&pyphp_filecache_stats, 0, sizeof(pyphp_filecache_stats));
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Returns the Zend heap usage of the last run.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the sizes in bytes: peak (the peak usage), usage
+ * (the usage when the run ended) and input (taken by the converted input
+ * variables).
+ ******************************************************************************/
+static PyObject * pyphp_runMemory(PyObject * self, PyObject * args) {
+	const struct pyphp_core_runMemory_t * memory = &pyphp_core.lastRunMemory;
+	return Py_BuildValue("{s:n,s:n,s:n}",
+		"peak", (Py_ssize_t)memory->peak,
+		"usage", (Py_ssize_t)memory->usage,
+		"input", (Py_ssize_t)memory->input
+	);
+}
+
+/*******************************************************************************
+ * Sets the memory budget: the Zend heap limit of each run.
+ *
+ * A run that exceeds its budget is aborted, PHP is reset and
+ * pyphp.MemoryBudgetExceeded (a pyphp.error) is raised.
+ *
+ * While a budget is set, memory_limit cannot be raised past it or lifted
+ * with -1 (by ini_set() or pyphp.setIni()); lowering it still works.
+ *
+ * NOTE: the overrun is recognized by the Zend "Allowed memory size of"
+ * fatal error message, as the Zend heap state is not exposed.
+ *
+ * Arguments:
+ * - PyInt* bytes The budget in bytes, or 0 to use memory_limit.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ ******************************************************************************/
+static PyObject * pyphp_setMemoryBudget(PyObject * self, PyObject * args) {
+	Py_ssize_t bytes;
+	if (!PyArg_ParseTuple(args, "n:pyphp.setMemoryBudget", &bytes)) {
+		return NULL;
+	}
+	if (bytes < 0) {
+		PyErr_SetString(PyExc_ValueError, "The memory budget must not be negative");
+		return NULL;
+	}
+	pyphp_core.memoryBudget = (size_t)bytes;
+	if (pyphp_core.isInit) {
+		pyphp_core_php_applyMemoryBudget();
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets the recycling policy: when PHP is shut down and started up again
+ * between runs to shed whatever leaks and fragmentation built up.
+ *
+ * PHP is started up again with the same INI profile, extensions, registered
+ * functions and classes, persistent variables, mounts and memory budget, so
+ * recycling is invisible to the scripts besides the time it takes (see
+ * pyphp.stats()).
+ *
+ * Keyword Arguments:
+ * - PyInt* after_renders Recycle after this many runs (0 for no limit).
+ * - PyInt* max_rss Recycle once the resident set size of the process exceeds
+ *   this many bytes (0 for no limit).
+ * - PyInt* max_heap Recycle once the Zend heap exceeds this many bytes between
+ *   runs (0 for no limit).
+ * - PyBool* now Whether to recycle PHP right away.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_recycle(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"after_renders", "max_rss", "max_heap", "now", NULL};
+	Py_ssize_t afterRuns = 0;
+	Py_ssize_t maxRss = 0;
+	Py_ssize_t maxHeap = 0;
+	PyObject * pyNow = NULL;
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nnnO:pyphp.recycle", kwlist, &afterRuns, &maxRss, &maxHeap, &pyNow)) {
+		return NULL;
+	}
+	if (afterRuns < 0 || maxRss < 0 || maxHeap < 0) {
+		PyErr_SetString(PyExc_ValueError, "The recycling limits must not be negative");
+		return NULL;
+	}
+	pyphp_core.recycle.afterRuns = (uint64_t)afterRuns;
+	pyphp_core.recycle.maxRss = (size_t)maxRss;
+	pyphp_core.recycle.maxHeap = (size_t)maxHeap;
+	
+	if (pyNow != NULL && PyObject_IsTrue(pyNow) && pyphp_core.isInit) {
+		if (pyphp_core.executeDepth > 0) {
+			PyErr_SetString(pyphp_exception, "PHP can't be recycled while a script is running");
+			return NULL;
+		}
+		if (!pyphp_core_php_recycle()) {
+			PyErr_SetString(pyphp_exception, "PHP failed to initialize!");
+			return NULL;
+		}
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets the sampling interval of the PHP profiler.
+ *
+ * Arguments:
+ * - PyFloat* interval The interval in seconds of CPU time, or 0 to disable the
+ *   profiler.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setProfiler(PyObject * self, PyObject * args) {
+	double interval;
+	if (!PyArg_ParseTuple(args, "d:pyphp.setProfiler", &interval)) {
+		return NULL;
+	}
+	if (!pyphp_profile_setInterval(interval)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Returns the aggregated PHP profile.
+ *
+ * Keyword arguments:
+ * - PyBool* collapsed (optional) Whether to return collapsed stacks ("frame;
+ *   frame samples" lines for flamegraph.pl) instead of a dict.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* The collapsed stacks (a string), or a dict: stacks
+ * (collapsed stack => samples), functions (function (file:line) => samples
+ * taken in it), samples, dropped and interval.
+ ******************************************************************************/
+static PyObject * pyphp_profile(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"collapsed", NULL};
+	PyObject * pyCollapsed = NULL;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:pyphp.profile", kwlist, &pyCollapsed)) {
+		return NULL;
+	}
+	return pyphp_profile_get(pyCollapsed != NULL && PyObject_IsTrue(pyCollapsed) == 1);
+}
+
+/*******************************************************************************
+ * Clears the aggregated PHP profile.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ ******************************************************************************/
+static PyObject * pyphp_clearProfile(PyObject * self, PyObject * args) {
+	pyphp_profile_clear();
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets the number of events the trace ring buffer holds.
+ *
+ * Arguments:
+ * - PyInt* capacity The number of events (rounded up to a power of two), or 0
+ *   to disable tracing.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setTrace(PyObject * self, PyObject * args) {
+	Py_ssize_t capacity;
+	if (!PyArg_ParseTuple(args, "n:pyphp.setTrace", &capacity)) {
+		return NULL;
+	}
+	if (capacity < 0) {
+		PyErr_SetString(PyExc_ValueError, "The trace capacity must not be negative");
+		return NULL;
+	}
+	if (!pyphp_trace_setCapacity((size_t)capacity)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets the id the following trace events carry (e.g. the request id).
+ *
+ * Arguments:
+ * - PyInt* id The id.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setTraceId(PyObject * self, PyObject * args) {
+	unsigned PY_LONG_LONG id;
+	if (!PyArg_ParseTuple(args, "K:pyphp.setTraceId", &id)) {
+		return NULL;
+	}
+	pyphp_trace.id = id;
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Returns and removes the recorded trace events.
+ *
+ * Arguments:
+ * - PyInt* max (optional) The most events returned (0 for all).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A list of (time, id, kind, phase, value) tuples: time is
+ * the monotonic clock in nanoseconds, kind is compile, marshal, execute,
+ * flush, reset or error, phase is B (begin), E (end) or I (instant), and value
+ * is the PHP error type for errors, the bytes for marshal ends and the peak
+ * heap usage of the run for reset ends.
+ ******************************************************************************/
+static PyObject * pyphp_drainTrace(PyObject * self, PyObject * args) {
+	Py_ssize_t max = 0;
+	if (!PyArg_ParseTuple(args, "|n:pyphp.drainTrace", &max)) {
+		return NULL;
+	}
+	return pyphp_trace_drain(max > 0 ? (size_t)max : 0);
+}
+
+/*******************************************************************************
+ * Sets how PHP output is compressed as it is written.
+ *
+ * Only the compressed output reaches the capture of pyphp.render() and WSGI
+ * responses (which get a Content-Encoding header), the output handler, or the
+ * output stream. A PHP flush() flushes the compressor, and each run ends the
+ * compressed stream.
+ *
+ * Keyword Arguments:
+ * - PyInt* level The zlib compression level (-1 for the default, 0-9), or
+ *   None to disable compression.
+ * - PyString* format The format: "gzip" (the default), "deflate" (zlib) or
+ *   "raw" (raw deflate).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setCompression(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"level", "format", NULL};
+	PyObject * pyLevel = NULL;
+	const char * formatName = "gzip";
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|s:pyphp.setCompression", kwlist, &pyLevel, &formatName)) {
+		return NULL;
+	}
+	
+	int format;
+	if (strcmp(formatName, "gzip") == 0) {
+		format = PYPHP_COMPRESS_GZIP;
+	} else if (strcmp(formatName, "deflate") == 0) {
+		format = PYPHP_COMPRESS_DEFLATE;
+	} else if (strcmp(formatName, "raw") == 0) {
+		format = PYPHP_COMPRESS_RAW;
+	} else {
+		PyErr_Format(PyExc_ValueError, "Unknown compression format: %s", formatName);
+		return NULL;
+	}
+	
+	long level = Z_DEFAULT_COMPRESSION;
+	if (pyLevel != Py_None) {
+		level = PyInt_AsLong(pyLevel);
+		if (level == -1 && PyErr_Occurred()) {
+			return NULL;
+		}
+		if (level < -1 || level > 9) {
+			PyErr_SetString(PyExc_ValueError, "The compression level must be between -1 and 9");
+			return NULL;
+		}
+	}
+	if (!pyphp_compress_configure(pyLevel != Py_None, (int)level, format)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets which PHP error levels are collected as diagnostics, and how each type
+ * is sampled and rate limited.
+ *
+ * Collected errors are recorded instead of displayed or logged, and read with
+ * pyphp.diagnostics() once the run ended. Errors sampled out or over the limit
+ * are only counted (see pyphp.stats()).
+ *
+ * Keyword Arguments:
+ * - PyInt* levels The error levels (e.g., pyphp.E_ALL), or 0 to disable
+ *   diagnostics.
+ * - PyInt|PyDict* sample Record every Nth error of all types (an int) or of
+ *   each type (a dict of type => N).
+ * - PyInt|PyDict* limit Record at most N errors per run of all types (an int)
+ *   or of each type (a dict of type => N; 0 for no limit).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setDiagnostics(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"levels", "sample", "limit", NULL};
+	int levels = 0;
+	PyObject * pySample = NULL;
+	PyObject * pyLimit = NULL;
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|OO:pyphp.setDiagnostics", kwlist, &levels, &pySample, &pyLimit)) {
+		return NULL;
+	}
+	if (!pyphp_diagnostics_setPolicy(levels, pySample, pyLimit)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Returns the diagnostics of the last run.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, a list of (type, file, line, message) tuples;
+ * otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_getDiagnostics(PyObject * self, PyObject * args) {
+	return pyphp_diagnostics_get();
+}
+
+/*******************************************************************************
+ * Converts a Python value to a PHP INI value.
+ *
+ * @param PyObject* pyValue The Python value (bool, int, float or string).
+ * @return PyObject* On success, a new PyString reference; otherwise, NULL with
+ * a python exception set.
+ ******************************************************************************/
+static PyObject * pyphp_iniValue(PyObject * pyValue) {
+	PyObject * pyString;
+	if (PyBool_Check(pyValue)) {
+		pyString = PyString_FromString(pyValue == Py_True ? "1" : "0");
+	} else if (PyString_Check(pyValue)) {
+		Py_INCREF(pyValue);
+		pyString = pyValue;
+	} else if (PyInt_Check(pyValue) || PyLong_Check(pyValue) || PyFloat_Check(pyValue)) {
+		pyString = PyObject_Str(pyValue);
+	} else {
+		PyErr_Format(PyExc_TypeError, "INI values must be a bool, int, float or string, not %s", pyValue->ob_type->tp_name);
+		return NULL;
+	}
+	if (pyString != NULL && strpbrk(PyString_AS_STRING(pyString), "\r\n") != NULL) {
+		PyErr_SetString(PyExc_ValueError, "INI values must not contain line breaks");
+		Py_DECREF(pyString);
+		return NULL;
+	}
+	return pyString;
+}
+
+/*******************************************************************************
+ * Sets the INI profile and the extensions applied when the PHP interpreter
+ * starts up.
+ *
+ * @param PyObject* pyIni The INI settings dict, None to clear them, or NULL
+ * to leave them as they are.
+ * @param PyObject* pyExtensions The sequence of the only shared extensions to
+ * load, None to load the extensions listed in php.ini, or NULL to leave them
+ * as they are.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ ******************************************************************************/
+static bool pyphp_setProfile(PyObject * pyIni, PyObject * pyExtensions) {
+	if (pyIni == Py_None) {
+		pyphp_core_setIniProfile(NULL);
+	} else if (pyIni != NULL) {
+		if (!PyDict_Check(pyIni)) {
+			PyErr_SetString(PyExc_TypeError, "ini must be a dict");
+			return false;
+		}
+		// Build the INI profile ("name=value\n" lines).
+		PyObject * pyProfile = PyString_FromString("");
+		PyObject * pyKey;
+		PyObject * pyValue;
+		Py_ssize_t pos = 0;
+		while (pyProfile != NULL && PyDict_Next(pyIni, &pos, &pyKey, &pyValue)) {
+			if (!PyString_Check(pyKey) || strpbrk(PyString_AS_STRING(pyKey), "=\r\n") != NULL) {
+				PyErr_SetString(PyExc_KeyError, "INI names must be strings without '=' or line breaks");
+				Py_CLEAR(pyProfile);
+				break;
+			}
+			PyObject * pyString = pyphp_iniValue(pyValue);
+			if (pyString == NULL) {
+				Py_CLEAR(pyProfile);
+				break;
+			}
+			PyString_ConcatAndDel(&pyProfile, PyString_FromFormat("%s=%s\n", PyString_AS_STRING(pyKey), PyString_AS_STRING(pyString)));
+			Py_DECREF(pyString);
+		}
+		if (pyProfile == NULL) {
+			return false;
+		}
+		bool isSet = pyphp_core_setIniProfile(PyString_AS_STRING(pyProfile));
+		Py_DECREF(pyProfile);
+		if (!isSet) {
+			PyErr_NoMemory();
+			return false;
+		}
+	}
+	
+	if (pyExtensions == Py_None) {
+		pyphp_core_setExtensions(NULL);
+	} else if (pyExtensions != NULL) {
+		PyObject * pySeq = PySequence_Fast(pyExtensions, "extensions must be a sequence of extension names");
+		if (pySeq == NULL) {
+			return false;
+		}
+		// Build the extension lines ("extension=name\n").
+		PyObject * pyLines = PyString_FromString("");
+		Py_ssize_t i;
+		for (i = 0; pyLines != NULL && i < PySequence_Fast_GET_SIZE(pySeq); i++) {
+			PyObject * pyName = PySequence_Fast_GET_ITEM(pySeq, i);
+			if (!PyString_Check(pyName) || strpbrk(PyString_AS_STRING(pyName), "\r\n") != NULL) {
+				PyErr_SetString(PyExc_TypeError, "extension names must be strings without line breaks");
+				Py_CLEAR(pyLines);
+				break;
+			}
+			PyString_ConcatAndDel(&pyLines, PyString_FromFormat("extension=%s\n", PyString_AS_STRING(pyName)));
+		}
+		Py_DECREF(pySeq);
+		if (pyLines == NULL) {
+			return false;
+		}
+		bool isSet = pyphp_core_setExtensions(PyString_AS_STRING(pyLines));
+		Py_DECREF(pyLines);
+		if (!isSet) {
+			PyErr_NoMemory();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/*******************************************************************************
+ * Sets the INI profile applied when the PHP interpreter starts up.
+ *
+ * The profile is handed to PHP through the embed INI entries so it is parsed
+ * once at startup instead of being altered after every run. If the interpreter
+ * is already running it is restarted so that the profile takes effect.
+ *
+ * Keyword Arguments:
+ * - PyDict* ini The INI settings (name-value pairs) to apply. Values are
+ *   passed to the PHP INI parser verbatim, so constants such as E_ALL work.
+ * - PyList* extensions The only shared extensions to load. When given, the
+ *   system php.ini and its scan directory are ignored so that startup doesn't
+ *   load anything else. Statically compiled extensions are always loaded.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* Always returns Py_None.
+ ******************************************************************************/
+static PyObject * pyphp_configure(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"ini", "extensions", NULL};
+	PyObject * pyIni = NULL;
+	PyObject * pyExtensions = NULL;
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:pyphp.configure", kwlist, &pyIni, &pyExtensions)) {
+		return NULL;
+	}
+	if (!pyphp_setProfile(pyIni, pyExtensions)) {
+		return NULL;
+	}
+	
+	// Restart PHP so the profile takes effect.
+	if (pyphp_core.isInit) {
+		pyphp_core_php_shutdown();
+		if (!pyphp_core_php_init(0, NULL)) {
+			PyErr_SetString(pyphp_exception, "PHP failed to initialize!");
+			return NULL;
+		}
+	}
+	
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * Sets PHP INI settings for the next run only.
+ *
+ * The settings are rolled back when PHP is reset after the next run, so the
+ * INI profile set with pyphp.configure() only needs to be overridden by the
+ * difference.
+ *
+ * Arguments:
+ * - PyDict* dict A dict of name-value pairs to set multiple INI settings.
+ * - OR
+ * - PyString* name The name of the INI setting.
+ * - PyObject* value The value of the INI setting.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
+ ******************************************************************************/
+static PyObject * pyphp_setIni(PyObject * self, PyObject * args) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	
+	const Py_ssize_t argc = PyTuple_Size(args);
+	PyObject * pyItem = argc >= 1 ? PyTuple_GetItem(args, 0) : NULL;
+	PyObject * pyIni;
+	
+	if (argc == 1 && PyDict_Check(pyItem)) {
+		Py_INCREF(pyItem);
+		pyIni = pyItem;
+	} else if (argc == 2 && PyString_Check(pyItem)) {
+		pyIni = PyDict_New();
+		if (pyIni == NULL || PyDict_SetItem(pyIni, pyItem, PyTuple_GetItem(args, 1)) != 0) {
+			Py_XDECREF(pyIni);
+			return NULL;
+		}
+	} else {
+		PyErr_SetString(PyExc_TypeError, "pyphp.setIni() takes a dict or a name and a value");
+		return NULL;
+	}
+	
+	bool result = true;
+	PyObject * pyKey;
+	PyObject * pyValue;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(pyIni, &pos, &pyKey, &pyValue)) {
+		if (!PyString_Check(pyKey)) {
+			PyErr_SetString(PyExc_KeyError, "INI names must be strings");
+			Py_DECREF(pyIni);
+			return NULL;
+		}
+		PyObject * pyString = pyphp_iniValue(pyValue);
+		if (pyString == NULL) {
+			Py_DECREF(pyIni);
+			return NULL;
+		}
+		if (!pyphp_core_php_setIni(PyString_AS_STRING(pyKey), PyString_AS_STRING(pyString))) {
+			printf("%s:%u Failed to set INI setting %s\n", __FUNCTION__, __LINE__, PyString_AS_STRING(pyKey));
+			result = false;
+		}
+		Py_DECREF(pyString);
+	}
+	Py_DECREF(pyIni);
+	
+	PyObject * pyReturn = result ? Py_True : Py_False;
+	Py_INCREF(pyReturn);
+	return pyReturn;
+}
+
+/*******************************************************************************
+ * Gets the timeout_ms keyword argument.
+ *
+ * @param PyObject* kwargs The function keyword arguments, or NULL.
+ * @param long* timeoutMs Where the timeout in milliseconds is stored (0 if
+ * there is none).
+ * @return bool On success, true; otherwise, false with a python exception
+ * set.
+ ******************************************************************************/
+static bool pyphp_getTimeout(PyObject * kwargs, long * timeoutMs) {
+	*timeoutMs = 0;
+	PyObject * pyTimeout = (kwargs != NULL ? PyDict_GetItemString(kwargs, "timeout_ms") : NULL);
+	if (pyTimeout == NULL || pyTimeout == Py_None) {
+		return true;
+	}
+	*timeoutMs = PyInt_AsLong(pyTimeout);
+	if (*timeoutMs == -1 && PyErr_Occurred()) {
+		return false;
+	}
+	if (*timeoutMs < 0) {
+		PyErr_SetString(PyExc_ValueError, "timeout_ms must not be negative");
+		return false;
+	}
+	return true;
+}
+
 /*******************************************************************************
  * Runs/evaluates the PHP inline script.
  *
+ * Keyword arguments:
+ * - PyInt* timeout_ms (optional) The deadline in milliseconds, past which the
+ *   script is interrupted and pyphp.TimeoutError is raised.
+ *
  * @todo Get filename of python script executing this inline php script.
  * @todo Display PHP errors.
  * @todo Raise Python error on PHP Fatal error.
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  ******************************************************************************/
-static PyObject * pyphp_runInline(PyObject * self, PyObject * args) {
+static PyObject * pyphp_runInline(PyObject * self, PyObject * args, PyObject * kwargs) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	
+	long timeoutMs;
+	if (!pyphp_getTimeout(kwargs, &timeoutMs)) {
+		return NULL;
+	}
+	
 	const Py_ssize_t argc = PySequence_Size(args);
 	
 	if (argc < 1) {
@@ -164,12 +964,21 @@ static PyObject * pyphp_runInline(PyObject * self, PyObject * args) {
 	}
 	
 	// Execute inline script.
+	if (!pyphp_timeout_php_arm(timeoutMs)) {
+		return NULL;
+	}
 	int result = SUCCESS;
+	// NOTE: PHP must not be recycled while the inline script runs.
+	pyphp_core.executeDepth++;
 	zend_try {
 		zend_eval_string(phpInline, NULL, filename TSRMLS_CC);
 	} zend_catch {
 		result = FAILURE;
 	} zend_end_try();
+	pyphp_core.executeDepth--;
+	// NOTE: the deadline must be disarmed before the request shutdown frees
+	// the frames the signal handler redirects.
+	bool isTimedOut = pyphp_timeout_php_disarm();
 	
 	// Clean up variables.
 	filename = NULL;
@@ -178,7 +987,11 @@ static PyObject * pyphp_runInline(PyObject * self, PyObject * args) {
 	// Reset PHP.
 	pyphp_core_php_reset();
 	
-	// Check for a python exception.
+	// Check for a timeout, then for a python exception.
+	if (isTimedOut) {
+		PyErr_Format(pyphp_timeoutException, "PHP exceeded its timeout of %ld ms", timeoutMs);
+		return NULL;
+	}
 	PyObject * pyError = PyErr_Occurred();
 	if (pyError != NULL) {
 		return NULL;
@@ -194,14 +1007,37 @@ static PyObject * pyphp_runInline(PyObject * self, PyObject * args) {
 /*******************************************************************************
  * Runs/executes the PHP script.
  *
+ * Arguments:
+ * - PyString* filename The filename of the script.
+ * - OR
+ * - PyFile* file The script file.
+ * - OR
+ * - PyBuffer* source The source of the script (any object supporting the
+ *   buffer interface, other than a string).
+ * - PyString* name (optional) The filename the source is reported as.
+ *
+ * Keyword arguments:
+ * - PyInt* timeout_ms (optional) The deadline in milliseconds, past which the
+ *   script is interrupted and pyphp.TimeoutError is raised.
+ *
  * @todo Display PHP errors.
  * @todo Raise Python error on PHP Fatal error.
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  ******************************************************************************/
-static PyObject * pyphp_runScript(PyObject * self, PyObject * args) {
+static PyObject * pyphp_runScript(PyObject * self, PyObject * args, PyObject * kwargs) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	
+	long timeoutMs;
+	if (!pyphp_getTimeout(kwargs, &timeoutMs)) {
+		return NULL;
+	}
+	
 	const Py_ssize_t argc = PyTuple_Size(args);
 	
 	if (argc < 1) {
@@ -211,36 +1047,66 @@ static PyObject * pyphp_runScript(PyObject * self, PyObject * args) {
 	
 	PyObject * pyFile = PyTuple_GetItem(args, 0);
 	char * filename;
-	FILE * file;
+	zend_file_handle script;
 	bool isFileOwned = false;
 	if (PyString_Check(pyFile)) {
+		// NOTE: mounted scripts are opened from memory.
 		filename = PyString_AsString(pyFile);
-		file = fopen(filename, "rb");
+		if (!pyphp_core_php_openScript(&script, filename)) {
+			PyErr_Format(pyphp_exception, "Failed to open %s", filename);
+			return NULL;
+		}
 		isFileOwned = true;
 	} else if (PyFile_Check(pyFile)) {
 		filename = PyString_AsString(PyFile_Name(pyFile));
-		file = PyFile_AsFile(pyFile);
+		FILE * file = PyFile_AsFile(pyFile);
+		if (file == NULL) {
+			PyErr_Format(pyphp_exception, "Failed to open %s", filename);
+			return NULL;
+		}
 		PyFile_IncUseCount((PyFileObject *)pyFile);
+		
+		// Create the zend file handle.
+		script.type = ZEND_HANDLE_FP;
+		script.filename = filename;
+		script.opened_path = NULL;
+		script.free_filename = 0;
+		script.handle.fp = file;
+	} else if (!PyUnicode_Check(pyFile) && PyObject_CheckReadBuffer(pyFile)) {
+		const void * source;
+		Py_ssize_t sourceLen;
+		if (PyObject_AsReadBuffer(pyFile, &source, &sourceLen) == -1) {
+			return NULL;
+		}
+		filename = "[buffer]";
+		if (argc > 1) {
+			PyObject * pyName = PyTuple_GetItem(args, 1);
+			if (!PyString_Check(pyName)) {
+				PyErr_SetString(PyExc_TypeError, "2nd argument is not a filename string!");
+				return NULL;
+			}
+			filename = PyString_AS_STRING(pyName);
+		}
+		pyphp_core_php_openSource(&script, filename, (const char *)source, sourceLen);
+		isFileOwned = true;
 	} else {
-		printf("%s:%u 1st argument is neither a filename string nor a file pointer!", __FUNCTION__, __LINE__);
+		printf("%s:%u 1st argument is neither a filename string, a file pointer nor a buffer!", __FUNCTION__, __LINE__);
 		return NULL;
 	}
 	
-	// Create the zend file handle.
-	zend_file_handle script;
-	script.type = ZEND_HANDLE_FP;
-	script.filename = filename;
-	script.opened_path = NULL;
-	script.free_filename = 0;
-	script.handle.fp = file;
-	
 	// Execute the script.
-	int result = SUCCESS;
-	zend_try {
-		zend_execute_scripts(ZEND_REQUIRE TSRMLS_CC, NULL, 1, &script);
-	} zend_catch {
-		result = FAILURE;
-	} zend_end_try();
+	// - NOTE: if the deadline can't be armed, the script is only closed.
+	bool isArmed = pyphp_timeout_php_arm(timeoutMs);
+	int result = FAILURE;
+	if (isArmed) {
+		result = pyphp_core_php_execute(&script);
+	} else {
+		TSRMLS_FETCH();
+		zend_file_handle_dtor(&script TSRMLS_CC);
+	}
+	// NOTE: the deadline must be disarmed before the request shutdown frees
+	// the frames the signal handler redirects.
+	bool isTimedOut = pyphp_timeout_php_disarm();
 	
 	// Clean up variables.
 	// - NOTE: do not fclose() the file pointer because PHP will close the file
@@ -249,14 +1115,20 @@ static PyObject * pyphp_runScript(PyObject * self, PyObject * args) {
 		PyFile_DecUseCount((PyFileObject *)pyFile);
 	}
 	
-	file = NULL;
 	filename = NULL;
 	pyFile = NULL;
 	
 	// Reset PHP.
 	pyphp_core_php_reset();
 	
-	// Check for a python exception.
+	// Check for a timeout, then for a python exception.
+	if (isTimedOut) {
+		PyErr_Format(pyphp_timeoutException, "PHP exceeded its timeout of %ld ms", timeoutMs);
+		return NULL;
+	}
+	if (!isArmed) {
+		return NULL;
+	}
 	PyObject * pyError = PyErr_Occurred();
 	if (pyError != NULL) {
 		return NULL;
@@ -272,109 +1144,181 @@ static PyObject * pyphp_runScript(PyObject * self, PyObject * args) {
 /*******************************************************************************
  * Sets a global PHP variable.
  *
- * @todo USE ZEND_SET_SYMBOL instead of zend_hash_update
- *
  * NOTE: Keys (variable) are limited to 255 character in length.
  *
  * Arguments:
  * - PyDict* dict A dict of key-value paris to set multiple variables in PHP.
  * - OR
+ * - pyphp.Scope scope A prebuilt scope whose variables are bound by reference.
+ * - OR
  * - PyString* key The name of the variable to set in PHP.
  * - PyObject* value The value of the variable set in PHP.
  *
+ * Keyword arguments:
+ * - PyBool* escape Whether strings are HTML escaped as they are converted
+ *   (like htmlspecialchars() with ENT_QUOTES), except pyphp.Safe strings. A
+ *   scope can't be escaped.
+ *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  ******************************************************************************/
-static PyObject * pyphp_setVar(PyObject * self, PyObject * args) {	
-	const Py_ssize_t argc = PyTuple_Size(args);
+static PyObject * pyphp_setVar(PyObject * self, PyObject * args, PyObject * kwargs) {	
+	static char * kwlist[] = {"key", "value", "escape", NULL};
+	PyObject * pyItem;
+	PyObject * pyValue = NULL;
+	PyObject * pyEscape = NULL;
 	
-	if (argc < 1) {
-		printf("%s:%u No arguments passed!\n", __FUNCTION__, __LINE__);
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:pyphp.setVar", kwlist, &pyItem, &pyValue, &pyEscape)) {
+		return NULL;
+	}
+	
+	// Strings are HTML escaped as they are converted with escape=True.
+	int isEscaped = (pyEscape != NULL ? PyObject_IsTrue(pyEscape) : 0);
+	if (isEscaped == -1) {
+		return NULL;
+	}
+	// NOTE: a scope was converted when it was built, so it can't be escaped
+	// now.
+	if (pyEscape != NULL && pyphp_scope_check(pyItem)) {
+		PyErr_SetString(PyExc_TypeError, "pyphp.setVar() can't escape a pyphp.Scope");
 		return NULL;
 	}
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	// NOTE: the global variables set here are seen by the next render.
+	pyphp_core.generation++;
+	
+	const pyphp_core_convert_t options = {
+		.escape = (isEscaped == 1)
+	};
+	PyObject * pyReturn = Py_False;
+	char name[256];
+	zval * phpValue;
 	
-	PyObject * pyItem = PyTuple_GetItem(args, 0);
+	// NOTE: every path below ends the marshal, so that its trace span is closed
+	// and its time counted.
+	pyphp_core_marshal_t marshal;
+	pyphp_core_marshal_start(&marshal);
 	
+	// Check to see if the first argument is a prebuilt scope.
+	if (pyphp_scope_check(pyItem)) {
+		pyphp_scope_bind((pyphp_scope_t *)pyItem);
+		pyReturn = Py_True;
+	}
 	// Check to see if the first argument is a python dict.
-	if (PyDict_Check(pyItem)) {
+	else if (PyDict_Check(pyItem)) {
 		// Iterate over python dict items, convert each item to a zval and set it as
 		// as a global variable.
 		Py_ssize_t pos = 0;
 		PyObject * pyKey;
-		PyObject * pyValue;
-		zval * phpValue;
-		char * key;
-		char name[256];
-		size_t len;
-		while (PyDict_Next(pyItem, &pos, &pyKey, &pyValue)) {
-			if (pyphp_core_convert_pyObjectToZval(pyValue, &phpValue)) {
-				key = PyString_AsString(pyKey);
-				// Ensure variable name (key) begins with a dollar sign ($).
-				if (key[0] != '$') {
-					PyErr_Format(PyExc_KeyError, "Invalid key in argument 1: %s - PHP variables must begin with a dollar sign ($)", key);
-					return NULL;
-				}
-				// Strip the dollar sign.
-				len = strlen(key)-1;
-				if (len > 255) {
-					PyErr_Format(PyExc_KeyError, "Invalid key length in argument 1: (%lu) %s  - PHP variable name must not exceed 255 characters", len, key);
-					return NULL;
-				}
-				memcpy(name, &(key[1]), len);
-				name[len] = '\0';
-				
-				ZEND_SET_GLOBAL_VAR(name, phpValue);
-				zval_dtor(phpValue);
+		PyObject * pyEntry;
+		pyReturn = Py_True;
+		while (PyDict_Next(pyItem, &pos, &pyKey, &pyEntry)) {
+			if (!pyphp_core_getVarName(pyKey, name)) {
+				pyReturn = NULL;
+				break;
+			}
+			if (pyphp_core_convert_pyObjectToZvalEx(pyEntry, &phpValue, &options)) {
+				// NOTE: the symbol table takes ownership of the value.
+				pyphp_core_php_setGlobalVar(name, phpValue);
+			} else {
+				printf("%s:%u Failed to convert python value to php value!\n", __FUNCTION__, __LINE__);
 			}
 		}
-		key = NULL;
-		phpValue = NULL;
-		pyValue = NULL;
+		pyEntry = NULL;
 		pyKey = NULL;
-		Py_RETURN_TRUE;
-	} else if (argc >= 2 && PyString_Check(pyItem)) {
-		PyObject * pyKey = pyItem;
-		pyItem = PyTuple_GetItem(args, 1);
-		zval * phpValue;
-		char * key;
-		char name[256];
-		size_t len;
-		if (pyphp_core_convert_pyObjectToZval(pyItem, &phpValue)) {
-			key = PyString_AsString(pyKey);
-			
-			// Ensure variable name (key) begins with a dollar sign ($).
-			if (key[0] != '$') {
-				PyErr_Format(PyExc_KeyError, "Invalid name in argument 1: %s - PHP variables must begin with a dollar sign ($)", key);
-				return NULL;
-			}
-			// Strip the dollar sign.
-			len = strlen(key)-1;
-			if (len > 255) {
-				PyErr_Format(PyExc_KeyError, "Invalid name length in argument 1: (%lu) %s  - PHP variable name must not exceed 255 characters", len, key);
-				return NULL;
-			}
-			memcpy(name, &(key[1]), len);
-			name[len] = '\0';
-			
-			ZEND_SET_GLOBAL_VAR(name, phpValue);
-			
-			zend_print_zval_r(phpValue, 0);
+	} else if (pyValue != NULL && PyString_Check(pyItem)) {
+		pyReturn = Py_True;
+		if (!pyphp_core_getVarName(pyItem, name)) {
+			pyReturn = NULL;
+		} else if (pyphp_core_convert_pyObjectToZvalEx(pyValue, &phpValue, &options)) {
+			// NOTE: the symbol table takes ownership of the value.
+			pyphp_core_php_setGlobalVar(name, phpValue);
 		} else {
 			printf("%s:%u Failed to convert python value to php value!\n", __FUNCTION__, __LINE__);
 		}
-		key = NULL;
-		phpValue = NULL;
-		pyKey = NULL;
-		Py_RETURN_TRUE;
 	} else {
-		printf("%s:%u Invalid argument - argument 1:[key|dict] is a (%s), not a string|dict!\n", __FUNCTION__, __LINE__, pyItem->ob_type->tp_name);
+		printf("%s:%u Invalid argument - argument 1:[key|dict|scope] is a (%s), not a string|dict|scope!\n", __FUNCTION__, __LINE__, pyItem->ob_type->tp_name);
+		printf("%s:%u Arguments are invalid!\n", __FUNCTION__, __LINE__);
+	}
+	pyphp_core_marshal_end(&marshal);
+	
+	phpValue = NULL;
+	pyItem = NULL;
+	
+	Py_XINCREF(pyReturn);
+	return pyReturn;
+}
+
+/*******************************************************************************
+ * Sets a persistent global PHP variable.
+ *
+ * The value is converted once into persistent (read-only) PHP memory and bound
+ * into every following run by reference, so rebinding it costs nothing. PHP
+ * copies the value if a script writes to it.
+ *
+ * Arguments:
+ * - PyString* name The name of the variable to set in PHP.
+ * - PyObject* value The value of the variable set in PHP.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
+ ******************************************************************************/
+static PyObject * pyphp_setPersistentVar(PyObject * self, PyObject * args) {
+	PyObject * pyKey;
+	PyObject * pyValue;
+	char name[256];
+	
+	if (!PyArg_ParseTuple(args, "OO:pyphp.setPersistentVar", &pyKey, &pyValue)) {
+		return NULL;
+	}
+	if (!pyphp_core_getVarName(pyKey, name)) {
+		return NULL;
+	}
+	
+	const pyphp_core_convert_t options = {
+		.persistent = true
+	};
+	zval * phpValue = NULL;
+	if (!pyphp_core_convert_pyObjectToZvalEx(pyValue, &phpValue, &options)) {
+		printf("%s:%u Failed to convert python value to php value!\n", __FUNCTION__, __LINE__);
+		Py_RETURN_FALSE;
+	}
+	if (!pyphp_core_setPersistentVar(name, phpValue)) {
+		Py_RETURN_FALSE;
+	}
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Unsets a persistent global PHP variable.
+ *
+ * Arguments:
+ * - PyString* name The name of the variable to unset in PHP.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ ******************************************************************************/
+static PyObject * pyphp_unsetPersistentVar(PyObject * self, PyObject * args) {
+	PyObject * pyKey;
+	char name[256];
+	
+	if (!PyArg_ParseTuple(args, "O:pyphp.unsetPersistentVar", &pyKey)) {
+		return NULL;
+	}
+	if (!pyphp_core_getVarName(pyKey, name)) {
+		return NULL;
 	}
 	
-	pyItem = NULL;
+	pyphp_core_setPersistentVar(name, NULL);
 	
-	printf("%s:%u Arguments are invalid!\n", __FUNCTION__, __LINE__);
-	Py_RETURN_FALSE;
+	Py_RETURN_NONE;
 }
 
 /*******************************************************************************
@@ -396,7 +1340,7 @@ static PyObject * pyphp_setErrorHandler(PyObject * self, PyObject * args) {
 	
 	PyObject * pyErrorHandler;
 	
-	if (PyArg_ParseTuple(args, "0:pyphp.setErrorHandler", &pyErrorHandler)) {
+	if (PyArg_ParseTuple(args, "O:pyphp.setErrorHandler", &pyErrorHandler)) {
 		if (!PyCallable_Check(pyErrorHandler)) {
 			PyErr_SetString(PyExc_TypeError, "1st argument is not callable!");
 			Py_RETURN_NONE;
@@ -411,7 +1355,7 @@ static PyObject * pyphp_setErrorHandler(PyObject * self, PyObject * args) {
  * Sets the PHP log handler callback function.
  *
  * Arguments:
- * - PyCallable* logHandler() The PHP log handler callback function.
+ * - PyCallable* logHandler(message) The PHP log handler callback function.
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
@@ -426,7 +1370,7 @@ static PyObject * pyphp_setLogHandler(PyObject * self, PyObject * args) {
 	
 	PyObject * pyLogHandler;
 	
-	if (PyArg_ParseTuple(args, "0:pyphp.setLogHandler", &pyLogHandler)) {
+	if (PyArg_ParseTuple(args, "O:pyphp.setLogHandler", &pyLogHandler)) {
 		if (!PyCallable_Check(pyLogHandler)) {
 			PyErr_SetString(PyExc_TypeError, "1st argument is not callable!");
 			Py_RETURN_NONE;
@@ -456,7 +1400,7 @@ static PyObject * pyphp_setOutputHandler(PyObject * self, PyObject * args) {
 	
 	PyObject * pyOutputHandler;
 	
-	if (PyArg_ParseTuple(args, "0:pyphp.setOutputHandler", &pyOutputHandler)) {
+	if (PyArg_ParseTuple(args, "O:pyphp.setOutputHandler", &pyOutputHandler)) {
 		if (!PyCallable_Check(pyOutputHandler)) {
 			PyErr_SetString(PyExc_TypeError, "1st argument is not callable!");
 			Py_RETURN_NONE;
@@ -480,6 +1424,10 @@ static PyObject * pyphp_setOutputHandler(PyObject * self, PyObject * args) {
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  ******************************************************************************/
 static PyObject * pyphp_setSuperGlobalKey(PyObject * self, PyObject * args) {
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	
 	const Py_ssize_t argc = PySequence_Size(args);
 	if (argc < 3) {
 		printf("%s:%u Invalid number of arguments - expected 3 arguments!\n", __FUNCTION__, __LINE__);
@@ -503,31 +1451,447 @@ static PyObject * pyphp_setSuperGlobalKey(PyObject * self, PyObject * args) {
 	// Get value arg.
 	PyObject * pyValue = PyTuple_GetItem(args, 2);
 	
+	// Find PHP super global.
+	zval * phpSuperGlobal = pyphp_request_php_findSuperGlobal(PyString_AS_STRING(pySuperGlobal), PyString_GET_SIZE(pySuperGlobal));
+	if (phpSuperGlobal == NULL) {
+		PyErr_Format(pyphp_exception, "%s is not a PHP super global", PyString_AS_STRING(pySuperGlobal));
+		return NULL;
+	}
+	
 	// Convert python values to c and PHP values.
-	char * superGlobal = PyString_AsString(pySuperGlobal);
-	char * key = PyString_AsString(pyKey);
+	char * key = PyString_AS_STRING(pyKey);
 	zval * phpValue;
-	
-	pyphp_core_convert_pyObjectToZval(pyValue, &phpValue);
-	
-	// Find PHP super global.
-	zval ** phpSuperGlobal;
-	zend_hash_find(&EG(symbol_table), superGlobal, strlen(superGlobal), (void **)&phpSuperGlobal);
-	//TODO: check zend_hash_find() return value.
+	if (!pyphp_core_convert_pyObjectToZval(pyValue, &phpValue)) {
+		printf("%s:%u Failed to convert python value to php value!\n", __FUNCTION__, __LINE__);
+		Py_RETURN_FALSE;
+	}
 	
 	// Set super global key-value pair.
-	ZEND_SET_SYMBOL(Z_ARRVAL(**phpSuperGlobal), key, phpValue);
-	//TODO: check zend_hash_update() return value.
+	// - NOTE: the super global takes ownership of the value.
+	pyphp_core.generation++;
+	ZEND_SET_SYMBOL(Z_ARRVAL_P(phpSuperGlobal), key, phpValue);
 
 	// Clean up variables.
-	*phpSuperGlobal = NULL;
 	phpSuperGlobal = NULL;
 	phpValue = NULL;
 	key = NULL;
-	superGlobal = NULL;
 	pyValue = NULL;
 	pyKey = NULL;
 	pySuperGlobal = NULL;
 
 	Py_RETURN_TRUE;
 }
+
+/*******************************************************************************
+ * Sets the WSGI environ the PHP super globals are built from.
+ *
+ * $_SERVER gets the environ's string values, $_GET and $_COOKIE are parsed
+ * from QUERY_STRING and HTTP_COOKIE, and $_POST from an url-encoded body read
+ * from wsgi.input. Each super global is only built if the next run uses it.
+ *
+ * Arguments:
+ * - PyDict* environ The WSGI environ.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setRequest(PyObject * self, PyObject * args) {
+	PyObject * pyEnviron;
+	
+	if (!PyArg_ParseTuple(args, "O:pyphp.setRequest", &pyEnviron)) {
+		return NULL;
+	}
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	if (!pyphp_request_set(pyEnviron)) {
+		return NULL;
+	}
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Mounts PHP scripts held in memory under a path prefix.
+ *
+ * Scripts under the prefix are run, included and required straight from
+ * memory. Scripts previously mounted under the prefix are unmounted first.
+ *
+ * Arguments:
+ * - PyString* prefix The absolute path prefix (e.g., "/templates").
+ * - PyDict* scripts The scripts (relative path => source).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_mount(PyObject * self, PyObject * args) {
+	const char * prefix;
+	PyObject * pyScripts;
+	
+	if (!PyArg_ParseTuple(args, "sO:pyphp.mount", &prefix, &pyScripts)) {
+		return NULL;
+	}
+	if (!pyphp_vfs_mount(prefix, pyScripts)) {
+		return NULL;
+	}
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Unmounts the PHP scripts under a path prefix.
+ *
+ * Arguments:
+ * - PyString* prefix The absolute path prefix.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of scripts unmounted; otherwise,
+ * NULL.
+ ******************************************************************************/
+static PyObject * pyphp_unmount(PyObject * self, PyObject * args) {
+	const char * prefix;
+	
+	if (!PyArg_ParseTuple(args, "s:pyphp.unmount", &prefix)) {
+		return NULL;
+	}
+	
+	return PyInt_FromLong(pyphp_vfs_unmount(prefix));
+}
+
+/*******************************************************************************
+ * Sets the directory compiled PHP scripts are cached in.
+ *
+ * Scripts compiled by any process are written there and loaded back instead
+ * of being recompiled as long as they haven't changed.
+ *
+ * Arguments:
+ * - PyString* directory The cache directory, or None to disable the cache.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setCompileCache(PyObject * self, PyObject * args) {
+	const char * directory;
+	
+	if (!PyArg_ParseTuple(args, "z:pyphp.setCompileCache", &directory)) {
+		return NULL;
+	}
+	if (!pyphp_filecache_setDirectory(directory)) {
+		return NULL;
+	}
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Runs a PHP script with global variables and returns its output.
+ *
+ * When the render cache is enabled (see pyphp.setRenderCache()), the output is
+ * cached under the script and a hash of its variables, and rendering the same
+ * script with equal variables returns the cached output without running PHP.
+ *
+ * Arguments:
+ * - PyString* script The filename of the script.
+ * - PyDict* vars (optional) The global variables ($name => value).
+ * - PyFloat* ttl (optional) How long the output is cached in seconds (a
+ *   negative number doesn't cache it).
+ * - PyBool* escape (optional) Whether strings are HTML escaped as they are
+ *   converted, except pyphp.Safe strings.
+ * - PyBool* diagnostics (optional) Whether to also return the diagnostics of
+ *   the run (see pyphp.setDiagnostics()).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, the output, or an (output, diagnostics) tuple;
+ * otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_render(PyObject * self, PyObject * args, PyObject * kwargs) {
+	static char * kwlist[] = {"script", "vars", "ttl", "escape", "diagnostics", NULL};
+	const char * filename;
+	PyObject * pyVars = NULL;
+	double ttl = 0;
+	PyObject * pyEscape = NULL;
+	PyObject * pyDiagnostics = NULL;
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|OdOO:pyphp.render", kwlist, &filename, &pyVars, &ttl, &pyEscape, &pyDiagnostics)) {
+		return NULL;
+	}
+	if (pyVars == Py_None) {
+		pyVars = NULL;
+	} else if (pyVars != NULL && !PyDict_Check(pyVars)) {
+		PyErr_SetString(PyExc_TypeError, "vars must be a dict");
+		return NULL;
+	}
+	
+	bool escape = (pyEscape != NULL && PyObject_IsTrue(pyEscape) == 1);
+	if (pyDiagnostics == NULL || PyObject_IsTrue(pyDiagnostics) != 1) {
+		return pyphp_render_render(filename, pyVars, ttl, escape);
+	}
+	
+	// NOTE: output served from the render cache didn't run, so it has no
+	// diagnostics.
+	ulong requests = pyphp_core.requests;
+	PyObject * pyOutput = pyphp_render_render(filename, pyVars, ttl, escape);
+	if (pyOutput == NULL) {
+		return NULL;
+	}
+	PyObject * pyRecords = (pyphp_core.requests != requests ? pyphp_diagnostics_get() : PyList_New(0));
+	if (pyRecords == NULL) {
+		Py_DECREF(pyOutput);
+		return NULL;
+	}
+	PyObject * pyReturn = PyTuple_Pack(2, pyOutput, pyRecords);
+	Py_DECREF(pyOutput);
+	Py_DECREF(pyRecords);
+	return pyReturn;
+}
+
+/*******************************************************************************
+ * Sets the byte budget and default time-to-live of the render cache.
+ *
+ * Arguments:
+ * - PyInt* maxBytes The byte budget (0 empties and disables the cache).
+ * - PyFloat* ttl (optional) The default time-to-live in seconds (0 for ever).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setRenderCache(PyObject * self, PyObject * args) {
+	Py_ssize_t maxBytes;
+	double ttl = 0;
+	
+	if (!PyArg_ParseTuple(args, "n|d:pyphp.setRenderCache", &maxBytes, &ttl)) {
+		return NULL;
+	}
+	if (maxBytes < 0) {
+		PyErr_SetString(PyExc_ValueError, "maxBytes must not be negative");
+		return NULL;
+	}
+	pyphp_render_setCache(maxBytes, ttl);
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Removes the cached output of a PHP script, or all cached output.
+ *
+ * Arguments:
+ * - PyString* script (optional) The filename of the script.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of entries removed; otherwise,
+ * NULL.
+ ******************************************************************************/
+static PyObject * pyphp_clearRenderCache(PyObject * self, PyObject * args) {
+	const char * filename = NULL;
+	
+	if (!PyArg_ParseTuple(args, "|z:pyphp.clearRenderCache", &filename)) {
+		return NULL;
+	}
+	
+	return PyInt_FromLong(pyphp_render_clearCache(filename));
+}
+
+/*******************************************************************************
+ * Returns the render cache counters.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ ******************************************************************************/
+static PyObject * pyphp_renderCacheStats(PyObject * self, PyObject * args) {
+	return pyphp_render_cacheStats();
+}
+
+/*******************************************************************************
+ * Sets the byte budget of the fragment cache used by the PHP function
+ * pyphp_cache_fragment($key, $ttl, $callback).
+ *
+ * Arguments:
+ * - PyInt* maxBytes The byte budget (0 empties and disables the cache).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_setFragmentCache(PyObject * self, PyObject * args) {
+	Py_ssize_t maxBytes;
+	
+	if (!PyArg_ParseTuple(args, "n:pyphp.setFragmentCache", &maxBytes)) {
+		return NULL;
+	}
+	if (maxBytes < 0) {
+		PyErr_SetString(PyExc_ValueError, "maxBytes must not be negative");
+		return NULL;
+	}
+	pyphp_fragment_setCache(maxBytes);
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Removes a cached fragment.
+ *
+ * Arguments:
+ * - PyString* key The key of the fragment.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, whether the fragment was cached; otherwise,
+ * NULL.
+ ******************************************************************************/
+static PyObject * pyphp_invalidateFragment(PyObject * self, PyObject * args) {
+	const char * key;
+	int keyLen;
+	
+	if (!PyArg_ParseTuple(args, "s#:pyphp.invalidateFragment", &key, &keyLen)) {
+		return NULL;
+	}
+	
+	return PyBool_FromLong(pyphp_fragment_invalidate(key, keyLen));
+}
+
+/*******************************************************************************
+ * Removes the cached fragments whose keys begin with a prefix, or all cached
+ * fragments.
+ *
+ * Arguments:
+ * - PyString* prefix (optional) The prefix of the keys.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of fragments removed; otherwise,
+ * NULL.
+ ******************************************************************************/
+static PyObject * pyphp_clearFragmentCache(PyObject * self, PyObject * args) {
+	const char * prefix = NULL;
+	int prefixLen = 0;
+	
+	if (!PyArg_ParseTuple(args, "|z#:pyphp.clearFragmentCache", &prefix, &prefixLen)) {
+		return NULL;
+	}
+	
+	return PyInt_FromLong(pyphp_fragment_clearCache(prefix, prefixLen));
+}
+
+/*******************************************************************************
+ * Returns the fragment cache counters.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ ******************************************************************************/
+static PyObject * pyphp_fragmentCacheStats(PyObject * self, PyObject * args) {
+	return pyphp_fragment_cacheStats();
+}
+
+/*******************************************************************************
+ * Registers a Python callable as a PHP function.
+ *
+ * The PHP function converts its arguments to python values, calls the
+ * callable and returns its result converted to a PHP value. A python exception
+ * raised by the callable is thrown as a PHP Exception. Registrations survive
+ * resets.
+ *
+ * Arguments:
+ * - PyString* name The name of the PHP function.
+ * - PyObject* callable The callable.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_registerFunction(PyObject * self, PyObject * args) {
+	const char * name;
+	PyObject * pyCallable;
+	
+	if (!PyArg_ParseTuple(args, "sO:pyphp.registerFunction", &name, &pyCallable)) {
+		return NULL;
+	}
+	if (!pyphp_function_register(name, pyCallable)) {
+		return NULL;
+	}
+	
+	Py_RETURN_TRUE;
+}
+
+/*******************************************************************************
+ * Calls a PHP function and returns its result.
+ *
+ * The lookup of the function is cached, and the arguments and result are
+ * converted directly (no PHP source is parsed).
+ *
+ * Arguments:
+ * - PyString* name The name of the PHP function.
+ * - PyObject* ... The arguments.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the result; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_call(PyObject * self, PyObject * args) {
+	const Py_ssize_t argc = PyTuple_Size(args);
+	
+	if (argc < 1 || !PyString_Check(PyTuple_GET_ITEM(args, 0))) {
+		PyErr_SetString(PyExc_TypeError, "pyphp.call() takes a PHP function name followed by its arguments");
+		return NULL;
+	}
+	
+	PyObject * pyArgs = PyTuple_GetSlice(args, 1, argc);
+	if (pyArgs == NULL) {
+		return NULL;
+	}
+	PyObject * pyResult = pyphp_function_call(PyString_AS_STRING(PyTuple_GET_ITEM(args, 0)), pyArgs);
+	Py_DECREF(pyArgs);
+	return pyResult;
+}
+
+/*******************************************************************************
+ * Runs a PHP script without resetting PHP afterwards, so the functions and
+ * classes it declares can be called with pyphp.call() until the next reset.
+ *
+ * Arguments:
+ * - PyString* script The filename of the script.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ ******************************************************************************/
+static PyObject * pyphp_load(PyObject * self, PyObject * args) {
+	char * filename;
+	
+	if (!PyArg_ParseTuple(args, "s:pyphp.load", &filename)) {
+		return NULL;
+	}
+	if (!pyphp_core_ensureInit()) {
+		return NULL;
+	}
+	
+	zend_file_handle script;
+	if (!pyphp_core_php_openScript(&script, filename)) {
+		PyErr_Format(pyphp_exception, "Failed to open %s", filename);
+		return NULL;
+	}
+	if (pyphp_core_php_execute(&script) == FAILURE) {
+		// NOTE: the request is unusable after a fatal error.
+		pyphp_core_php_reset();
+		if (!PyErr_Occurred()) {
+			PyErr_Format(pyphp_exception, "Failed to load %s", filename);
+		}
+		return NULL;
+	}
+	if (PyErr_Occurred()) {
+		return NULL;
+	}
+	
+	Py_RETURN_TRUE;
+}
@@ -35,11 +35,265 @@ static PyObject * pyphp_displayErrors(PyObject * self, PyObject * args);
 /**
  * Initializes the PHP interpreter.
  *
+ * Keyword Arguments:
+ * - PyDict* ini The INI settings (name-value pairs) to apply.
+ * - PyList* extensions The only shared extensions to load.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
+ */
+static PyObject * pyphp_init(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Returns how long the last initialization of the PHP interpreter took.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each startup phase.
+ */
+static PyObject * pyphp_initTimes(PyObject * self, PyObject * args);
+
+/**
+ * Returns how long each phase of the last run took.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each phase
+ * (marshal, compile, execute, output, reset and total).
+ */
+static PyObject * pyphp_runTimes(PyObject * self, PyObject * args);
+
+/**
+ * Returns the cumulative runtime statistics since startup or the last
+ * pyphp.resetStats().
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the durations (in seconds) of each phase and the
+ * counters.
+ */
+static PyObject * pyphp_stats(PyObject * self, PyObject * args);
+
+/**
+ * Clears the cumulative runtime statistics.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ */
+static PyObject * pyphp_resetStats(PyObject * self, PyObject * args);
+
+/**
+ * Returns the Zend heap usage of the last run.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict of the sizes in bytes (peak, usage and input).
+ */
+static PyObject * pyphp_runMemory(PyObject * self, PyObject * args);
+
+/**
+ * Sets the memory budget: the Zend heap limit of each run.
+ *
+ * Arguments:
+ * - PyInt* bytes The budget in bytes, or 0 to use memory_limit.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ */
+static PyObject * pyphp_setMemoryBudget(PyObject * self, PyObject * args);
+
+/**
+ * Sets the recycling policy: when PHP is shut down and started up again
+ * between runs.
+ *
+ * Keyword Arguments:
+ * - PyInt* after_renders Recycle after this many runs (0 for no limit).
+ * - PyInt* max_rss Recycle once the resident set size exceeds this many bytes
+ *   (0 for no limit).
+ * - PyInt* max_heap Recycle once the Zend heap exceeds this many bytes between
+ *   runs (0 for no limit).
+ * - PyBool* now Whether to recycle PHP right away.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_recycle(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Sets the sampling interval of the PHP profiler.
+ *
+ * Arguments:
+ * - PyFloat* interval The interval in seconds of CPU time, or 0 to disable the
+ *   profiler.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_setProfiler(PyObject * self, PyObject * args);
+
+/**
+ * Returns the aggregated PHP profile.
+ *
+ * Keyword arguments:
+ * - PyBool* collapsed (optional) Whether to return collapsed stacks.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* The collapsed stacks (a string), or a dict.
+ */
+static PyObject * pyphp_profile(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Clears the aggregated PHP profile.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ */
+static PyObject * pyphp_clearProfile(PyObject * self, PyObject * args);
+
+/**
+ * Sets the number of events the trace ring buffer holds.
+ *
+ * Arguments:
+ * - PyInt* capacity The number of events, or 0 to disable tracing.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_setTrace(PyObject * self, PyObject * args);
+
+/**
+ * Sets the id the following trace events carry.
+ *
+ * Arguments:
+ * - PyInt* id The id.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_setTraceId(PyObject * self, PyObject * args);
+
+/**
+ * Returns and removes the recorded trace events.
+ *
+ * Arguments:
+ * - PyInt* max (optional) The most events returned (0 for all).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A list of (time, id, kind, phase, value) tuples.
+ */
+static PyObject * pyphp_drainTrace(PyObject * self, PyObject * args);
+
+/**
+ * Sets how PHP output is compressed as it is written.
+ *
+ * Keyword Arguments:
+ * - PyInt* level The zlib compression level (-1 for the default, 0-9), or
+ *   None to disable compression.
+ * - PyString* format The format: "gzip" (the default), "deflate" or "raw".
+ *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_setCompression(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Sets which PHP error levels are collected as diagnostics, and how each type
+ * is sampled and rate limited.
+ *
+ * Keyword Arguments:
+ * - PyInt* levels The error levels, or 0 to disable diagnostics.
+ * - PyInt|PyDict* sample Record every Nth error of all types or of each type.
+ * - PyInt|PyDict* limit Record at most N errors per run of all types or of
+ *   each type.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, Py_None; otherwise, NULL.
+ */
+static PyObject * pyphp_setDiagnostics(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Returns the diagnostics of the last run.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, a list of (type, file, line, message) tuples;
+ * otherwise, NULL.
+ */
+static PyObject * pyphp_getDiagnostics(PyObject * self, PyObject * args);
+
+/**
+ * Converts a Python value to a PHP INI value.
+ *
+ * @param PyObject* pyValue The Python value (bool, int, float or string).
+ * @return PyObject* On success, a new PyString reference; otherwise, NULL.
+ */
+static PyObject * pyphp_iniValue(PyObject * pyValue);
+
+/**
+ * Sets the INI profile and the extensions applied when the PHP interpreter
+ * starts up.
+ *
+ * @param PyObject* pyIni The INI settings dict, None, or NULL.
+ * @param PyObject* pyExtensions The sequence of extension names, None, or NULL.
+ * @return bool On success, true; otherwise, false with a python exception set.
+ */
+static bool pyphp_setProfile(PyObject * pyIni, PyObject * pyExtensions);
+
+/**
+ * Sets the INI profile applied when the PHP interpreter starts up.
+ *
+ * Keyword Arguments:
+ * - PyDict* ini The INI settings (name-value pairs) to apply.
+ * - PyList* extensions The only shared extensions to load.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
  * @return PyObject* Always returns Py_None.
  */
-static PyObject * pyphp_init(PyObject * self, PyObject * args);
+static PyObject * pyphp_configure(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Sets PHP INI settings for the next run only.
+ *
+ * Arguments:
+ * - PyDict* dict A dict of name-value pairs to set multiple INI settings.
+ * - OR
+ * - PyString* name The name of the INI setting.
+ * - PyObject* value The value of the INI setting.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
+ */
+static PyObject * pyphp_setIni(PyObject * self, PyObject * args);
+
+/**
+ * Gets the timeout_ms keyword argument.
+ *
+ * @param PyObject* kwargs The function keyword arguments, or NULL.
+ * @param long* timeoutMs Where the timeout in milliseconds is stored (0 if
+ * there is none).
+ * @return bool On success, true; otherwise, false with a python exception set.
+ */
+static bool pyphp_getTimeout(PyObject * kwargs, long * timeoutMs);
 
 /**
  * Runs/evaluates the PHP inline script.
@@ -49,20 +303,31 @@ static PyObject * pyphp_init(PyObject * self, PyObject * args);
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments (timeout_ms).
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  */
-static PyObject * pyphp_runInline(PyObject * self, PyObject * args);
+static PyObject * pyphp_runInline(PyObject * self, PyObject * args, PyObject * kwargs);
 
 /**
  * Runs/executes the PHP script.
  *
+ * Arguments:
+ * - PyString* filename The filename of the script.
+ * - OR
+ * - PyFile* file The script file.
+ * - OR
+ * - PyBuffer* source The source of the script (any object supporting the
+ *   buffer interface, other than a string).
+ * - PyString* name (optional) The filename the source is reported as.
+ *
  * @todo Display PHP errors.
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments (timeout_ms).
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  */
-static PyObject * pyphp_runScript(PyObject * self, PyObject * args);
+static PyObject * pyphp_runScript(PyObject * self, PyObject * args, PyObject * kwargs);
 
 /**
  * Sets the PHP error handler callback function.
@@ -101,13 +366,39 @@ static PyObject * pyphp_setLogHandler(PyObject * self, PyObject * args);
 static PyObject * pyphp_setOutputHandler(PyObject * self, PyObject * args);
 
 /**
- * Sets a global PHP variable.
+ * Sets a global PHP variable, or binds a prebuilt scope (pyphp.Scope).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments (escape).
+ * @return PyObject* On success, Py_True; otherwise, Py_False.
+ */
+static PyObject * pyphp_setVar(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Sets a persistent global PHP variable.
+ *
+ * Arguments:
+ * - PyString* name The name of the variable to set in PHP.
+ * - PyObject* value The value of the variable set in PHP.
  *
  * @param PyObject* self Myself.
  * @param PyObject* args The function arguments.
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  */
-static PyObject * pyphp_setVar(PyObject * self, PyObject * args);
+static PyObject * pyphp_setPersistentVar(PyObject * self, PyObject * args);
+
+/**
+ * Unsets a persistent global PHP variable.
+ *
+ * Arguments:
+ * - PyString* name The name of the variable to unset in PHP.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* Always returns Py_None.
+ */
+static PyObject * pyphp_unsetPersistentVar(PyObject * self, PyObject * args);
 
 /**
  * Sets a super global PHP variable key.
@@ -122,3 +413,217 @@ static PyObject * pyphp_setVar(PyObject * self, PyObject * args);
  * @return PyObject* On success, Py_True; otherwise, Py_False.
  */
 static PyObject * pyphp_setSuperGlobalKey(PyObject * self, PyObject * args);
+
+/**
+ * Sets the WSGI environ the PHP super globals are built from.
+ *
+ * Arguments:
+ * - PyDict* environ The WSGI environ.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_setRequest(PyObject * self, PyObject * args);
+
+/**
+ * Mounts PHP scripts held in memory under a path prefix.
+ *
+ * Scripts under the prefix are run, included and required straight from
+ * memory. Scripts previously mounted under the prefix are unmounted first.
+ *
+ * Arguments:
+ * - PyString* prefix The absolute path prefix (e.g., "/templates").
+ * - PyDict* scripts The scripts (relative path => source).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_mount(PyObject * self, PyObject * args);
+
+/**
+ * Unmounts the PHP scripts under a path prefix.
+ *
+ * Arguments:
+ * - PyString* prefix The absolute path prefix.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of scripts unmounted; otherwise,
+ * NULL.
+ */
+static PyObject * pyphp_unmount(PyObject * self, PyObject * args);
+
+/**
+ * Sets the directory compiled PHP scripts are cached in.
+ *
+ * Scripts compiled by any process are written there and loaded back instead
+ * of being recompiled as long as they haven't changed.
+ *
+ * Arguments:
+ * - PyString* directory The cache directory, or None to disable the cache.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_setCompileCache(PyObject * self, PyObject * args);
+
+/**
+ * Runs a PHP script with global variables and returns its output.
+ *
+ * When the render cache is enabled (see pyphp.setRenderCache()), the output is
+ * cached under the script and a hash of its variables, and rendering the same
+ * script with equal variables returns the cached output without running PHP.
+ *
+ * Arguments:
+ * - PyString* script The filename of the script.
+ * - PyDict* vars (optional) The global variables ($name => value).
+ * - PyFloat* ttl (optional) How long the output is cached in seconds (a
+ *   negative number doesn't cache it).
+ * - PyBool* escape (optional) Whether strings are HTML escaped as they are
+ *   converted, except pyphp.Safe strings.
+ * - PyBool* diagnostics (optional) Whether to also return the diagnostics of
+ *   the run.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @param PyObject* kwargs The function keyword arguments.
+ * @return PyObject* On success, the output, or an (output, diagnostics) tuple;
+ * otherwise, NULL.
+ */
+static PyObject * pyphp_render(PyObject * self, PyObject * args, PyObject * kwargs);
+
+/**
+ * Sets the byte budget and default time-to-live of the render cache.
+ *
+ * Arguments:
+ * - PyInt* maxBytes The byte budget (0 empties and disables the cache).
+ * - PyFloat* ttl (optional) The default time-to-live in seconds (0 for ever).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_setRenderCache(PyObject * self, PyObject * args);
+
+/**
+ * Removes the cached output of a PHP script, or all cached output.
+ *
+ * Arguments:
+ * - PyString* script (optional) The filename of the script.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of entries removed; otherwise,
+ * NULL.
+ */
+static PyObject * pyphp_clearRenderCache(PyObject * self, PyObject * args);
+
+/**
+ * Returns the render cache counters.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ */
+static PyObject * pyphp_renderCacheStats(PyObject * self, PyObject * args);
+
+/**
+ * Sets the byte budget of the fragment cache used by the PHP function
+ * pyphp_cache_fragment($key, $ttl, $callback).
+ *
+ * Arguments:
+ * - PyInt* maxBytes The byte budget (0 empties and disables the cache).
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_setFragmentCache(PyObject * self, PyObject * args);
+
+/**
+ * Removes a cached fragment.
+ *
+ * Arguments:
+ * - PyString* key The key of the fragment.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, whether the fragment was cached; otherwise,
+ * NULL.
+ */
+static PyObject * pyphp_invalidateFragment(PyObject * self, PyObject * args);
+
+/**
+ * Removes the cached fragments whose keys begin with a prefix, or all cached
+ * fragments.
+ *
+ * Arguments:
+ * - PyString* prefix (optional) The prefix of the keys.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the number of fragments removed; otherwise,
+ * NULL.
+ */
+static PyObject * pyphp_clearFragmentCache(PyObject * self, PyObject * args);
+
+/**
+ * Returns the fragment cache counters.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* A dict (hits, misses, evictions, expirations, entries,
+ * bytes, maxBytes).
+ */
+static PyObject * pyphp_fragmentCacheStats(PyObject * self, PyObject * args);
+
+/**
+ * Registers a Python callable as a PHP function.
+ *
+ * The PHP function converts its arguments to python values, calls the
+ * callable and returns its result converted to a PHP value. A python exception
+ * raised by the callable is thrown as a PHP Exception. Registrations survive
+ * resets.
+ *
+ * Arguments:
+ * - PyString* name The name of the PHP function.
+ * - PyObject* callable The callable.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_registerFunction(PyObject * self, PyObject * args);
+
+/**
+ * Calls a PHP function and returns its result.
+ *
+ * The lookup of the function is cached, and the arguments and result are
+ * converted directly (no PHP source is parsed).
+ *
+ * Arguments:
+ * - PyString* name The name of the PHP function.
+ * - PyObject* ... The arguments.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, the result; otherwise, NULL.
+ */
+static PyObject * pyphp_call(PyObject * self, PyObject * args);
+
+/**
+ * Runs a PHP script without resetting PHP afterwards, so the functions and
+ * classes it declares can be called with pyphp.call() until the next reset.
+ *
+ * Arguments:
+ * - PyString* script The filename of the script.
+ *
+ * @param PyObject* self Myself.
+ * @param PyObject* args The function arguments.
+ * @return PyObject* On success, Py_True; otherwise, NULL.
+ */
+static PyObject * pyphp_load(PyObject * self, PyObject * args);
@@ -8,6 +8,22 @@ from distutils.core import setup, Extension
 pyphpModule = Extension('pyphp',
 	sources = [
 		'pyphp-core.c',
+		'pyphp-scope.c',
+		'pyphp-request.c',
+		'pyphp-vfs.c',
+		'pyphp-filecache.c',
+		'pyphp-lru.c',
+		'pyphp-fragment.c',
+		'pyphp-function.c',
+		'pyphp-object.c',
+		'pyphp-escape.c',
+		'pyphp-profile.c',
+		'pyphp-trace.c',
+		'pyphp-diagnostics.c',
+		'pyphp-compress.c',
+		'pyphp-timeout.c',
+		'pyphp-render.c',
+		'pyphp-wsgi.c',
 		'pyphp.c'
 	],
 	include_dirs=[
@@ -16,7 +32,7 @@ pyphpModule = Extension('pyphp',
 		'/usr/local/include/php/Zend',
 		'/usr/local/include/php/TSRM'
 	],
-	libraries=['php5'],
+	libraries=['php5', 'rt', 'z'],
 	runtime_library_dirs=[
 		'/usr/local/lib',
 		'/lib'